@@ -3,6 +3,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
@@ -19,6 +20,7 @@ class Dlhandle;
 using namespace std::string_literals;
 
 #define LLMODEL_MAX_PROMPT_BATCH 128
+#define LLMODEL_MAX_SEQUENCES 8 // maximum number of sequences sharing a context, see LLModel::Sequence
 
 class LLModel {
 public:
@@ -108,6 +110,8 @@ public:
 
     private:
         Implementation(Dlhandle &&);
+        // for models that are built into the library rather than loaded from one
+        Implementation(std::string_view modelType, std::string_view buildVariant);
 
         static const std::vector<Implementation> &implementationList();
         static const Implementation *implementation(const char *fname, const std::string &buildVariant);
@@ -120,6 +124,32 @@ public:
         std::string_view m_modelType;
         std::string_view m_buildVariant;
         Dlhandle *m_dlhandle;
+
+        friend class StandInModel;
+    };
+
+    // Wall-clock time (in microseconds, from a monotonic clock) and call counts for each phase of prompt(). These
+    // are reset at the start of every prompt() call and can be read from the PromptContext afterwards.
+    struct Timings {
+        int64_t t_tokenize_us      = 0;
+        int64_t t_prompt_eval_us   = 0; // decoding the prompt (and any fake reply) in batches
+        int64_t t_sample_us        = 0;
+        int64_t t_gen_eval_us      = 0; // decoding sampled tokens
+        int64_t t_detokenize_us    = 0;
+        int64_t t_stop_check_us    = 0; // EOS and stop sequence matching
+        int64_t t_callback_us      = 0; // time spent in the prompt and response callbacks
+        int64_t t_context_shift_us = 0;
+        int64_t t_total_us         = 0;
+
+        int32_t n_tokenize         = 0; // number of tokenize calls
+        int32_t n_prompt_tokens    = 0;
+        int32_t n_prompt_batches   = 0;
+        int32_t n_sample           = 0;
+        int32_t n_gen_tokens       = 0;
+        int32_t n_detokenize       = 0;
+        int32_t n_callback         = 0;
+        int32_t n_context_shift    = 0;
+        int32_t n_tokens_discarded = 0; // tokens dropped from the context by context shifts
     };
 
     struct PromptContext {
@@ -135,9 +165,40 @@ public:
         float   repeat_penalty = 1.10f;
         int32_t repeat_last_n = 64;     // last n tokens to penalize
         float   contextErase = 0.5f;    // percent of context to erase if we exceed the context window
+        Timings timings;                // per-phase statistics for the last prompt() call
+
+        // Decoding and generation stop once the deadline has passed, which sets deadlineExceeded. The response is
+        // cut short as if n_predict had been reached.
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+        bool    deadlineExceeded = false;
+
+        bool pastDeadline() const
+        {
+            return deadline != std::chrono::steady_clock::time_point::max()
+                && std::chrono::steady_clock::now() >= deadline;
+        }
+    };
+
+    // A request decoded on its own sequence of the KV cache. Several sequences can share the context and be advanced
+    // together by stepSequences, which decodes the next token of every generating sequence and chunks of not yet
+    // decoded prompt tokens in a single batch.
+    struct Sequence {
+        int32_t            id = 0;              // KV cache sequence, less than maxSequences()
+        PromptContext      ctx;                 // decoded tokens and sampling parameters
+        std::vector<Token> pending;             // prompt tokens that have not been decoded yet
+        std::function<bool(int32_t, const std::string&)> responseCallback;
+        bool               stopped = false;     // set once the response is complete, see finishSequence
+
+        // generation state, managed by stepSequences
+        std::string        cachedResponse;
+        std::vector<Token> cachedTokens;
+        int32_t            n_predicted = 0;
+        int32_t            batchIdx = -1;       // where to find the logits of the last decoded token
+        bool               hasLogits = false;
     };
 
     using ProgressCallback = std::function<bool(float progress)>;
+    using ChoiceResponseCallback = std::function<bool(int32_t choice, int32_t token, const std::string &piece)>;
 
     explicit LLModel() {}
     virtual ~LLModel() {}
@@ -164,6 +225,38 @@ public:
                         bool special = false,
                         std::optional<std::string_view> fakeReply = {});
 
+    // Like prompt, but generates nChoices independent responses to the same input. The prompt is decoded only once;
+    // each choice then continues from a copy of its KV cache, and all choices are sampled and decoded together in one
+    // batch. Returning false from the response callback stops only that choice. Afterwards the context contains the
+    // response of choice 0. The context is not shifted while the choices are being generated.
+    virtual void promptChoices(const std::string &prompt,
+                               const std::string &promptTemplate,
+                               std::function<bool(int32_t)> promptCallback,
+                               ChoiceResponseCallback responseCallback,
+                               int32_t nChoices,
+                               bool allowContextShift,
+                               PromptContext &ctx,
+                               bool special = false);
+
+    // The number of tokens the context of the loaded model holds.
+    virtual int32_t contextLength() const = 0;
+    // The number of sequences that can share the context of this model.
+    virtual int32_t maxSequences() const { return 1; }
+    // Tokenizes a prompt formatted with promptTemplate and appends it to the pending tokens of seq. If fakeReply is
+    // given, it is appended as the response along with the rest of the template, to reconstruct a conversation.
+    bool appendSequencePrompt(Sequence &seq, const std::string &prompt, const std::string &promptTemplate,
+                              std::optional<std::string_view> fakeReply = {}, bool special = false);
+    // Resets seq to the first n_keep decoded tokens of src, or of its own if src is null. The KV cache cells of
+    // src are shared rather than decoded again.
+    void resetSequence(Sequence &seq, int32_t n_keep, const Sequence *src = nullptr);
+    // Ends the response of seq, forgetting any tokens that were held back while checking for stop sequences.
+    void finishSequence(Sequence &seq);
+    // Samples the next token of every generating sequence, then decodes those together with up to nBatch tokens in
+    // total from the pending prompts. Returns false if decoding failed.
+    bool stepSequences(const std::vector<Sequence *> &seqs, int32_t nBatch, Timings &timings);
+    // Frees the KV cache cells of seq.
+    void releaseSequence(Sequence &seq);
+
     using EmbedCancelCallback = bool(unsigned *batchSizes, unsigned nBatch, const char *backend);
 
     virtual size_t embeddingSize() const {
@@ -218,10 +311,46 @@ protected:
     virtual Token sampleToken(PromptContext &ctx) const = 0;
     virtual bool evalTokens(PromptContext &ctx, const std::vector<int32_t> &tokens) const = 0;
     virtual void shiftContext(PromptContext &promptCtx) = 0;
-    virtual int32_t contextLength() const = 0;
     virtual const std::vector<Token> &endTokens() const = 0;
     virtual bool shouldAddBOS() const = 0;
 
+    // Multiple sequence support, used by Sequence and promptChoices. Sequence 0 is the one described by the
+    // PromptContext passed to prompt.
+    struct SequenceToken {
+        int32_t seq;
+        int32_t pos;
+        Token   token;
+        bool    logits;
+    };
+
+    virtual void copySequence(int32_t srcSeq, int32_t dstSeq, int32_t n_past)
+    {
+        (void)srcSeq;
+        (void)dstSeq;
+        (void)n_past;
+        throw std::logic_error(std::string(implementation().modelType()) + " does not support multiple sequences");
+    }
+    // removes the cells of seq from position p0 onward
+    virtual void removeSequence(int32_t seq, int32_t p0)
+    {
+        (void)seq;
+        (void)p0;
+        throw std::logic_error(std::string(implementation().modelType()) + " does not support multiple sequences");
+    }
+    // decodes the tokens in one batch
+    virtual bool evalSequences(const std::vector<SequenceToken> &tokens) const
+    {
+        (void)tokens;
+        throw std::logic_error(std::string(implementation().modelType()) + " does not support multiple sequences");
+    }
+    // samples from the logits of entry batchIdx of the last evalSequences call, or -1 for the last token decoded
+    virtual Token sampleSequenceToken(PromptContext &ctx, int32_t batchIdx) const
+    {
+        (void)ctx;
+        (void)batchIdx;
+        throw std::logic_error(std::string(implementation().modelType()) + " does not support multiple sequences");
+    }
+
     virtual int32_t maxContextLength(std::string const &modelPath) const
     {
         (void)modelPath;
@@ -245,6 +374,28 @@ protected:
         return true;
     }
 
+    std::vector<Token> timedTokenize(PromptContext &ctx, std::string_view str, bool special);
+    std::string timedTokenToString(Timings &timings, Token id) const;
+    void timedShiftContext(PromptContext &promptCtx);
+
+    bool tokenizePrompt(const std::string &prompt,
+                        const std::string &promptTemplate,
+                        const std::function<bool(int32_t, const std::string&)> &responseCallback,
+                        PromptContext &promptCtx,
+                        bool special,
+                        std::vector<Token> &embd_inp,
+                        std::string &asstSuffix);
+    bool tokenizeTemplate(const std::string &prompt,
+                          const std::string &promptTemplate,
+                          PromptContext &promptCtx,
+                          bool special,
+                          std::vector<Token> &embd_inp,
+                          std::string &asstSuffix,
+                          std::string &err);
+    bool checkStop(Token tok, const std::string &piece, const std::string &cachedResponse,
+                   std::string::size_type &lengthLimit) const;
+    bool acceptSampledToken(Sequence &seq, Token tok, Timings &timings);
+
     bool decodePrompt(std::function<bool(int32_t)> promptCallback,
                       std::function<bool(int32_t, const std::string&)> responseCallback,
                       bool allowContextShift,
@@ -254,6 +405,9 @@ protected:
     void generateResponse(std::function<bool(int32_t, const std::string&)> responseCallback,
                           bool allowContextShift,
                           PromptContext &promptCtx);
+    void generateChoices(const ChoiceResponseCallback &responseCallback,
+                         int32_t nChoices,
+                         PromptContext &promptCtx);
 
     Token m_tokenize_last_token = -1; // not serialized
 
@@ -54,9 +54,35 @@ struct llmodel_gpu_device {
     const char * vendor;
 };
 
+/**
+ * llmodel_timings structure for the per-phase statistics of the last llmodel_prompt call.
+ * Durations are in microseconds, measured with a monotonic clock.
+ */
+struct llmodel_timings {
+    int64_t t_tokenize_us;      // tokenizing the prompt template and input
+    int64_t t_prompt_eval_us;   // decoding the prompt in batches
+    int64_t t_sample_us;        // sampling new tokens
+    int64_t t_gen_eval_us;      // decoding sampled tokens
+    int64_t t_detokenize_us;    // converting tokens to text
+    int64_t t_stop_check_us;    // EOS and stop sequence matching
+    int64_t t_callback_us;      // time spent in the prompt and response callbacks
+    int64_t t_context_shift_us; // shifting the context window when it is full
+    int64_t t_total_us;         // the whole llmodel_prompt call
+    int32_t n_tokenize;         // number of tokenize calls
+    int32_t n_prompt_tokens;    // number of prompt tokens decoded
+    int32_t n_prompt_batches;   // number of prompt batches decoded
+    int32_t n_sample;           // number of tokens sampled
+    int32_t n_gen_tokens;       // number of generated tokens decoded
+    int32_t n_detokenize;       // number of tokens converted to text
+    int32_t n_callback;         // number of callback invocations
+    int32_t n_context_shift;    // number of context shifts
+    int32_t n_tokens_discarded; // number of tokens removed by context shifts
+};
+
 #ifndef __cplusplus
 typedef struct llmodel_prompt_context llmodel_prompt_context;
 typedef struct llmodel_gpu_device llmodel_gpu_device;
+typedef struct llmodel_timings llmodel_timings;
 #endif
 
 /**
@@ -182,6 +208,13 @@ void llmodel_prompt(llmodel_model model, const char *prompt,
                     bool special,
                     const char *fake_reply);
 
+/**
+ * Get the per-phase timings and counts of the most recent call to llmodel_prompt.
+ * @param model A pointer to the llmodel_model instance.
+ * @param timings A pointer to a llmodel_timings structure that will be filled in.
+ */
+void llmodel_get_timings(llmodel_model model, llmodel_timings *timings);
+
 /**
  * Generate an embedding using the model.
  * NOTE: If given NULL pointers for the model or text, or an empty text, a NULL pointer will be
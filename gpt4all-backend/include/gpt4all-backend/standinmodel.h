@@ -0,0 +1,70 @@
+#ifndef STANDINMODEL_H
+#define STANDINMODEL_H
+
+#include "llmodel.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * A model without weights, for benchmarking what surrounds inference, like the scheduler and the HTTP layer of the
+ * local API server, on any machine. Decoding takes a fixed time per token, and the responses only depend on the
+ * position they start at, so every run generates the same text at the same speed. Responses never end on their own,
+ * so their length is set with n_predict.
+ *
+ * A token is up to three bytes of text, so any prompt can be tokenized without a vocabulary. A batch of sequences
+ * takes as long as its prompt tokens plus a single generation step, however many sequences it advances, which is
+ * roughly how a memory-bound GPU behaves.
+ */
+class StandInModel : public LLModel {
+public:
+    struct Config {
+        double  promptTokensPerSec = 1000.0;
+        double  genTokensPerSec    = 20.0;  // per sequence
+        int32_t contextLength      = 4096;
+        int32_t maxSequences       = LLMODEL_MAX_SEQUENCES;
+    };
+
+    StandInModel();
+    explicit StandInModel(const Config &config);
+
+    bool supportsEmbedding() const override { return false; }
+    bool supportsCompletion() const override { return true; }
+    bool loadModel(const std::string &modelPath, int n_ctx, int ngl) override;
+    bool isModelLoaded() const override { return true; }
+    size_t requiredMem(const std::string &modelPath, int n_ctx, int ngl) override;
+    int32_t contextLength() const override { return m_config.contextLength; }
+    int32_t maxSequences() const override { return m_config.maxSequences; }
+
+protected:
+    std::vector<Token> tokenize(PromptContext &ctx, std::string_view str, bool special) override;
+    bool isSpecialToken(Token id) const override { return id == s_eos; }
+    std::string tokenToString(Token id) const override;
+    Token sampleToken(PromptContext &ctx) const override;
+    bool evalTokens(PromptContext &ctx, const std::vector<int32_t> &tokens) const override;
+    void shiftContext(PromptContext &promptCtx) override;
+    const std::vector<Token> &endTokens() const override { return m_endTokens; }
+    bool shouldAddBOS() const override { return false; }
+
+    void copySequence(int32_t srcSeq, int32_t dstSeq, int32_t n_past) override;
+    void removeSequence(int32_t seq, int32_t p0) override;
+    bool evalSequences(const std::vector<SequenceToken> &tokens) const override;
+    Token sampleSequenceToken(PromptContext &ctx, int32_t batchIdx) const override;
+
+private:
+    static constexpr Token s_eos = 0;
+
+    static std::vector<Token> encode(std::string_view str);
+    void simulateDecode(size_t promptTokens, bool generates) const;
+    static int32_t usedCells(const std::vector<int32_t> &cells);
+
+    Config                       m_config;
+    std::vector<Token>           m_endTokens { s_eos };
+    std::vector<Token>           m_response; // repeated for as long as a response goes on
+    mutable std::vector<int32_t> m_cells;    // KV cache cells used by each sequence
+};
+
+#endif // STANDINMODEL_H
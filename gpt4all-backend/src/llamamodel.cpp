@@ -139,6 +139,7 @@ struct gpt_params {
 
 static llama_token llama_sample_top_p_top_k(
         llama_context *ctx,
+        int32_t logits_idx,
         const llama_token *last_n_tokens_data,
         int last_n_tokens_size,
         int top_k,
@@ -146,7 +147,7 @@ static llama_token llama_sample_top_p_top_k(
         float min_p,
         float temp,
         float repeat_penalty) {
-    auto logits = llama_get_logits_ith(ctx, -1);
+    auto logits = llama_get_logits_ith(ctx, logits_idx);
     auto n_vocab = llama_n_vocab(llama_get_model(ctx));
     // Populate initial list of all candidates
     std::vector<llama_token_data> candidates;
@@ -445,6 +446,8 @@ bool LLamaModel::loadModel(const std::string &modelPath, int n_ctx, int ngl)
     }
 
     d_ptr->ctx_params.n_ctx   = n_ctx;
+    if (!isEmbedding)
+        d_ptr->ctx_params.n_seq_max = LLMODEL_MAX_SEQUENCES;
     d_ptr->ctx_params.seed    = params.seed;
     d_ptr->ctx_params.type_k  = params.kv_type;
     d_ptr->ctx_params.type_v  = params.kv_type;
@@ -576,7 +579,16 @@ std::string LLamaModel::tokenToString(Token id) const
 LLModel::Token LLamaModel::sampleToken(PromptContext &promptCtx) const
 {
     const size_t n_prev_toks = std::min((size_t) promptCtx.repeat_last_n, promptCtx.tokens.size());
-    return llama_sample_top_p_top_k(d_ptr->ctx,
+    return llama_sample_top_p_top_k(d_ptr->ctx, -1,
+        promptCtx.tokens.data() + promptCtx.tokens.size() - n_prev_toks,
+        n_prev_toks, promptCtx.top_k, promptCtx.top_p, promptCtx.min_p, promptCtx.temp,
+        promptCtx.repeat_penalty);
+}
+
+LLModel::Token LLamaModel::sampleSequenceToken(PromptContext &promptCtx, int32_t batchIdx) const
+{
+    const size_t n_prev_toks = std::min((size_t) promptCtx.repeat_last_n, promptCtx.tokens.size());
+    return llama_sample_top_p_top_k(d_ptr->ctx, batchIdx,
         promptCtx.tokens.data() + promptCtx.tokens.size() - n_prev_toks,
         n_prev_toks, promptCtx.top_k, promptCtx.top_p, promptCtx.min_p, promptCtx.temp,
         promptCtx.repeat_penalty);
@@ -606,6 +618,40 @@ bool LLamaModel::evalTokens(PromptContext &ctx, const std::vector<int32_t> &toke
     return res == 0;
 }
 
+int32_t LLamaModel::maxSequences() const
+{
+    return d_ptr->ctx_params.n_seq_max;
+}
+
+void LLamaModel::copySequence(int32_t srcSeq, int32_t dstSeq, int32_t n_past)
+{
+    llama_kv_cache_seq_cp(d_ptr->ctx, srcSeq, dstSeq, 0, n_past);
+}
+
+void LLamaModel::removeSequence(int32_t seq, int32_t p0)
+{
+    llama_kv_cache_seq_rm(d_ptr->ctx, seq, p0, -1);
+}
+
+bool LLamaModel::evalSequences(const std::vector<SequenceToken> &tokens) const
+{
+    llama_batch batch = llama_batch_init(tokens.size(), 0, 1);
+
+    batch.n_tokens = tokens.size();
+
+    for (int32_t i = 0; i < batch.n_tokens; i++) {
+        batch.token   [i] = tokens[i].token;
+        batch.pos     [i] = tokens[i].pos;
+        batch.n_seq_id[i] = 1;
+        batch.seq_id  [i][0] = tokens[i].seq;
+        batch.logits  [i] = tokens[i].logits;
+    }
+
+    int res = llama_decode(d_ptr->ctx, batch);
+    llama_batch_free(batch);
+    return res == 0;
+}
+
 void LLamaModel::shiftContext(PromptContext &promptCtx)
 {
     // infinite text generation via context shifting
@@ -37,6 +37,7 @@ public:
     bool usingGPUDevice() const override;
     const char *backendName() const override;
     const char *gpuDeviceName() const override;
+    int32_t maxSequences() const override;
 
     size_t embeddingSize() const override;
     // user-specified prefix
@@ -59,6 +60,10 @@ protected:
     Token sampleToken(PromptContext &ctx) const override;
     bool evalTokens(PromptContext &ctx, const std::vector<int32_t> &tokens) const override;
     void shiftContext(PromptContext &promptCtx) override;
+    void copySequence(int32_t srcSeq, int32_t dstSeq, int32_t n_past) override;
+    void removeSequence(int32_t seq, int32_t p0) override;
+    bool evalSequences(const std::vector<SequenceToken> &tokens) const override;
+    Token sampleSequenceToken(PromptContext &ctx, int32_t batchIdx) const override;
     int32_t contextLength() const override;
     const std::vector<Token> &endTokens() const override;
     bool shouldAddBOS() const override;
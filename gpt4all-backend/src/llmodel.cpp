@@ -82,6 +82,15 @@ LLModel::Implementation::Implementation(Dlhandle &&dlhandle_)
     assert(m_construct);
 }
 
+LLModel::Implementation::Implementation(std::string_view modelType, std::string_view buildVariant)
+    : m_getFileArch(nullptr)
+    , m_isArchSupported(nullptr)
+    , m_construct(nullptr)
+    , m_modelType(modelType)
+    , m_buildVariant(buildVariant)
+    , m_dlhandle(nullptr) {
+}
+
 LLModel::Implementation::Implementation(Implementation &&o)
     : m_getFileArch(o.m_getFileArch)
     , m_isArchSupported(o.m_isArchSupported)
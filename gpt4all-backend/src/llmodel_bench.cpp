@@ -0,0 +1,580 @@
+// llmodel-bench: end-to-end inference benchmark for the llmodel backend.
+//
+// Loads a GGUF through LLModel::Implementation::construct and reports time-to-first-token, prompt
+// processing and generation throughput, embedding throughput and peak RSS as a single JSON object,
+// so that results can be collected per commit and per machine.
+
+#include "llmodel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   ifndef NOMINMAX
+#       define NOMINMAX
+#   endif
+#   include <windows.h>
+#   include <psapi.h>
+#else
+#   include <sys/resource.h>
+#endif
+
+namespace fs = std::filesystem;
+using namespace std::string_literals;
+
+using Clock = std::chrono::steady_clock;
+
+static double msSince(Clock::time_point start, Clock::time_point end = Clock::now())
+{
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+static double perSecond(double count, double ms)
+{
+    return ms > 0 ? count * 1000.0 / ms : 0.0;
+}
+
+// peak resident set size of this process in bytes, or 0 if unknown
+static uint64_t peakRSS()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage))
+        return 0;
+#   ifdef __APPLE__
+    return uint64_t(usage.ru_maxrss); // bytes
+#   else
+    return uint64_t(usage.ru_maxrss) * 1024; // kilobytes
+#   endif
+#endif
+}
+
+/*
+ * Minimal JSON writer - the backend has no JSON dependency and we only need to emit objects,
+ * arrays, strings and numbers.
+ */
+class JsonWriter {
+public:
+    explicit JsonWriter(std::ostream &out): m_out(out) {}
+
+    JsonWriter &beginObject(std::string_view key = {}) { open(key, '{'); return *this; }
+    JsonWriter &endObject() { close('}'); return *this; }
+    JsonWriter &beginArray(std::string_view key = {}) { open(key, '['); return *this; }
+    JsonWriter &endArray() { close(']'); return *this; }
+
+    JsonWriter &value(std::string_view key, std::string_view str)
+    {
+        writeKey(key);
+        writeString(str);
+        return *this;
+    }
+    JsonWriter &value(std::string_view key, const char *str)
+    {
+        if (!str) { writeKey(key); m_out << "null"; return *this; }
+        return value(key, std::string_view(str));
+    }
+    JsonWriter &value(std::string_view key, bool b)
+    {
+        writeKey(key);
+        m_out << (b ? "true" : "false");
+        return *this;
+    }
+    JsonWriter &value(std::string_view key, double num)
+    {
+        writeKey(key);
+        std::ostringstream ss;
+        ss << std::fixed << std::setprecision(3) << num;
+        m_out << ss.str();
+        return *this;
+    }
+    JsonWriter &value(std::string_view key, int64_t num)
+    {
+        writeKey(key);
+        m_out << num;
+        return *this;
+    }
+    JsonWriter &value(std::string_view key, int num)      { return value(key, int64_t(num)); }
+    JsonWriter &value(std::string_view key, uint64_t num) { return value(key, int64_t(num)); }
+
+private:
+    void open(std::string_view key, char bracket)
+    {
+        writeKey(key);
+        m_out << bracket;
+        m_first.push_back(true);
+    }
+
+    void close(char bracket)
+    {
+        m_first.pop_back();
+        m_out << '\n' << std::string(2 * m_first.size(), ' ') << bracket;
+        if (m_first.empty())
+            m_out << '\n';
+    }
+
+    void writeKey(std::string_view key)
+    {
+        if (!m_first.empty()) {
+            if (!m_first.back())
+                m_out << ',';
+            m_first.back() = false;
+            m_out << '\n' << std::string(2 * m_first.size(), ' ');
+        }
+        if (!key.empty()) {
+            writeString(key);
+            m_out << ": ";
+        }
+    }
+
+    void writeString(std::string_view str)
+    {
+        m_out << '"';
+        for (char c : str) {
+            switch (c) {
+                case '"':  m_out << "\\\""; break;
+                case '\\': m_out << "\\\\"; break;
+                case '\n': m_out << "\\n";  break;
+                case '\r': m_out << "\\r";  break;
+                case '\t': m_out << "\\t";  break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20) {
+                        char buf[8];
+                        snprintf(buf, sizeof buf, "\\u%04x", c);
+                        m_out << buf;
+                    } else {
+                        m_out << c;
+                    }
+            }
+        }
+        m_out << '"';
+    }
+
+    std::ostream &m_out;
+    std::vector<bool> m_first;
+};
+
+struct BenchParams {
+    std::string model;
+    std::string embedModel;
+    std::string backend = "auto";
+    std::string device;
+    std::string implPath;
+    std::string output;
+    int32_t n_ctx = 2048;
+    int32_t ngl = 100;
+    int32_t n_threads = std::min(4, int32_t(std::thread::hardware_concurrency()));
+    std::vector<int32_t> promptLengths { 32, 128, 512 };
+    std::vector<int32_t> batchSizes { 8, 32, 128 };
+    int32_t n_gen = 128;
+    int32_t reps = 3;
+    int32_t embedTexts = 32;
+    int32_t embedLength = 128;
+};
+
+static void printUsage(const char *argv0, const BenchParams &p)
+{
+    auto join = [](const std::vector<int32_t> &v) {
+        std::string s;
+        for (size_t i = 0; i < v.size(); i++)
+            s += (i ? "," : "") + std::to_string(v[i]);
+        return s;
+    };
+
+    std::cerr
+        << "usage: " << argv0 << " [options]\n"
+        << "\n"
+        << "options:\n"
+        << "  -m, --model PATH         completion model to benchmark\n"
+        << "  -e, --embed-model PATH   embedding model to benchmark\n"
+        << "  -b, --backend NAME       one of auto, cpu, metal, kompute, cuda (default: " << p.backend << ")\n"
+        << "  -d, --device NAME        GPU device to use: gpu, amd, nvidia, intel, or a device name\n"
+        << "  -c, --n-ctx N            context length (default: " << p.n_ctx << ")\n"
+        << "  -g, --ngl N              number of GPU layers (default: " << p.ngl << ")\n"
+        << "  -t, --threads N          number of threads (default: " << p.n_threads << ")\n"
+        << "  -p, --prompt-lengths L   comma-separated prompt lengths in tokens (default: "
+                                          << join(p.promptLengths) << ")\n"
+        << "  -B, --batch-sizes L      comma-separated values of n_batch (default: " << join(p.batchSizes) << ")\n"
+        << "  -n, --n-gen N            number of tokens to generate (default: " << p.n_gen << ")\n"
+        << "  -r, --reps N             repetitions of each measurement (default: " << p.reps << ")\n"
+        << "      --embed-texts N      number of texts per embed() call (default: " << p.embedTexts << ")\n"
+        << "      --embed-length N     approximate length of each text in tokens (default: "
+                                          << p.embedLength << ")\n"
+        << "      --impl-path PATH     llmodel implementation search path (default: executable directory)\n"
+        << "  -o, --output PATH        write JSON results to PATH instead of stdout\n"
+        << "  -h, --help               show this help message and exit\n";
+}
+
+static std::vector<int32_t> parseIntList(const std::string &str)
+{
+    std::vector<int32_t> result;
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, ','))
+        result.push_back(std::stoi(item));
+    if (result.empty())
+        throw std::invalid_argument("empty list: " + str);
+    return result;
+}
+
+static bool parseArgs(int argc, char **argv, BenchParams &p)
+{
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto next = [&]() -> std::string {
+            if (++i >= argc)
+                throw std::invalid_argument("missing value for " + arg);
+            return argv[i];
+        };
+
+        if (arg == "-h" || arg == "--help") {
+            printUsage(argv[0], p);
+            exit(0);
+        } else if (arg == "-m" || arg == "--model") {
+            p.model = next();
+        } else if (arg == "-e" || arg == "--embed-model") {
+            p.embedModel = next();
+        } else if (arg == "-b" || arg == "--backend") {
+            p.backend = next();
+        } else if (arg == "-d" || arg == "--device") {
+            p.device = next();
+        } else if (arg == "-c" || arg == "--n-ctx") {
+            p.n_ctx = std::stoi(next());
+        } else if (arg == "-g" || arg == "--ngl") {
+            p.ngl = std::stoi(next());
+        } else if (arg == "-t" || arg == "--threads") {
+            p.n_threads = std::stoi(next());
+        } else if (arg == "-p" || arg == "--prompt-lengths") {
+            p.promptLengths = parseIntList(next());
+        } else if (arg == "-B" || arg == "--batch-sizes") {
+            p.batchSizes = parseIntList(next());
+        } else if (arg == "-n" || arg == "--n-gen") {
+            p.n_gen = std::stoi(next());
+        } else if (arg == "-r" || arg == "--reps") {
+            p.reps = std::max(1, std::stoi(next()));
+        } else if (arg == "--embed-texts") {
+            p.embedTexts = std::stoi(next());
+        } else if (arg == "--embed-length") {
+            p.embedLength = std::stoi(next());
+        } else if (arg == "--impl-path") {
+            p.implPath = next();
+        } else if (arg == "-o" || arg == "--output") {
+            p.output = next();
+        } else {
+            std::cerr << "error: unknown argument: " << arg << "\n";
+            printUsage(argv[0], p);
+            return false;
+        }
+    }
+
+    if (p.model.empty() && p.embedModel.empty()) {
+        std::cerr << "error: at least one of --model or --embed-model is required\n";
+        printUsage(argv[0], p);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Deterministic filler text of roughly n_tokens tokens. The tokenizer is not part of the public
+ * LLModel API, so the actual number of decoded tokens is counted by the prompt callback and
+ * reported alongside the requested length.
+ */
+static std::string fillerText(int32_t n_tokens)
+{
+    static const char *words[] {
+        "the", "quick", "brown", "fox", "jumps", "over", "a", "lazy", "dog", "and", "then", "runs", "into",
+        "forest", "where", "it", "finds", "small", "river", "with", "clear", "water", "under", "old", "tree",
+    };
+    constexpr size_t nWords = std::size(words);
+
+    std::string text;
+    uint32_t state = 42;
+    for (int32_t i = 0; i < n_tokens; i++) {
+        state = state * 1664525u + 1013904223u; // LCG, fixed seed
+        if (i) text += ' ';
+        text += words[(state >> 16) % nWords];
+    }
+    return text;
+}
+
+static LLModel *loadModel(const BenchParams &p, const std::string &modelPath, double &loadMs)
+{
+    auto start = Clock::now();
+    auto model = std::unique_ptr<LLModel>(LLModel::Implementation::construct(modelPath, p.backend, p.n_ctx));
+
+    if (!p.device.empty()) {
+        size_t memReq = model->requiredMem(modelPath, p.n_ctx, p.ngl);
+        if (!model->initializeGPUDevice(memReq, p.device))
+            std::cerr << "warning: could not initialize GPU device " << p.device << ", falling back to CPU\n";
+    }
+
+    if (!model->loadModel(modelPath, p.n_ctx, p.ngl))
+        throw std::runtime_error("failed to load model: " + modelPath);
+    model->setThreadCount(p.n_threads);
+
+    loadMs = msSince(start);
+    return model.release();
+}
+
+static void writeModelInfo(JsonWriter &json, const LLModel &model, const std::string &path, double loadMs)
+{
+    json.value("path", fs::path(path).filename().string());
+    json.value("type", model.implementation().modelType());
+    json.value("build_variant", model.implementation().buildVariant());
+    json.value("backend", model.backendName());
+    json.value("gpu_device", model.gpuDeviceName());
+    json.value("load_ms", loadMs);
+}
+
+struct PromptRun {
+    int32_t n_prompt = 0;
+    int32_t n_gen = 0;
+    double promptMs = 0;
+    double ttftMs = -1;
+    double genMs = 0;
+};
+
+// Decode a prompt from an empty context and optionally generate a response.
+static PromptRun runPrompt(LLModel &model, const std::string &text, int32_t n_batch, int32_t n_predict,
+                           int32_t n_ctx)
+{
+    PromptRun run;
+    LLModel::PromptContext ctx;
+    ctx.n_ctx = n_ctx;
+    ctx.n_batch = n_batch;
+    ctx.n_predict = n_predict;
+    ctx.temp = 0.0f; // greedy, for reproducible token counts
+
+    Clock::time_point start, lastPrompt, firstResponse, lastResponse;
+    auto promptFunc = [&](int32_t) {
+        ++run.n_prompt;
+        lastPrompt = Clock::now();
+        return true;
+    };
+    auto responseFunc = [&](int32_t token, const std::string &response) {
+        if (token < 0) {
+            std::cerr << "error: " << response << "\n";
+            return false;
+        }
+        auto now = Clock::now();
+        if (!run.n_gen++)
+            firstResponse = now;
+        lastResponse = now;
+        return true;
+    };
+
+    start = Clock::now();
+    // "%1%2" avoids an implicit assistant suffix being decoded after the response
+    model.prompt(text, "%1%2", promptFunc, responseFunc, /*allowContextShift*/ false, ctx);
+    auto end = Clock::now();
+
+    run.promptMs = run.n_prompt ? msSince(start, lastPrompt) : 0;
+    if (run.n_gen) {
+        run.ttftMs = msSince(start, firstResponse);
+        run.genMs = msSince(firstResponse, lastResponse);
+    } else if (!n_predict) {
+        run.promptMs = msSince(start, end);
+    }
+    return run;
+}
+
+template <typename T>
+static T median(std::vector<T> values)
+{
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+static void benchCompletion(JsonWriter &json, const BenchParams &p)
+{
+    double loadMs;
+    std::unique_ptr<LLModel> model(loadModel(p, p.model, loadMs));
+    if (!model->supportsCompletion())
+        throw std::runtime_error("not a completion model: " + p.model);
+
+    json.beginObject("completion");
+    json.beginObject("model");
+    writeModelInfo(json, *model, p.model, loadMs);
+    json.value("n_ctx", p.n_ctx);
+    json.value("n_threads", p.n_threads);
+    json.endObject();
+
+    // warm-up, so that one-time allocations are not attributed to the first measurement
+    runPrompt(*model, fillerText(16), LLMODEL_MAX_PROMPT_BATCH, 4, p.n_ctx);
+
+    json.beginArray("prompt_eval");
+    for (int32_t length : p.promptLengths) {
+        if (length + p.n_gen + 4 > p.n_ctx) {
+            std::cerr << "warning: skipping prompt length " << length << " which does not fit in n_ctx=" << p.n_ctx
+                      << "\n";
+            continue;
+        }
+        std::string text = fillerText(length);
+        for (int32_t n_batch : p.batchSizes) {
+            std::vector<double> ms;
+            int32_t n_tokens = 0;
+            for (int32_t r = 0; r < p.reps; r++) {
+                auto run = runPrompt(*model, text, n_batch, /*n_predict*/ 0, p.n_ctx);
+                ms.push_back(run.promptMs);
+                n_tokens = run.n_prompt;
+            }
+            double medMs = median(ms);
+            json.beginObject();
+            json.value("n_batch", std::min(n_batch, LLMODEL_MAX_PROMPT_BATCH));
+            json.value("n_tokens_requested", length);
+            json.value("n_tokens", n_tokens);
+            json.value("ms", medMs);
+            json.value("tokens_per_sec", perSecond(n_tokens, medMs));
+            json.endObject();
+        }
+    }
+    json.endArray();
+
+    {
+        // generation after a prompt of the first requested length, using the largest batch size
+        int32_t n_batch = *std::max_element(p.batchSizes.begin(), p.batchSizes.end());
+        std::string text = fillerText(p.promptLengths.front());
+        std::vector<double> ttft, genMs, genRate;
+        int32_t n_gen = 0, n_prompt = 0;
+        for (int32_t r = 0; r < p.reps; r++) {
+            auto run = runPrompt(*model, text, n_batch, p.n_gen, p.n_ctx);
+            if (!run.n_gen)
+                continue;
+            ttft.push_back(run.ttftMs);
+            genMs.push_back(run.genMs);
+            // the first token is accounted for by time-to-first-token
+            genRate.push_back(perSecond(run.n_gen - 1, run.genMs));
+            n_gen = run.n_gen;
+            n_prompt = run.n_prompt;
+        }
+
+        json.beginObject("generation");
+        json.value("n_prompt", n_prompt);
+        json.value("n_batch", std::min(n_batch, LLMODEL_MAX_PROMPT_BATCH));
+        json.value("n_tokens", n_gen);
+        if (ttft.empty()) {
+            std::cerr << "warning: model did not generate any tokens\n";
+        } else {
+            json.value("time_to_first_token_ms", median(ttft));
+            json.value("ms", median(genMs));
+            json.value("tokens_per_sec", median(genRate));
+        }
+        json.endObject();
+    }
+
+    json.endObject();
+}
+
+static void benchEmbedding(JsonWriter &json, const BenchParams &p)
+{
+    double loadMs;
+    std::unique_ptr<LLModel> model(loadModel(p, p.embedModel, loadMs));
+    if (!model->supportsEmbedding())
+        throw std::runtime_error("not an embedding model: " + p.embedModel);
+
+    std::vector<std::string> texts;
+    for (int32_t i = 0; i < p.embedTexts; i++)
+        texts.push_back(std::to_string(i) + " " + fillerText(p.embedLength));
+
+    const size_t n_embd = model->embeddingSize();
+    std::vector<float> embeddings(n_embd * texts.size());
+
+    // warm-up
+    model->embed({ texts.front() }, embeddings.data(), /*isRetrieval*/ false);
+
+    std::vector<double> ms;
+    size_t tokenCount = 0;
+    for (int32_t r = 0; r < p.reps; r++) {
+        auto start = Clock::now();
+        model->embed(texts, embeddings.data(), /*isRetrieval*/ false, /*dimensionality*/ -1, &tokenCount);
+        ms.push_back(msSince(start));
+    }
+    double medMs = median(ms);
+
+    json.beginObject("embedding");
+    json.beginObject("model");
+    writeModelInfo(json, *model, p.embedModel, loadMs);
+    json.value("n_embd", uint64_t(n_embd));
+    json.endObject();
+    json.value("n_texts", int64_t(texts.size()));
+    json.value("n_tokens", uint64_t(tokenCount));
+    json.value("ms", medMs);
+    json.value("texts_per_sec", perSecond(double(texts.size()), medMs));
+    json.value("tokens_per_sec", perSecond(double(tokenCount), medMs));
+    json.endObject();
+}
+
+int main(int argc, char **argv)
+{
+    BenchParams params;
+    try {
+        if (!parseArgs(argc, argv, params))
+            return 1;
+    } catch (const std::exception &e) {
+        std::cerr << "error: " << e.what() << "\n";
+        return 1;
+    }
+
+    if (params.implPath.empty())
+        params.implPath = fs::absolute(fs::path(argv[0])).parent_path().string();
+    LLModel::Implementation::setImplementationsSearchPath(params.implPath);
+
+    std::ofstream outFile;
+    if (!params.output.empty()) {
+        outFile.open(params.output);
+        if (!outFile) {
+            std::cerr << "error: could not open " << params.output << " for writing\n";
+            return 1;
+        }
+    }
+    std::ostringstream buf; // only written out if every benchmark succeeds
+    JsonWriter json(buf);
+
+    int status = 0;
+    json.beginObject();
+    json.beginObject("system");
+    json.value("hardware_concurrency", int(std::thread::hardware_concurrency()));
+    json.value("cpu_supports_avx2", LLModel::Implementation::cpuSupportsAVX2());
+    json.endObject();
+
+    try {
+        if (!params.model.empty())
+            benchCompletion(json, params);
+        if (!params.embedModel.empty())
+            benchEmbedding(json, params);
+    } catch (const std::exception &e) {
+        std::cerr << "error: " << e.what() << "\n";
+        status = 1;
+    }
+
+    json.value("peak_rss_bytes", peakRSS());
+    json.endObject();
+
+    if (status)
+        return status;
+    (outFile.is_open() ? static_cast<std::ostream &>(outFile) : std::cout) << buf.str();
+    return 0;
+}
@@ -155,6 +155,31 @@ void llmodel_prompt(llmodel_model model, const char *prompt,
     ctx->context_erase = wrapper->promptContext.contextErase;
 }
 
+void llmodel_get_timings(llmodel_model model, llmodel_timings *timings)
+{
+    const auto *wrapper = static_cast<LLModelWrapper *>(model);
+    const auto &t = wrapper->promptContext.timings;
+
+    timings->t_tokenize_us = t.t_tokenize_us;
+    timings->t_prompt_eval_us = t.t_prompt_eval_us;
+    timings->t_sample_us = t.t_sample_us;
+    timings->t_gen_eval_us = t.t_gen_eval_us;
+    timings->t_detokenize_us = t.t_detokenize_us;
+    timings->t_stop_check_us = t.t_stop_check_us;
+    timings->t_callback_us = t.t_callback_us;
+    timings->t_context_shift_us = t.t_context_shift_us;
+    timings->t_total_us = t.t_total_us;
+    timings->n_tokenize = t.n_tokenize;
+    timings->n_prompt_tokens = t.n_prompt_tokens;
+    timings->n_prompt_batches = t.n_prompt_batches;
+    timings->n_sample = t.n_sample;
+    timings->n_gen_tokens = t.n_gen_tokens;
+    timings->n_detokenize = t.n_detokenize;
+    timings->n_callback = t.n_callback;
+    timings->n_context_shift = t.n_context_shift;
+    timings->n_tokens_discarded = t.n_tokens_discarded;
+}
+
 float *llmodel_embed(
     llmodel_model model, const char **texts, size_t *embedding_size, const char *prefix, int dimensionality,
     size_t *token_count, bool do_mean, bool atlas, llmodel_emb_cancel_callback cancel_cb, const char **error
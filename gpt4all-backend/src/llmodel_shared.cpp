@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
@@ -16,6 +17,32 @@
 
 namespace ranges = std::ranges;
 
+namespace {
+
+// Adds the lifetime of the timer to a microsecond counter in LLModel::Timings.
+class PhaseTimer {
+public:
+    explicit PhaseTimer(int64_t &accum)
+        : m_accum(accum)
+        , m_start(std::chrono::steady_clock::now())
+        {}
+
+    ~PhaseTimer()
+    {
+        auto elapsed = std::chrono::steady_clock::now() - m_start;
+        m_accum += std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    }
+
+    PhaseTimer(const PhaseTimer &) = delete;
+    PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+private:
+    int64_t &m_accum;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+} // namespace
+
 static bool parsePromptTemplate(const std::string &tmpl, std::vector<std::smatch> &placeholders, std::string &err)
 {
     static const std::regex placeholderRegex(R"(%[1-2](?![0-9]))");
@@ -47,17 +74,94 @@ void LLModel::prompt(const std::string &prompt,
                      PromptContext &promptCtx,
                      bool special,
                      std::optional<std::string_view> fakeReply)
+{
+    promptCtx.timings = {};
+    PhaseTimer totalTimer(promptCtx.timings.t_total_us);
+
+    std::vector<Token> embd_inp;
+    std::string asstSuffix;
+    if (!tokenizePrompt(prompt, promptTemplate, responseCallback, promptCtx, special, embd_inp, asstSuffix))
+        return; // error
+
+    // decode the user prompt
+    if (!decodePrompt(promptCallback, responseCallback, allowContextShift, promptCtx, embd_inp))
+        return; // error
+
+    // decode the assistant's reply, either generated or spoofed
+    if (!fakeReply) {
+        generateResponse(responseCallback, allowContextShift, promptCtx);
+    } else {
+        embd_inp = timedTokenize(promptCtx, *fakeReply, false);
+        if (!decodePrompt(promptCallback, responseCallback, allowContextShift, promptCtx, embd_inp, true))
+            return; // error
+    }
+
+    // decode the rest of the prompt template
+    if (!asstSuffix.empty()) {
+        embd_inp = timedTokenize(promptCtx, asstSuffix, true);
+        decodePrompt(promptCallback, responseCallback, allowContextShift, promptCtx, embd_inp);
+    }
+}
+
+void LLModel::promptChoices(const std::string &prompt,
+                            const std::string &promptTemplate,
+                            std::function<bool(int32_t)> promptCallback,
+                            ChoiceResponseCallback responseCallback,
+                            int32_t nChoices,
+                            bool allowContextShift,
+                            PromptContext &promptCtx,
+                            bool special)
+{
+    // errors and the prompt template are reported through choice 0
+    auto firstResponse = [&responseCallback](int32_t token, const std::string &piece) {
+        return responseCallback(0, token, piece);
+    };
+
+    if (nChoices <= 1) {
+        this->prompt(prompt, promptTemplate, promptCallback, firstResponse, allowContextShift, promptCtx, special);
+        return;
+    }
+
+    promptCtx.timings = {};
+    PhaseTimer totalTimer(promptCtx.timings.t_total_us);
+
+    std::vector<Token> embd_inp;
+    std::string asstSuffix;
+    if (!tokenizePrompt(prompt, promptTemplate, firstResponse, promptCtx, special, embd_inp, asstSuffix))
+        return; // error
+
+    // decode the user prompt once for all choices
+    if (!decodePrompt(promptCallback, firstResponse, allowContextShift, promptCtx, embd_inp))
+        return; // error
+
+    generateChoices(responseCallback, nChoices, promptCtx);
+
+    // decode the rest of the prompt template after the response of choice 0
+    if (!asstSuffix.empty()) {
+        embd_inp = timedTokenize(promptCtx, asstSuffix, true);
+        decodePrompt(promptCallback, firstResponse, allowContextShift, promptCtx, embd_inp);
+    }
+}
+
+// returns false on error
+bool LLModel::tokenizePrompt(const std::string &prompt,
+                             const std::string &promptTemplate,
+                             const std::function<bool(int32_t, const std::string&)> &responseCallback,
+                             PromptContext &promptCtx,
+                             bool special,
+                             std::vector<Token> &embd_inp,
+                             std::string &asstSuffix)
 {
     if (!isModelLoaded()) {
         std::cerr << implementation().modelType() << " ERROR: prompt won't work with an unloaded model!\n";
-        return;
+        return false;
     }
 
     if (!supportsCompletion()) {
         std::string errorMessage = "ERROR: this model does not support text completion or chat!";
         responseCallback(-1, errorMessage);
         std::cerr << implementation().modelType() << " " << errorMessage << "\n";
-        return;
+        return false;
     }
 
     // sanity checks
@@ -79,36 +183,48 @@ void LLModel::prompt(const std::string &prompt,
         promptCtx.tokens.resize(promptCtx.n_past);
     m_tokenize_last_token = promptCtx.tokens.empty() ? -1 : promptCtx.tokens.back(); // not serialized
 
+    std::string err;
+    if (!tokenizeTemplate(prompt, promptTemplate, promptCtx, special, embd_inp, asstSuffix, err)) {
+        responseCallback(-1, err);
+        std::cerr << err << "\n";
+        return false;
+    }
+    return true;
+}
+
+// returns false if the prompt template is invalid
+bool LLModel::tokenizeTemplate(const std::string &prompt,
+                               const std::string &promptTemplate,
+                               PromptContext &promptCtx,
+                               bool special,
+                               std::vector<Token> &embd_inp,
+                               std::string &asstSuffix,
+                               std::string &err)
+{
     // parse the prompt template
     std::vector<std::smatch> placeholders;
-    {
-        std::string err;
-        if (!parsePromptTemplate(promptTemplate, placeholders, err)) {
-            responseCallback(-1, err);
-            std::cerr << err << "\n";
-            return;
-        }
-    }
+    if (!parsePromptTemplate(promptTemplate, placeholders, err))
+        return false;
 
     auto old_n_past = promptCtx.n_past; // prepare to fake n_past for tokenize
 
     // tokenize the user prompt
-    std::vector<Token> embd_inp;
+    embd_inp.clear();
     if (placeholders.empty()) {
         // this is unusual, but well-defined
         std::cerr << __func__ << ": prompt template has no placeholder\n";
-        embd_inp = tokenize(promptCtx, promptTemplate, true);
+        embd_inp = timedTokenize(promptCtx, promptTemplate, true);
     } else {
         // template: beginning of user prompt
         const auto &phUser = placeholders[0];
         std::string userPrefix(phUser.prefix());
         if (!userPrefix.empty()) {
-            embd_inp = tokenize(promptCtx, userPrefix, true);
+            embd_inp = timedTokenize(promptCtx, userPrefix, true);
             promptCtx.n_past += embd_inp.size();
         }
 
         // user input (shouldn't have special token processing)
-        auto tokens = tokenize(promptCtx, prompt, special);
+        auto tokens = timedTokenize(promptCtx, prompt, special);
         embd_inp.insert(embd_inp.end(), tokens.begin(), tokens.end());
         promptCtx.n_past += tokens.size();
 
@@ -117,7 +233,7 @@ void LLModel::prompt(const std::string &prompt,
         size_t end = placeholders.size() >= 2 ? placeholders[1].position() : promptTemplate.length();
         auto userToAsst = promptTemplate.substr(start, end - start);
         if (!userToAsst.empty()) {
-            tokens = tokenize(promptCtx, userToAsst, true);
+            tokens = timedTokenize(promptCtx, userToAsst, true);
             embd_inp.insert(embd_inp.end(), tokens.begin(), tokens.end());
             promptCtx.n_past += tokens.size();
         }
@@ -125,32 +241,37 @@ void LLModel::prompt(const std::string &prompt,
 
     promptCtx.n_past = old_n_past; // restore n_past so decodePrompt can increment it
 
-    // decode the user prompt
-    if (!decodePrompt(promptCallback, responseCallback, allowContextShift, promptCtx, embd_inp))
-        return; // error
-
-    // decode the assistant's reply, either generated or spoofed
-    if (!fakeReply) {
-        generateResponse(responseCallback, allowContextShift, promptCtx);
-    } else {
-        embd_inp = tokenize(promptCtx, *fakeReply, false);
-        if (!decodePrompt(promptCallback, responseCallback, allowContextShift, promptCtx, embd_inp, true))
-            return; // error
-    }
-
-    // decode the rest of the prompt template
     // template: end of assistant prompt
-    std::string asstSuffix;
     if (placeholders.size() >= 2) {
         size_t start = placeholders[1].position() + placeholders[1].length();
         asstSuffix = promptTemplate.substr(start);
     } else {
         asstSuffix = "\n\n"; // default to a blank link, good for e.g. Alpaca
     }
-    if (!asstSuffix.empty()) {
-        embd_inp = tokenize(promptCtx, asstSuffix, true);
-        decodePrompt(promptCallback, responseCallback, allowContextShift, promptCtx, embd_inp);
-    }
+    return true;
+}
+
+std::vector<LLModel::Token> LLModel::timedTokenize(PromptContext &ctx, std::string_view str, bool special)
+{
+    PhaseTimer timer(ctx.timings.t_tokenize_us);
+    ctx.timings.n_tokenize++;
+    return tokenize(ctx, str, special);
+}
+
+std::string LLModel::timedTokenToString(Timings &timings, Token id) const
+{
+    PhaseTimer timer(timings.t_detokenize_us);
+    timings.n_detokenize++;
+    return tokenToString(id);
+}
+
+void LLModel::timedShiftContext(PromptContext &promptCtx)
+{
+    PhaseTimer timer(promptCtx.timings.t_context_shift_us);
+    int32_t old_n_past = promptCtx.n_past;
+    shiftContext(promptCtx);
+    promptCtx.timings.n_context_shift++;
+    promptCtx.timings.n_tokens_discarded += old_n_past - promptCtx.n_past;
 }
 
 // returns false on error
@@ -179,27 +300,47 @@ bool LLModel::decodePrompt(std::function<bool(int32_t)> promptCallback,
     // process the prompt in batches
     size_t i = 0;
     while (i < embd_inp.size()) {
+        if (promptCtx.pastDeadline()) {
+            promptCtx.deadlineExceeded = true;
+            return false;
+        }
+
         size_t batch_end = std::min(i + promptCtx.n_batch, embd_inp.size());
         std::vector<Token> batch(embd_inp.begin() + i, embd_inp.begin() + batch_end);
 
         // Check if the context has run out...
         if (promptCtx.n_past + int32_t(batch.size()) > promptCtx.n_ctx) {
             assert(allowContextShift);
-            shiftContext(promptCtx);
+            timedShiftContext(promptCtx);
             assert(promptCtx.n_past + int32_t(batch.size()) <= promptCtx.n_ctx);
         }
 
-        if (!evalTokens(promptCtx, batch)) {
+        bool ok;
+        {
+            PhaseTimer timer(promptCtx.timings.t_prompt_eval_us);
+            ok = evalTokens(promptCtx, batch);
+        }
+        if (!ok) {
             std::cerr << implementation().modelType() << " ERROR: Failed to process prompt\n";
             return false;
         }
+        promptCtx.timings.n_prompt_batches++;
+        promptCtx.timings.n_prompt_tokens += batch.size();
 
         size_t tokens = batch_end - i;
         for (size_t t = 0; t < tokens; ++t) {
             promptCtx.tokens.push_back(batch.at(t));
             promptCtx.n_past += 1;
             Token tok = batch.at(t);
-            bool res = isResponse ? responseCallback(tok, tokenToString(tok)) : promptCallback(tok);
+            std::string piece;
+            if (isResponse)
+                piece = timedTokenToString(promptCtx.timings, tok);
+            bool res;
+            {
+                PhaseTimer timer(promptCtx.timings.t_callback_us);
+                res = isResponse ? responseCallback(tok, piece) : promptCallback(tok);
+            }
+            promptCtx.timings.n_callback++;
             if (!res)
                 return false;
         }
@@ -228,13 +369,60 @@ static std::string::size_type stringsOverlap(const std::string &s, const std::st
     return std::string::npos;
 }
 
+static const char *stopSequences[] {
+    "### Instruction", "### Prompt", "### Response", "### Human", "### Assistant", "### Context",
+};
+
+/*
+ * Check the newest token of a response for EOS and stop sequences. Returns true if generation
+ * should stop, and sets lengthLimit to the number of bytes of cachedResponse that may be sent,
+ * or std::string::npos if there is no limit.
+ */
+bool LLModel::checkStop(Token tok, const std::string &piece, const std::string &cachedResponse,
+                        std::string::size_type &lengthLimit) const
+{
+    bool stop = false;
+
+    // Check for EOS
+    lengthLimit = std::string::npos;
+    for (const auto token : endTokens()) {
+        if (tok == token) {
+            stop = true;
+            lengthLimit = cachedResponse.size() - piece.size();
+        }
+    }
+
+    if (lengthLimit != std::string::npos) {
+        // EOS matched
+    } else if (!isSpecialToken(tok)) {
+        // Check if the response contains a stop sequence
+        for (const auto &p : stopSequences) {
+            auto match = cachedResponse.find(p);
+            if (match != std::string::npos) stop = true;
+            lengthLimit = std::min(lengthLimit, match);
+            if (match == 0) break;
+        }
+
+        // Check if the response matches the start of a stop sequence
+        if (lengthLimit == std::string::npos) {
+            for (const auto &p : stopSequences) {
+                auto match = stringsOverlap(cachedResponse, p);
+                lengthLimit = std::min(lengthLimit, match);
+                if (match == 0) break;
+            }
+        }
+    } else if (ranges::find(stopSequences, piece) < std::end(stopSequences)) {
+        // Special tokens must exactly match a stop sequence
+        stop = true;
+        lengthLimit = cachedResponse.size() - piece.size();
+    }
+
+    return stop;
+}
+
 void LLModel::generateResponse(std::function<bool(int32_t, const std::string&)> responseCallback,
                                bool allowContextShift,
                                PromptContext &promptCtx) {
-    static const char *stopSequences[] {
-        "### Instruction", "### Prompt", "### Response", "### Human", "### Assistant", "### Context",
-    };
-
     // Don't even start if there is no room
     if (!promptCtx.n_predict)
         return;
@@ -250,9 +438,20 @@ void LLModel::generateResponse(std::function<bool(int32_t, const std::string&)>
 
     // Predict next tokens
     for (bool stop = false; !stop;) {
+        // tokens held back for a possible stop sequence are dropped below, like when the response ends
+        if (promptCtx.pastDeadline()) {
+            promptCtx.deadlineExceeded = true;
+            break;
+        }
+
         // Sample next token
-        std::optional<Token> new_tok = sampleToken(promptCtx);
-        std::string new_piece = tokenToString(new_tok.value());
+        std::optional<Token> new_tok;
+        {
+            PhaseTimer timer(promptCtx.timings.t_sample_us);
+            new_tok = sampleToken(promptCtx);
+        }
+        promptCtx.timings.n_sample++;
+        std::string new_piece = timedTokenToString(promptCtx.timings, new_tok.value());
         cachedTokens.push_back(new_tok.value());
         cachedResponse += new_piece;
 
@@ -261,13 +460,18 @@ void LLModel::generateResponse(std::function<bool(int32_t, const std::string&)>
             if (promptCtx.n_past >= promptCtx.n_ctx) {
                 (void)allowContextShift;
                 assert(allowContextShift);
-                shiftContext(promptCtx);
+                timedShiftContext(promptCtx);
                 assert(promptCtx.n_past < promptCtx.n_ctx);
             }
 
             // Accept the token
             Token tok = std::exchange(new_tok, std::nullopt).value();
-            if (!evalTokens(promptCtx, { tok })) {
+            bool ok;
+            {
+                PhaseTimer timer(promptCtx.timings.t_gen_eval_us);
+                ok = evalTokens(promptCtx, { tok });
+            }
+            if (!ok) {
                 // TODO(jared): raise an exception
                 std::cerr << implementation().modelType() << " ERROR: Failed to predict next token\n";
                 return false;
@@ -275,41 +479,14 @@ void LLModel::generateResponse(std::function<bool(int32_t, const std::string&)>
 
             promptCtx.tokens.push_back(tok);
             promptCtx.n_past += 1;
+            promptCtx.timings.n_gen_tokens++;
             return true;
         };
 
-        // Check for EOS
-        auto lengthLimit = std::string::npos;
-        for (const auto token : endTokens()) {
-            if (new_tok == token) {
-                stop = true;
-                lengthLimit = cachedResponse.size() - new_piece.size();
-            }
-        }
-
-        if (lengthLimit != std::string::npos) {
-            // EOS matched
-        } else if (!isSpecialToken(new_tok.value())) {
-            // Check if the response contains a stop sequence
-            for (const auto &p : stopSequences) {
-                auto match = cachedResponse.find(p);
-                if (match != std::string::npos) stop = true;
-                lengthLimit = std::min(lengthLimit, match);
-                if (match == 0) break;
-            }
-
-            // Check if the response matches the start of a stop sequence
-            if (lengthLimit == std::string::npos) {
-                for (const auto &p : stopSequences) {
-                    auto match = stringsOverlap(cachedResponse, p);
-                    lengthLimit = std::min(lengthLimit, match);
-                    if (match == 0) break;
-                }
-            }
-        } else if (ranges::find(stopSequences, new_piece) < std::end(stopSequences)) {
-            // Special tokens must exactly match a stop sequence
-            stop = true;
-            lengthLimit = cachedResponse.size() - new_piece.size();
+        std::string::size_type lengthLimit;
+        {
+            PhaseTimer timer(promptCtx.timings.t_stop_check_us);
+            stop = checkStop(new_tok.value(), new_piece, cachedResponse, lengthLimit);
         }
 
         // Optionally stop if the context will run out
@@ -323,7 +500,7 @@ void LLModel::generateResponse(std::function<bool(int32_t, const std::string&)>
         std::string::size_type responseLength = 0;
         while (!cachedTokens.empty()) {
             Token tok = cachedTokens.front();
-            std::string piece = tokenToString(tok);
+            std::string piece = timedTokenToString(promptCtx.timings, tok);
 
             // Stop if the piece (or part of it) does not fit within the length limit
             if (responseLength + (stop ? 1 : piece.size()) > lengthLimit)
@@ -339,7 +516,13 @@ void LLModel::generateResponse(std::function<bool(int32_t, const std::string&)>
                 return;
 
             // Send the token
-            if (!responseCallback(tok, piece) || ++n_predicted >= promptCtx.n_predict) {
+            bool res;
+            {
+                PhaseTimer timer(promptCtx.timings.t_callback_us);
+                res = responseCallback(tok, piece);
+            }
+            promptCtx.timings.n_callback++;
+            if (!res || ++n_predicted >= promptCtx.n_predict) {
                 stop = true;
                 break;
             }
@@ -375,6 +558,346 @@ void LLModel::generateResponse(std::function<bool(int32_t, const std::string&)>
     promptCtx.n_past -= cachedTokens.size();
 }
 
+void LLModel::generateChoices(const ChoiceResponseCallback &responseCallback,
+                              int32_t nChoices,
+                              PromptContext &promptCtx) {
+    if (!promptCtx.n_predict)
+        return;
+    if (promptCtx.n_past < 1 || promptCtx.n_past >= promptCtx.n_ctx) {
+        std::cerr << "LLModel Warning: Not enough space, n_past=" << promptCtx.n_past << ", n_ctx=" << promptCtx.n_ctx
+                  << "\n";
+        return;
+    }
+
+    if (maxSequences() < nChoices) {
+        // Fall back to generating the choices one after another. The prompt is still decoded only once: after each
+        // choice, roll back to the end of the prompt and re-decode its last token to recover the logits. Choice 0 is
+        // generated last so that it remains in the context.
+        std::vector<Token> promptTokens = promptCtx.tokens;
+        for (int32_t choice = nChoices - 1; choice >= 0; choice--) {
+            if (choice != nChoices - 1) {
+                promptCtx.tokens.assign(promptTokens.begin(), promptTokens.end() - 1);
+                promptCtx.n_past = promptCtx.tokens.size();
+                if (!evalTokens(promptCtx, { promptTokens.back() })) {
+                    std::cerr << implementation().modelType() << " ERROR: Failed to process prompt\n";
+                    return;
+                }
+                promptCtx.tokens.push_back(promptTokens.back());
+                promptCtx.n_past += 1;
+            }
+            auto choiceResponse = [&responseCallback, choice](int32_t token, const std::string &piece) {
+                return responseCallback(choice, token, piece);
+            };
+            generateResponse(choiceResponse, /*allowContextShift*/ false, promptCtx);
+        }
+        return;
+    }
+
+    // Fork the KV cache of the prompt into one sequence per choice. Choice 0 stays in sequence 0.
+    std::vector<Sequence> choices(nChoices);
+    for (int32_t i = 0; i < nChoices; i++) {
+        auto &c = choices[i];
+        c.id = i;
+        c.ctx = promptCtx;
+        c.hasLogits = true;
+        c.responseCallback = [&responseCallback, i](int32_t token, const std::string &piece) {
+            return responseCallback(i, token, piece);
+        };
+        if (i != 0) {
+            removeSequence(i, 0);
+            copySequence(0, i, promptCtx.n_past);
+        }
+    }
+
+    std::vector<Sequence *> active;
+    active.reserve(nChoices);
+    for (;;) {
+        // KV cache cells are shared by the prompt, so only generated tokens take up additional space
+        int32_t n_cells = promptCtx.n_past;
+        active.clear();
+        for (auto &c : choices) {
+            n_cells += c.ctx.n_past - promptCtx.n_past;
+            if (!c.stopped)
+                active.push_back(&c);
+        }
+        if (active.empty())
+            break;
+        if (n_cells + int32_t(active.size()) > promptCtx.n_ctx) {
+            std::cerr << "LLModel Warning: Not enough space, n_cells=" << n_cells << ", n_ctx=" << promptCtx.n_ctx
+                      << "\n";
+            break;
+        }
+        if (!stepSequences(active, nChoices, promptCtx.timings))
+            break;
+    }
+
+    // Drop the other branches and keep choice 0, minus any tokens that were never sent
+    for (int32_t i = 1; i < nChoices; i++)
+        removeSequence(i, 0);
+
+    for (const auto &c : choices)
+        promptCtx.deadlineExceeded |= c.ctx.deadlineExceeded;
+
+    auto &first = choices.front();
+    finishSequence(first);
+    promptCtx.tokens = std::move(first.ctx.tokens);
+    promptCtx.n_past = promptCtx.tokens.size();
+}
+
+bool LLModel::appendSequencePrompt(Sequence &seq, const std::string &prompt, const std::string &promptTemplate,
+                                   std::optional<std::string_view> fakeReply, bool special)
+{
+    if (!isModelLoaded() || !supportsCompletion()) {
+        std::cerr << implementation().modelType() << " ERROR: this model does not support text completion or chat!\n";
+        return false;
+    }
+
+    seq.ctx.n_ctx = contextLength();
+    if (!seq.pending.empty())
+        m_tokenize_last_token = seq.pending.back();
+    else
+        m_tokenize_last_token = seq.ctx.tokens.empty() ? -1 : seq.ctx.tokens.back();
+
+    std::vector<Token> embd_inp;
+    std::string asstSuffix;
+    std::string err;
+    if (!tokenizeTemplate(prompt, promptTemplate, seq.ctx, special, embd_inp, asstSuffix, err)) {
+        std::cerr << err << "\n";
+        return false;
+    }
+    seq.pending.insert(seq.pending.end(), embd_inp.begin(), embd_inp.end());
+
+    if (fakeReply) {
+        auto tokens = timedTokenize(seq.ctx, *fakeReply, false);
+        seq.pending.insert(seq.pending.end(), tokens.begin(), tokens.end());
+        if (!asstSuffix.empty()) {
+            tokens = timedTokenize(seq.ctx, asstSuffix, true);
+            seq.pending.insert(seq.pending.end(), tokens.begin(), tokens.end());
+        }
+    }
+
+    if (seq.ctx.n_past + int32_t(seq.pending.size()) > seq.ctx.n_ctx - 4) {
+        std::cerr << implementation().modelType() << " ERROR: The prompt is " << seq.pending.size()
+                  << " tokens and the context window is " << seq.ctx.n_ctx << "!\n";
+        return false;
+    }
+    return true;
+}
+
+void LLModel::resetSequence(Sequence &seq, int32_t n_keep, const Sequence *src)
+{
+    const auto &from = src ? src->ctx : seq.ctx;
+    if (n_keep > from.n_past) {
+        std::ostringstream ss;
+        ss << "n_keep=" << n_keep << " is past end of sequence length=" << from.n_past;
+        throw std::out_of_range(ss.str());
+    }
+
+    if (src && src != &seq) {
+        removeSequence(seq.id, 0);
+        if (n_keep)
+            copySequence(src->id, seq.id, n_keep);
+        seq.ctx.tokens.assign(from.tokens.begin(), from.tokens.begin() + n_keep);
+    } else {
+        removeSequence(seq.id, n_keep);
+        seq.ctx.tokens.resize(n_keep);
+    }
+    seq.ctx.n_past = n_keep;
+    seq.ctx.n_ctx = contextLength();
+
+    seq.pending.clear();
+    seq.cachedResponse.clear();
+    seq.cachedTokens.clear();
+    seq.n_predicted = 0;
+    seq.batchIdx = -1;
+    seq.hasLogits = false;
+    seq.stopped = false;
+}
+
+void LLModel::finishSequence(Sequence &seq)
+{
+    // forget the tokens that were decoded but held back from the response
+    auto &tokens = seq.ctx.tokens;
+    assert(tokens.size() >= seq.cachedTokens.size());
+    tokens.erase(tokens.end() - seq.cachedTokens.size(), tokens.end());
+    seq.ctx.n_past -= seq.cachedTokens.size();
+    removeSequence(seq.id, seq.ctx.n_past);
+
+    seq.cachedResponse.clear();
+    seq.cachedTokens.clear();
+    seq.pending.clear();
+    seq.hasLogits = false;
+    seq.stopped = true;
+}
+
+void LLModel::releaseSequence(Sequence &seq)
+{
+    removeSequence(seq.id, 0);
+    seq.ctx.tokens.clear();
+    seq.ctx.n_past = 0;
+    seq.cachedResponse.clear();
+    seq.cachedTokens.clear();
+    seq.pending.clear();
+    seq.hasLogits = false;
+    seq.stopped = true;
+}
+
+// Caches a sampled token and sends as much of the response as cannot be part of a stop sequence. Returns true if
+// the token needs to be decoded.
+bool LLModel::acceptSampledToken(Sequence &seq, Token tok, Timings &timings)
+{
+    std::string new_piece = timedTokenToString(timings, tok);
+    seq.cachedTokens.push_back(tok);
+    seq.cachedResponse += new_piece;
+
+    bool stop;
+    std::string::size_type lengthLimit;
+    {
+        PhaseTimer timer(timings.t_stop_check_us);
+        stop = checkStop(tok, new_piece, seq.cachedResponse, lengthLimit);
+    }
+
+    // Empty the cache, up to the length limit
+    std::string::size_type responseLength = 0;
+    bool sentNewToken = false;
+    while (!seq.cachedTokens.empty()) {
+        Token front = seq.cachedTokens.front();
+        std::string piece = timedTokenToString(timings, front);
+        if (responseLength + (stop ? 1 : piece.size()) > lengthLimit)
+            break;
+
+        seq.cachedTokens.erase(seq.cachedTokens.begin(), seq.cachedTokens.begin() + 1);
+        seq.cachedResponse.erase(seq.cachedResponse.begin(), seq.cachedResponse.begin() + piece.size());
+        sentNewToken = seq.cachedTokens.empty();
+
+        bool res;
+        {
+            PhaseTimer timer(timings.t_callback_us);
+            res = seq.responseCallback(front, piece);
+        }
+        timings.n_callback++;
+        if (!res || ++seq.n_predicted >= seq.ctx.n_predict) {
+            stop = true;
+            break;
+        }
+        responseLength += piece.size();
+    }
+
+    // Decode the token, unless it ended the response without being sent
+    bool decode = !stop || sentNewToken;
+    if (!decode)
+        seq.cachedTokens.pop_back();
+    if (stop)
+        finishSequence(seq);
+    return decode;
+}
+
+bool LLModel::stepSequences(const std::vector<Sequence *> &seqs, int32_t nBatch, Timings &timings)
+{
+    std::vector<SequenceToken> batch;
+    int32_t n_gen = 0;
+
+    // where to roll back each sequence to if decoding fails
+    struct Rollback { Sequence *seq; int32_t n_past; bool cachedNew; };
+    std::vector<Rollback> rollback;
+
+    // Sample the next token of every sequence that has decoded its prompt
+    for (auto *seq : seqs) {
+        if (seq->stopped || !seq->pending.empty())
+            continue;
+        if (!seq->hasLogits) {
+            std::cerr << implementation().modelType() << " ERROR: sequence " << seq->id << " has nothing to decode\n";
+            finishSequence(*seq);
+            continue;
+        }
+        if (seq->n_predicted >= seq->ctx.n_predict || seq->ctx.n_past >= seq->ctx.n_ctx) {
+            finishSequence(*seq);
+            continue;
+        }
+        if (seq->ctx.pastDeadline()) {
+            seq->ctx.deadlineExceeded = true;
+            finishSequence(*seq);
+            continue;
+        }
+
+        Token tok;
+        {
+            PhaseTimer timer(timings.t_sample_us);
+            tok = sampleSequenceToken(seq->ctx, seq->batchIdx);
+        }
+        timings.n_sample++;
+        seq->hasLogits = false;
+        if (!acceptSampledToken(*seq, tok, timings))
+            continue;
+
+        rollback.push_back({ seq, seq->ctx.n_past, !seq->cachedTokens.empty() });
+        seq->batchIdx = batch.size();
+        batch.push_back({ seq->id, seq->ctx.n_past, tok, true });
+        seq->ctx.tokens.push_back(tok);
+        seq->ctx.n_past += 1;
+        seq->hasLogits = true;
+        n_gen++;
+    }
+
+    // Fill the rest of the batch with prompt tokens, computing logits only at the end of each prompt
+    int32_t n_prompt = 0;
+    for (auto *seq : seqs) {
+        int32_t budget = nBatch - int32_t(batch.size());
+        if (budget <= 0)
+            break;
+        if (seq->stopped || seq->pending.empty())
+            continue;
+
+        if (seq->ctx.pastDeadline()) {
+            seq->ctx.deadlineExceeded = true;
+            finishSequence(*seq);
+            continue;
+        }
+
+        int32_t n = std::min(budget, int32_t(seq->pending.size()));
+        bool last = n == int32_t(seq->pending.size());
+        rollback.push_back({ seq, seq->ctx.n_past, false });
+        for (int32_t i = 0; i < n; i++) {
+            Token tok = seq->pending[i];
+            batch.push_back({ seq->id, seq->ctx.n_past, tok, last && i == n - 1 });
+            seq->ctx.tokens.push_back(tok);
+            seq->ctx.n_past += 1;
+        }
+        seq->pending.erase(seq->pending.begin(), seq->pending.begin() + n);
+        if (last) {
+            seq->batchIdx = batch.size() - 1;
+            seq->hasLogits = true;
+        }
+        n_prompt += n;
+    }
+
+    if (batch.empty())
+        return true;
+
+    // a batch with generated tokens counts as generation, even if it finishes some prompts
+    bool ok;
+    {
+        PhaseTimer timer(n_gen ? timings.t_gen_eval_us : timings.t_prompt_eval_us);
+        ok = evalSequences(batch);
+    }
+    if (!ok) {
+        std::cerr << implementation().modelType() << " ERROR: Failed to decode " << batch.size() << " tokens\n";
+        for (auto &r : rollback) {
+            r.seq->ctx.tokens.resize(r.n_past);
+            r.seq->ctx.n_past = r.n_past;
+            if (r.cachedNew)
+                r.seq->cachedTokens.pop_back();
+            finishSequence(*r.seq);
+        }
+        return false;
+    }
+    timings.n_gen_tokens += n_gen;
+    timings.n_prompt_tokens += n_prompt;
+    if (n_prompt)
+        timings.n_prompt_batches++;
+    return true;
+}
+
 void LLModel::embed(
     const std::vector<std::string> &texts, float *embeddings, std::optional<std::string> prefix, int dimensionality,
     size_t *tokenCount, bool doMean, bool atlas, EmbedCancelCallback *cancelCb
@@ -0,0 +1,179 @@
+#include "standinmodel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const char *s_text =
+    " Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore et dolore"
+    " magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo"
+    " consequat. Duis aute irure dolor in reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla"
+    " pariatur. Excepteur sint occaecat cupidatat non proident, sunt in culpa qui officia deserunt mollit anim id est"
+    " laborum.";
+
+} // namespace
+
+StandInModel::StandInModel()
+    : StandInModel(Config())
+{
+}
+
+StandInModel::StandInModel(const Config &config)
+    : m_config(config)
+    , m_response(encode(s_text))
+    , m_cells(std::max(config.maxSequences, 1), 0)
+{
+    static const Implementation implementation("StandIn", "cpu");
+    m_implementation = &implementation;
+}
+
+bool StandInModel::loadModel(const std::string &modelPath, int n_ctx, int ngl)
+{
+    (void)modelPath;
+    (void)ngl;
+    if (n_ctx > 0)
+        m_config.contextLength = n_ctx;
+    std::ranges::fill(m_cells, 0);
+    return true;
+}
+
+size_t StandInModel::requiredMem(const std::string &modelPath, int n_ctx, int ngl)
+{
+    (void)modelPath;
+    (void)n_ctx;
+    (void)ngl;
+    return 0;
+}
+
+// Packs up to three bytes into each token, with the number of bytes in the top byte so that no token is 0.
+std::vector<LLModel::Token> StandInModel::encode(std::string_view str)
+{
+    std::vector<Token> tokens;
+    tokens.reserve((str.size() + 2) / 3);
+    for (size_t i = 0; i < str.size(); i += 3) {
+        size_t n = std::min<size_t>(3, str.size() - i);
+        Token tok = Token(n) << 24;
+        for (size_t j = 0; j < n; j++)
+            tok |= Token(uint8_t(str[i + j])) << (16 - 8 * j);
+        tokens.push_back(tok);
+    }
+    return tokens;
+}
+
+std::vector<LLModel::Token> StandInModel::tokenize(PromptContext &ctx, std::string_view str, bool special)
+{
+    (void)ctx;
+    (void)special;
+    return encode(str);
+}
+
+std::string StandInModel::tokenToString(Token id) const
+{
+    std::string piece;
+    size_t n = size_t(uint32_t(id) >> 24);
+    for (size_t j = 0; j < std::min<size_t>(n, 3); j++)
+        piece += char((id >> (16 - 8 * j)) & 0xFF);
+    return piece;
+}
+
+// The response continues the text from the position in the context, which makes it deterministic.
+LLModel::Token StandInModel::sampleToken(PromptContext &ctx) const
+{
+    return m_response[size_t(ctx.n_past) % m_response.size()];
+}
+
+LLModel::Token StandInModel::sampleSequenceToken(PromptContext &ctx, int32_t batchIdx) const
+{
+    (void)batchIdx;
+    return sampleToken(ctx);
+}
+
+// Takes as long as a real model would to decode the batch, which is spent on the prompt tokens plus one step for
+// the generated tokens.
+void StandInModel::simulateDecode(size_t promptTokens, bool generates) const
+{
+    double secs = 0.0;
+    if (promptTokens && m_config.promptTokensPerSec > 0)
+        secs += double(promptTokens) / m_config.promptTokensPerSec;
+    if (generates && m_config.genTokensPerSec > 0)
+        secs += 1.0 / m_config.genTokensPerSec;
+    if (secs > 0)
+        std::this_thread::sleep_for(std::chrono::duration<double>(secs));
+}
+
+int32_t StandInModel::usedCells(const std::vector<int32_t> &cells)
+{
+    return std::accumulate(cells.begin(), cells.end(), 0);
+}
+
+bool StandInModel::evalTokens(PromptContext &ctx, const std::vector<int32_t> &tokens) const
+{
+    int32_t n_past = ctx.n_past + int32_t(tokens.size());
+    if (n_past > m_config.contextLength) {
+        std::cerr << "StandInModel ERROR: n_past=" << n_past << " is past the context length "
+                  << m_config.contextLength << "\n";
+        return false;
+    }
+
+    // a single token is decoded like the next token of a response
+    simulateDecode(tokens.size() == 1 ? 0 : tokens.size(), tokens.size() == 1);
+    m_cells[0] = n_past;
+    return true;
+}
+
+void StandInModel::shiftContext(PromptContext &promptCtx)
+{
+    int32_t n_discard = std::min(promptCtx.n_past, int32_t(promptCtx.n_ctx * promptCtx.contextErase));
+    if (n_discard <= 0)
+        return;
+    promptCtx.tokens.erase(promptCtx.tokens.begin(), promptCtx.tokens.begin() + n_discard);
+    promptCtx.n_past = promptCtx.tokens.size();
+    m_cells[0] = promptCtx.n_past;
+}
+
+void StandInModel::copySequence(int32_t srcSeq, int32_t dstSeq, int32_t n_past)
+{
+    m_cells.at(dstSeq) = std::min(n_past, m_cells.at(srcSeq));
+}
+
+void StandInModel::removeSequence(int32_t seq, int32_t p0)
+{
+    m_cells.at(seq) = std::min(m_cells.at(seq), std::max(p0, 0));
+}
+
+bool StandInModel::evalSequences(const std::vector<SequenceToken> &tokens) const
+{
+    std::vector<int32_t> cells = m_cells;
+    std::vector<int32_t> counts(cells.size(), 0);
+    for (const auto &t : tokens) {
+        if (t.seq < 0 || t.seq >= int32_t(cells.size()))
+            return false;
+        cells[t.seq] = std::max(cells[t.seq], t.pos + 1);
+        counts[t.seq]++;
+    }
+    // like the KV cache, fail without changes if the tokens do not fit
+    if (usedCells(cells) > m_config.contextLength)
+        return false;
+
+    // a sequence with a single token in the batch is generating, and the others are decoding their prompt
+    size_t promptTokens = 0;
+    bool generates = false;
+    for (int32_t n : counts) {
+        if (n == 1)
+            generates = true;
+        else
+            promptTokens += n;
+    }
+    simulateDecode(promptTokens, generates);
+    m_cells = std::move(cells);
+    return true;
+}
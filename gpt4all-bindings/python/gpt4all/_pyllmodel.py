@@ -131,6 +131,28 @@ class LLModelGPUDevice(ctypes.Structure):
         ("vendor", ctypes.c_char_p),
     ]
 
+class LLModelTimings(ctypes.Structure):
+    _fields_ = [
+        ("t_tokenize_us", ctypes.c_int64),
+        ("t_prompt_eval_us", ctypes.c_int64),
+        ("t_sample_us", ctypes.c_int64),
+        ("t_gen_eval_us", ctypes.c_int64),
+        ("t_detokenize_us", ctypes.c_int64),
+        ("t_stop_check_us", ctypes.c_int64),
+        ("t_callback_us", ctypes.c_int64),
+        ("t_context_shift_us", ctypes.c_int64),
+        ("t_total_us", ctypes.c_int64),
+        ("n_tokenize", ctypes.c_int32),
+        ("n_prompt_tokens", ctypes.c_int32),
+        ("n_prompt_batches", ctypes.c_int32),
+        ("n_sample", ctypes.c_int32),
+        ("n_gen_tokens", ctypes.c_int32),
+        ("n_detokenize", ctypes.c_int32),
+        ("n_callback", ctypes.c_int32),
+        ("n_context_shift", ctypes.c_int32),
+        ("n_tokens_discarded", ctypes.c_int32),
+    ]
+
 # Define C function signatures using ctypes
 llmodel.llmodel_model_create.argtypes = [ctypes.c_char_p]
 llmodel.llmodel_model_create.restype = ctypes.c_void_p
@@ -207,6 +229,9 @@ llmodel.llmodel_gpu_init_gpu_device_by_struct.restype = ctypes.c_bool
 llmodel.llmodel_gpu_init_gpu_device_by_int.argtypes = [ctypes.c_void_p, ctypes.c_int32]
 llmodel.llmodel_gpu_init_gpu_device_by_int.restype = ctypes.c_bool
 
+llmodel.llmodel_get_timings.argtypes = [ctypes.c_void_p, ctypes.POINTER(LLModelTimings)]
+llmodel.llmodel_get_timings.restype = None
+
 llmodel.llmodel_model_backend_name.argtypes = [ctypes.c_void_p]
 llmodel.llmodel_model_backend_name.restype = ctypes.c_char_p
 
@@ -303,6 +328,14 @@ class LLModel:
         dev = llmodel.llmodel_model_gpu_device_name(self.model)
         return None if dev is None else dev.decode()
 
+    @property
+    def timings(self) -> dict[str, int]:
+        if self.model is None:
+            self._raise_closed()
+        timings = LLModelTimings()
+        llmodel.llmodel_get_timings(self.model, ctypes.byref(timings))
+        return {name: getattr(timings, name) for name, _ in LLModelTimings._fields_}
+
     @staticmethod
     def list_gpus(mem_required: int = 0) -> list[str]:
         """
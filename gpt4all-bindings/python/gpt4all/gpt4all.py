@@ -263,6 +263,15 @@ class GPT4All:
         """The name of the GPU device currently in use, or None for backends other than Kompute or CUDA."""
         return self.model.device
 
+    @property
+    def timings(self) -> dict[str, int]:
+        """
+        Per-phase statistics for the most recent call to the model, as reported by the backend.
+
+        Durations (keys starting with "t_") are in microseconds; counts start with "n_".
+        """
+        return self.model.timings
+
     @property
     def current_chat_session(self) -> list[MessageType] | None:
         return None if self._history is None else list(self._history)
@@ -8,6 +8,7 @@ Napi::Function NodeModelWrapper::GetClass(Napi::Env env)
                                        InstanceMethod("isModelLoaded", &NodeModelWrapper::IsModelLoaded),
                                        InstanceMethod("name", &NodeModelWrapper::GetName),
                                        InstanceMethod("stateSize", &NodeModelWrapper::StateSize),
+                                       InstanceMethod("timings", &NodeModelWrapper::GetTimings),
                                        InstanceMethod("infer", &NodeModelWrapper::Infer),
                                        InstanceMethod("setThreadCount", &NodeModelWrapper::SetThreadCount),
                                        InstanceMethod("embed", &NodeModelWrapper::GenerateEmbedding),
@@ -191,6 +192,37 @@ Napi::Value NodeModelWrapper::StateSize(const Napi::CallbackInfo &info)
     return Napi::Number::New(info.Env(), static_cast<int64_t>(llmodel_get_state_size(GetInference())));
 }
 
+Napi::Value NodeModelWrapper::GetTimings(const Napi::CallbackInfo &info)
+{
+    auto env = info.Env();
+    llmodel_timings timings;
+    {
+        std::lock_guard<std::mutex> lock(inference_mutex);
+        llmodel_get_timings(GetInference(), &timings);
+    }
+
+    auto result = Napi::Object::New(env);
+    result["tokenizeUs"] = Napi::Number::New(env, timings.t_tokenize_us);
+    result["promptEvalUs"] = Napi::Number::New(env, timings.t_prompt_eval_us);
+    result["sampleUs"] = Napi::Number::New(env, timings.t_sample_us);
+    result["genEvalUs"] = Napi::Number::New(env, timings.t_gen_eval_us);
+    result["detokenizeUs"] = Napi::Number::New(env, timings.t_detokenize_us);
+    result["stopCheckUs"] = Napi::Number::New(env, timings.t_stop_check_us);
+    result["callbackUs"] = Napi::Number::New(env, timings.t_callback_us);
+    result["contextShiftUs"] = Napi::Number::New(env, timings.t_context_shift_us);
+    result["totalUs"] = Napi::Number::New(env, timings.t_total_us);
+    result["nTokenize"] = Napi::Number::New(env, timings.n_tokenize);
+    result["nPromptTokens"] = Napi::Number::New(env, timings.n_prompt_tokens);
+    result["nPromptBatches"] = Napi::Number::New(env, timings.n_prompt_batches);
+    result["nSample"] = Napi::Number::New(env, timings.n_sample);
+    result["nGenTokens"] = Napi::Number::New(env, timings.n_gen_tokens);
+    result["nDetokenize"] = Napi::Number::New(env, timings.n_detokenize);
+    result["nCallback"] = Napi::Number::New(env, timings.n_callback);
+    result["nContextShift"] = Napi::Number::New(env, timings.n_context_shift);
+    result["nTokensDiscarded"] = Napi::Number::New(env, timings.n_tokens_discarded);
+    return result;
+}
+
 Napi::Array ChunkedFloatPtr(float *embedding_ptr, int embedding_size, int text_len, Napi::Env const &env)
 {
     auto n_embd = embedding_size / text_len;
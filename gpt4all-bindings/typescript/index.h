@@ -20,6 +20,7 @@ class NodeModelWrapper : public Napi::ObjectWrap<NodeModelWrapper>
     Napi::Value GetType(const Napi::CallbackInfo &info);
     Napi::Value IsModelLoaded(const Napi::CallbackInfo &info);
     Napi::Value StateSize(const Napi::CallbackInfo &info);
+    Napi::Value GetTimings(const Napi::CallbackInfo &info);
     // void Finalize(Napi::Env env) override;
     /**
      * Prompting the model. This entails spawning a new thread and adding the response tokens
@@ -260,6 +260,49 @@ interface LLModelInferenceResult {
     nPast: number;
 }
 
+/**
+ * Per-phase statistics of the last LLModel.infer call.
+ * Durations are in microseconds, measured with a monotonic clock.
+ */
+interface LLModelTimings {
+    /** Time spent tokenizing the prompt template and input. */
+    tokenizeUs: number;
+    /** Time spent decoding the prompt in batches. */
+    promptEvalUs: number;
+    /** Time spent sampling new tokens. */
+    sampleUs: number;
+    /** Time spent decoding sampled tokens. */
+    genEvalUs: number;
+    /** Time spent converting tokens to text. */
+    detokenizeUs: number;
+    /** Time spent matching EOS tokens and stop sequences. */
+    stopCheckUs: number;
+    /** Time spent in the prompt and response callbacks. */
+    callbackUs: number;
+    /** Time spent shifting the context window when it was full. */
+    contextShiftUs: number;
+    /** Total duration of the call. */
+    totalUs: number;
+    /** Number of tokenizer calls. */
+    nTokenize: number;
+    /** Number of prompt tokens decoded. */
+    nPromptTokens: number;
+    /** Number of prompt batches decoded. */
+    nPromptBatches: number;
+    /** Number of tokens sampled. */
+    nSample: number;
+    /** Number of generated tokens decoded. */
+    nGenTokens: number;
+    /** Number of tokens converted to text. */
+    nDetokenize: number;
+    /** Number of callback invocations. */
+    nCallback: number;
+    /** Number of context shifts. */
+    nContextShift: number;
+    /** Number of tokens removed from the context by context shifts. */
+    nTokensDiscarded: number;
+}
+
 interface LLModelInferenceOptions extends Partial<LLModelPromptContext> {
     /** Callback for response tokens, called for each generated token.
      * @param {number} tokenId The token id.
@@ -299,6 +342,12 @@ declare class LLModel {
      */
     stateSize(): number;
 
+    /**
+     * Get the per-phase timings and counts of the most recent inference call.
+     * @returns {LLModelTimings} The statistics of the last call to infer.
+     */
+    timings(): LLModelTimings;
+
     /**
      * Get the number of threads used for model inference.
      * The default is the number of physical cores your computer has.
@@ -826,6 +875,7 @@ interface DownloadController {
 export {
     LLModel,
     LLModelPromptContext,
+    LLModelTimings,
     ModelConfig,
     InferenceModel,
     InferenceResult,
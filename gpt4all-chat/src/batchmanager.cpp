@@ -0,0 +1,338 @@
+#include "batchmanager.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QIODevice>
+#include <QJsonDocument>
+#include <QJsonParseError>
+#include <QJsonValue>
+#include <QMetaObject>
+#include <QStandardPaths>
+#include <QTimer>
+#include <QUuid>
+#include <Qt>
+#include <QtLogging>
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace ranges = std::ranges;
+using namespace Qt::Literals::StringLiterals;
+
+
+BatchManager::BatchManager(WorkerPool *workers, Preparer preparer, QObject *parent)
+    : QObject(parent)
+    , m_workers(workers)
+    , m_preparer(std::move(preparer))
+{
+}
+
+QString BatchManager::directory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + u"/batches"_s;
+}
+
+QString BatchManager::inputDirectory()
+{
+    return directory() + u"/input"_s;
+}
+
+QJsonObject BatchManager::create(const QByteArray &input, const QString &inputName, QString *error)
+{
+    pruneFinished();
+
+    auto batch = std::make_shared<Batch>();
+    batch->id        = u"batch_"_s + QUuid::createUuid().toString(QUuid::Id128);
+    batch->inputName = inputName;
+    batch->createdAt = QDateTime::currentSecsSinceEpoch();
+
+    QDir dir(directory());
+    dir.mkpath(u"."_s);
+    batch->output.setFileName(dir.filePath(batch->id + u".jsonl"_s));
+    if (!batch->output.open(QIODevice::WriteOnly | QIODevice::NewOnly)) {
+        *error = u"could not create the output file %1: %2"_s.arg(batch->output.fileName(),
+                                                                   batch->output.errorString());
+        return {};
+    }
+
+    qint64 index = 0;
+    for (const QByteArray &rawLine : input.split('\n')) {
+        const QByteArray line = rawLine.trimmed();
+        if (line.isEmpty())
+            continue;
+
+        const qint64 i = index++;
+        batch->total++;
+        QString customId;
+        // invalid requests fail on their own, like the ones that fail while running
+        auto invalid = [&batch, &customId, i](const QString &message) {
+            writeResult(*batch, i, customId, QJsonValue::Null, QJsonObject {
+                { "code",    "invalid_request" },
+                { "message", message           },
+            });
+            batch->failed++;
+        };
+
+        QJsonParseError err;
+        const QJsonDocument document = QJsonDocument::fromJson(line, &err);
+        if (err.error || !document.isObject()) {
+            invalid(u"error parsing request JSON: %1"_s.arg(err.error ? err.errorString() : u"not an object"_s));
+            continue;
+        }
+        const QJsonObject object = document.object();
+        customId = object.value("custom_id").toString();
+
+        if (object.contains("method") && object.value("method").toString() != u"POST"_s) {
+            invalid(u"'method' must be 'POST'"_s);
+            continue;
+        }
+        if (QString url = object.value("url").toString(u"/v1/completions"_s); url != u"/v1/completions"_s) {
+            invalid(u"'%1' is not supported in batches, only '/v1/completions' is"_s.arg(url));
+            continue;
+        }
+        if (!object.value("body").isObject()) {
+            invalid(u"'body' must be an object"_s);
+            continue;
+        }
+
+        try {
+            batch->items.push_back({ i, customId, m_preparer(object.value("body").toObject()) });
+        } catch (const std::invalid_argument &e) {
+            invalid(QString::fromUtf8(e.what()));
+        }
+    }
+
+    order(batch->items);
+    m_batches.push_back(batch);
+    finishIfDone(*batch);
+    submitPending();
+    return toJson(*batch);
+}
+
+static qsizetype commonPrefix(const QString &a, const QString &b)
+{
+    return ranges::mismatch(a, b).in1 - a.begin();
+}
+
+void BatchManager::order(std::vector<Item> &items)
+{
+    auto model  = [](const Item &item) { return item.prepared.job->modelInfo.id(); };
+    auto prompt = [](const Item &item) -> const QString & { return item.prepared.job->prompt; };
+
+    // lexicographic order puts the prompts that share a prefix next to each other
+    ranges::sort(items, [&](const Item &a, const Item &b) {
+        if (int cmp = model(a).compare(model(b)))
+            return cmp < 0;
+        return prompt(a) < prompt(b);
+    });
+
+    struct Group {
+        size_t begin, end;
+        double length; // average, in characters
+    };
+    std::vector<Group> groups;
+    for (size_t i = 0; i < items.size(); i++) {
+        bool joins = !groups.empty() && model(items[i]) == model(items[i - 1])
+                  && commonPrefix(prompt(items[i]), prompt(items[i - 1])) >= s_minSharedPrefix;
+        if (!joins)
+            groups.push_back({ i, i, 0.0 });
+        groups.back().end = i + 1;
+        groups.back().length += prompt(items[i]).size();
+    }
+    for (auto &group : groups)
+        group.length /= double(group.end - group.begin);
+
+    ranges::stable_sort(groups, [&](const Group &a, const Group &b) {
+        if (int cmp = model(items[a.begin]).compare(model(items[b.begin])))
+            return cmp < 0;
+        return a.length < b.length;
+    });
+
+    std::vector<Item> ordered;
+    ordered.reserve(items.size());
+    for (const auto &group : groups) {
+        for (size_t i = group.begin; i < group.end; i++)
+            ordered.push_back(std::move(items[i]));
+    }
+    items = std::move(ordered);
+}
+
+void BatchManager::submitPending()
+{
+    for (auto &batch : m_batches) {
+        while (batch->status == Status::InProgress && batch->next < batch->items.size()) {
+            if (m_running >= m_workers->maxSlots())
+                return;
+
+            auto &item = batch->items[batch->next];
+            auto job = item.prepared.job;
+            job->onResponse = [batch = batch.get()](int32_t choice, const std::string &piece) {
+                (void)choice;
+                (void)piece;
+                return batch->status == Status::InProgress;
+            };
+            job->onFinished = [this, batch, index = item.index, customId = item.customId,
+                               respond = item.prepared.respond]
+                              (const GenerationResult &result) {
+                batch->running--;
+                m_running--;
+                // the results of a cancelled batch are incomplete, so they are left out
+                if (batch->status == Status::InProgress) {
+                    if (result.error) {
+                        const char *code = result.timedOut      ? "timeout"
+                                         : result.internalError ? "server_error"
+                                                                : "invalid_request";
+                        writeResult(*batch, index, customId, QJsonValue::Null, QJsonObject {
+                            { "code",    code          },
+                            { "message", *result.error },
+                        });
+                        batch->failed++;
+                    } else {
+                        writeResult(*batch, index, customId, QJsonObject {
+                            { "status_code", 200             },
+                            { "body",        respond(result) },
+                        }, QJsonValue::Null);
+                        batch->completed++;
+                    }
+                }
+                finishIfDone(*batch);
+                // not while the scheduler is calling back
+                QMetaObject::invokeMethod(this, &BatchManager::submitPending, Qt::QueuedConnection);
+            };
+
+            if (!m_workers->submit(job)) {
+                // busy with other requests, try again when one of ours is done or after a while
+                if (!m_running && !std::exchange(m_retryQueued, true)) {
+                    QTimer::singleShot(s_retryMs, this, [this] {
+                        m_retryQueued = false;
+                        submitPending();
+                    });
+                }
+                return;
+            }
+            item.prepared = {};
+            batch->next++;
+            batch->running++;
+            m_running++;
+        }
+    }
+}
+
+void BatchManager::finishIfDone(Batch &batch)
+{
+    if (batch.running)
+        return;
+    if (batch.status == Status::Cancelling)
+        batch.status = Status::Cancelled;
+    else if (batch.status == Status::InProgress && batch.next == batch.items.size())
+        batch.status = Status::Completed;
+    else
+        return;
+
+    batch.endedAt = QDateTime::currentSecsSinceEpoch();
+    batch.output.close();
+    batch.items = {};
+}
+
+// Removes the oldest finished batches and their results beyond s_maxFinished.
+void BatchManager::pruneFinished()
+{
+    auto finished = [](const auto &batch) {
+        return batch->status == Status::Completed || batch->status == Status::Cancelled;
+    };
+    auto excess = qsizetype(ranges::count_if(m_batches, finished)) - qsizetype(s_maxFinished);
+    for (auto it = m_batches.begin(); excess > 0 && it != m_batches.end();) {
+        if (!finished(*it)) {
+            ++it;
+            continue;
+        }
+        (*it)->output.remove();
+        it = m_batches.erase(it);
+        excess--;
+    }
+}
+
+void BatchManager::writeResult(Batch &batch, qint64 index, const QString &customId, const QJsonValue &response,
+                               const QJsonValue &error)
+{
+    QJsonObject result {
+        { "id",        u"%1_req_%2"_s.arg(batch.id).arg(index)                    },
+        { "custom_id", customId.isEmpty() ? QJsonValue::Null : QJsonValue(customId) },
+        { "response",  response                                                   },
+        { "error",     error                                                      },
+    };
+    if (batch.output.write(QJsonDocument(result).toJson(QJsonDocument::Compact) + '\n') < 0)
+        qWarning() << "ERROR: Unable to write the result of" << batch.id << ":" << batch.output.errorString();
+}
+
+QJsonObject BatchManager::toJson(const Batch &batch)
+{
+    static const char *statusNames[] { "in_progress", "cancelling", "completed", "cancelled" };
+    auto endedAt = [&batch](Status status) {
+        return batch.status == status ? QJsonValue(batch.endedAt) : QJsonValue(QJsonValue::Null);
+    };
+
+    return {
+        { "id",           batch.id                                                                   },
+        { "object",       "batch"                                                                    },
+        { "endpoint",     "/v1/completions"                                                          },
+        { "input_file",   batch.inputName.isEmpty() ? QJsonValue::Null : QJsonValue(batch.inputName) },
+        { "output_file",  batch.output.fileName()                                                    },
+        { "status",       statusNames[int(batch.status)]                                             },
+        { "created_at",   batch.createdAt                                                            },
+        { "completed_at", endedAt(Status::Completed)                                                 },
+        { "cancelled_at", endedAt(Status::Cancelled)                                                 },
+        { "request_counts", QJsonObject {
+            { "total",     batch.total     },
+            { "completed", batch.completed },
+            { "failed",    batch.failed    },
+        }},
+    };
+}
+
+QList<QJsonObject> BatchManager::list() const
+{
+    QList<QJsonObject> batches;
+    for (const auto &batch : m_batches)
+        batches.append(toJson(*batch));
+    return batches;
+}
+
+std::optional<QJsonObject> BatchManager::status(const QString &id) const
+{
+    auto it = ranges::find(m_batches, id, [](const auto &batch) { return batch->id; });
+    if (it == m_batches.end())
+        return std::nullopt;
+    return toJson(**it);
+}
+
+std::optional<QJsonObject> BatchManager::cancel(const QString &id)
+{
+    auto it = ranges::find(m_batches, id, [](const auto &batch) { return batch->id; });
+    if (it == m_batches.end())
+        return std::nullopt;
+
+    auto &batch = **it;
+    if (batch.status == Status::InProgress) {
+        batch.status = Status::Cancelling;
+        finishIfDone(batch);
+    }
+    return toJson(batch);
+}
+
+std::optional<QByteArray> BatchManager::output(const QString &id)
+{
+    auto it = ranges::find(m_batches, id, [](const auto &batch) { return batch->id; });
+    if (it == m_batches.end())
+        return std::nullopt;
+
+    auto &batch = **it;
+    if (batch.output.isOpen())
+        batch.output.flush();
+    QFile file(batch.output.fileName());
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    return file.readAll();
+}
@@ -0,0 +1,113 @@
+#ifndef BATCHMANAGER_H
+#define BATCHMANAGER_H
+
+#include "scheduler.h"
+#include "workerpool.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QList>
+#include <QObject>
+#include <QString>
+#include <QtGlobal>
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <vector>
+
+/*
+ * Offline batches of /v1/completions requests, read from a JSONL file with one request per line in the format of the
+ * OpenAI batch API. The results are written to an output JSONL file in the directory of the server as they are done,
+ * in no particular order, and matched to their requests by custom_id. Only the last 100 finished batches are kept.
+ *
+ * Batches are run for throughput rather than latency: the requests are ordered by model, so that models are not
+ * unloaded to make room for each other, then requests that share a prefix are grouped, so that they resume from the
+ * prefix cache, and groups of similar length are run together, so that their slots retire at about the same time. A
+ * batch submits at most as many requests as a model has slots, which keeps every slot busy without filling the queue
+ * that interactive requests wait in.
+ */
+class BatchManager : public QObject
+{
+    Q_OBJECT
+
+public:
+    // A validated request of a batch, and how to turn its result into the body of its response.
+    struct Prepared {
+        std::shared_ptr<GenerationJob>                           job;
+        std::function<QJsonObject(const GenerationResult &result)> respond;
+    };
+
+    // Validates the body of a request and prepares its job, whose callbacks are left to the BatchManager. Throws
+    // std::invalid_argument if the request is not valid.
+    using Preparer = std::function<Prepared(const QJsonObject &body)>;
+
+    BatchManager(WorkerPool *workers, Preparer preparer, QObject *parent = nullptr);
+
+    // The directory of the server that the results of the batches are written to, as <batch id>.jsonl.
+    static QString directory();
+    // The directory that input files are read from, so that a request can name only a file the user put there.
+    static QString inputDirectory();
+
+    // Starts a batch of the requests in input. inputName only identifies the input in the batch object. Returns the
+    // batch object, or the error if the output cannot be created.
+    QJsonObject create(const QByteArray &input, const QString &inputName, QString *error);
+
+    QList<QJsonObject> list() const;
+    std::optional<QJsonObject> status(const QString &id) const;
+    // Stops submitting the requests of a batch, and ends the ones that are running.
+    std::optional<QJsonObject> cancel(const QString &id);
+    // The results written so far.
+    std::optional<QByteArray> output(const QString &id);
+
+private:
+    enum class Status {
+        InProgress,
+        Cancelling,
+        Completed,
+        Cancelled,
+    };
+
+    struct Item {
+        qint64   index;    // line of the input file, counting non-empty lines from 0
+        QString  customId;
+        Prepared prepared; // released once submitted
+    };
+
+    struct Batch {
+        QString           id;
+        QString           inputName;
+        QFile             output;
+        Status            status = Status::InProgress;
+        qint64            createdAt = 0;
+        qint64            endedAt = 0;
+        std::vector<Item> items;
+        size_t            next = 0;    // index into items of the next request to submit
+        qint64            total = 0;
+        qint64            completed = 0;
+        qint64            failed = 0;
+        int32_t           running = 0; // requests submitted to the scheduler
+    };
+
+    static constexpr qsizetype s_minSharedPrefix = 64;  // characters two prompts share to be grouped
+    static constexpr int       s_retryMs         = 100; // while the scheduler's queue is full
+    static constexpr size_t    s_maxFinished     = 100; // batches whose results are kept, the oldest are removed
+
+    static void order(std::vector<Item> &items);
+    static QJsonObject toJson(const Batch &batch);
+    static void writeResult(Batch &batch, qint64 index, const QString &customId, const QJsonValue &response,
+                            const QJsonValue &error);
+    void submitPending();
+    void finishIfDone(Batch &batch);
+    void pruneFinished();
+
+    WorkerPool                         *m_workers;
+    Preparer                            m_preparer;
+    std::vector<std::shared_ptr<Batch>> m_batches; // in the order they were created
+    int32_t                             m_running = 0;
+    bool                                m_retryQueued = false;
+};
+
+#endif // BATCHMANAGER_H
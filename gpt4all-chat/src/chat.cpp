@@ -26,7 +26,7 @@ Chat::Chat(QObject *parent)
     , m_chatModel(new ChatModel(this))
     , m_responseState(Chat::ResponseStopped)
     , m_creationDate(QDateTime::currentSecsSinceEpoch())
-    , m_llmodel(new ChatLLM(this))
+    , m_llmodel(new ChatLLM(m_id))
     , m_collectionModel(new LocalDocsCollectionsModel(this))
 {
     connectLLM();
@@ -39,11 +39,16 @@ Chat::Chat(bool isServer, QObject *parent)
     , m_chatModel(new ChatModel(this))
     , m_responseState(Chat::ResponseStopped)
     , m_creationDate(QDateTime::currentSecsSinceEpoch())
-    , m_llmodel(new Server(this))
+    , m_llmodel(new Server(m_id))
     , m_isServer(true)
     , m_collectionModel(new LocalDocsCollectionsModel(this))
 {
     connectLLM();
+
+    auto *server = static_cast<Server *>(m_llmodel);
+    connect(this, &Chat::collectionListChanged, server, &Server::handleCollectionListChanged, Qt::QueuedConnection);
+    connect(server, &Server::requestServerNewPromptResponsePair, this, &Chat::serverNewPromptResponsePair,
+            Qt::BlockingQueuedConnection);
 }
 
 Chat::~Chat()
@@ -71,6 +76,7 @@ void Chat::connectLLM()
     connect(m_llmodel, &ChatLLM::modelInfoChanged, this, &Chat::handleModelInfoChanged, Qt::QueuedConnection);
     connect(m_llmodel, &ChatLLM::trySwitchContextOfLoadedModelCompleted, this, &Chat::handleTrySwitchContextOfLoadedModelCompleted, Qt::QueuedConnection);
 
+    connect(this, &Chat::idChanged, m_llmodel, &ChatLLM::handleChatIdChanged, Qt::QueuedConnection);
     connect(this, &Chat::promptRequested, m_llmodel, &ChatLLM::prompt, Qt::QueuedConnection);
     connect(this, &Chat::modelChangeRequested, m_llmodel, &ChatLLM::modelChangeRequested, Qt::QueuedConnection);
     connect(this, &Chat::loadDefaultModelRequested, m_llmodel, &ChatLLM::loadDefaultModel, Qt::QueuedConnection);
@@ -3,7 +3,6 @@
 #include <gpt4all-backend/llmodel.h>
 
 #include <QCoreApplication>
-#include <QGuiApplication>
 #include <QDebug>
 #include <QJsonArray>
 #include <QJsonDocument>
@@ -208,7 +207,7 @@ void ChatAPIWorker::request(const QString &apiKey,
 #endif
     m_networkManager = new QNetworkAccessManager(this);
     QNetworkReply *reply = m_networkManager->post(request, array);
-    connect(qGuiApp, &QCoreApplication::aboutToQuit, reply, &QNetworkReply::abort);
+    connect(qApp, &QCoreApplication::aboutToQuit, reply, &QNetworkReply::abort);
     connect(reply, &QNetworkReply::finished, this, &ChatAPIWorker::handleFinished);
     connect(reply, &QNetworkReply::readyRead, this, &ChatAPIWorker::handleReadyRead);
     connect(reply, &QNetworkReply::errorOccurred, this, &ChatAPIWorker::handleErrorOccurred);
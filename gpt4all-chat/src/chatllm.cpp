@@ -1,6 +1,5 @@
 #include "chatllm.h"
 
-#include "chat.h"
 #include "chatapi.h"
 #include "localdocs.h"
 #include "mysettings.h"
@@ -98,7 +97,7 @@ void LLModelInfo::resetModel(ChatLLM *cllm, LLModel *model) {
     emit cllm->loadedModelInfoChanged();
 }
 
-ChatLLM::ChatLLM(Chat *parent, bool isServer)
+ChatLLM::ChatLLM(const QString &id, bool isServer)
     : QObject{nullptr}
     , m_promptResponseTokens(0)
     , m_promptTokens(0)
@@ -119,7 +118,6 @@ ChatLLM::ChatLLM(Chat *parent, bool isServer)
         Qt::QueuedConnection); // explicitly queued
     connect(this, &ChatLLM::trySwitchContextRequested, this, &ChatLLM::trySwitchContextOfLoadedModel,
         Qt::QueuedConnection); // explicitly queued
-    connect(parent, &Chat::idChanged, this, &ChatLLM::handleChatIdChanged);
     connect(&m_llmThread, &QThread::started, this, &ChatLLM::handleThreadStarted);
     connect(MySettings::globalInstance(), &MySettings::forceMetalChanged, this, &ChatLLM::handleForceMetalChanged);
     connect(MySettings::globalInstance(), &MySettings::deviceChanged, this, &ChatLLM::handleDeviceChanged);
@@ -128,7 +126,7 @@ ChatLLM::ChatLLM(Chat *parent, bool isServer)
     connect(this, &ChatLLM::requestRetrieveFromDB, LocalDocs::globalInstance()->database(), &Database::retrieveFromDB,
         Qt::BlockingQueuedConnection);
 
-    m_llmThread.setObjectName(parent->id());
+    m_llmThread.setObjectName(id);
     m_llmThread.start();
 }
 
@@ -616,6 +614,8 @@ std::string trim_whitespace(const std::string& input)
 // FIXME(jared): we don't actually have to re-decode the prompt to generate a new response
 void ChatLLM::regenerateResponse()
 {
+    m_regenerating = true;
+
     // ChatGPT uses a different semantic meaning for n_past than local models. For ChatGPT, the meaning
     // of n_past is of the number of prompt/response pairs, rather than for total tokens.
     if (m_llModelType == LLModelType::API_)
@@ -641,6 +641,8 @@ void ChatLLM::resetResponse()
 void ChatLLM::resetContext()
 {
     resetResponse();
+    m_regenerating = false;
+    m_alternatives.clear();
     m_processedSystemPrompt = false;
     m_ctx = LLModel::PromptContext();
 }
@@ -724,6 +726,19 @@ bool ChatLLM::handleResponse(int32_t token, const std::string &response)
     return !m_stopGenerating;
 }
 
+bool ChatLLM::handleChoiceResponse(int32_t choice, int32_t token, const std::string &response)
+{
+    // choice 0 is the one shown to the user
+    if (choice == 0)
+        return handleResponse(token, response);
+
+    if (token < 0)
+        return false;
+
+    m_choiceResponses[choice - 1].append(response);
+    return !m_stopGenerating;
+}
+
 bool ChatLLM::prompt(const QList<QString> &collectionList, const QString &prompt)
 {
     if (m_restoreStateFromText) {
@@ -740,37 +755,82 @@ bool ChatLLM::prompt(const QList<QString> &collectionList, const QString &prompt
     const int32_t n_batch = MySettings::globalInstance()->modelPromptBatchSize(m_modelInfo);
     const float repeat_penalty = MySettings::globalInstance()->modelRepeatPenalty(m_modelInfo);
     const int32_t repeat_penalty_tokens = MySettings::globalInstance()->modelRepeatPenaltyTokens(m_modelInfo);
-    return promptInternal(collectionList, prompt, promptTemplate, n_predict, top_k, top_p, min_p, temp, n_batch,
-        repeat_penalty, repeat_penalty_tokens);
+
+    // With "Regenerate Alternatives" above 1, regenerating produces that many responses at once, sharing a single
+    // decode of the prompt. Later regenerations show the remaining ones without sampling again, as long as the model,
+    // its prompts and its sampling settings are the same. LocalDocs results may change between calls, so this is only
+    // done without collections.
+    const QString alternativesKey = QStringList {
+        m_modelInfo.id(), promptTemplate, MySettings::globalInstance()->modelSystemPrompt(m_modelInfo), prompt,
+        QString::number(n_predict), QString::number(top_k), QString::number(top_p), QString::number(min_p),
+        QString::number(temp), QString::number(repeat_penalty), QString::number(repeat_penalty_tokens),
+    }.join(QChar(0));
+    if (alternativesKey != m_alternativesKey)
+        m_alternatives.clear();
+
+    int32_t n_choices = 1;
+    if (std::exchange(m_regenerating, false) && collectionList.isEmpty()) {
+        if (!m_alternatives.isEmpty()) {
+            auto reply = QString::fromStdString(m_alternatives.takeFirst());
+            return promptInternal(collectionList, prompt, promptTemplate, n_predict, top_k, top_p, min_p, temp,
+                n_batch, repeat_penalty, repeat_penalty_tokens, reply);
+        }
+        n_choices = std::max(MySettings::globalInstance()->regenerateChoices(), 1);
+    }
+    m_alternatives.clear();
+
+    bool ok = promptInternal(collectionList, prompt, promptTemplate, n_predict, top_k, top_p, min_p, temp, n_batch,
+        repeat_penalty, repeat_penalty_tokens, /*fakeReply*/ {}, n_choices);
+    if (ok && !m_stopGenerating) {
+        m_alternativesKey = alternativesKey;
+        for (const auto &response : std::as_const(m_choiceResponses)) {
+            if (!response.empty())
+                m_alternatives << response;
+        }
+    }
+    return ok;
+}
+
+QString ChatLLM::retrieveDocsContext(const QList<QString> &collectionList, const QString &prompt,
+                                     QList<ResultInfo> &databaseResults)
+{
+    if (collectionList.isEmpty())
+        return {};
+
+    const int retrievalSize = MySettings::globalInstance()->localDocsRetrievalSize();
+    emit requestRetrieveFromDB(collectionList, prompt, retrievalSize, &databaseResults); // blocks
+    emit databaseResultsChanged(databaseResults);
+    if (databaseResults.isEmpty())
+        return {};
+
+    QStringList results;
+    for (const ResultInfo &info : databaseResults)
+        results << u"Collection: %1\nPath: %2\nExcerpt: %3"_s.arg(info.collection, info.path, info.text);
+
+    // FIXME(jared): use a Jinja prompt template instead of hardcoded Alpaca-style localdocs template
+    return u"### Context:\n%1\n\n"_s.arg(results.join("\n\n"));
 }
 
 bool ChatLLM::promptInternal(const QList<QString> &collectionList, const QString &prompt, const QString &promptTemplate,
     int32_t n_predict, int32_t top_k, float top_p, float min_p, float temp, int32_t n_batch, float repeat_penalty,
-    int32_t repeat_penalty_tokens, std::optional<QString> fakeReply)
+    int32_t repeat_penalty_tokens, std::optional<QString> fakeReply, int32_t n_choices)
 {
     if (!isModelLoaded())
         return false;
 
+    // remote models and spoofed replies only ever have one choice
+    if (fakeReply || m_llModelType == LLModelType::API_)
+        n_choices = 1;
+    m_choiceResponses = QList<std::string>(n_choices - 1);
+
     if (!m_processedSystemPrompt)
         processSystemPrompt();
 
-    QList<ResultInfo> databaseResults;
-    const int retrievalSize = MySettings::globalInstance()->localDocsRetrievalSize();
-    if (!fakeReply && !collectionList.isEmpty()) {
-        emit requestRetrieveFromDB(collectionList, prompt, retrievalSize, &databaseResults); // blocks
-        emit databaseResultsChanged(databaseResults);
-    }
-
     // Augment the prompt template with the results if any
+    QList<ResultInfo> databaseResults;
     QString docsContext;
-    if (!databaseResults.isEmpty()) {
-        QStringList results;
-        for (const ResultInfo &info : databaseResults)
-            results << u"Collection: %1\nPath: %2\nExcerpt: %3"_s.arg(info.collection, info.path, info.text);
-
-        // FIXME(jared): use a Jinja prompt template instead of hardcoded Alpaca-style localdocs template
-        docsContext = u"### Context:\n%1\n\n"_s.arg(results.join("\n\n"));
-    }
+    if (!fakeReply)
+        docsContext = retrieveDocsContext(collectionList, prompt, databaseResults);
 
     int n_threads = MySettings::globalInstance()->threadCount();
 
@@ -801,9 +861,16 @@ bool ChatLLM::promptInternal(const QList<QString> &collectionList, const QString
                                     /*allowContextShift*/ true, m_ctx);
         m_ctx.n_predict = old_n_predict; // now we are ready for a response
     }
-    m_llModelInfo.model->prompt(prompt.toStdString(), promptTemplate.toStdString(), promptFunc, responseFunc,
-                                /*allowContextShift*/ true, m_ctx, false,
-                                fakeReply.transform(std::mem_fn(&QString::toStdString)));
+    if (n_choices > 1) {
+        auto choiceFunc = std::bind(&ChatLLM::handleChoiceResponse, this, std::placeholders::_1,
+            std::placeholders::_2, std::placeholders::_3);
+        m_llModelInfo.model->promptChoices(prompt.toStdString(), promptTemplate.toStdString(), promptFunc,
+                                           choiceFunc, n_choices, /*allowContextShift*/ true, m_ctx);
+    } else {
+        m_llModelInfo.model->prompt(prompt.toStdString(), promptTemplate.toStdString(), promptFunc, responseFunc,
+                                    /*allowContextShift*/ true, m_ctx, false,
+                                    fakeReply.transform(std::mem_fn(&QString::toStdString)));
+    }
 #if defined(DEBUG)
     printf("\n");
     fflush(stdout);
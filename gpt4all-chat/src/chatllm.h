@@ -89,7 +89,6 @@ private:
     quint32 m_tokens;
 };
 
-class Chat;
 class ChatLLM : public QObject
 {
     Q_OBJECT
@@ -98,7 +97,8 @@ class ChatLLM : public QObject
     Q_PROPERTY(QString device READ device NOTIFY loadedModelInfoChanged)
     Q_PROPERTY(QString fallbackReason READ fallbackReason NOTIFY loadedModelInfoChanged)
 public:
-    ChatLLM(Chat *parent, bool isServer = false);
+    // id names the thread of the model, see handleChatIdChanged
+    explicit ChatLLM(const QString &id, bool isServer = false);
     virtual ~ChatLLM();
 
     void destroy();
@@ -198,9 +198,14 @@ Q_SIGNALS:
 protected:
     bool promptInternal(const QList<QString> &collectionList, const QString &prompt, const QString &promptTemplate,
         int32_t n_predict, int32_t top_k, float top_p, float min_p, float temp, int32_t n_batch, float repeat_penalty,
-        int32_t repeat_penalty_tokens, std::optional<QString> fakeReply = {});
+        int32_t repeat_penalty_tokens, std::optional<QString> fakeReply = {}, int32_t n_choices = 1);
+    // looks up the prompt in the LocalDocs collections, and returns the results formatted as context for it
+    QString retrieveDocsContext(const QList<QString> &collectionList, const QString &prompt,
+                                QList<ResultInfo> &databaseResults);
+    LLModel *llModel() const { return m_llModelInfo.model.get(); }
     bool handlePrompt(int32_t token);
     bool handleResponse(int32_t token, const std::string &response);
+    bool handleChoiceResponse(int32_t choice, int32_t token, const std::string &response);
     bool handleNamePrompt(int32_t token);
     bool handleNameResponse(int32_t token, const std::string &response);
     bool handleSystemPrompt(int32_t token);
@@ -216,6 +221,8 @@ protected:
     LLModel::PromptContext m_ctx;
     quint32 m_promptTokens;
     quint32 m_promptResponseTokens;
+    // responses of choices 1..n-1 from the last promptInternal call, kept as alternatives for regenerating
+    QList<std::string> m_choiceResponses;
 
 private:
     bool loadNewModel(const ModelInfo &modelInfo, QVariantMap &modelLoadProps);
@@ -240,6 +247,11 @@ private:
     bool m_reloadingToChangeVariant;
     bool m_processedSystemPrompt;
     bool m_restoreStateFromText;
+    bool m_regenerating = false;
+    // alternative responses generated together with the current one for regeneration, for the prompt, model and
+    // settings identified by m_alternativesKey
+    QString m_alternativesKey;
+    QList<std::string> m_alternatives;
     // m_pristineLoadedState is set if saveSate is unnecessary, either because:
     // - an unload was queued during LLModel::restoreState()
     // - the chat will be restored from text and hasn't been interacted with yet
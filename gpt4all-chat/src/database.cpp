@@ -1,22 +1,23 @@
 #include "database.h"
 
+#include "documentparser.h"
+#include "embeddingcache.h"
+#include "embeddingindex.h"
+#include "folderwatcher.h"
+#include "metrics.h"
 #include "mysettings.h"
 
-#include <usearch/index_plugins.hpp>
-
 #include <QDebug>
 #include <QDir>
 #include <QDirIterator>
 #include <QElapsedTimer>
 #include <QFile>
-#include <QFileSystemWatcher>
-#include <QIODevice>
-#include <QPdfDocument>
-#include <QPdfSelection>
+#include <QMetaObject>
 #include <QRegularExpression>
+#include <QScopeGuard>
 #include <QSqlError>
 #include <QSqlQuery>
-#include <QTextStream>
+#include <QThreadPool>
 #include <QTimer>
 #include <QVariant>
 #include <Qt>
@@ -24,63 +25,32 @@
 #include <QtLogging>
 
 #include <algorithm>
-#include <cmath>
+#include <atomic>
+#include <functional>
+#include <initializer_list>
 #include <optional>
+#include <ranges>
 #include <utility>
 #include <vector>
 
+#ifdef Q_OS_UNIX
+#   include <sys/stat.h>
+#endif
+
 using namespace Qt::Literals::StringLiterals;
-namespace us = unum::usearch;
 
 //#define DEBUG
 //#define DEBUG_EXAMPLE
 
-namespace {
-
-/* QFile that checks input for binary data. If seen, it fails the read and returns true
- * for binarySeen(). */
-class BinaryDetectingFile: public QFile {
-public:
-    using QFile::QFile;
-
-    bool binarySeen() const { return m_binarySeen; }
-
-protected:
-    qint64 readData(char *data, qint64 maxSize) override {
-        qint64 res = QFile::readData(data, maxSize);
-        return checkData(data, res);
-    }
-
-    qint64 readLineData(char *data, qint64 maxSize) override {
-        qint64 res = QFile::readLineData(data, maxSize);
-        return checkData(data, res);
-    }
-
-private:
-    qint64 checkData(const char *data, qint64 size) {
-        Q_ASSERT(!isTextModeEnabled()); // We need raw bytes from the underlying QFile
-        if (size != -1 && !m_binarySeen) {
-            for (qint64 i = 0; i < size; i++) {
-                /* Control characters we should never see in plain text:
-                 * 0x00 NUL - 0x06 ACK
-                 * 0x0E SO  - 0x1A SUB
-                 * 0x1C FS  - 0x1F US */
-                auto c = static_cast<unsigned char>(data[i]);
-                if (c < 0x07 || (c >= 0x0E && c < 0x1B) || (c >= 0x1C && c < 0x20)) {
-                    m_binarySeen = true;
-                    break;
-                }
-            }
-        }
-        return m_binarySeen ? -1 : size;
-    }
-
-    bool m_binarySeen = false;
-};
-
-} // namespace
-
 static int s_batchSize = 100;
+// Text waiting for embeddings, in bytes, at which scanning pauses until half of it is embedded. Also the most that is
+// sent to the embedding thread at once, so that chunks do not pile up in its event queue.
+static const qint64 s_maxEmbeddingQueueBytes = 4 * 1024 * 1024;
+// Memory the embeddings of the folders searched exhaustively can take, beyond which the least recently searched ones
+// are read from the database again when they are next searched.
+static const qint64 s_maxEmbeddingCacheBytes = 512 * 1024 * 1024;
+// Chunks left without embeddings by an earlier run that are read from the database at a time.
+static const int s_uncompletedPageSize = 1000;
 
 static const QString INIT_DB_SQL[] = {
     // automatically free unused disk space
@@ -146,10 +116,59 @@ static const QString INIT_DB_SQL[] = {
     )"_s,
 };
 
-static const QString INSERT_CHUNK_SQL = uR"(
+// Full-text search of the chunks, for keyword retrieval. Created separately from the other tables so that databases
+// created before it get it too, and so that LocalDocs still works with an SQLite that lacks FTS5. The triggers keep it
+// in sync with every statement that adds or removes chunks.
+static const QString INIT_FTS_SQL[] = {
+    uR"(
+        create virtual table chunks_fts using fts5(
+            chunk_text,
+            content='chunks',
+            content_rowid='id'
+        );
+    )"_s, uR"(
+        create trigger chunks_fts_insert after insert on chunks begin
+            insert into chunks_fts(rowid, chunk_text) values (new.id, new.chunk_text);
+        end;
+    )"_s, uR"(
+        create trigger chunks_fts_delete after delete on chunks begin
+            insert into chunks_fts(chunks_fts, rowid, chunk_text) values ('delete', old.id, old.chunk_text);
+        end;
+    )"_s, uR"(
+        create trigger chunks_fts_update after update of chunk_text on chunks begin
+            insert into chunks_fts(chunks_fts, rowid, chunk_text) values ('delete', old.id, old.chunk_text);
+            insert into chunks_fts(rowid, chunk_text) values (new.id, new.chunk_text);
+        end;
+    )"_s, uR"(
+        insert into chunks_fts(chunks_fts) values ('rebuild');
+    )"_s,
+};
+
+// The size, modification time and inode each document had when it was last indexed, so that a scan of a folder only
+// has to stat its files to tell which of them changed. Created separately from the other tables so that databases
+// created before it get it too. The trigger forgets the state of a document along with the document.
+static const QString INIT_FILE_STATES_SQL[] = {
+    uR"(
+        create table if not exists file_states(
+            document_path text primary key,
+            folder_id integer not null,
+            size integer not null,
+            mtime integer not null,
+            inode integer not null,
+            foreign key(folder_id) references folders(id)
+        );
+    )"_s, uR"(
+        create trigger if not exists file_states_delete after delete on documents begin
+            delete from file_states where document_path = old.document_path;
+        end;
+    )"_s,
+};
+
+// %1 is a row of placeholders for each chunk
+static const QString INSERT_CHUNKS_SQL = uR"(
     insert into chunks(document_id, chunk_text,
         file, title, author, subject, keywords, page, line_from, line_to, words)
-        values(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
+        values %1
         returning id;
     )"_s;
 
@@ -158,7 +177,8 @@ static const QString DELETE_CHUNKS_SQL[] = {
         delete from embeddings
         where chunk_id in (
             select id from chunks where document_id = ?
-        );
+        )
+        returning model, folder_id;
     )"_s, uR"(
         delete from chunks where document_id = ?;
     )"_s,
@@ -178,8 +198,8 @@ static const QString SELECT_CHUNKS_SQL = uR"(
     where c.id in (%1);
 )"_s;
 
-static const QString SELECT_UNCOMPLETED_CHUNKS_SQL = uR"(
-    select co.name, co.embedding_model, c.id, d.folder_id, c.chunk_text
+static const QString COUNT_UNCOMPLETED_CHUNKS_SQL = uR"(
+    select co.name, d.folder_id, count(*)
     from chunks c
     join documents d on d.id = c.document_id
     join folders f on f.id = d.folder_id
@@ -189,7 +209,28 @@ static const QString SELECT_UNCOMPLETED_CHUNKS_SQL = uR"(
         select 1
         from embeddings e
         where e.chunk_id = c.id and e.model = co.embedding_model
-    );
+    )
+    group by co.name, d.folder_id;
+    )"_s;
+
+static const QString SELECT_UNCOMPLETED_CHUNKS_SQL = uR"(
+    select distinct c.id, co.embedding_model, d.folder_id, c.chunk_text
+    from chunks c
+    join documents d on d.id = c.document_id
+    join folders f on f.id = d.folder_id
+    join collection_items ci on ci.folder_id = f.id
+    join collections co on co.id = ci.collection_id and co.embedding_model is not null
+    where (c.id, co.embedding_model) > (?, ?) and c.id <= ? and not exists(
+        select 1
+        from embeddings e
+        where e.chunk_id = c.id and e.model = co.embedding_model
+    )
+    order by c.id, co.embedding_model
+    limit ?;
+    )"_s;
+
+static const QString SELECT_MAX_CHUNK_ID_SQL = uR"(
+    select coalesce(max(id), -1) from chunks;
     )"_s;
 
 static const QString SELECT_COUNT_CHUNKS_SQL = uR"(
@@ -199,37 +240,109 @@ static const QString SELECT_COUNT_CHUNKS_SQL = uR"(
     where d.folder_id = ?;
     )"_s;
 
-static bool addChunk(QSqlQuery &q, int document_id, const QString &chunk_text, const QString &file,
-                     const QString &title, const QString &author, const QString &subject, const QString &keywords,
-                     int page, int from, int to, int words, int *chunk_id)
+// rows inserted by one statement, which keeps their placeholders under the 999 of older SQLite versions
+static const qsizetype s_rowsPerInsert = 64;
+
+// Placeholders for rows of n values, for a multi-row insert.
+static QString valuesPlaceholders(qsizetype rows, int n)
 {
-    if (!q.prepare(INSERT_CHUNK_SQL))
-        return false;
-    q.addBindValue(document_id);
-    q.addBindValue(chunk_text);
-    q.addBindValue(file);
-    q.addBindValue(title);
-    q.addBindValue(author);
-    q.addBindValue(subject);
-    q.addBindValue(keywords);
-    q.addBindValue(page);
-    q.addBindValue(from);
-    q.addBindValue(to);
-    q.addBindValue(words);
-    if (!q.exec() || !q.next())
-        return false;
-    *chunk_id = q.value(0).toInt();
+    QStringList placeholders(n, u"?"_s);
+    const QString row = u"(%1)"_s.arg(placeholders.join(u", "_s));
+    return QStringList(rows, row).join(u", "_s);
+}
+
+// Returns a statement prepared once for the lifetime of the connection, or null with the error in q.
+static QSqlQuery *preparedQuery(std::map<QString, QSqlQuery> &cache, const QSqlDatabase &db, QSqlQuery &q,
+                                const QString &sql)
+{
+    auto it = cache.find(sql);
+    if (it != cache.end())
+        return &it->second;
+
+    QSqlQuery prepared(db);
+    if (!prepared.prepare(sql)) {
+        q = std::move(prepared);
+        return nullptr;
+    }
+    return &cache.emplace(sql, std::move(prepared)).first->second;
+}
+
+// Moves a statement that failed out of the cache into q, for its error.
+static void releaseQuery(std::map<QString, QSqlQuery> &cache, const QString &sql, QSqlQuery &q)
+{
+    auto it = cache.find(sql);
+    q = std::move(it->second);
+    cache.erase(it);
+}
+
+// Inserts the chunks of a document with a statement per 64 of them. Their ids are appended to chunkIds, in order.
+static bool addChunks(std::map<QString, QSqlQuery> &cache, const QSqlDatabase &db, QSqlQuery &q, int document_id,
+                      const QString &file, const QString &title, const QString &author, const QString &subject,
+                      const QString &keywords, int from, int to, const QList<ParsedChunk> &chunks,
+                      QList<int> &chunkIds)
+{
+    for (qsizetype start = 0; start < chunks.size(); start += s_rowsPerInsert) {
+        const qsizetype rows = std::min(s_rowsPerInsert, chunks.size() - start);
+        const QString sql = INSERT_CHUNKS_SQL.arg(valuesPlaceholders(rows, 11));
+        QSqlQuery *insert = preparedQuery(cache, db, q, sql);
+        if (!insert)
+            return false;
+        for (qsizetype i = start; i < start + rows; i++) {
+            const ParsedChunk &chunk = chunks[i];
+            insert->addBindValue(document_id);
+            insert->addBindValue(chunk.text);
+            insert->addBindValue(file);
+            insert->addBindValue(title);
+            insert->addBindValue(author);
+            insert->addBindValue(subject);
+            insert->addBindValue(keywords);
+            insert->addBindValue(chunk.page);
+            insert->addBindValue(from);
+            insert->addBindValue(to);
+            insert->addBindValue(chunk.words);
+        }
+        if (!insert->exec()) {
+            releaseQuery(cache, sql, q);
+            return false;
+        }
+
+        // The order of the rows returned is unspecified, but the ids of one statement increase with the rows.
+        QList<int> ids;
+        ids.reserve(rows);
+        while (insert->next())
+            ids.append(insert->value(0).toInt());
+        insert->finish();
+        if (ids.size() != rows) {
+            releaseQuery(cache, sql, q);
+            return false;
+        }
+        std::ranges::sort(ids);
+        chunkIds.append(ids);
+    }
     return true;
 }
 
-static bool removeChunksByDocumentId(QSqlQuery &q, int document_id)
+// The ids of the removed chunks are appended to removedChunks, for the embedding indexes, and the removed embeddings
+// are counted by (embedding model, folder_id) in removedEmbeddings.
+static bool removeChunksByDocumentId(QSqlQuery &q, int document_id, QList<int> &removedChunks,
+                                     std::map<std::pair<QString, int>, qsizetype> &removedEmbeddings)
 {
+    if (!q.prepare(SELECT_CHUNKS_BY_DOCUMENT_SQL))
+        return false;
+    q.addBindValue(document_id);
+    if (!q.exec())
+        return false;
+    while (q.next())
+        removedChunks.append(q.value(0).toInt());
+
     for (const auto &cmd: DELETE_CHUNKS_SQL) {
         if (!q.prepare(cmd))
             return false;
         q.addBindValue(document_id);
         if (!q.exec())
             return false;
+        while (q.next())
+            removedEmbeddings[{ q.value(0).toString(), q.value(1).toInt() }]++;
     }
     return true;
 }
@@ -242,27 +355,48 @@ static bool removeChunksByDocumentId(QSqlQuery &q, int document_id)
 // struct compared by embedding key, can be extended with additional unique data
 NAMED_PAIR(EmbeddingKey, QString, embedding_model, int, chunk_id)
 
-namespace {
-    struct IncompleteChunk: EmbeddingKey { int folder_id; QString text; };
-} // namespace
+// Counts the chunks without embeddings by (folder_id, collection).
+static bool countUncompletedChunks(QSqlQuery &q, QMap<QPair<int, QString>, int> &counts)
+{
+    if (!q.exec(COUNT_UNCOMPLETED_CHUNKS_SQL))
+        return false;
+    while (q.next())
+        counts.insert({ q.value(1).toInt(), q.value(0).toString() }, q.value(2).toInt());
+    return true;
+}
 
-static bool selectAllUncompletedChunks(QSqlQuery &q, QHash<IncompleteChunk, QStringList> &chunks)
+// Selects up to limit chunks without embeddings, in order of (chunk_id, model), after the given one and up to
+// maxChunkId.
+static bool selectUncompletedChunks(QSqlQuery &q, const std::pair<int, QString> &after, int maxChunkId, int limit,
+                                    QList<EmbeddingChunk> &chunks)
 {
-    if (!q.exec(SELECT_UNCOMPLETED_CHUNKS_SQL))
+    if (!q.prepare(SELECT_UNCOMPLETED_CHUNKS_SQL))
+        return false;
+    q.addBindValue(after.first);
+    q.addBindValue(after.second);
+    q.addBindValue(maxChunkId);
+    q.addBindValue(limit);
+    if (!q.exec())
         return false;
     while (q.next()) {
-        QString collection = q.value(0).toString();
-        IncompleteChunk ic {
-            /*embedding_model =*/ q.value(1).toString(),
-            /*chunk_id        =*/ q.value(2).toInt(),
-            /*folder_id       =*/ q.value(3).toInt(),
-            /*text            =*/ q.value(4).toString(),
-        };
-        chunks[ic] << collection;
+        chunks.append({
+            /*model     =*/ q.value(1).toString(),
+            /*folder_id =*/ q.value(2).toInt(),
+            /*chunk_id  =*/ q.value(0).toInt(),
+            /*chunk     =*/ q.value(3).toString(),
+        });
     }
     return true;
 }
 
+static bool selectMaxChunkId(QSqlQuery &q, int &maxChunkId)
+{
+    if (!q.exec(SELECT_MAX_CHUNK_ID_SQL) || !q.next())
+        return false;
+    maxChunkId = q.value(0).toInt();
+    return true;
+}
+
 static bool selectCountChunks(QSqlQuery &q, int folder_id, int &count)
 {
     if (!q.prepare(SELECT_COUNT_CHUNKS_SQL))
@@ -289,6 +423,50 @@ static bool selectChunk(QSqlQuery &q, const QList<int> &chunk_ids, int retrieval
     return q.exec();
 }
 
+// bm25 is the default rank of FTS5
+static const QString KEYWORD_SEARCH_SQL = uR"(
+    select chunks_fts.rowid
+    from chunks_fts
+    where chunks_fts match ? and exists (
+        select 1
+        from chunks c
+        join documents d on d.id = c.document_id
+        join collection_items ci on ci.folder_id = d.folder_id
+        join collections co on co.id = ci.collection_id
+        where c.id = chunks_fts.rowid and co.name in ('%1')
+    )
+    order by rank
+    limit ?;
+)"_s;
+
+// Finds the chunks that contain any word of the text, best matches first.
+static bool sqlKeywordSearch(QSqlQuery &q, const QList<QString> &collections, const QString &text, int limit,
+                             QList<int> *chunk_ids)
+{
+    constexpr qsizetype MAX_TERMS = 64;
+
+    // quote every word so that nothing in the text is taken for FTS5 syntax
+    static const QRegularExpression wordRegex(uR"(\w+)"_s, QRegularExpression::UseUnicodePropertiesOption);
+    QStringList terms;
+    for (auto it = wordRegex.globalMatch(text); it.hasNext() && terms.size() < MAX_TERMS;) {
+        QString term = u"\"%1\""_s.arg(it.next().captured());
+        if (!terms.contains(term))
+            terms << term;
+    }
+    if (terms.isEmpty())
+        return true;
+
+    if (!q.prepare(KEYWORD_SEARCH_SQL.arg(collections.join("', '"))))
+        return false;
+    q.addBindValue(terms.join(" OR "_L1));
+    q.addBindValue(limit);
+    if (!q.exec())
+        return false;
+    while (q.next())
+        chunk_ids->append(q.value(0).toInt());
+    return true;
+}
+
 static const QString INSERT_COLLECTION_SQL = uR"(
     insert into collections(name, start_update_time, last_update_time, embedding_model)
         values(?, ?, ?, ?)
@@ -670,6 +848,17 @@ static const QString SELECT_ALL_DOCUMENTS_SQL = uR"(
     select id, document_path from documents;
     )"_s;
 
+static const QString SELECT_FILE_STATES_SQL = uR"(
+    select d.id, d.document_path, f.size, f.mtime, f.inode
+    from documents d
+    left join file_states f on f.document_path = d.document_path
+    where d.folder_id = ?;
+    )"_s;
+
+static const QString UPSERT_FILE_STATE_SQL = uR"(
+    insert or replace into file_states(document_path, folder_id, size, mtime, inode) values(?, ?, ?, ?, ?);
+    )"_s;
+
 static const QString SELECT_COUNT_STATISTICS_SQL = uR"(
     select count(distinct d.id), sum(c.words), sum(c.tokens)
     from documents d
@@ -734,6 +923,64 @@ static bool selectDocuments(QSqlQuery &q, int folder_id, QList<int> *documentIds
     return true;
 }
 
+namespace {
+    struct FileState {
+        qint64 size = -1;
+        qint64 mtime = -1; // in ms since the epoch, like document_time
+        qint64 inode = 0;  // 0 where there is none, e.g. on Windows
+
+        bool operator==(const FileState &) const = default;
+    };
+} // namespace
+
+// Returns the state of a file, or nullopt if it cannot be read.
+static std::optional<FileState> fileState(const QString &path)
+{
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if (::stat(QFile::encodeName(path).constData(), &st) == -1)
+        return std::nullopt;
+#   ifdef Q_OS_DARWIN
+    const auto &mtim = st.st_mtimespec;
+#   else
+    const auto &mtim = st.st_mtim;
+#   endif
+    return FileState {
+        qint64(st.st_size),
+        qint64(mtim.tv_sec) * 1000 + mtim.tv_nsec / 1'000'000,
+        qint64(st.st_ino),
+    };
+#else
+    QFileInfo info(path);
+    if (!info.exists())
+        return std::nullopt;
+    return FileState { info.size(), info.fileTime(QFile::FileModificationTime).toMSecsSinceEpoch(), 0 };
+#endif
+}
+
+static bool upsertFileState(QSqlQuery &q, const QString &document_path, int folder_id, const FileState &state)
+{
+    if (!q.prepare(UPSERT_FILE_STATE_SQL))
+        return false;
+    q.addBindValue(document_path);
+    q.addBindValue(folder_id);
+    q.addBindValue(state.size);
+    q.addBindValue(state.mtime);
+    q.addBindValue(state.inode);
+    return q.exec();
+}
+
+// Records the state of a document that is indexed as of document_time.
+static bool recordFileState(QSqlQuery &q, const QString &document_path, int folder_id, qint64 document_time)
+{
+    std::optional<FileState> state = fileState(document_path);
+    if (!state)
+        return true; // removed since, which its folder's next scan finds
+    // if it changed since it was indexed, the time tells the next scan so
+    state->mtime = document_time;
+    return upsertFileState(q, document_path, folder_id, *state);
+}
+
 static bool selectCountStatistics(QSqlQuery &q, int folder_id, int *total_docs, int *total_words, int *total_tokens)
 {
     if (!q.prepare(SELECT_COUNT_STATISTICS_SQL))
@@ -749,25 +996,33 @@ static bool selectCountStatistics(QSqlQuery &q, int folder_id, int *total_docs,
     return true;
 }
 
-// insert embedding only if still needed
-static const QString INSERT_EMBEDDING_SQL = uR"(
+// Inserts the embeddings whose chunk still exists. %1 is a row of placeholders for each (model, folder_id, chunk_id,
+// embedding). Whether the folder still needs embeddings of the model is checked beforehand.
+static const QString INSERT_EMBEDDINGS_SQL = uR"(
     insert into embeddings(model, folder_id, chunk_id, embedding)
-    select :model, d.folder_id, :chunk_id, :embedding
-    from chunks c
-    join documents d on d.id = c.document_id
-    join folders f on f.id = d.folder_id
-    join collection_items ci on ci.folder_id = f.id
-    join collections co on co.id = ci.collection_id
-    where co.embedding_model = :model and c.id = :chunk_id
-    limit 1;
+    select v.column1, v.column2, v.column3, v.column4
+    from (values %1) v
+    join chunks c on c.id = v.column3
+    returning model, chunk_id;
+)"_s;
+
+static const QString GET_EMBEDDING_COUNTS_SQL = uR"(
+    select model, folder_id, count(*) from embeddings group by model, folder_id;
+)"_s;
+
+static const QString GET_COLLECTION_FOLDERS_SQL = uR"(
+    select co.name, co.embedding_model, ci.folder_id
+    from collections co
+    join collection_items ci on ci.collection_id = co.id
+    where co.embedding_model is not null;
+)"_s;
+
+static const QString GET_EMBEDDINGS_BY_CHUNK_SQL = uR"(
+    select chunk_id, embedding from embeddings where model = ? and chunk_id in (%1);
 )"_s;
 
-static const QString GET_COLLECTION_EMBEDDINGS_SQL = uR"(
-    select e.chunk_id, e.embedding
-    from embeddings e
-    join collections co on co.embedding_model = e.model
-    join collection_items ci on ci.folder_id = e.folder_id and ci.collection_id = co.id
-    where co.name in ('%1');
+static const QString GET_FOLDER_EMBEDDINGS_SQL = uR"(
+    select chunk_id, embedding from embeddings where model = ? and folder_id = ?;
 )"_s;
 
 static const QString GET_CHUNK_FILE_SQL = uR"(
@@ -781,38 +1036,78 @@ namespace {
 
 NAMED_PAIR(EmbeddingFolder, QString, embedding_model, int, folder_id)
 
-static bool sqlAddEmbeddings(QSqlQuery &q, const QList<Embedding> &embeddings, QHash<EmbeddingFolder, EmbeddingStat> &embeddingStats)
+// The embeddings that were inserted are appended to added, by index.
+static bool sqlAddEmbeddings(std::map<QString, QSqlQuery> &cache, const QSqlDatabase &db, QSqlQuery &q,
+                             const QList<Embedding> &embeddings, QHash<EmbeddingFolder, EmbeddingStat> &embeddingStats,
+                             QList<qsizetype> &added)
 {
-    if (!q.prepare(INSERT_EMBEDDING_SQL))
+    // the folders that still need embeddings of each model, instead of joining every embedding to its collections
+    QSet<EmbeddingFolder> needed;
+    if (!q.exec(GET_COLLECTION_FOLDERS_SQL))
         return false;
+    while (q.next())
+        needed.insert({ q.value(1).toString(), q.value(2).toInt() });
+
+    QList<qsizetype> toInsert;
+    QHash<EmbeddingKey, qsizetype> indexes;
+    for (qsizetype i = 0; i < embeddings.size(); i++) {
+        const auto &e = embeddings[i];
+        if (needed.contains({ e.model, e.folder_id })) {
+            toInsert.append(i);
+            indexes.insert({ e.model, e.chunk_id }, i);
+        }
+    }
 
-    // insert embedding if needed
-    for (const auto &e: embeddings) {
-        q.bindValue(":model", e.model);
-        q.bindValue(":chunk_id", e.chunk_id);
-        q.bindValue(":embedding", e.data);
-        if (!q.exec())
+    // insert embeddings if needed
+    QSet<qsizetype> inserted;
+    for (qsizetype start = 0; start < toInsert.size(); start += s_rowsPerInsert) {
+        const qsizetype rows = std::min(s_rowsPerInsert, toInsert.size() - start);
+        const QString sql = INSERT_EMBEDDINGS_SQL.arg(valuesPlaceholders(rows, 4));
+        QSqlQuery *insert = preparedQuery(cache, db, q, sql);
+        if (!insert)
+            return false;
+        for (qsizetype i = start; i < start + rows; i++) {
+            const auto &e = embeddings[toInsert[i]];
+            insert->addBindValue(e.model);
+            insert->addBindValue(e.folder_id);
+            insert->addBindValue(e.chunk_id);
+            insert->addBindValue(e.data);
+        }
+        if (!insert->exec()) {
+            releaseQuery(cache, sql, q);
             return false;
+        }
+        while (insert->next())
+            inserted.insert(indexes.value({ insert->value(0).toString(), insert->value(1).toInt() }));
+        insert->finish();
+    }
 
+    for (qsizetype i = 0; i < embeddings.size(); i++) {
+        const auto &e = embeddings[i];
         auto &stat = embeddingStats[{ e.model, e.folder_id }];
-        if (q.numRowsAffected()) {
+        if (inserted.contains(i)) {
             stat.nAdded++; // embedding added
+            added.append(i);
         } else {
             stat.nSkipped++; // embedding no longer needed
         }
     }
 
-    if (!q.prepare(GET_CHUNK_FILE_SQL))
+    QSqlQuery *getFile = preparedQuery(cache, db, q, GET_CHUNK_FILE_SQL);
+    if (!getFile)
         return false;
 
     // populate statistics for each collection item
     for (const auto &e: embeddings) {
         auto &stat = embeddingStats[{ e.model, e.folder_id }];
         if (stat.nAdded && stat.lastFile.isNull()) {
-            q.addBindValue(e.chunk_id);
-            if (!q.exec() || !q.next())
+            getFile->addBindValue(e.chunk_id);
+            if (!getFile->exec() || !getFile->next()) {
+                releaseQuery(cache, GET_CHUNK_FILE_SQL, q);
                 return false;
-            stat.lastFile = q.value(0).toString();
+            }
+            stat.lastFile = getFile->value(0).toString();
+            getFile->finish();
         }
     }
 
@@ -829,12 +1124,47 @@ void Database::commit()
 {
     bool ok = m_db.commit();
     Q_ASSERT(ok);
+    applyEmbeddingIndexChanges();
 }
 
 void Database::rollback()
 {
     bool ok = m_db.rollback();
     Q_ASSERT(ok);
+    m_removedChunks.clear();
+    m_removedFolders.clear();
+    m_removedEmbeddings.clear();
+}
+
+// Removes what the committed transaction removed from the database from the embedding counts, cache and indexes.
+void Database::applyEmbeddingIndexChanges()
+{
+    for (int folder_id: std::as_const(m_removedFolders))
+        std::erase_if(m_embeddingCounts, [folder_id](const auto &item) { return item.first.second == folder_id; });
+    for (const auto &[key, removed]: m_removedEmbeddings) {
+        auto it = m_embeddingCounts.find(key);
+        if (it != m_embeddingCounts.end() && (it->second -= removed) <= 0)
+            m_embeddingCounts.erase(it);
+    }
+
+    if (!m_removedFolders.isEmpty() || !m_removedChunks.isEmpty()) {
+        for (int folder_id: std::as_const(m_removedFolders))
+            m_embeddingCache->removeFolder(folder_id);
+        m_embeddingCache->remove(m_removedChunks);
+        reportEmbeddingCacheMemory();
+    }
+
+    if (m_embeddingIndex && (!m_removedFolders.isEmpty() || !m_removedChunks.isEmpty())) {
+        // folders first, so that their indexes are not loaded only to remove chunks from them
+        for (int folder_id: std::as_const(m_removedFolders))
+            m_embeddingIndex->removeFolder(folder_id);
+        m_embeddingIndex->remove(m_removedChunks);
+        if (m_embeddingIndex->hasUnsavedChanges())
+            m_indexSaveTimer->start();
+    }
+    m_removedChunks.clear();
+    m_removedFolders.clear();
+    m_removedEmbeddings.clear();
 }
 
 bool Database::hasContent()
@@ -848,6 +1178,7 @@ int Database::openDatabase(const QString &modelPath, bool create, int ver)
         qWarning() << "ERROR: invalid download path" << modelPath;
         return -1;
     }
+    m_preparedQueries.clear();
     if (m_db.isOpen())
         m_db.close();
     auto dbPath = u"%1/localdocs_v%2.db"_s.arg(modelPath).arg(ver);
@@ -899,6 +1230,7 @@ bool Database::openLatestDb(const QString &modelPath, QList<CollectionItem> &old
         return false;
     }
 
+    m_preparedQueries.clear();
     m_db.close();
     return true;
 }
@@ -939,180 +1271,329 @@ bool Database::initDb(const QString &modelPath, const QList<CollectionItem> &old
     return true;
 }
 
-Database::Database(int chunkSize, QStringList extensions)
-    : QObject(nullptr)
-    , m_chunkSize(chunkSize)
-    , m_scannedFileExtensions(std::move(extensions))
-    , m_scanTimer(new QTimer(this))
-    , m_watcher(new QFileSystemWatcher(this))
-    , m_embLLM(new EmbeddingLLM)
-    , m_databaseValid(true)
+// Creates the full-text index of the chunks if the database does not have it yet.
+void Database::initFullTextSearch()
 {
-    m_db = QSqlDatabase::database(QSqlDatabase::defaultConnection, false);
-    if (!m_db.isValid())
-        m_db = QSqlDatabase::addDatabase("QSQLITE");
-    Q_ASSERT(m_db.isValid());
+    m_fullTextSearch = m_db.tables().contains("chunks_fts", Qt::CaseInsensitive);
+    if (m_fullTextSearch)
+        return;
 
-    moveToThread(&m_dbThread);
-    m_dbThread.setObjectName("database");
-    m_dbThread.start();
-}
+    transaction();
 
-Database::~Database()
-{
-    m_dbThread.quit();
-    m_dbThread.wait();
-    delete m_embLLM;
+    QSqlQuery q(m_db);
+    for (const auto &cmd: INIT_FTS_SQL) {
+        if (!q.exec(cmd)) {
+            qWarning() << "Database ERROR: failed to create the full-text index, keyword search is disabled:"
+                       << q.lastError();
+            return rollback();
+        }
+    }
+
+    commit();
+    m_fullTextSearch = true;
 }
 
-void Database::setStartUpdateTime(CollectionItem &item)
+// Creates the table of file states if the database does not have it yet.
+bool Database::initFileStates()
 {
+    transaction();
+
     QSqlQuery q(m_db);
-    const qint64 update_time = QDateTime::currentMSecsSinceEpoch();
-    if (!updateStartUpdateTime(q, item.collection_id, update_time))
-        qWarning() << "Database ERROR: failed to set start update time:" << q.lastError();
-    else
-        item.startUpdate = QDateTime::fromMSecsSinceEpoch(update_time);
+    for (const auto &cmd: INIT_FILE_STATES_SQL) {
+        if (!q.exec(cmd)) {
+            qWarning() << "Database ERROR: failed to create the file states:" << q.lastError();
+            rollback();
+            return false;
+        }
+    }
+
+    commit();
+    return true;
 }
 
-void Database::setLastUpdateTime(CollectionItem &item)
+// Counts the embeddings of every folder and model once, after which the counts are kept up to date as embeddings are
+// added and removed, so that a search knows how large the folders are without counting them.
+void Database::loadEmbeddingCounts()
 {
+    m_embeddingCounts.clear();
     QSqlQuery q(m_db);
-    const qint64 update_time = QDateTime::currentMSecsSinceEpoch();
-    if (!updateLastUpdateTime(q, item.collection_id, update_time))
-        qWarning() << "Database ERROR: failed to set last update time:" << q.lastError();
-    else
-        item.lastUpdate = QDateTime::fromMSecsSinceEpoch(update_time);
+    if (!q.exec(GET_EMBEDDING_COUNTS_SQL)) {
+        qWarning() << "Database ERROR: failed to count embeddings:" << q.lastError();
+        return;
+    }
+    while (q.next())
+        m_embeddingCounts[{ q.value(0).toString(), q.value(1).toInt() }] = q.value(2).toLongLong();
 }
 
-CollectionItem Database::guiCollectionItem(int folder_id) const
+// Reads the folders each collection searches, with the embedding model of the collection.
+bool Database::loadCollectionFolders()
 {
-    Q_ASSERT(m_collectionMap.contains(folder_id));
-    return m_collectionMap.value(folder_id);
+    QSqlQuery q(m_db);
+    if (!q.exec(GET_COLLECTION_FOLDERS_SQL)) {
+        qWarning() << "Database ERROR: failed to select the folders of the collections:" << q.lastError();
+        return false;
+    }
+    m_collectionFolders.clear();
+    while (q.next())
+        m_collectionFolders[q.value(0).toString()].append({ q.value(1).toString(), q.value(2).toInt() });
+    m_collectionFoldersStale = false;
+    return true;
 }
 
-void Database::updateGuiForCollectionItem(const CollectionItem &item)
+// The quantization of the embeddings in the indexes and the cache, as set.
+static EmbeddingCache::Quantization embeddingQuantization()
 {
-    m_collectionMap.insert(item.folder_id, item);
-    emit requestUpdateGuiForCollectionItem(item);
+    switch (MySettings::globalInstance()->localDocsQuantization()) {
+    case EmbeddingQuantization::None:   return EmbeddingCache::Quantization::None;
+    case EmbeddingQuantization::Int8:   return EmbeddingCache::Quantization::Int8;
+    case EmbeddingQuantization::Binary: return EmbeddingCache::Quantization::Binary;
+    }
+    Q_UNREACHABLE();
 }
 
-void Database::addGuiCollectionItem(const CollectionItem &item)
+// Opens the embedding index of every folder and model. Those that are missing or out of date are dropped, so that their
+// folders are searched exhaustively, and rebuilt one at a time once the database is started.
+void Database::openEmbeddingIndexes(const QString &modelPath)
 {
-    m_collectionMap.insert(item.folder_id, item);
-    emit requestAddGuiCollectionItem(item);
-}
+    m_embeddingIndex = std::make_unique<EmbeddingIndex>(u"%1/localdocs_v%2_index"_s.arg(modelPath).arg(LOCALDOCS_VERSION),
+                                                        embeddingQuantization());
 
-void Database::removeGuiFolderById(const QString &collection, int folder_id)
-{
-    emit requestRemoveGuiFolderById(collection, folder_id);
+    for (const auto &[key, count]: m_embeddingCounts) {
+        if (!m_embeddingIndex->open(key, count)) {
+            m_embeddingIndex->drop(key);
+            m_staleIndexes.append(key);
+        }
+    }
+    if (!m_staleIndexes.isEmpty())
+        m_indexRebuildTimer->start();
 }
 
-void Database::guiCollectionListUpdated(const QList<CollectionItem> &collectionList)
+// Rebuilds every embedding index with another quantization, a folder at a time like the stale ones.
+void Database::requantizeEmbeddingIndexes(EmbeddingIndex::Quantization quantization)
 {
-    for (const auto &i : collectionList)
-        m_collectionMap.insert(i.folder_id, i);
-    emit requestGuiCollectionListUpdated(collectionList);
+    m_embeddingIndex->setQuantization(quantization);
+    for (const auto &key: std::views::keys(m_embeddingCounts)) {
+        if (!m_staleIndexes.contains(key))
+            m_staleIndexes.append(key);
+    }
+    if (!m_staleIndexes.isEmpty())
+        m_indexRebuildTimer->start();
 }
 
-void Database::updateFolderToIndex(int folder_id, size_t countForFolder, bool sendChunks)
+// Rebuilds the next stale embedding index, letting the events of the database thread run between folders.
+void Database::rebuildNextEmbeddingIndex()
 {
-    CollectionItem item = guiCollectionItem(folder_id);
-    item.currentDocsToIndex = countForFolder;
-    if (!countForFolder) {
-        if (sendChunks && !m_chunkList.isEmpty())
-            sendChunkList(); // send any remaining embedding chunks to llm
-        item.indexing = false;
-        item.installed = true;
-
-        // Set the last update if we are done
-        if (item.startUpdate > item.lastUpdate && item.currentEmbeddingsToIndex == 0)
-            setLastUpdateTime(item);
+    if (m_staleIndexes.isEmpty()) {
+        m_indexRebuildTimer->stop();
+        return;
     }
-    updateGuiForCollectionItem(item);
+
+    const auto [model, folder_id] = m_staleIndexes.takeFirst();
+    if (!rebuildEmbeddingIndex(model, folder_id))
+        m_embeddingIndex->drop({ model, folder_id }); // searched exhaustively
+    m_indexSaveTimer->start();
+
+    if (m_staleIndexes.isEmpty())
+        m_indexRebuildTimer->stop();
 }
 
-void Database::handleDocumentError(const QString &errorMessage,
-    int document_id, const QString &document_path, const QSqlError &error)
+// Calls add with every embedding of a folder and model in the database of the connection, until it returns false.
+// Fails on an embedding that is not a whole number of floats, or that does not have n_embd dimensions, or the ones of
+// the first embedding if n_embd is 0.
+static bool readFolderEmbeddings(const QSqlDatabase &db, const QString &embedding_model, int folder_id, int n_embd,
+                                 const std::function<bool(int chunk_id, const float *embedding, int n_embd)> &add)
 {
-    qWarning() << errorMessage << document_id << document_path << error;
+    QSqlQuery q(db);
+    q.setForwardOnly(true);
+    if (!q.prepare(GET_FOLDER_EMBEDDINGS_SQL)) {
+        qWarning() << "Database ERROR: failed to prepare embeddings query:" << q.lastError();
+        return false;
+    }
+    q.addBindValue(embedding_model);
+    q.addBindValue(folder_id);
+    if (!q.exec()) {
+        qWarning() << "Database ERROR: failed to exec embeddings query:" << q.lastError();
+        return false;
+    }
+
+    while (q.next()) {
+        QVariant embdCol = q.value(1);
+        if (embdCol.userType() != QMetaType::QByteArray) {
+            qWarning() << "Database ERROR: Expected embedding to be blob, got" << embdCol.userType();
+            return false;
+        }
+        auto *embd = static_cast<const QByteArray *>(embdCol.constData());
+        if (embd->size() % sizeof(float)) {
+            qWarning() << "Database ERROR: Expected embedding to be a whole number of floats, got" << embd->size()
+                       << "bytes";
+            return false;
+        }
+        const int dims = int(embd->size() / sizeof(float));
+        if (!n_embd)
+            n_embd = dims;
+        if (dims != n_embd) {
+            qWarning() << "Database ERROR: Expected embedding of" << n_embd << "dimensions, got" << dims;
+            return false;
+        }
+        if (!add(q.value(0).toInt(), reinterpret_cast<const float *>(embd->constData()), dims))
+            return false;
+    }
+    return true;
 }
 
-size_t Database::chunkStream(QTextStream &stream, int folder_id, int document_id, const QString &embedding_model,
-    const QString &file, const QString &title, const QString &author, const QString &subject, const QString &keywords,
-    int page, int maxChunks)
+bool Database::readEmbeddings(const QString &embedding_model, int folder_id, int n_embd,
+                              const std::function<bool(int chunk_id, const float *embedding, int n_embd)> &add)
 {
-    int charCount = 0;
-    // TODO: implement line_from/line_to
-    constexpr int line_from = -1;
-    constexpr int line_to = -1;
-    QList<QString> words;
-    int chunks = 0;
-    int addedWords = 0;
+    return readFolderEmbeddings(m_db, embedding_model, folder_id, n_embd, add);
+}
 
-    for (;;) {
-        QString word;
-        stream >> word;
-        if (stream.status() && !stream.atEnd())
-            return -1;
-        charCount += word.length();
-        if (!word.isEmpty())
-            words.append(word);
-        if (stream.status() || charCount + words.size() - 1 >= m_chunkSize) {
-            if (!words.isEmpty()) {
-                const QString chunk = words.join(" ");
-                QSqlQuery q(m_db);
-                int chunk_id = 0;
-                if (!addChunk(q,
-                    document_id,
-                    chunk,
-                    file,
-                    title,
-                    author,
-                    subject,
-                    keywords,
-                    page,
-                    line_from,
-                    line_to,
-                    words.size(),
-                    &chunk_id
-                )) {
-                    qWarning() << "ERROR: Could not insert chunk into db" << q.lastError();
-                }
-
-                addedWords += words.size();
-
-                EmbeddingChunk toEmbed;
-                toEmbed.model = embedding_model;
-                toEmbed.folder_id = folder_id;
-                toEmbed.chunk_id = chunk_id;
-                toEmbed.chunk = chunk;
-                appendChunk(toEmbed);
-                ++chunks;
-
-                words.clear();
-                charCount = 0;
-            }
+bool Database::rebuildEmbeddingIndex(const QString &embedding_model, int folder_id)
+{
+#if defined(DEBUG)
+    qDebug() << "rebuildEmbeddingIndex" << embedding_model << folder_id;
+#endif
+    const EmbeddingIndex::Key key { embedding_model, folder_id };
+    m_embeddingIndex->drop(key);
+    return readEmbeddings(embedding_model, folder_id, 0, [&](int chunk_id, const float *embedding, int n_embd) {
+        return m_embeddingIndex->add(key, chunk_id, embedding, n_embd);
+    });
+}
 
-            if (stream.status() || (maxChunks > 0 && chunks == maxChunks))
-                break;
-        }
+// Loads the embeddings of a folder into the cache, which must all have the dimensions of the query they are loaded for.
+bool Database::loadEmbeddingCache(const QString &embedding_model, int folder_id, int n_embd)
+{
+#if defined(DEBUG)
+    qDebug() << "loadEmbeddingCache" << embedding_model << folder_id;
+#endif
+    const EmbeddingCache::Key key { embedding_model, folder_id };
+    m_embeddingCache->insert(key);
+    bool ok = readEmbeddings(embedding_model, folder_id, n_embd, [&](int chunk_id, const float *embedding, int) {
+        return m_embeddingCache->add(key, chunk_id, embedding, n_embd);
+    });
+    if (!ok)
+        m_embeddingCache->drop(key);
+    return ok;
+}
+
+// Publishes the memory taken by the cached embeddings of each collection, counting a folder shared by several
+// collections in each of them.
+void Database::reportEmbeddingCacheMemory()
+{
+    if (m_collectionFoldersStale && !loadCollectionFolders())
+        return;
+
+    QHash<QString, qint64> memory;
+    for (const auto &[collection, folders]: m_collectionFolders.asKeyValueRange()) {
+        qint64 &bytes = memory[collection];
+        for (const auto &key: folders)
+            bytes += m_embeddingCache->memoryUsage(key);
     }
+    Metrics::globalInstance()->setEmbeddingCacheMemory(std::move(memory));
+}
 
-    if (chunks) {
-        CollectionItem item = guiCollectionItem(folder_id);
+Database::Database(int chunkSize, QStringList extensions)
+    : QObject(nullptr)
+    , m_chunkSize(chunkSize)
+    , m_scannedFileExtensions(std::move(extensions))
+    , m_scanTimer(new QTimer(this))
+    , m_parserPool(new QThreadPool(this))
+    , m_writeTimer(new QTimer(this))
+    , m_watcher(new FolderWatcher(this))
+    , m_embLLM(new EmbeddingLLM)
+    , m_databaseValid(true)
+    , m_embeddingCache(std::make_unique<EmbeddingCache>(s_maxEmbeddingCacheBytes))
+    , m_indexSaveTimer(new QTimer(this))
+    , m_indexRebuildTimer(new QTimer(this))
+{
+    m_db = QSqlDatabase::database(QSqlDatabase::defaultConnection, false);
+    if (!m_db.isValid())
+        m_db = QSqlDatabase::addDatabase("QSQLITE");
+    Q_ASSERT(m_db.isValid());
 
-        // Set the start update if we haven't done so already
-        if (item.startUpdate <= item.lastUpdate && item.currentEmbeddingsToIndex == 0)
-            setStartUpdateTime(item);
+    moveToThread(&m_dbThread);
+    m_dbThread.setObjectName("database");
+    m_dbThread.start();
+}
 
-        item.currentEmbeddingsToIndex += chunks;
-        item.totalEmbeddingsToIndex += chunks;
-        item.totalWords += addedWords;
-        updateGuiForCollectionItem(item);
+Database::~Database()
+{
+    m_parserPool->waitForDone();
+    m_dbThread.quit();
+    m_dbThread.wait();
+    delete m_embLLM;
+}
+
+void Database::setStartUpdateTime(CollectionItem &item)
+{
+    QSqlQuery q(m_db);
+    const qint64 update_time = QDateTime::currentMSecsSinceEpoch();
+    if (!updateStartUpdateTime(q, item.collection_id, update_time))
+        qWarning() << "Database ERROR: failed to set start update time:" << q.lastError();
+    else
+        item.startUpdate = QDateTime::fromMSecsSinceEpoch(update_time);
+}
+
+void Database::setLastUpdateTime(CollectionItem &item)
+{
+    QSqlQuery q(m_db);
+    const qint64 update_time = QDateTime::currentMSecsSinceEpoch();
+    if (!updateLastUpdateTime(q, item.collection_id, update_time))
+        qWarning() << "Database ERROR: failed to set last update time:" << q.lastError();
+    else
+        item.lastUpdate = QDateTime::fromMSecsSinceEpoch(update_time);
+}
+
+CollectionItem Database::guiCollectionItem(int folder_id) const
+{
+    Q_ASSERT(m_collectionMap.contains(folder_id));
+    return m_collectionMap.value(folder_id);
+}
+
+void Database::updateGuiForCollectionItem(const CollectionItem &item)
+{
+    m_collectionMap.insert(item.folder_id, item);
+    emit requestUpdateGuiForCollectionItem(item);
+}
+
+void Database::addGuiCollectionItem(const CollectionItem &item)
+{
+    m_collectionMap.insert(item.folder_id, item);
+    emit requestAddGuiCollectionItem(item);
+}
+
+void Database::removeGuiFolderById(const QString &collection, int folder_id)
+{
+    emit requestRemoveGuiFolderById(collection, folder_id);
+}
+
+void Database::guiCollectionListUpdated(const QList<CollectionItem> &collectionList)
+{
+    for (const auto &i : collectionList)
+        m_collectionMap.insert(i.folder_id, i);
+    emit requestGuiCollectionListUpdated(collectionList);
+}
+
+void Database::updateFolderToIndex(int folder_id, size_t countForFolder, bool sendChunks)
+{
+    CollectionItem item = guiCollectionItem(folder_id);
+    item.currentDocsToIndex = countForFolder;
+    if (!countForFolder) {
+        if (sendChunks && !m_chunkList.isEmpty())
+            sendChunkList(); // send any remaining embedding chunks to llm
+        item.indexing = false;
+        item.installed = true;
+
+        // Set the last update if we are done
+        if (item.startUpdate > item.lastUpdate && item.currentEmbeddingsToIndex == 0)
+            setLastUpdateTime(item);
     }
+    updateGuiForCollectionItem(item);
+}
 
-    return stream.pos();
+void Database::handleDocumentError(const QString &errorMessage,
+    int document_id, const QString &document_path, const QSqlError &error)
+{
+    qWarning() << errorMessage << document_id << document_path << error;
 }
 
 void Database::appendChunk(const EmbeddingChunk &chunk)
@@ -1125,14 +1606,98 @@ void Database::appendChunk(const EmbeddingChunk &chunk)
 
 void Database::sendChunkList()
 {
-    m_embLLM->generateDocEmbeddingsAsync(m_chunkList);
+    queueEmbeddings(m_chunkList);
     m_chunkList.clear();
 }
 
+static qsizetype chunkBytes(const EmbeddingChunk &chunk)
+{
+    return chunk.chunk.size() * qsizetype(sizeof(QChar));
+}
+
+void Database::queueEmbeddings(const QList<EmbeddingChunk> &chunks)
+{
+    QHash<int, qint64> folderBytes;
+    for (const auto &c: chunks) {
+        m_embeddingBacklog.enqueue(c);
+        m_embeddingQueueBytes += chunkBytes(c);
+        folderBytes[c.folder_id] += chunkBytes(c);
+    }
+    for (const auto &[folder_id, bytes]: std::as_const(folderBytes).asKeyValueRange()) {
+        if (!m_collectionMap.contains(folder_id)) continue;
+        CollectionItem item = guiCollectionItem(folder_id);
+        item.embeddingQueueBytes += bytes;
+        updateGuiForCollectionItem(item);
+    }
+    sendEmbeddings();
+}
+
+// Sends the backlog to the embedding thread, as long as what it already has is under the limit.
+void Database::sendEmbeddings()
+{
+    while (!m_embeddingBacklog.isEmpty() && m_embeddingsInFlightBytes < s_maxEmbeddingQueueBytes) {
+        QList<EmbeddingChunk> batch;
+        while (!m_embeddingBacklog.isEmpty() && batch.size() < s_batchSize) {
+            EmbeddingChunk chunk = m_embeddingBacklog.dequeue();
+            m_embeddingsInFlight[{ chunk.model, chunk.chunk_id }] += chunkBytes(chunk);
+            m_embeddingsInFlightBytes += chunkBytes(chunk);
+            batch.append(std::move(chunk));
+        }
+        m_embLLM->generateDocEmbeddingsAsync(batch);
+    }
+}
+
+// Accounts for chunks that came back from the embedding thread, with or without their embeddings, and resumes
+// scanning once the embeddings have caught up. Only the model, folder and id of the chunks are used.
+void Database::releaseEmbeddings(const QList<EmbeddingChunk> &chunks)
+{
+    QHash<int, qint64> folderBytes;
+    for (const auto &c: chunks) {
+        auto it = m_embeddingsInFlight.find({ c.model, c.chunk_id });
+        if (it == m_embeddingsInFlight.end())
+            continue;
+        m_embeddingsInFlightBytes -= *it;
+        m_embeddingQueueBytes -= *it;
+        folderBytes[c.folder_id] += *it;
+        m_embeddingsInFlight.erase(it);
+    }
+    for (const auto &[folder_id, bytes]: std::as_const(folderBytes).asKeyValueRange()) {
+        if (!m_collectionMap.contains(folder_id)) continue;
+        CollectionItem item = guiCollectionItem(folder_id);
+        item.embeddingQueueBytes = std::max(item.embeddingQueueBytes - bytes, qint64(0));
+        updateGuiForCollectionItem(item);
+    }
+    sendEmbeddings();
+
+    if (m_stallTimer.isValid() && m_embeddingQueueBytes < s_maxEmbeddingQueueBytes / 2) {
+        const qint64 stallMs = m_stallTimer.elapsed();
+        m_stallTimer.invalidate();
+        for (int folder_id: m_docsToScan.keys()) {
+            CollectionItem item = guiCollectionItem(folder_id);
+            item.indexingStallMs += stallMs;
+            updateGuiForCollectionItem(item);
+        }
+        if (!m_docsToScan.isEmpty())
+            m_scanTimer->start();
+    }
+
+    queueUncompletedEmbeddings();
+}
+
+bool Database::embeddingQueueFull() const
+{
+    return m_embeddingQueueBytes >= s_maxEmbeddingQueueBytes;
+}
+
 void Database::handleEmbeddingsGenerated(const QVector<EmbeddingResult> &embeddings)
 {
     Q_ASSERT(!embeddings.isEmpty());
 
+    QList<EmbeddingChunk> returned;
+    for (const auto &e: embeddings)
+        returned.append({ e.model, e.folder_id, e.chunk_id, QString() });
+    releaseEmbeddings(returned);
+
     QList<Embedding> sqlEmbeddings;
     for (const auto &e: embeddings) {
         auto data = QByteArray::fromRawData(
@@ -1146,13 +1711,32 @@ void Database::handleEmbeddingsGenerated(const QVector<EmbeddingResult> &embeddi
 
     QSqlQuery q(m_db);
     QHash<EmbeddingFolder, EmbeddingStat> stats;
-    if (!sqlAddEmbeddings(q, sqlEmbeddings, stats)) {
+    QList<qsizetype> added;
+    if (!sqlAddEmbeddings(m_preparedQueries, m_db, q, sqlEmbeddings, stats, added)) {
         qWarning() << "Database ERROR: failed to add embeddings:" << q.lastError();
         return rollback();
     }
 
     commit();
 
+    bool cacheChanged = false;
+    for (qsizetype i: std::as_const(added)) {
+        const auto &e = embeddings[i];
+        m_embeddingCounts[{ e.model, e.folder_id }]++;
+        if (m_embeddingCache->contains({ e.model, e.folder_id })) {
+            // a folder that is missing an embedding is loaded again when it is next searched
+            if (!m_embeddingCache->add({ e.model, e.folder_id }, e.chunk_id, e.embedding.data(), int(e.embedding.size())))
+                m_embeddingCache->drop({ e.model, e.folder_id });
+            cacheChanged = true;
+        }
+        if (m_embeddingIndex)
+            m_embeddingIndex->add({ e.model, e.folder_id }, e.chunk_id, e.embedding.data(), int(e.embedding.size()));
+    }
+    if (cacheChanged)
+        reportEmbeddingCacheMemory();
+    if (m_embeddingIndex && !added.isEmpty())
+        m_indexSaveTimer->start();
+
     // FIXME(jared): embedding counts are per-collectionitem, not per-folder
     for (const auto &[key, stat]: std::as_const(stats).asKeyValueRange()) {
         if (!m_collectionMap.contains(key.folder_id)) continue;
@@ -1177,6 +1761,8 @@ void Database::handleErrorGenerated(const QVector<EmbeddingChunk> &chunks, const
      * on the embedding model, but this sets the error on all collections for a given
      * folder */
 
+    releaseEmbeddings(chunks);
+
     QSet<int> folder_ids;
     for (const auto &c: chunks) { folder_ids << c.folder_id; }
 
@@ -1188,11 +1774,13 @@ void Database::handleErrorGenerated(const QVector<EmbeddingChunk> &chunks, const
     }
 }
 
+// including the documents that are being parsed
 size_t Database::countOfDocuments(int folder_id) const
 {
-    if (!m_docsToScan.contains(folder_id))
-        return 0;
-    return m_docsToScan.value(folder_id).size();
+    size_t count = m_parsingFolders.value(folder_id);
+    if (m_docsToScan.contains(folder_id))
+        count += m_docsToScan.value(folder_id).size();
+    return count;
 }
 
 size_t Database::countOfBytes(int folder_id) const
@@ -1254,19 +1842,25 @@ void Database::enqueueDocuments(int folder_id, const QVector<DocumentInfo> &info
 
 void Database::scanQueueBatch()
 {
+    // enough for the parsers to start on another document as soon as they are done with one
+    const int maxParsing = 2 * m_parserPool->maxThreadCount();
+
     QElapsedTimer timer;
     timer.start();
 
     transaction();
 
-    // scan for up to 100ms or until we run out of documents
-    while (!m_docsToScan.isEmpty() && timer.elapsed() < 100)
+    // scan for up to 100ms, until we run out of documents, or until the parsers or the embeddings have enough to do
+    while (!m_docsToScan.isEmpty() && m_parsing < maxParsing && !embeddingQueueFull() && timer.elapsed() < 100)
         scanQueue();
 
     commit();
 
-    if (m_docsToScan.isEmpty())
+    // the writer starts it again once the parsers catch up, and releaseEmbeddings once the embeddings do
+    if (m_docsToScan.isEmpty() || m_parsing >= maxParsing || embeddingQueueFull())
         m_scanTimer->stop();
+    if (!m_docsToScan.isEmpty() && embeddingQueueFull() && !m_stallTimer.isValid())
+        m_stallTimer.start();
 }
 
 void Database::scanQueue()
@@ -1302,10 +1896,12 @@ void Database::scanQueue()
     if (existing_id != -1 && !currentlyProcessing) {
         Q_ASSERT(existing_time != -1);
         if (document_time == existing_time) {
-            // No need to rescan, but we do have to schedule next
+            // No need to rescan, but we do have to schedule next. Its state lets the next scan skip it without a query.
+            if (!recordFileState(q, document_path, folder_id, document_time))
+                qWarning() << "Database ERROR: Cannot record the state of" << document_path << q.lastError();
             return updateFolderToIndex(folder_id, countForFolder);
         }
-        if (!removeChunksByDocumentId(q, existing_id)) {
+        if (!removeChunksByDocumentId(q, existing_id, m_removedChunks, m_removedEmbeddings)) {
             handleDocumentError("ERROR: Cannot remove chunks of document",
                 existing_id, document_path, q.lastError());
             return updateFolderToIndex(folder_id, countForFolder);
@@ -1345,113 +1941,195 @@ void Database::scanQueue()
     }
 
     Q_ASSERT(document_id != -1);
-    if (info.isPdf()) {
-        QPdfDocument doc;
-        if (QPdfDocument::Error::None != doc.load(info.doc.canonicalFilePath())) {
-            handleDocumentError("ERROR: Could not load pdf",
-                document_id, document_path, q.lastError());
-            return updateFolderToIndex(folder_id, countForFolder);
-        }
-        const size_t bytes = info.doc.size();
-        const size_t bytesPerPage = std::floor(bytes / doc.pageCount());
-        const int pageIndex = info.currentPage;
-#if defined(DEBUG)
-        qDebug() << "scanning page" << pageIndex << "of" << doc.pageCount() << document_path;
-#endif
-        const QPdfSelection selection = doc.getAllText(pageIndex);
-        QString text = selection.text();
-        QTextStream stream(&text);
-        chunkStream(stream, info.folder, document_id, embedding_model, info.doc.fileName(),
-            doc.metaData(QPdfDocument::MetaDataField::Title).toString(),
-            doc.metaData(QPdfDocument::MetaDataField::Author).toString(),
-            doc.metaData(QPdfDocument::MetaDataField::Subject).toString(),
-            doc.metaData(QPdfDocument::MetaDataField::Keywords).toString(),
-            pageIndex + 1
-        );
-        CollectionItem item = guiCollectionItem(info.folder);
-        item.currentBytesToIndex -= bytesPerPage;
-        updateGuiForCollectionItem(item);
-        if (info.currentPage < doc.pageCount()) {
-            info.currentPage += 1;
-            info.currentlyProcessing = true;
-            enqueueDocumentInternal(info, true /*prepend*/);
-            return updateFolderToIndex(folder_id, countForFolder + 1);
-        }
+    // the database has the time of the document when it started to be indexed
+    ParseJob job { info, document_id, currentlyProcessing ? existing_time : document_time, embedding_model,
+                   m_chunkSize };
 
-        item.currentBytesToIndex -= bytes - (bytesPerPage * doc.pageCount());
-        updateGuiForCollectionItem(item);
-    } else {
-        BinaryDetectingFile file(document_path);
-        if (!file.open(QIODevice::ReadOnly)) {
-            handleDocumentError("ERROR: Cannot open file for scanning",
-                                existing_id, document_path, q.lastError());
-            return updateFolderToIndex(folder_id, countForFolder);
-        }
-        Q_ASSERT(!file.isSequential()); // we need to seek
-
-        const size_t bytes = info.doc.size();
-        QTextStream stream(&file);
-        const size_t byteIndex = info.currentPosition;
-        if (byteIndex) {
-            /* Read the Unicode BOM to detect the encoding. Without this, QTextStream will
-             * always interpret the text as UTF-8 when byteIndex is nonzero. */
-            stream.read(1);
-
-            if (!stream.seek(byteIndex)) {
-                handleDocumentError("ERROR: Cannot seek to pos for scanning",
-                                    existing_id, document_path, q.lastError());
-                return updateFolderToIndex(folder_id, countForFolder);
-            }
-        }
-#if defined(DEBUG)
-        qDebug() << "scanning byteIndex" << byteIndex << "of" << bytes << document_path;
-#endif
-        int pos = chunkStream(stream, info.folder, document_id, embedding_model, info.doc.fileName(),
-            QString() /*title*/, QString() /*author*/, QString() /*subject*/, QString() /*keywords*/, -1 /*page*/,
-            100 /*maxChunks*/);
-        if (pos < 0) {
-            if (!file.binarySeen()) {
-                handleDocumentError(u"ERROR: Failed to read file (status %1)"_s.arg(stream.status()),
-                                    existing_id, document_path, q.lastError());
-                return updateFolderToIndex(folder_id, countForFolder);
-            }
+    // Once the page count of a PDF is known, queue its next page now rather than once this one is written, so that its
+    // pages are parsed in parallel.
+    if (info.isPdf() && info.pageCount > 0 && info.currentPage + 1 < info.pageCount) {
+        DocumentInfo next = info;
+        next.currentPage += 1;
+        next.currentlyProcessing = true;
+        enqueueDocumentInternal(next, true /*prepend*/);
+        job.nextQueued = true;
+    }
 
-            /* When we see a binary file, we treat it like an empty file so we know not to
-             * scan it again. All existing chunks are removed, and in-progress embeddings
-             * are ignored when they complete. */
+    ++m_parsing;
+    ++m_parsingFolders[folder_id];
+    m_parserPool->start([this, job = std::move(job)] {
+        ParsedDocument parsed = parseDocument(job);
+        QMetaObject::invokeMethod(this, [this, parsed = std::move(parsed)]() mutable {
+            handleDocumentParsed(std::move(parsed));
+        }, Qt::QueuedConnection);
+    });
 
-            qInfo() << "LocalDocs: Ignoring file with binary data:" << document_path;
+    return updateFolderToIndex(folder_id, countOfDocuments(folder_id));
+}
 
-            // this will also ensure in-flight embeddings are ignored
-            if (!removeChunksByDocumentId(q, existing_id)) {
-                handleDocumentError("ERROR: Cannot remove chunks of document",
-                    existing_id, document_path, q.lastError());
-            }
-            updateCollectionStatistics();
-            return updateFolderToIndex(folder_id, countForFolder);
-        }
-        file.close();
-        const size_t bytesChunked = pos - byteIndex;
-        CollectionItem item = guiCollectionItem(info.folder);
-        item.currentBytesToIndex -= bytesChunked;
-        updateGuiForCollectionItem(item);
-        if (info.currentPosition < bytes) {
-            info.currentPosition = pos;
-            info.currentlyProcessing = true;
-            enqueueDocumentInternal(info, true /*prepend*/);
-            return updateFolderToIndex(folder_id, countForFolder + 1);
+void Database::handleDocumentParsed(ParsedDocument parsed)
+{
+    m_parsedDocuments.push_back(std::move(parsed));
+    // write the documents parsed in the meantime along with this one
+    if (!m_writeTimer->isActive())
+        m_writeTimer->start();
+}
+
+void Database::writeParsedDocuments()
+{
+    transaction();
+
+    for (ParsedDocument &parsed : m_parsedDocuments) {
+        const int folder_id = parsed.job.info.folder;
+        --m_parsing;
+        if (--m_parsingFolders[folder_id] == 0)
+            m_parsingFolders.remove(folder_id);
+        // the folder was removed while the document was parsed
+        if (!m_collectionMap.contains(folder_id))
+            continue;
+        writeParsedDocument(parsed);
+        updateFolderToIndex(folder_id, countOfDocuments(folder_id));
+    }
+    m_parsedDocuments.clear();
+
+    commit();
+
+    if (!m_docsToScan.isEmpty() && !m_scanTimer->isActive() && !m_stallTimer.isValid())
+        m_scanTimer->start();
+}
+
+void Database::writeParsedDocument(const ParsedDocument &parsed)
+{
+    // TODO: implement line_from/line_to
+    constexpr int line_from = -1;
+    constexpr int line_to = -1;
+
+    const ParseJob &job = parsed.job;
+    const int folder_id = job.info.folder;
+    const QString document_path = job.info.doc.canonicalFilePath();
+
+    // The document was changed or removed while it was parsed. If it was changed, it is scanned again.
+    QSqlQuery q(m_db);
+    int existing_id = -1;
+    qint64 existing_time = -1;
+    if (!selectDocument(q, document_path, &existing_id, &existing_time)) {
+        handleDocumentError("ERROR: Cannot select document", job.document_id, document_path, q.lastError());
+        return;
+    }
+    if (existing_id != job.document_id || existing_time != job.document_time)
+        return;
+
+    switch (parsed.status) {
+    case ParsedDocument::Status::Ok:
+        break;
+    case ParsedDocument::Status::Error:
+        handleDocumentError(parsed.error, job.document_id, document_path, q.lastError());
+        return;
+    case ParsedDocument::Status::Binary:
+        /* When we see a binary file, we treat it like an empty file so we know not to
+         * scan it again. All existing chunks are removed, and in-progress embeddings
+         * are ignored when they complete. */
+
+        qInfo() << "LocalDocs: Ignoring file with binary data:" << document_path;
+
+        // this will also ensure in-flight embeddings are ignored
+        if (!removeChunksByDocumentId(q, job.document_id, m_removedChunks, m_removedEmbeddings)) {
+            handleDocumentError("ERROR: Cannot remove chunks of document",
+                job.document_id, document_path, q.lastError());
+        } else if (!recordFileState(q, document_path, folder_id, job.document_time)) {
+            qWarning() << "Database ERROR: Cannot record the state of" << document_path << q.lastError();
         }
+        updateCollectionStatistics();
+        return;
     }
 
-    return updateFolderToIndex(folder_id, countForFolder);
+    QList<int> chunkIds;
+    if (!addChunks(m_preparedQueries, m_db, q,
+        job.document_id,
+        job.info.doc.fileName(),
+        parsed.title,
+        parsed.author,
+        parsed.subject,
+        parsed.keywords,
+        line_from,
+        line_to,
+        parsed.chunks,
+        chunkIds
+    )) {
+        qWarning() << "ERROR: Could not insert chunks into db" << q.lastError();
+        return;
+    }
+
+    int addedWords = 0;
+    for (qsizetype i = 0; i < parsed.chunks.size(); i++) {
+        const ParsedChunk &chunk = parsed.chunks[i];
+        addedWords += chunk.words;
+
+        EmbeddingChunk toEmbed;
+        toEmbed.model = job.embedding_model;
+        toEmbed.folder_id = folder_id;
+        toEmbed.chunk_id = chunkIds[i];
+        toEmbed.chunk = chunk.text;
+        appendChunk(toEmbed);
+    }
+
+    CollectionItem item = guiCollectionItem(folder_id);
+    if (!parsed.chunks.isEmpty()) {
+        // Set the start update if we haven't done so already
+        if (item.startUpdate <= item.lastUpdate && item.currentEmbeddingsToIndex == 0)
+            setStartUpdateTime(item);
+
+        item.currentEmbeddingsToIndex += parsed.chunks.size();
+        item.totalEmbeddingsToIndex += parsed.chunks.size();
+        item.totalWords += addedWords;
+    }
+    item.currentBytesToIndex -= std::min(item.currentBytesToIndex, parsed.bytesParsed);
+    updateGuiForCollectionItem(item);
+
+    if (parsed.finished) {
+        if (!recordFileState(q, document_path, folder_id, job.document_time))
+            qWarning() << "Database ERROR: Cannot record the state of" << document_path << q.lastError();
+    }
+
+    // continue with the next slice before the other documents of the folder
+    if (!parsed.finished && !job.nextQueued)
+        enqueueDocumentInternal(job.info, true /*prepend*/);
 }
 
+// Scans a folder, or a directory within one, for documents that were added, changed or removed since they were last
+// indexed. Only the files whose state differs from the one recorded when they were indexed are queued.
 void Database::scanDocuments(int folder_id, const QString &folder_path)
 {
 #if defined(DEBUG)
     qDebug() << "scanning folder for documents" << folder_path;
 #endif
 
+    // the documents of the folder within the scanned directory, and their states
+    struct Known { int id; std::optional<FileState> state; bool seen = false; };
+    QHash<QString, Known> known;
+    {
+        const QString prefix = folder_path + u'/';
+        QSqlQuery q(m_db);
+        if (!q.prepare(SELECT_FILE_STATES_SQL)) {
+            qWarning() << "Database ERROR: Cannot prepare sql for select file states" << q.lastError();
+            return;
+        }
+        q.addBindValue(folder_id);
+        if (!q.exec()) {
+            qWarning() << "Database ERROR: Cannot exec sql for select file states" << q.lastError();
+            return;
+        }
+        while (q.next()) {
+            QString document_path = q.value(1).toString();
+            if (!document_path.startsWith(prefix))
+                continue;
+            Known k { q.value(0).toInt(), std::nullopt };
+            if (!q.value(2).isNull())
+                k.state = FileState { q.value(2).toLongLong(), q.value(3).toLongLong(), q.value(4).toLongLong() };
+            known.insert(std::move(document_path), std::move(k));
+        }
+    }
+
     QDirIterator it(folder_path, QDir::Readable | QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot,
                     QDirIterator::Subdirectories);
     QVector<DocumentInfo> infos;
@@ -1466,15 +2144,59 @@ void Database::scanDocuments(int folder_id, const QString &folder_path)
         if (!m_scannedFileExtensions.contains(fileInfo.suffix(), Qt::CaseInsensitive))
             continue;
 
+        // documents are stored by their canonical path, which is usually the one walked
+        auto k = known.find(fileInfo.filePath());
+        if (k == known.end())
+            k = known.find(fileInfo.canonicalFilePath());
+        if (k != known.end()) {
+            k->seen = true;
+            if (k->state && k->state == fileState(k.key()))
+                continue; // unchanged
+        }
+
         DocumentInfo info;
         info.folder = folder_id;
         info.doc = fileInfo;
         infos.append(info);
     }
 
+    // the documents that were not seen were removed, or no longer have a scanned extension
+    QList<int> removed;
+    for (const Known &k : std::as_const(known)) {
+        if (!k.seen)
+            removed.append(k.id);
+    }
+    if (!removed.isEmpty()) {
+        transaction();
+        QSqlQuery q(m_db);
+        bool ok = true;
+        for (int document_id : std::as_const(removed)) {
+#if defined(DEBUG)
+            qDebug() << "scan removing document" << document_id;
+#endif
+            if (!removeChunksByDocumentId(q, document_id, m_removedChunks, m_removedEmbeddings)) {
+                qWarning() << "ERROR: Cannot remove chunks of document_id" << document_id << q.lastError();
+                ok = false;
+                break;
+            }
+            if (!removeDocument(q, document_id)) {
+                qWarning() << "ERROR: Cannot remove document_id" << document_id << q.lastError();
+                ok = false;
+                break;
+            }
+        }
+        if (ok) {
+            commit();
+            updateCollectionStatistics();
+        } else {
+            rollback();
+        }
+    }
+
     if (!infos.isEmpty()) {
         CollectionItem item = guiCollectionItem(folder_id);
         item.indexing = true;
+        item.indexingStallMs = 0;
         updateGuiForCollectionItem(item);
         enqueueDocuments(folder_id, infos);
     } else {
@@ -1484,19 +2206,33 @@ void Database::scanDocuments(int folder_id, const QString &folder_path)
 
 void Database::start()
 {
-    connect(m_watcher, &QFileSystemWatcher::directoryChanged, this, &Database::directoryChanged);
+    connect(m_watcher, &FolderWatcher::directoryChanged, this, &Database::directoryChanged);
     connect(m_embLLM, &EmbeddingLLM::embeddingsGenerated, this, &Database::handleEmbeddingsGenerated);
     connect(m_embLLM, &EmbeddingLLM::errorGenerated, this, &Database::handleErrorGenerated);
     m_scanTimer->callOnTimeout(this, &Database::scanQueueBatch);
+    // write the chunks of the parsed documents in batches, each in one transaction
+    m_writeTimer->setSingleShot(true);
+    m_writeTimer->setInterval(25);
+    m_writeTimer->callOnTimeout(this, &Database::writeParsedDocuments);
+    // save the indexes once the embeddings stop coming in, rather than after every batch
+    m_indexSaveTimer->setSingleShot(true);
+    m_indexSaveTimer->setInterval(30'000);
+    m_indexSaveTimer->callOnTimeout(this, [this] { m_embeddingIndex->save(); });
+    // rebuild stale indexes a folder at a time, so that indexing and searches are not held up until all are done
+    m_indexRebuildTimer->setInterval(0);
+    m_indexRebuildTimer->callOnTimeout(this, &Database::rebuildNextEmbeddingIndex);
 
     const QString modelPath = MySettings::globalInstance()->modelPath();
     QList<CollectionItem> oldCollections;
 
     if (!openLatestDb(modelPath, oldCollections)) {
         m_databaseValid = false;
-    } else if (!initDb(modelPath, oldCollections)) {
+    } else if (!initDb(modelPath, oldCollections) || !initFileStates()) {
         m_databaseValid = false;
     } else {
+        initFullTextSearch();
+        loadEmbeddingCounts();
+        openEmbeddingIndexes(modelPath);
         cleanDB();
         addCurrentFolders();
     }
@@ -1534,20 +2270,21 @@ void Database::addCurrentFolders()
 
 void Database::scheduleUncompletedEmbeddings()
 {
-    QHash<IncompleteChunk, QStringList> chunkList;
+    // map of (folder_id, collection) -> incomplete count
+    QMap<QPair<int, QString>, int> itemNIncomplete;
     QSqlQuery q(m_db);
-    if (!selectAllUncompletedChunks(q, chunkList)) {
-        qWarning() << "ERROR: Cannot select uncompleted chunks" << q.lastError();
+    if (!countUncompletedChunks(q, itemNIncomplete)) {
+        qWarning() << "ERROR: Cannot count uncompleted chunks" << q.lastError();
         return;
     }
 
-    if (chunkList.isEmpty())
+    if (itemNIncomplete.isEmpty())
         return;
 
     // map of folder_id -> chunk count
     QMap<int, int> folderNChunks;
-    for (auto it = chunkList.keyBegin(), end = chunkList.keyEnd(); it != end; ++it) {
-        int folder_id = it->folder_id;
+    for (auto it = itemNIncomplete.keyBegin(), end = itemNIncomplete.keyEnd(); it != end; ++it) {
+        int folder_id = it->first;
 
         if (folderNChunks.contains(folder_id)) continue;
         int total = 0;
@@ -1558,12 +2295,6 @@ void Database::scheduleUncompletedEmbeddings()
         folderNChunks.insert(folder_id, total);
     }
 
-    // map of (folder_id, collection) -> incomplete count
-    QMap<QPair<int, QString>, int> itemNIncomplete;
-    for (const auto &[chunk, collections]: std::as_const(chunkList).asKeyValueRange())
-        for (const auto &collection: std::as_const(collections))
-            itemNIncomplete[{ chunk.folder_id, collection }]++;
-
     for (const auto &[key, nIncomplete]: std::as_const(itemNIncomplete).asKeyValueRange()) {
         const auto &[folder_id, collection] = key;
 
@@ -1576,12 +2307,34 @@ void Database::scheduleUncompletedEmbeddings()
         updateGuiForCollectionItem(item);
     }
 
-    for (auto it = chunkList.keyBegin(), end = chunkList.keyEnd(); it != end;) {
-        QList<EmbeddingChunk> batch;
-        for (; it != end && batch.size() < s_batchSize; ++it)
-            batch.append({ /*model*/ it->embedding_model, /*folder_id*/ it->folder_id, /*chunk_id*/ it->chunk_id, /*chunk*/ it->text });
-        Q_ASSERT(!batch.isEmpty());
-        m_embLLM->generateDocEmbeddingsAsync(batch);
+    // chunks written from now on are embedded as they are scanned, so stop at the last one there is now
+    if (!selectMaxChunkId(q, m_uncompletedMaxChunkId)) {
+        qWarning() << "ERROR: Cannot select the last chunk" << q.lastError();
+        m_uncompletedMaxChunkId = -1;
+        return;
+    }
+    m_uncompletedCursor = { -1, QString() };
+    queueUncompletedEmbeddings();
+}
+
+// Queues the chunks left without embeddings by an earlier run a page at a time, whenever the backlog drops below half
+// of its limit, rather than reading the text of all of them at once.
+void Database::queueUncompletedEmbeddings()
+{
+    while (m_uncompletedMaxChunkId != -1 && m_embeddingQueueBytes < s_maxEmbeddingQueueBytes / 2) {
+        QSqlQuery q(m_db);
+        QList<EmbeddingChunk> chunks;
+        if (!selectUncompletedChunks(q, m_uncompletedCursor, m_uncompletedMaxChunkId, s_uncompletedPageSize, chunks)) {
+            qWarning() << "ERROR: Cannot select uncompleted chunks" << q.lastError();
+            m_uncompletedMaxChunkId = -1;
+            return;
+        }
+        if (chunks.size() < s_uncompletedPageSize)
+            m_uncompletedMaxChunkId = -1; // that was the last page
+        if (chunks.isEmpty())
+            return;
+        m_uncompletedCursor = { chunks.last().chunk_id, chunks.last().model };
+        queueEmbeddings(chunks);
     }
 }
 
@@ -1653,6 +2406,7 @@ void Database::forceIndexing(const QString &collection, const QString &embedding
                              << q.lastError();
         return;
     }
+    m_collectionFoldersStale = true;
 
     for (const auto &folder: std::as_const(folders)) {
         CollectionItem item = guiCollectionItem(folder.first);
@@ -1681,6 +2435,7 @@ void Database::forceRebuildFolder(const QString &path)
         qWarning().nospace() << "Database ERROR: Cannot remove chunks for folder " << path << ": " << q.lastError();
         return rollback();
     }
+    m_removedFolders.append(folder_id);
 
     commit();
 
@@ -1729,6 +2484,7 @@ bool Database::addFolder(const QString &collection, const QString &path, const Q
 
     // add the new collection item to the UI
     if (res == 1) { // new item added
+        m_collectionFoldersStale = true;
         item->folder_path = path;
         item->folder_id = folder_id;
         addGuiCollectionItem(item.value());
@@ -1785,6 +2541,7 @@ bool Database::removeFolderInternal(const QString &collection, int folder_id, co
         return false;
     }
     removeGuiFolderById(collection, folder_id);
+    m_collectionFoldersStale = true;
 
     if (!sqlPruneCollections(q)) {
         qWarning() << "Database ERROR: Cannot prune collections:" << q.lastError();
@@ -1809,7 +2566,7 @@ bool Database::removeFolderInternal(const QString &collection, int folder_id, co
 
     // Remove all chunks and documents associated with this folder
     for (int document_id: std::as_const(documentIds)) {
-        if (!removeChunksByDocumentId(q, document_id)) {
+        if (!removeChunksByDocumentId(q, document_id, m_removedChunks, m_removedEmbeddings)) {
             qWarning() << "ERROR: Cannot remove chunks of document_id" << document_id << q.lastError();
             return false;
         }
@@ -1824,6 +2581,7 @@ bool Database::removeFolderInternal(const QString &collection, int folder_id, co
         qWarning() << "ERROR: Cannot remove folder_id" << folder_id << q.lastError();
         return false;
     }
+    m_removedFolders.append(folder_id);
 
     m_collectionMap.remove(folder_id);
     removeFolderFromWatch(path);
@@ -1858,83 +2616,233 @@ void Database::removeFolderFromWatch(const QString &path)
     m_watchedPaths -= QSet(children.begin(), children.end());
 }
 
-QList<int> Database::searchEmbeddings(const std::vector<float> &query, const QList<QString> &collections, int nNeighbors)
+static float innerProductDistance(const float *a, const float *b, int n_embd)
+{
+    float dot = 0.0f;
+    for (int i = 0; i < n_embd; i++)
+        dot += a[i] * b[i];
+    return 1.0f - dot;
+}
+
+// The chunks with the k smallest distances, nearest first.
+static QList<int> nearestChunks(QList<QPair<int, float>> &results, int k)
 {
-    constexpr int BATCH_SIZE = 2048;
+    k = qMin(k, int(results.size()));
+    std::partial_sort(
+        results.begin(), results.begin() + k, results.end(),
+        [](const auto &a, const auto &b) { return a.second < b.second; }
+    );
 
-    const int n_embd = query.size();
-    const us::metric_punned_t metric(n_embd, us::metric_kind_t::ip_k); // inner product
+    QList<int> chunkIds;
+    chunkIds.reserve(k);
+    for (int i = 0; i < k; i++)
+        chunkIds << results[i].first;
+    return chunkIds;
+}
 
-    QSqlQuery q(m_db);
-    if (!q.exec(GET_COLLECTION_EMBEDDINGS_SQL.arg(collections.join("', '")))) {
-        qWarning() << "Database ERROR: Failed to exec embeddings query:" << q.lastError();
-        return {};
+QList<int> fuseRankings(std::initializer_list<QList<int>> rankings, int n)
+{
+    constexpr double RRF_K = 60.0;
+
+    QHash<int, double> scores;
+    for (const auto &ranking: rankings) {
+        for (qsizetype rank = 0; rank < ranking.size(); rank++)
+            scores[ranking[rank]] += 1.0 / (RRF_K + double(rank + 1));
     }
 
-    us::executor_default_t executor(std::thread::hardware_concurrency());
-    us::exact_search_t search;
+    QList<QPair<int, float>> results;
+    results.reserve(scores.size());
+    for (const auto &[chunk_id, score]: scores.asKeyValueRange())
+        results.append({ chunk_id, float(-score) });
+    return nearestChunks(results, n);
+}
 
-    QList<int> batchChunkIds;
-    QList<float> batchEmbeddings;
-    batchChunkIds.reserve(BATCH_SIZE);
-    batchEmbeddings.reserve(BATCH_SIZE * n_embd);
+// whether a recall measurement is running, so that they do not pile up behind a slow one
+static std::atomic<bool> s_measuringRecall = false;
 
-    struct Result { int chunkId; us::distance_punned_t dist; };
-    QList<Result> results;
+// Records the recall@k of a quantized search, the share of the chunks an exact search finds that it found too. Reads
+// the embeddings through a connection of its own, so that it can run on any thread.
+static void measureQuantizedRecall(const QString &dbPath, const std::vector<float> &query,
+                                   const QList<EmbeddingIndex::Key> &folders, const QList<int> &found)
+{
+    const QString connection = u"recall"_s;
+    QList<QPair<int, float>> exact;
+    bool ok = true;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connection);
+        db.setDatabaseName(dbPath);
+        ok = db.open();
+        if (!ok)
+            qWarning() << "Database ERROR: failed to open the database to measure recall:" << db.lastError();
+        for (const auto &[model, folder_id]: folders) {
+            if (!ok)
+                break;
+            ok = readFolderEmbeddings(db, model, folder_id, int(query.size()),
+                                      [&](int chunk_id, const float *embedding, int n_embd) {
+                exact.append({ chunk_id, innerProductDistance(query.data(), embedding, n_embd) });
+                return true;
+            });
+        }
+    }
+    QSqlDatabase::removeDatabase(connection);
+    if (!ok)
+        return;
 
-    while (q.at() != QSql::AfterLastRow) { // batches
-        batchChunkIds.clear();
-        batchEmbeddings.clear();
+    const QList<int> expected = nearestChunks(exact, int(found.size()));
+    if (expected.isEmpty())
+        return;
+    const QSet<int> foundSet(found.begin(), found.end());
+    const auto hits = std::ranges::count_if(expected, [&](int chunk_id) { return foundSet.contains(chunk_id); });
+    const double recall = double(hits) / double(expected.size());
+#if defined(DEBUG)
+    qDebug() << "measureQuantizedRecall" << recall;
+#endif
+    Metrics::globalInstance()->quantizedRecall.observe(recall);
+}
 
-        while (batchChunkIds.count() < BATCH_SIZE && q.next()) { // batch
-            batchChunkIds << q.value(0).toInt();
-            batchEmbeddings.resize(batchEmbeddings.size() + n_embd);
-            QVariant embdCol = q.value(1);
-            if (embdCol.userType() != QMetaType::QByteArray) {
-                qWarning() << "Database ERROR: Expected embedding to be blob, got" << embdCol.userType();
-                return {};
-            }
-            auto *embd = static_cast<const QByteArray *>(embdCol.constData());
-            const int embd_stride = n_embd * sizeof(float);
-            if (embd->size() != embd_stride) {
-                qWarning() << "Database ERROR: Expected embedding to be" << embd_stride << "bytes, got"
-                           << embd->size();
-                return {};
-            }
-            memcpy(&*(batchEmbeddings.end() - n_embd), embd->constData(), embd_stride);
-        }
+// Searches the embedding indexes of the folders of the collections, unless the collections are small enough for an
+// exact search to be fast, or one of their indexes cannot be used. The exact search scans the cached embeddings of the
+// folders, which are loaded from the database the first time they are searched.
+QList<int> Database::searchEmbeddings(const std::vector<float> &query, const QList<QString> &collections, int nNeighbors)
+{
+    // below this many embeddings, a search of the indexes is not worth the loss of recall
+    constexpr qsizetype EXACT_SEARCH_LIMIT = 16384;
+    // candidates whose quantized distances are replaced with exact ones: of each cached folder, from the full
+    // embeddings in the cache, and of all the indexes together, from the embeddings in the database
+    constexpr int RERANK_CANDIDATES = 256;
+    // one in this many quantized searches is compared with an exact search
+    constexpr quint64 RECALL_SAMPLE_INTERVAL = 32;
 
-        int nBatch = batchChunkIds.count();
-        if (!nBatch)
-            break;
+    if (m_collectionFoldersStale && !loadCollectionFolders())
+        return {};
 
-        // get top-k nearest neighbors of this batch
-        int kBatch = qMin(nNeighbors, nBatch);
-        us::exact_search_results_t batchResults = search(
-            (us::byte_t const *)batchEmbeddings.data(), nBatch, n_embd * sizeof(float),
-            (us::byte_t const *)query.data(),           1,      n_embd * sizeof(float),
-            kBatch, metric
-        );
+    // indexes of another quantization are rebuilt, and their folders searched exhaustively until then
+    const auto quantization = embeddingQuantization();
+    if (m_embeddingIndex && m_embeddingIndex->quantization() != quantization)
+        requantizeEmbeddingIndexes(quantization);
+    const bool quantized = quantization != EmbeddingCache::Quantization::None;
+
+    // the folders of the collections with embeddings, each once, and how many
+    std::map<EmbeddingIndex::Key, qsizetype> folders;
+    for (const QString &collection: collections) {
+        for (const auto &key: m_collectionFolders.value(collection)) {
+            auto it = m_embeddingCounts.find(key);
+            if (it != m_embeddingCounts.end() && it->second > 0)
+                folders.emplace(key, it->second);
+        }
+    }
 
-        for (int i = 0; i < kBatch; ++i) {
-            auto offset = batchResults.at(0)[i].offset;
-            us::distance_punned_t distance = batchResults.at(0)[i].distance;
-            results.append({batchChunkIds[offset], distance});
+    qsizetype total = 0;
+    bool useIndexes = bool(m_embeddingIndex);
+    for (const auto &[key, count]: folders) {
+        // an index that does not match the database, after an error, would miss results
+        if (useIndexes && m_embeddingIndex->size(key) != count)
+            useIndexes = false;
+        total += count;
+    }
+    if (total < EXACT_SEARCH_LIMIT)
+        useIndexes = false;
+
+    const auto *mySettings = MySettings::globalInstance();
+    const int expansion = mySettings->localDocsSearchExpansion();
+    bool cacheChanged = false;
+    if (!useIndexes) {
+        cacheChanged = quantization != m_embeddingCache->quantization();
+        m_embeddingCache->setQuantization(quantization);
+    }
+
+    QList<QPair<int, float>> results;
+    QHash<int, QString> models; // of the chunks found in quantized indexes, to re-rank them
+    for (const auto &key: std::views::keys(folders)) {
+        std::optional<QList<QPair<int, float>>> found;
+        if (useIndexes) {
+            found = m_embeddingIndex->search(key, query, quantized ? qMax(nNeighbors, RERANK_CANDIDATES) : nNeighbors,
+                                             expansion);
+            if (found && quantized) {
+                for (const auto &result: std::as_const(*found))
+                    models.insert(result.first, key.first);
+            }
+        } else {
+            // a cached folder is kept complete as embeddings are added and removed
+            if (!m_embeddingCache->contains(key)) {
+                if (!loadEmbeddingCache(key.first, key.second, int(query.size())))
+                    return {};
+                cacheChanged = true;
+            }
+            found = m_embeddingCache->search(key, query, nNeighbors, RERANK_CANDIDATES);
         }
+        if (!found)
+            return {};
+        results.append(*found);
     }
+    if (useIndexes && quantized && !rerankEmbeddings(query, models, results, RERANK_CANDIDATES))
+        return {};
+    if (m_embeddingCache->evict())
+        cacheChanged = true;
+    if (cacheChanged)
+        reportEmbeddingCacheMemory();
+
+    QList<int> chunkIds = nearestChunks(results, nNeighbors);
+
+    // compare a sample of the quantized searches with exact ones, on a thread of its own so that the exact search
+    // does not hold up the database thread, and one at a time
+    if (quantized && ++m_quantizedSearches % RECALL_SAMPLE_INTERVAL == 0 && !s_measuringRecall.exchange(true)) {
+        QList<EmbeddingIndex::Key> keys;
+        for (const auto &folder: std::as_const(folders))
+            keys.append(folder.first);
+        QThreadPool::globalInstance()->start([dbPath = m_db.databaseName(), query, keys, chunkIds] {
+            measureQuantizedRecall(dbPath, query, keys, chunkIds);
+            s_measuringRecall = false;
+        });
+    }
+    return chunkIds;
+}
 
-    // get top-k nearest neighbors of combined results
-    nNeighbors = qMin(nNeighbors, results.size());
+// Keeps the candidates of quantized indexes with the nearest approximate distances, and replaces those with the
+// distances of the embeddings in the database, reading them with a query per embedding model.
+bool Database::rerankEmbeddings(const std::vector<float> &query, const QHash<int, QString> &models,
+                                QList<QPair<int, float>> &candidates, int nCandidates)
+{
+    const qsizetype n = qMin(candidates.size(), qsizetype(nCandidates));
     std::partial_sort(
-        results.begin(), results.begin() + nNeighbors, results.end(),
-        [](const Result &a, const Result &b) { return a.dist < b.dist; }
+        candidates.begin(), candidates.begin() + n, candidates.end(),
+        [](const auto &a, const auto &b) { return a.second < b.second; }
     );
+    candidates.resize(n);
 
-    QList<int> chunkIds;
-    chunkIds.reserve(nNeighbors);
-    for (int i = 0; i < nNeighbors; i++)
-        chunkIds << results[i].chunkId;
-    return chunkIds;
+    QHash<QString, QStringList> idsByModel;
+    QHash<int, qsizetype> candidateIndex;
+    for (qsizetype i = 0; i < candidates.size(); i++) {
+        idsByModel[models.value(candidates[i].first)] << QString::number(candidates[i].first);
+        candidateIndex.insert(candidates[i].first, i);
+    }
+
+    QSqlQuery q(m_db);
+    q.setForwardOnly(true);
+    for (const auto &[model, ids]: idsByModel.asKeyValueRange()) {
+        if (!q.prepare(GET_EMBEDDINGS_BY_CHUNK_SQL.arg(ids.join(", ")))) {
+            qWarning() << "Database ERROR: failed to prepare re-ranking query:" << q.lastError();
+            return false;
+        }
+        q.addBindValue(model);
+        if (!q.exec()) {
+            qWarning() << "Database ERROR: failed to exec re-ranking query:" << q.lastError();
+            return false;
+        }
+
+        while (q.next()) {
+            auto embd = q.value(1).toByteArray();
+            if (qsizetype(embd.size()) != qsizetype(query.size() * sizeof(float))) {
+                qWarning() << "Database ERROR: Expected embedding to be" << query.size() * sizeof(float)
+                           << "bytes, got" << embd.size();
+                return false;
+            }
+            candidates[candidateIndex.value(q.value(0).toInt())].second = innerProductDistance(
+                query.data(), reinterpret_cast<const float *>(embd.constData()), int(query.size())
+            );
+        }
+    }
+    return true;
 }
 
 void Database::retrieveFromDB(const QList<QString> &collections, const QString &text, int retrievalSize,
@@ -1944,26 +2852,48 @@ void Database::retrieveFromDB(const QList<QString> &collections, const QString &
     qDebug() << "retrieveFromDB" << collections << text << retrievalSize;
 #endif
 
-    std::vector<float> queryEmbd = m_embLLM->generateQueryEmbedding(text);
-    if (queryEmbd.empty()) {
-        qDebug() << "ERROR: generating embeddings returned a null result";
-        return;
+    QElapsedTimer timer;
+    timer.start();
+    // also record the searches that fail or find nothing
+    auto recordLatency = qScopeGuard([&timer] {
+        Metrics::globalInstance()->retrieval.observe(timer.nsecsElapsed() / 1e9);
+    });
+
+    // candidates of each ranking that take part in the fusion
+    const int depth = qMax(retrievalSize * 4, 20);
+
+    QSqlQuery q(m_db);
+    QList<int> keywordResults;
+    if (m_fullTextSearch && !sqlKeywordSearch(q, collections, text, depth, &keywordResults)) {
+        qWarning() << "Database ERROR: keyword search failed:" << q.lastError();
+        keywordResults.clear();
+    }
+
+    // keywords alone rather than waiting for the embedding model to load, which is then loaded for the next queries
+    QList<int> vectorResults;
+    if (!keywordResults.isEmpty() && !m_embLLM->hasModel()) {
+        m_embLLM->loadModelAsync();
+    } else {
+        std::vector<float> queryEmbd = m_embLLM->generateQueryEmbedding(text);
+        if (queryEmbd.empty()) {
+            qDebug() << "ERROR: generating embeddings returned a null result";
+        } else {
+            vectorResults = searchEmbeddings(queryEmbd, collections, depth);
+        }
     }
 
-    QList<int> searchResults = searchEmbeddings(queryEmbd, collections, retrievalSize);
+    const QList<int> searchResults = fuseRankings({ vectorResults, keywordResults }, retrievalSize);
     if (searchResults.isEmpty())
         return;
 
-    QSqlQuery q(m_db);
     if (!selectChunk(q, searchResults, retrievalSize)) {
         qDebug() << "ERROR: selecting chunks:" << q.lastError();
         return;
     }
 
+    QList<std::pair<qsizetype, ResultInfo>> ranked;
     while (q.next()) {
-#if defined(DEBUG)
         const int rowid = q.value(0).toInt();
-#endif
         const QString document_path = q.value(2).toString();
         const QString chunk_text = q.value(3).toString();
         const QString date = QDateTime::fromMSecsSinceEpoch(q.value(1).toLongLong()).toString("yyyy, MMMM dd");
@@ -1985,17 +2915,21 @@ void Database::retrieveFromDB(const QList<QString> &collections, const QString &
         info.page = page;
         info.from = from;
         info.to = to;
-        results->append(info);
+        ranked.append({ searchResults.indexOf(rowid), info });
 #if defined(DEBUG)
         qDebug() << "retrieve rowid:" << rowid
                  << "chunk_text:" << chunk_text;
 #endif
     }
+
+    // best first
+    std::ranges::stable_sort(ranked, {}, [](const auto &r) { return r.first; });
+    for (auto &[rank, info]: ranked)
+        results->append(std::move(info));
 }
 
-// FIXME This is very slow and non-interruptible and when we close the application and we're
-// cleaning a large table this can cause the app to take forever to shut down. This would ideally be
-// interruptible and we'd continue 'cleaning' when we restart
+// Removes the folders that no longer exist or have become unreadable. Their documents that no longer exist are removed
+// by scanDocuments, which compares the files of a folder with the states recorded when they were indexed.
 bool Database::cleanDB()
 {
 #if defined(DEBUG)
@@ -2026,45 +2960,6 @@ bool Database::cleanDB()
         }
     }
 
-    // Scan all documents in db to make sure they still exist
-    if (!q.prepare(SELECT_ALL_DOCUMENTS_SQL)) {
-        qWarning() << "ERROR: Cannot prepare sql for select all documents" << q.lastError();
-        rollback();
-        return false;
-    }
-
-    if (!q.exec()) {
-        qWarning() << "ERROR: Cannot exec sql for select all documents" << q.lastError();
-        rollback();
-        return false;
-    }
-
-    while (q.next()) {
-        int document_id = q.value(0).toInt();
-        QString document_path = q.value(1).toString();
-        QFileInfo info(document_path);
-        if (info.exists() && info.isReadable() && m_scannedFileExtensions.contains(info.suffix()))
-            continue;
-
-#if defined(DEBUG)
-        qDebug() << "clean db removing document" << document_id << document_path;
-#endif
-
-        // Remove all chunks and documents that either don't exist or have become unreadable
-        QSqlQuery query(m_db);
-        if (!removeChunksByDocumentId(query, document_id)) {
-            qWarning() << "ERROR: Cannot remove chunks of document_id" << document_id << query.lastError();
-            rollback();
-            return false;
-        }
-
-        if (!removeDocument(query, document_id)) {
-            qWarning() << "ERROR: Cannot remove document_id" << document_id << query.lastError();
-            rollback();
-            return false;
-        }
-    }
-
     commit();
     return true;
 }
@@ -2096,7 +2991,7 @@ void Database::changeChunkSize(int chunkSize)
         int document_id = q.value(0).toInt();
         // Remove all chunks and documents to change the chunk size
         QSqlQuery query(m_db);
-        if (!removeChunksByDocumentId(query, document_id)) {
+        if (!removeChunksByDocumentId(query, document_id, m_removedChunks, m_removedEmbeddings)) {
             qWarning() << "ERROR: Cannot remove chunks of document_id" << document_id << query.lastError();
             return rollback();
         }
@@ -4,15 +4,18 @@
 #include "embllm.h" // IWYU pragma: keep
 
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QFileInfo>
 #include <QHash>
 #include <QLatin1String>
 #include <QList>
 #include <QMap>
 #include <QObject>
+#include <QPair>
 #include <QQueue>
 #include <QSet>
 #include <QSqlDatabase>
+#include <QSqlQuery>
 #include <QString>
 #include <QStringList>
 #include <QThread>
@@ -20,13 +23,22 @@
 #include <QVector>
 
 #include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
 
 using namespace Qt::Literals::StringLiterals;
 
-class QFileSystemWatcher;
+class EmbeddingCache;
+class EmbeddingIndex;
+class FolderWatcher;
 class QSqlError;
-class QTextStream;
+class QThreadPool;
 class QTimer;
+struct ParsedDocument;
 
 /* Version 0: GPT4All v2.4.3, full-text search
  * Version 1: GPT4All v2.5.3, embeddings in hsnwlib
@@ -42,6 +54,7 @@ struct DocumentInfo
     int folder;
     QFileInfo doc;
     int currentPage = 0;
+    int pageCount = -1; // of a PDF, once its first page was parsed
     size_t currentPosition = 0;
     bool currentlyProcessing = false;
     bool isPdf() const {
@@ -107,6 +120,9 @@ public:
 
 Q_DECLARE_METATYPE(ResultInfo)
 
+// Reciprocal rank fusion: the chunks with the best sum of 1 / (k + rank) over the rankings, best first.
+QList<int> fuseRankings(std::initializer_list<QList<int>> rankings, int n);
+
 struct CollectionItem {
     // -- Fields persisted to database --
 
@@ -130,6 +146,8 @@ struct CollectionItem {
     size_t totalBytesToIndex = 0;
     size_t currentEmbeddingsToIndex = 0;
     size_t totalEmbeddingsToIndex = 0;
+    qint64 embeddingQueueBytes = 0; // of the text of the chunks waiting for their embeddings
+    qint64 indexingStallMs = 0;     // time indexing waited for the embeddings to catch up
 
     // statistics
     size_t totalDocs = 0;
@@ -186,13 +204,27 @@ private:
     int openDatabase(const QString &modelPath, bool create = true, int ver = LOCALDOCS_VERSION);
     bool openLatestDb(const QString &modelPath, QList<CollectionItem> &oldCollections);
     bool initDb(const QString &modelPath, const QList<CollectionItem> &oldCollections);
+    void initFullTextSearch();
+    bool initFileStates();
+    void loadEmbeddingCounts();
+    bool loadCollectionFolders();
+    void openEmbeddingIndexes(const QString &modelPath);
+    bool readEmbeddings(const QString &embedding_model, int folder_id, int n_embd,
+                        const std::function<bool(int chunk_id, const float *embedding, int n_embd)> &add);
+    bool rebuildEmbeddingIndex(const QString &embedding_model, int folder_id);
+    void rebuildNextEmbeddingIndex();
+    void requantizeEmbeddingIndexes(EmbeddingCache::Quantization quantization);
+    bool loadEmbeddingCache(const QString &embedding_model, int folder_id, int n_embd);
+    void reportEmbeddingCacheMemory();
+    void applyEmbeddingIndexChanges();
     int checkAndAddFolderToDB(const QString &path);
     bool removeFolderInternal(const QString &collection, int folder_id, const QString &path);
-    size_t chunkStream(QTextStream &stream, int folder_id, int document_id, const QString &embedding_model,
-        const QString &file, const QString &title, const QString &author, const QString &subject,
-        const QString &keywords, int page, int maxChunks = -1);
     void appendChunk(const EmbeddingChunk &chunk);
     void sendChunkList();
+    void queueEmbeddings(const QList<EmbeddingChunk> &chunks);
+    void sendEmbeddings();
+    void releaseEmbeddings(const QList<EmbeddingChunk> &chunks);
+    bool embeddingQueueFull() const;
     void updateFolderToIndex(int folder_id, size_t countForFolder, bool sendChunks = true);
     void handleDocumentError(const QString &errorMessage,
         int document_id, const QString &document_path, const QSqlError &error);
@@ -203,10 +235,15 @@ private:
     void enqueueDocumentInternal(const DocumentInfo &info, bool prepend = false);
     void enqueueDocuments(int folder_id, const QVector<DocumentInfo> &infos);
     void scanQueue();
+    void handleDocumentParsed(ParsedDocument parsed);
+    void writeParsedDocuments();
+    void writeParsedDocument(const ParsedDocument &parsed);
     bool cleanDB();
     void addFolderToWatch(const QString &path);
     void removeFolderFromWatch(const QString &path);
     QList<int> searchEmbeddings(const std::vector<float> &query, const QList<QString> &collections, int nNeighbors);
+    bool rerankEmbeddings(const std::vector<float> &query, const QHash<int, QString> &models,
+                          QList<QPair<int, float>> &candidates, int nCandidates);
 
     void setStartUpdateTime(CollectionItem &item);
     void setLastUpdateTime(CollectionItem &item);
@@ -217,22 +254,51 @@ private:
     void removeGuiFolderById(const QString &collection, int folder_id);
     void guiCollectionListUpdated(const QList<CollectionItem> &collectionList);
     void scheduleUncompletedEmbeddings();
+    void queueUncompletedEmbeddings();
     void updateCollectionStatistics();
 
 private:
     QSqlDatabase m_db;
+    std::map<QString, QSqlQuery> m_preparedQueries; // by their SQL, for the statements run for every chunk or embedding
     int m_chunkSize;
     QStringList m_scannedFileExtensions;
     QTimer *m_scanTimer;
     QMap<int, QQueue<DocumentInfo>> m_docsToScan;
+    QThreadPool *m_parserPool;
+    int m_parsing = 0;               // documents given to the parsers and not yet written
+    QHash<int, int> m_parsingFolders; // likewise, by folder
+    std::vector<ParsedDocument> m_parsedDocuments; // waiting to be written
+    QTimer *m_writeTimer;
     QList<ResultInfo> m_retrieve;
     QThread m_dbThread;
-    QFileSystemWatcher *m_watcher;
+    FolderWatcher *m_watcher;
     QSet<QString> m_watchedPaths;
     EmbeddingLLM *m_embLLM;
     QVector<EmbeddingChunk> m_chunkList;
+    QQueue<EmbeddingChunk> m_embeddingBacklog; // chunks to send once the embeddings in flight come back
+    QHash<std::pair<QString, int>, qsizetype> m_embeddingsInFlight; // bytes of text by (model, chunk_id)
+    qint64 m_embeddingsInFlightBytes = 0;
+    qint64 m_embeddingQueueBytes = 0; // of the backlog and the embeddings in flight
+    QElapsedTimer m_stallTimer;       // valid while scanning waits for the embeddings to catch up
+    std::pair<int, QString> m_uncompletedCursor; // (chunk_id, model) of the last chunk without embeddings queued
+    int m_uncompletedMaxChunkId = -1;            // last chunk to queue that way, or -1 once all of them are
     QHash<int, CollectionItem> m_collectionMap; // used only for tracking indexing/embedding progress
     std::atomic<bool> m_databaseValid;
+    std::unique_ptr<EmbeddingCache> m_embeddingCache;
+    quint64 m_quantizedSearches = 0;
+    bool m_fullTextSearch = false; // whether the database has the full-text index of the chunks
+    std::unique_ptr<EmbeddingIndex> m_embeddingIndex; // null if the database could not be opened
+    QTimer *m_indexSaveTimer;
+    QTimer *m_indexRebuildTimer;
+    QList<std::pair<QString, int>> m_staleIndexes; // embedding indexes to rebuild, dropped until then
+    // embeddings in the database by (embedding model, folder_id), kept up to date so that searches need not count them
+    std::map<std::pair<QString, int>, qsizetype> m_embeddingCounts;
+    // (embedding model, folder_id) of the folders each collection searches, read again once they change
+    QHash<QString, QList<std::pair<QString, int>>> m_collectionFolders;
+    bool m_collectionFoldersStale = true;
+    QList<int> m_removedChunks;  // to remove from the indexes once the transaction is committed
+    QList<int> m_removedFolders; // likewise
+    std::map<std::pair<QString, int>, qsizetype> m_removedEmbeddings; // likewise, from the counts
 };
 
 #endif // DATABASE_H
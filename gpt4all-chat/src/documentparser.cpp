@@ -0,0 +1,239 @@
+#include "documentparser.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <QIODevice>
+#include <QPdfDocument>
+#include <QPdfSelection>
+#include <QTextStream>
+#include <QtLogging>
+
+#include <QDebug>
+
+#include <algorithm>
+#include <list>
+#include <memory>
+
+using namespace Qt::Literals::StringLiterals;
+
+//#define DEBUG
+
+namespace {
+
+/* QFile that checks input for binary data. If seen, it fails the read and returns true
+ * for binarySeen(). */
+class BinaryDetectingFile: public QFile {
+public:
+    using QFile::QFile;
+
+    bool binarySeen() const { return m_binarySeen; }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override {
+        qint64 res = QFile::readData(data, maxSize);
+        return checkData(data, res);
+    }
+
+    qint64 readLineData(char *data, qint64 maxSize) override {
+        qint64 res = QFile::readLineData(data, maxSize);
+        return checkData(data, res);
+    }
+
+private:
+    qint64 checkData(const char *data, qint64 size) {
+        Q_ASSERT(!isTextModeEnabled()); // We need raw bytes from the underlying QFile
+        if (size != -1 && !m_binarySeen) {
+            for (qint64 i = 0; i < size; i++) {
+                /* Control characters we should never see in plain text:
+                 * 0x00 NUL - 0x06 ACK
+                 * 0x0E SO  - 0x1A SUB
+                 * 0x1C FS  - 0x1F US */
+                auto c = static_cast<unsigned char>(data[i]);
+                if (c < 0x07 || (c >= 0x0E && c < 0x1B) || (c >= 0x1C && c < 0x20)) {
+                    m_binarySeen = true;
+                    break;
+                }
+            }
+        }
+        return m_binarySeen ? -1 : size;
+    }
+
+    bool m_binarySeen = false;
+};
+
+/* The PDFs a parser thread has open, the most recently used first, so that a document is loaded once rather than once
+ * per page. Keyed by path and modification time so that a changed file is loaded again. */
+class PdfCache {
+public:
+    QPdfDocument *open(const QString &path, qint64 time) {
+        auto it = std::ranges::find_if(m_entries, [&](auto &e) { return e.path == path && e.time == time; });
+        if (it != m_entries.end()) {
+            m_entries.splice(m_entries.begin(), m_entries, it);
+            return m_entries.front().doc.get();
+        }
+
+        auto doc = std::make_unique<QPdfDocument>();
+        if (QPdfDocument::Error::None != doc->load(path))
+            return nullptr;
+        close(path); // an older version
+        if (m_entries.size() >= s_capacity)
+            m_entries.pop_back();
+        m_entries.push_front({ path, time, std::move(doc) });
+        return m_entries.front().doc.get();
+    }
+
+    void close(const QString &path) {
+        m_entries.remove_if([&](auto &e) { return e.path == path; });
+    }
+
+private:
+    static constexpr std::size_t s_capacity = 4;
+
+    struct Entry {
+        QString                       path;
+        qint64                        time;
+        std::unique_ptr<QPdfDocument> doc;
+    };
+    std::list<Entry> m_entries;
+};
+
+thread_local PdfCache t_pdfCache;
+
+} // namespace
+
+// Splits the words of the stream into chunks of up to chunkSize characters. Returns false if the stream fails.
+static bool chunkStream(QTextStream &stream, int chunkSize, int page, int maxChunks, QList<ParsedChunk> &chunks)
+{
+    int charCount = 0;
+    QList<QString> words;
+    int nChunks = 0;
+
+    for (;;) {
+        QString word;
+        stream >> word;
+        if (stream.status() && !stream.atEnd())
+            return false;
+        charCount += word.length();
+        if (!word.isEmpty())
+            words.append(word);
+        if (stream.status() || charCount + words.size() - 1 >= chunkSize) {
+            if (!words.isEmpty()) {
+                chunks.append({ words.join(" "), int(words.size()), page });
+                ++nChunks;
+                words.clear();
+                charCount = 0;
+            }
+
+            if (stream.status() || (maxChunks > 0 && nChunks == maxChunks))
+                break;
+        }
+    }
+    return true;
+}
+
+static void parsePdfPage(ParsedDocument &result)
+{
+    DocumentInfo &info = result.job.info;
+    const QString path = info.doc.canonicalFilePath();
+
+    const qint64 time = info.doc.fileTime(QFile::FileModificationTime).toMSecsSinceEpoch();
+    QPdfDocument *doc = t_pdfCache.open(path, time);
+    if (!doc) {
+        result.status = ParsedDocument::Status::Error;
+        result.error = u"ERROR: Could not load pdf"_s;
+        return;
+    }
+
+    const size_t bytes = info.doc.size();
+    const int pageCount = doc->pageCount();
+    const int pageIndex = info.currentPage;
+    info.pageCount = pageCount;
+    if (pageIndex >= pageCount) {
+        t_pdfCache.close(path);
+        result.bytesParsed = pageCount ? 0 : bytes;
+        result.finished = true;
+        return;
+    }
+#if defined(DEBUG)
+    qDebug() << "scanning page" << pageIndex << "of" << pageCount << path;
+#endif
+
+    result.title    = doc->metaData(QPdfDocument::MetaDataField::Title).toString();
+    result.author   = doc->metaData(QPdfDocument::MetaDataField::Author).toString();
+    result.subject  = doc->metaData(QPdfDocument::MetaDataField::Subject).toString();
+    result.keywords = doc->metaData(QPdfDocument::MetaDataField::Keywords).toString();
+
+    QString text = doc->getAllText(pageIndex).text();
+    QTextStream stream(&text);
+    chunkStream(stream, result.job.chunkSize, pageIndex + 1, -1 /*maxChunks*/, result.chunks);
+
+    // the progress of a PDF is counted in equal shares of its size per page
+    const size_t bytesPerPage = bytes / pageCount;
+    result.finished = pageIndex + 1 >= pageCount;
+    if (result.finished)
+        t_pdfCache.close(path);
+    result.bytesParsed = result.finished ? bytes - bytesPerPage * (pageCount - 1) : bytesPerPage;
+    info.currentPage = pageIndex + 1;
+}
+
+static void parseTextSlice(ParsedDocument &result)
+{
+    constexpr int MAX_CHUNKS = 100;
+
+    DocumentInfo &info = result.job.info;
+    const QString path = info.doc.canonicalFilePath();
+
+    BinaryDetectingFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        result.status = ParsedDocument::Status::Error;
+        result.error = u"ERROR: Cannot open file for scanning"_s;
+        return;
+    }
+    Q_ASSERT(!file.isSequential()); // we need to seek
+
+    QTextStream stream(&file);
+    const size_t byteIndex = info.currentPosition;
+    if (byteIndex) {
+        /* Read the Unicode BOM to detect the encoding. Without this, QTextStream will
+         * always interpret the text as UTF-8 when byteIndex is nonzero. */
+        stream.read(1);
+
+        if (!stream.seek(byteIndex)) {
+            result.status = ParsedDocument::Status::Error;
+            result.error = u"ERROR: Cannot seek to pos for scanning"_s;
+            return;
+        }
+    }
+#if defined(DEBUG)
+    qDebug() << "scanning byteIndex" << byteIndex << "of" << info.doc.size() << path;
+#endif
+
+    if (!chunkStream(stream, result.job.chunkSize, -1 /*page*/, MAX_CHUNKS, result.chunks)) {
+        result.chunks.clear();
+        if (file.binarySeen()) {
+            result.status = ParsedDocument::Status::Binary;
+        } else {
+            result.status = ParsedDocument::Status::Error;
+            result.error = u"ERROR: Failed to read file (status %1)"_s.arg(stream.status());
+        }
+        return;
+    }
+
+    const size_t pos = stream.pos();
+    result.finished = stream.atEnd();
+    result.bytesParsed = pos - byteIndex;
+    info.currentPosition = pos;
+}
+
+ParsedDocument parseDocument(const ParseJob &job)
+{
+    ParsedDocument result;
+    result.job = job;
+    if (job.info.isPdf()) {
+        parsePdfPage(result);
+    } else {
+        parseTextSlice(result);
+    }
+    result.job.info.currentlyProcessing = !result.finished;
+    return result;
+}
@@ -0,0 +1,59 @@
+#ifndef DOCUMENTPARSER_H
+#define DOCUMENTPARSER_H
+
+#include "database.h" // IWYU pragma: keep
+
+#include <QList>
+#include <QString>
+#include <QtGlobal>
+
+#include <cstddef>
+
+/*
+ * The reading, decoding, PDF extraction and chunking of LocalDocs documents, which run on a pool of threads while the
+ * database thread only writes the chunks. A document is parsed a slice at a time, up to 100 chunks of a text file or
+ * one page of a PDF, so that large documents neither take much memory nor hold up the others.
+ */
+
+struct ParsedChunk
+{
+    QString text;
+    int words = 0;
+    int page = -1;
+};
+
+// A slice of a document to parse, starting where its info says.
+struct ParseJob
+{
+    DocumentInfo info;
+    int document_id = -1;
+    qint64 document_time = 0; // the modification time the database has for the document
+    QString embedding_model;
+    int chunkSize = 0;
+    bool nextQueued = false; // whether the next page of a PDF was queued along with this one
+};
+
+struct ParsedDocument
+{
+    enum class Status {
+        Ok,
+        Error,
+        Binary, // a text file with binary data, which is ignored
+    };
+
+    ParseJob job;              // its info starts where the next slice would
+    Status status = Status::Ok;
+    QString error;
+    QString title;
+    QString author;
+    QString subject;
+    QString keywords;
+    QList<ParsedChunk> chunks;
+    size_t bytesParsed = 0;    // of the file, for the progress of its folder
+    bool finished = false;     // whether this was the last slice
+};
+
+// Parses a slice of a document. Can be called from any thread.
+ParsedDocument parseDocument(const ParseJob &job);
+
+#endif // DOCUMENTPARSER_H
@@ -0,0 +1,158 @@
+#include "embeddingbatcher.h"
+
+#include "embllm.h"
+
+#include <gpt4all-backend/llmodel.h>
+
+#include <QDebug>
+#include <QMetaObject>
+#include <QTimer>
+#include <Qt>
+#include <QtLogging>
+
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+using namespace Qt::Literals::StringLiterals;
+
+
+// A rough count of the tokens of a text, to fill batches without tokenizing twice.
+static qsizetype estimateTokens(const QString &text)
+{
+    constexpr qsizetype bytesPerToken = 4;
+    return text.toUtf8().size() / bytesPerToken + 1;
+}
+
+EmbeddingBatcher::EmbeddingBatcher()
+    : QObject(nullptr)
+    , m_timer(new QTimer(this))
+{
+    m_timer->setSingleShot(true);
+    connect(m_timer, &QTimer::timeout, this, &EmbeddingBatcher::process);
+    moveToThread(&m_workerThread);
+    m_workerThread.setObjectName("embeddingBatcher");
+    m_workerThread.start();
+}
+
+EmbeddingBatcher::~EmbeddingBatcher()
+{
+    m_workerThread.quit();
+    m_workerThread.wait();
+
+    delete m_model;
+    m_model = nullptr;
+}
+
+void EmbeddingBatcher::submit(std::shared_ptr<EmbeddingJob> job)
+{
+    QMetaObject::invokeMethod(this, [this, job = std::move(job)]() mutable { enqueue(std::move(job)); },
+                              Qt::QueuedConnection);
+}
+
+void EmbeddingBatcher::enqueue(std::shared_ptr<EmbeddingJob> job)
+{
+    qsizetype tokens = 0;
+    for (const auto &text : job->texts)
+        tokens += estimateTokens(text);
+    m_queue.push_back({ std::move(job), tokens });
+    m_queuedTokens += tokens;
+
+    if (m_queuedTokens >= s_maxBatchTokens)
+        process();
+    else if (!m_timer->isActive())
+        m_timer->start(s_maxDelayMs);
+}
+
+void EmbeddingBatcher::process()
+{
+    m_timer->stop();
+    if (m_queue.empty())
+        return;
+
+    // take the oldest job and the ones after it that ask for the same dimensions, up to the token budget
+    const int dimensions = m_queue.front().job->dimensions;
+    std::vector<Pending> batch;
+    qsizetype batchTokens = 0;
+    for (auto it = m_queue.begin(); it != m_queue.end();) {
+        if (it->job->dimensions != dimensions) {
+            ++it;
+            continue;
+        }
+        if (!batch.empty() && batchTokens + it->tokens > s_maxBatchTokens)
+            break;
+        batchTokens += it->tokens;
+        batch.push_back(std::move(*it));
+        it = m_queue.erase(it);
+    }
+    m_queuedTokens -= batchTokens;
+
+    embedBatch(batch, dimensions);
+
+    // jobs that arrived while this batch was running are queued behind this call, so they can join the next batch
+    if (!m_queue.empty())
+        QMetaObject::invokeMethod(this, &EmbeddingBatcher::process, Qt::QueuedConnection);
+}
+
+void EmbeddingBatcher::embedBatch(const std::vector<Pending> &batch, int dimensions)
+{
+    auto fail = [&batch](const QString &error, bool internalError) {
+        EmbeddingJobResult result;
+        result.error         = error;
+        result.internalError = internalError;
+        for (const auto &pending : batch)
+            pending.job->onFinished(result);
+    };
+
+    if (!m_model && !m_loadFailed) {
+        m_model = EmbeddingLLM::loadLocalModel();
+        m_loadFailed = !m_model;
+    }
+    if (!m_model) {
+        fail(u"could not load the embedding model"_s, /*internalError*/ true);
+        return;
+    }
+
+    std::vector<std::string> texts;
+    size_t textBytes = 0;
+    for (const auto &pending : batch) {
+        for (const auto &text : pending.job->texts) {
+            texts.push_back(text.toStdString());
+            textBytes += texts.back().size();
+        }
+    }
+
+    const int rowSize = dimensions < 0 ? int(m_model->embeddingSize()) : dimensions;
+    std::vector<float> embeddings(texts.size() * rowSize);
+    size_t tokenCount = 0;
+    try {
+        m_model->embed(texts, embeddings.data(), /*isRetrieval*/ false, dimensions, &tokenCount);
+    } catch (const std::out_of_range &e) {
+        // unsupported dimensions
+        fail(QString::fromUtf8(e.what()), /*internalError*/ false);
+        return;
+    } catch (const std::exception &e) {
+        qWarning() << "WARNING: LLModel::embed failed:" << e.what();
+        fail(QString::fromUtf8(e.what()), /*internalError*/ true);
+        return;
+    }
+
+    // the model only counts the tokens of the whole batch, so each job is given its share by the length of its texts
+    size_t row = 0, bytesDone = 0, tokensDone = 0;
+    for (const auto &pending : batch) {
+        EmbeddingJobResult result;
+        result.dimensions = rowSize;
+        auto first = embeddings.begin() + row * rowSize;
+        result.embeddings.assign(first, first + pending.job->texts.size() * rowSize);
+        row += pending.job->texts.size();
+
+        for (const auto &text : pending.job->texts)
+            bytesDone += text.toUtf8().size();
+        size_t tokens = textBytes ? tokenCount * bytesDone / textBytes : 0;
+        result.promptTokens = int(tokens - tokensDone);
+        tokensDone = tokens;
+
+        pending.job->onFinished(result);
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef EMBEDDINGBATCHER_H
+#define EMBEDDINGBATCHER_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QThread>
+#include <QtGlobal>
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <vector>
+
+class LLModel;
+class QTimer;
+
+struct EmbeddingJobResult {
+    std::optional<QString> error;                 // set if the job failed
+    bool                   internalError = false; // the error is not caused by the request
+    std::vector<float>     embeddings;            // one row of dimensions floats per text
+    int                    dimensions = 0;
+    int                    promptTokens = 0;
+};
+
+// The texts of one embeddings request, as submitted to the EmbeddingBatcher.
+struct EmbeddingJob {
+    QStringList texts;
+    int         dimensions = -1; // -1 for the full size of the model
+
+    // Called on the batcher's thread once the job is done, successfully or not.
+    std::function<void(const EmbeddingJobResult &result)> onFinished;
+};
+
+/*
+ * Computes embeddings for the local API server with a context of its own, separate from the one LocalDocs uses.
+ * Requests that arrive close together are coalesced into one call to LLModel::embed: a batch is started at most
+ * s_maxDelayMs after its first request arrived, or as soon as the queued texts fill s_maxBatchTokens. Only requests
+ * for the same dimensions share a batch.
+ */
+class EmbeddingBatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    EmbeddingBatcher();
+    ~EmbeddingBatcher() override;
+
+    // Queues a job. Can be called from any thread.
+    void submit(std::shared_ptr<EmbeddingJob> job);
+
+private Q_SLOTS:
+    void process();
+
+private:
+    struct Pending {
+        std::shared_ptr<EmbeddingJob> job;
+        qsizetype                     tokens; // estimated
+    };
+
+    static constexpr qsizetype s_maxBatchTokens = 2048; // the context size of the embedding model
+    static constexpr int       s_maxDelayMs     = 5;
+
+    void enqueue(std::shared_ptr<EmbeddingJob> job);
+    void embedBatch(const std::vector<Pending> &batch, int dimensions);
+
+    LLModel            *m_model = nullptr;
+    bool                m_loadFailed = false; // don't retry on every batch
+    std::deque<Pending> m_queue;
+    qsizetype           m_queuedTokens = 0;
+    QTimer             *m_timer;
+    QThread             m_workerThread;
+};
+
+#endif // EMBEDDINGBATCHER_H
@@ -0,0 +1,312 @@
+#include "embeddingcache.h"
+
+#include <usearch/index_plugins.hpp>
+
+#include <QtLogging>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace us = unum::usearch;
+
+
+// Quantizes an embedding to int8, scaled so that its largest component is 127. Returns the scale.
+static float quantizeInt8(const float *embedding, int n_embd, std::int8_t *out)
+{
+    float maxAbs = 0.0f;
+    for (int i = 0; i < n_embd; i++)
+        maxAbs = std::max(maxAbs, std::abs(embedding[i]));
+    if (maxAbs == 0.0f) {
+        std::fill(out, out + n_embd, std::int8_t(0));
+        return 0.0f;
+    }
+    const float scale = maxAbs / 127.0f;
+    for (int i = 0; i < n_embd; i++)
+        out[i] = std::int8_t(std::lround(embedding[i] / scale));
+    return scale;
+}
+
+// Sets a bit for each positive component of an embedding.
+static void quantizeBinary(const float *embedding, int n_embd, std::uint64_t *out)
+{
+    std::fill(out, out + (n_embd + 63) / 64, std::uint64_t(0));
+    for (int i = 0; i < n_embd; i++) {
+        if (embedding[i] > 0.0f)
+            out[i / 64] |= std::uint64_t(1) << (i % 64);
+    }
+}
+
+EmbeddingCache::EmbeddingCache(qint64 maxBytes)
+    : m_maxBytes(maxBytes)
+{
+}
+
+void EmbeddingCache::setQuantization(Quantization quantization)
+{
+    if (quantization == m_quantization)
+        return;
+    m_quantization = quantization;
+    m_matrices.clear();
+}
+
+qsizetype EmbeddingCache::size(const Key &key) const
+{
+    auto it = m_matrices.find(key);
+    return it == m_matrices.end() ? 0 : qsizetype(it->second.chunkIds.size());
+}
+
+void EmbeddingCache::insert(const Key &key)
+{
+    m_matrices[key] = { .lastUsed = ++m_clock };
+}
+
+qsizetype EmbeddingCache::rowBytes(int n_embd) const
+{
+    auto align = [](qsizetype bytes, qsizetype alignment) { return (bytes + alignment - 1) / alignment * alignment; };
+    switch (m_quantization) {
+    case Quantization::None:   return align(n_embd * qsizetype(sizeof(float)), s_alignment);
+    case Quantization::Int8:   return align(n_embd, s_alignment);
+    case Quantization::Binary: return align((n_embd + 7) / 8, sizeof(std::uint64_t));
+    }
+    Q_UNREACHABLE();
+}
+
+void EmbeddingCache::reserve(Matrix &matrix, qsizetype capacity)
+{
+    const std::size_t bytes = std::size_t(capacity) * matrix.rowBytes;
+    std::unique_ptr<std::byte[], AlignedDelete> data(
+        static_cast<std::byte *>(::operator new[](bytes, std::align_val_t(s_alignment)))
+    );
+    const qsizetype nRows = qsizetype(matrix.chunkIds.size());
+    if (nRows)
+        memcpy(data.get(), matrix.data.get(), std::size_t(nRows) * matrix.rowBytes);
+    matrix.data = std::move(data);
+    matrix.capacity = capacity;
+    matrix.chunkIds.reserve(capacity);
+}
+
+bool EmbeddingCache::add(const Key &key, int chunk_id, const float *embedding, int n_embd)
+{
+    constexpr qsizetype MIN_CAPACITY = 256;
+
+    auto it = m_matrices.find(key);
+    if (it == m_matrices.end())
+        return true;
+
+    Matrix &matrix = it->second;
+    if (!matrix.n_embd) {
+        matrix.n_embd = n_embd;
+        matrix.rowBytes = rowBytes(n_embd);
+    } else if (n_embd != matrix.n_embd) {
+        qWarning() << "EmbeddingCache ERROR: expected embedding of" << matrix.n_embd << "dimensions, got" << n_embd;
+        return false;
+    }
+    if (matrix.rows.contains(chunk_id))
+        return true;
+
+    const qsizetype row = qsizetype(matrix.chunkIds.size());
+    if (row == matrix.capacity) {
+        reserve(matrix, std::max(2 * matrix.capacity, MIN_CAPACITY));
+        if (m_quantization != Quantization::None)
+            matrix.full.reserve(std::size_t(matrix.capacity) * n_embd);
+        evictExcept(&key);
+    }
+
+    // the padding is zero in every row and in the query, so it never counts towards a distance
+    std::byte *dest = matrix.data.get() + row * matrix.rowBytes;
+    std::fill(dest, dest + matrix.rowBytes, std::byte(0));
+    switch (m_quantization) {
+    case Quantization::None:
+        memcpy(dest, embedding, n_embd * sizeof(float));
+        break;
+    case Quantization::Int8:
+        matrix.scales.push_back(quantizeInt8(embedding, n_embd, reinterpret_cast<std::int8_t *>(dest)));
+        break;
+    case Quantization::Binary:
+        quantizeBinary(embedding, n_embd, reinterpret_cast<std::uint64_t *>(dest));
+        break;
+    }
+    if (m_quantization != Quantization::None)
+        matrix.full.insert(matrix.full.end(), embedding, embedding + n_embd);
+    matrix.chunkIds.push_back(chunk_id);
+    matrix.rows[chunk_id] = row;
+    return true;
+}
+
+void EmbeddingCache::removeRow(Matrix &matrix, qsizetype row)
+{
+    const qsizetype last = qsizetype(matrix.chunkIds.size()) - 1;
+    matrix.rows.erase(matrix.chunkIds[row]);
+    if (row != last) {
+        memcpy(matrix.data.get() + row * matrix.rowBytes, matrix.data.get() + last * matrix.rowBytes,
+               matrix.rowBytes);
+        if (!matrix.scales.empty())
+            matrix.scales[row] = matrix.scales[last];
+        if (!matrix.full.empty()) {
+            std::copy_n(matrix.full.begin() + last * matrix.n_embd, matrix.n_embd,
+                        matrix.full.begin() + row * matrix.n_embd);
+        }
+        matrix.chunkIds[row] = matrix.chunkIds[last];
+        matrix.rows[matrix.chunkIds[row]] = row;
+    }
+    if (!matrix.scales.empty())
+        matrix.scales.pop_back();
+    if (!matrix.full.empty())
+        matrix.full.resize(matrix.full.size() - matrix.n_embd);
+    matrix.chunkIds.pop_back();
+}
+
+void EmbeddingCache::remove(const QList<int> &chunkIds)
+{
+    for (auto &[key, matrix] : m_matrices) {
+        for (int chunk_id : chunkIds) {
+            auto it = matrix.rows.find(chunk_id);
+            if (it != matrix.rows.end())
+                removeRow(matrix, it->second);
+        }
+    }
+}
+
+void EmbeddingCache::removeFolder(int folder_id)
+{
+    std::erase_if(m_matrices, [folder_id](const auto &item) { return item.first.second == folder_id; });
+}
+
+void EmbeddingCache::drop(const Key &key)
+{
+    m_matrices.erase(key);
+}
+
+std::optional<QList<QPair<int, float>>> EmbeddingCache::search(const Key &key, const std::vector<float> &query,
+                                                                int k, int candidates)
+{
+    auto it = m_matrices.find(key);
+    if (it == m_matrices.end())
+        return std::nullopt;
+
+    it->second.lastUsed = ++m_clock;
+    const Matrix &matrix = it->second;
+    const qsizetype nRows = qsizetype(matrix.chunkIds.size());
+    if (!nRows)
+        return QList<QPair<int, float>>();
+    if (qsizetype(query.size()) != matrix.n_embd) {
+        qWarning() << "EmbeddingCache ERROR: expected query of" << matrix.n_embd << "dimensions, got" << query.size();
+        return std::nullopt;
+    }
+
+    const int kMatrix = int(std::min(qsizetype(k), nRows));
+    QList<QPair<int, float>> found;
+    found.reserve(kMatrix);
+
+    if (m_quantization == Quantization::None) {
+        const us::metric_punned_t metric(matrix.n_embd, us::metric_kind_t::ip_k); // inner product
+        us::exact_search_t search;
+        us::exact_search_results_t results = search(
+            (us::byte_t const *)matrix.data.get(), nRows, matrix.rowBytes,
+            (us::byte_t const *)query.data(),      1,     matrix.n_embd * sizeof(float),
+            kMatrix, metric
+        );
+        for (int i = 0; i < kMatrix; ++i) {
+            auto offset = results.at(0)[i].offset;
+            found.append({ matrix.chunkIds[offset], float(results.at(0)[i].distance) });
+        }
+        return found;
+    }
+
+    // distances to every row, then the nearest k
+    std::vector<std::pair<float, qsizetype>> distances(nRows);
+    if (m_quantization == Quantization::Int8) {
+        std::vector<std::int8_t> q(matrix.n_embd);
+        const float queryScale = quantizeInt8(query.data(), matrix.n_embd, q.data());
+        for (qsizetype row = 0; row < nRows; row++) {
+            auto *r = reinterpret_cast<const std::int8_t *>(matrix.data.get() + row * matrix.rowBytes);
+            std::int32_t dot = 0;
+            for (int i = 0; i < matrix.n_embd; i++)
+                dot += std::int32_t(r[i]) * std::int32_t(q[i]);
+            distances[row] = { 1.0f - matrix.scales[row] * queryScale * float(dot), row };
+        }
+    } else {
+        const qsizetype nWords = matrix.rowBytes / qsizetype(sizeof(std::uint64_t));
+        std::vector<std::uint64_t> q(nWords);
+        quantizeBinary(query.data(), matrix.n_embd, q.data());
+        for (qsizetype row = 0; row < nRows; row++) {
+            auto *r = reinterpret_cast<const std::uint64_t *>(matrix.data.get() + row * matrix.rowBytes);
+            int hamming = 0;
+            for (qsizetype i = 0; i < nWords; i++)
+                hamming += std::popcount(r[i] ^ q[i]);
+            distances[row] = { float(hamming) / float(matrix.n_embd), row };
+        }
+    }
+
+    // re-rank the nearest candidates with the full embeddings
+    const qsizetype nCandidates = std::min(qsizetype(std::max(k, candidates)), nRows);
+    std::partial_sort(distances.begin(), distances.begin() + nCandidates, distances.end());
+    distances.resize(nCandidates);
+    for (auto &[distance, row] : distances) {
+        const float *embedding = matrix.full.data() + row * matrix.n_embd;
+        float dot = 0.0f;
+        for (int i = 0; i < matrix.n_embd; i++)
+            dot += embedding[i] * query[i];
+        distance = 1.0f - dot;
+    }
+
+    std::partial_sort(distances.begin(), distances.begin() + kMatrix, distances.end());
+    for (int i = 0; i < kMatrix; ++i)
+        found.append({ matrix.chunkIds[distances[i].second], distances[i].first });
+    return found;
+}
+
+bool EmbeddingCache::evict()
+{
+    return evictExcept(nullptr);
+}
+
+// Forgets the least recently used folders other than keep while the cache is over its budget.
+bool EmbeddingCache::evictExcept(const Key *keep)
+{
+    bool evicted = false;
+    qint64 total = memoryUsage();
+    while (total > m_maxBytes) {
+        auto lru = m_matrices.end();
+        for (auto it = m_matrices.begin(); it != m_matrices.end(); ++it) {
+            if (keep && it->first == *keep)
+                continue;
+            if (lru == m_matrices.end() || it->second.lastUsed < lru->second.lastUsed)
+                lru = it;
+        }
+        if (lru == m_matrices.end())
+            break;
+        total -= memoryUsage(lru->second);
+        m_matrices.erase(lru);
+        evicted = true;
+    }
+    return evicted;
+}
+
+qint64 EmbeddingCache::memoryUsage(const Key &key) const
+{
+    auto it = m_matrices.find(key);
+    return it == m_matrices.end() ? 0 : memoryUsage(it->second);
+}
+
+qint64 EmbeddingCache::memoryUsage() const
+{
+    qint64 total = 0;
+    for (const auto &[key, matrix] : m_matrices)
+        total += memoryUsage(matrix);
+    return total;
+}
+
+qint64 EmbeddingCache::memoryUsage(const Matrix &matrix)
+{
+    // roughly, for the map from chunk ids to rows
+    constexpr qint64 ROW_ENTRY_BYTES = 32;
+    return qint64(matrix.capacity) * matrix.rowBytes
+         + qint64(matrix.scales.capacity()) * sizeof(float)
+         + qint64(matrix.full.capacity()) * sizeof(float)
+         + qint64(matrix.chunkIds.capacity()) * sizeof(int)
+         + qint64(matrix.rows.size()) * ROW_ENTRY_BYTES;
+}
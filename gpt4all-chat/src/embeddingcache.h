@@ -0,0 +1,112 @@
+#ifndef EMBEDDINGCACHE_H
+#define EMBEDDINGCACHE_H
+
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <QtGlobal>
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <new>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*
+ * The LocalDocs embeddings of the folders that were searched exhaustively, kept in memory so that an exact search is a
+ * scan of a matrix instead of reading every embedding from the database again. Like the EmbeddingIndex, there is a
+ * matrix per (embedding model, folder).
+ *
+ * The embeddings can also be kept quantized, to be scanned with integer arithmetic: as int8 with a scale per embedding,
+ * or as the signs of their components compared by Hamming distance. The distances of quantized embeddings are
+ * approximate, so the nearest rows of a quantized scan are candidates that are re-ranked with the full embeddings,
+ * which a quantized matrix keeps next to its rows. A search never has to go back to the database.
+ *
+ * Each matrix is a single allocation aligned to 64 bytes. Its rows are padded to a multiple of 64 bytes, or 8 bytes for
+ * signs, so that every row can be read with aligned vector loads. Removed rows are replaced by the last one, so the
+ * matrix stays dense.
+ *
+ * The matrices share a memory budget. Once they take more than that, the least recently searched folders are forgotten
+ * and loaded again the next time they are searched.
+ *
+ * Only used on the database thread.
+ */
+class EmbeddingCache
+{
+public:
+    using Key = std::pair<QString, int>; // embedding model, folder_id
+
+    explicit EmbeddingCache(qint64 maxBytes);
+
+    enum class Quantization {
+        None,
+        Int8,
+        Binary,
+    };
+
+    Quantization quantization() const { return m_quantization; }
+    // Changing the quantization forgets every folder, so that they are loaded again with the new one.
+    void setQuantization(Quantization quantization);
+
+    bool contains(const Key &key) const { return m_matrices.contains(key); }
+    qsizetype size(const Key &key) const;
+
+    // Starts caching a folder, with no embeddings yet.
+    void insert(const Key &key);
+    // Adds an embedding to a folder that is cached. Folders that are not are loaded when they are first searched. May
+    // forget other folders to stay within the budget.
+    bool add(const Key &key, int chunk_id, const float *embedding, int n_embd);
+    // Removes chunks from every matrix that holds them.
+    void remove(const QList<int> &chunkIds);
+    void removeFolder(int folder_id);
+    void drop(const Key &key);
+
+    // The nearest chunks to the query and their distances, or nullopt on error. If the embeddings are quantized, the
+    // nearest candidates by their quantized distance, at least k, are re-ranked with the full embeddings.
+    std::optional<QList<QPair<int, float>>> search(const Key &key, const std::vector<float> &query, int k,
+                                                  int candidates);
+
+    // Forgets the least recently used folders until the cache is within its budget, which may be all of them if one
+    // folder is larger than the budget. Returns whether any were forgotten.
+    bool evict();
+
+    // bytes taken by the matrix of a folder, its full embeddings and its chunk ids
+    qint64 memoryUsage(const Key &key) const;
+    // bytes taken by every matrix
+    qint64 memoryUsage() const;
+
+private:
+    static constexpr std::size_t s_alignment = 64;
+
+    struct AlignedDelete {
+        void operator()(std::byte *data) const { ::operator delete[](data, std::align_val_t(s_alignment)); }
+    };
+
+    struct Matrix {
+        int                                         n_embd = 0;
+        qsizetype                                   rowBytes = 0; // including the padding
+        qsizetype                                   capacity = 0;
+        std::unique_ptr<std::byte[], AlignedDelete> data;
+        std::vector<float>                          scales;       // of each int8 row
+        std::vector<float>                          full;         // the embeddings of a quantized matrix, to re-rank
+        std::vector<int>                            chunkIds;     // of each row
+        std::unordered_map<int, qsizetype>          rows;         // by chunk id
+        quint64                                     lastUsed = 0; // m_clock when it was last searched or loaded
+    };
+
+    qsizetype rowBytes(int n_embd) const;
+    static void reserve(Matrix &matrix, qsizetype capacity);
+    static void removeRow(Matrix &matrix, qsizetype row);
+    static qint64 memoryUsage(const Matrix &matrix);
+    bool evictExcept(const Key *keep);
+
+    const qint64          m_maxBytes;
+    Quantization          m_quantization = Quantization::None;
+    std::map<Key, Matrix> m_matrices;
+    quint64               m_clock = 0;
+};
+
+#endif // EMBEDDINGCACHE_H
@@ -0,0 +1,273 @@
+#include "embeddingindex.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QtLogging>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+using namespace Qt::Literals::StringLiterals;
+namespace us = unum::usearch;
+
+
+// NB: usearch errors throw from their destructor unless they are released
+static const char *releaseError(us::error_t &error)
+{
+    const char *message = error.release();
+    return message ? message : "unknown error";
+}
+
+// Sets a bit for each positive component of an embedding, for an index of binary vectors.
+static std::vector<std::uint8_t> binarize(const float *embedding, std::size_t n_embd)
+{
+    std::vector<std::uint8_t> bits((n_embd + 7) / 8, 0);
+    for (std::size_t i = 0; i < n_embd; i++) {
+        if (embedding[i] > 0.0f)
+            bits[i / 8] |= std::uint8_t(0x80 >> (i % 8));
+    }
+    return bits;
+}
+
+EmbeddingIndex::EmbeddingIndex(const QString &directory, Quantization quantization)
+    : m_directory(directory)
+    , m_quantization(quantization)
+{
+    QDir().mkpath(m_directory);
+}
+
+EmbeddingIndex::~EmbeddingIndex()
+{
+    save();
+}
+
+void EmbeddingIndex::setQuantization(Quantization quantization)
+{
+    if (quantization == m_quantization)
+        return;
+    m_quantization = quantization;
+    for (const auto &[key, entry] : m_indexes)
+        QFile::remove(path(key));
+    m_indexes.clear();
+}
+
+us::scalar_kind_t EmbeddingIndex::scalarKind() const
+{
+    switch (m_quantization) {
+    case Quantization::None:   return us::scalar_kind_t::f32_k;
+    case Quantization::Int8:   return us::scalar_kind_t::i8_k;
+    case Quantization::Binary: return us::scalar_kind_t::b1x8_k;
+    }
+    Q_UNREACHABLE();
+}
+
+QString EmbeddingIndex::path(const Key &key) const
+{
+    // model names are arbitrary strings, so name the file after a hash of it
+    auto modelHash = QCryptographicHash::hash(key.first.toUtf8(), QCryptographicHash::Sha1).toHex().left(16);
+    return u"%1/%2-%3.usearch"_s.arg(m_directory).arg(key.second).arg(QLatin1StringView(modelHash));
+}
+
+bool EmbeddingIndex::open(const Key &key, qsizetype expected)
+{
+    m_indexes.erase(key);
+
+    const QString file = path(key);
+    if (!QFileInfo::exists(file))
+        return false;
+
+    auto state = Index::make(QFile::encodeName(file).constData(), /*view*/ true);
+    if (state.error) {
+        qWarning() << "EmbeddingIndex ERROR: failed to open" << file << releaseError(state.error);
+        QFile::remove(file);
+        return false;
+    }
+    if (qsizetype(state.index.size()) != expected || state.index.scalar_kind() != scalarKind()) {
+        qWarning() << "EmbeddingIndex: index" << file << "is out of date, rebuilding";
+        QFile::remove(file);
+        return false;
+    }
+
+    m_indexes[key] = { std::make_unique<Index>(std::move(state.index)), /*viewed*/ true, /*dirty*/ false };
+    return true;
+}
+
+qsizetype EmbeddingIndex::size(const Key &key) const
+{
+    auto it = m_indexes.find(key);
+    return it == m_indexes.end() ? 0 : qsizetype(it->second.index->size());
+}
+
+// Loads a memory-mapped index into memory, and deletes its file so that it is not used if the changes are not saved.
+bool EmbeddingIndex::makeMutable(const Key &key, Entry &entry)
+{
+    const QString file = path(key);
+    if (entry.viewed) {
+        auto state = Index::make(QFile::encodeName(file).constData(), /*view*/ false);
+        if (state.error) {
+            qWarning() << "EmbeddingIndex ERROR: failed to load" << file << releaseError(state.error);
+            return false;
+        }
+        entry.index = std::make_unique<Index>(std::move(state.index));
+        entry.viewed = false;
+    }
+    if (!entry.dirty) {
+        QFile::remove(file);
+        entry.dirty = true;
+    }
+    return true;
+}
+
+bool EmbeddingIndex::add(const Key &key, int chunk_id, const float *embedding, int n_embd)
+{
+    constexpr std::size_t MIN_CAPACITY = 1024;
+
+    auto it = m_indexes.find(key);
+    if (it == m_indexes.end()) {
+        // the embeddings are normalized, so the cosine of int8 vectors ranks them like their inner product
+        us::metric_kind_t metricKind = us::metric_kind_t::ip_k;
+        if (m_quantization == Quantization::Int8)
+            metricKind = us::metric_kind_t::cos_k;
+        else if (m_quantization == Quantization::Binary)
+            metricKind = us::metric_kind_t::hamming_k;
+        us::metric_punned_t metric(n_embd, metricKind, scalarKind());
+        auto state = Index::make(metric);
+        if (state.error) {
+            qWarning() << "EmbeddingIndex ERROR: failed to create index:" << releaseError(state.error);
+            return false;
+        }
+        it = m_indexes.emplace(key, Entry { std::make_unique<Index>(std::move(state.index)) }).first;
+    }
+
+    Entry &entry = it->second;
+    if (std::size_t(n_embd) != entry.index->dimensions()) {
+        qWarning() << "EmbeddingIndex ERROR: expected embedding of" << entry.index->dimensions()
+                   << "dimensions, got" << n_embd;
+        return false;
+    }
+    if (entry.index->contains(us::default_key_t(chunk_id)))
+        return true;
+    if (!makeMutable(key, entry))
+        return false;
+
+    Index &index = *entry.index;
+    if (index.size() >= index.capacity()) {
+        if (!index.reserve(std::max(2 * index.capacity(), MIN_CAPACITY))) {
+            qWarning() << "EmbeddingIndex ERROR: failed to grow index";
+            return false;
+        }
+    }
+
+    auto result = m_quantization == Quantization::Binary
+        ? index.add(us::default_key_t(chunk_id), reinterpret_cast<const us::b1x8_t *>(binarize(embedding, n_embd).data()))
+        : index.add(us::default_key_t(chunk_id), embedding); // converted to int8 by the index, if quantized
+    if (!result) {
+        qWarning() << "EmbeddingIndex ERROR: failed to add chunk" << chunk_id << releaseError(result.error);
+        return false;
+    }
+    return true;
+}
+
+void EmbeddingIndex::remove(const QList<int> &chunkIds)
+{
+    if (chunkIds.isEmpty())
+        return;
+
+    for (auto &[key, entry] : m_indexes) {
+        bool changed = false;
+        for (int chunk_id : chunkIds) {
+            if (!entry.index->contains(us::default_key_t(chunk_id)))
+                continue;
+            if (!changed && !makeMutable(key, entry))
+                break;
+            changed = true;
+            auto result = entry.index->remove(us::default_key_t(chunk_id));
+            if (result.error)
+                qWarning() << "EmbeddingIndex ERROR: failed to remove chunk" << chunk_id << releaseError(result.error);
+        }
+    }
+}
+
+void EmbeddingIndex::removeFolder(int folder_id)
+{
+    std::erase_if(m_indexes, [folder_id](const auto &item) { return item.first.second == folder_id; });
+
+    // including the files of models that are no longer open
+    QDir dir(m_directory);
+    for (const QString &file : dir.entryList({ u"%1-*.usearch"_s.arg(folder_id) }, QDir::Files))
+        dir.remove(file);
+}
+
+void EmbeddingIndex::drop(const Key &key)
+{
+    m_indexes.erase(key);
+    QFile::remove(path(key));
+}
+
+std::optional<QList<QPair<int, float>>> EmbeddingIndex::search(const Key &key, const std::vector<float> &query, int k,
+                                                                int expansion)
+{
+    auto it = m_indexes.find(key);
+    if (it == m_indexes.end())
+        return std::nullopt;
+
+    Index &index = *it->second.index;
+    if (std::size_t(query.size()) != index.dimensions()) {
+        qWarning() << "EmbeddingIndex ERROR: expected query of" << index.dimensions() << "dimensions, got"
+                   << query.size();
+        return std::nullopt;
+    }
+
+    // recall improves with the number of candidates, which must be at least the number of results
+    index.change_expansion_search(std::size_t(std::max(expansion, k)));
+    auto result = m_quantization == Quantization::Binary
+        ? index.search(reinterpret_cast<const us::b1x8_t *>(binarize(query.data(), query.size()).data()), std::size_t(k))
+        : index.search(query.data(), std::size_t(k));
+    if (!result) {
+        qWarning() << "EmbeddingIndex ERROR: search failed:" << releaseError(result.error);
+        return std::nullopt;
+    }
+
+    std::vector<us::default_key_t> keys(result.size());
+    std::vector<us::distance_punned_t> distances(result.size());
+    result.dump_to(keys.data(), distances.data());
+
+    QList<QPair<int, float>> found;
+    found.reserve(qsizetype(keys.size()));
+    for (std::size_t i = 0; i < keys.size(); i++)
+        found.append({ int(keys[i]), float(distances[i]) });
+    return found;
+}
+
+void EmbeddingIndex::save()
+{
+    for (auto &[key, entry] : m_indexes) {
+        if (!entry.dirty)
+            continue;
+
+        // write to a temporary file so that a crash never leaves a partial index behind
+        const QString file = path(key);
+        const QString tmpFile = file + u".tmp"_s;
+        auto result = entry.index->save(QFile::encodeName(tmpFile).constData());
+        if (!result) {
+            qWarning() << "EmbeddingIndex ERROR: failed to save" << file << releaseError(result.error);
+            QFile::remove(tmpFile);
+            continue;
+        }
+        QFile::remove(file);
+        if (!QFile::rename(tmpFile, file)) {
+            qWarning() << "EmbeddingIndex ERROR: failed to rename" << tmpFile << "to" << file;
+            QFile::remove(tmpFile);
+            continue;
+        }
+        entry.dirty = false;
+    }
+}
+
+bool EmbeddingIndex::hasUnsavedChanges() const
+{
+    return std::ranges::any_of(m_indexes, [](const auto &item) { return item.second.dirty; });
+}
@@ -0,0 +1,91 @@
+#ifndef EMBEDDINGINDEX_H
+#define EMBEDDINGINDEX_H
+
+#include "embeddingcache.h"
+
+#include <usearch/index_dense.hpp>
+
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <QtGlobal>
+
+#include <map>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+/*
+ * Approximate nearest-neighbour (HNSW) indexes of the LocalDocs embeddings, for retrieval that does not scan every
+ * embedding of a collection. Embeddings are stored per folder and model, so there is one index per (embedding model,
+ * folder), and a collection is searched through the indexes of its folders. A folder shared by several collections
+ * is indexed once.
+ *
+ * The vectors of an index can be quantized, which is where most of the memory of a large collection goes: to int8,
+ * a quarter of the size, or to the signs of their components compared by Hamming distance, a 32nd of the size. The
+ * distances of quantized vectors are approximate, so their nearest chunks are candidates to re-rank with the embeddings
+ * of the database.
+ *
+ * The indexes are saved next to the database, and memory-mapped while they are not being changed. The database
+ * stays the source of truth: the file of an index is deleted as soon as it is changed and written again once the
+ * changes settle, so an index whose file is missing or does not match the database after a crash is rebuilt from it.
+ *
+ * Only used on the database thread.
+ */
+class EmbeddingIndex
+{
+public:
+    using Key = std::pair<QString, int>; // embedding model, folder_id
+    using Quantization = EmbeddingCache::Quantization;
+
+    EmbeddingIndex(const QString &directory, Quantization quantization);
+    ~EmbeddingIndex();
+
+    Quantization quantization() const { return m_quantization; }
+    // Changing the quantization forgets every index and deletes its file, so that they are rebuilt with the new one.
+    void setQuantization(Quantization quantization);
+
+    // Opens the saved index of a folder if it holds the given number of embeddings, quantized as set. Returns false if
+    // it has to be rebuilt.
+    bool open(const Key &key, qsizetype expected);
+    bool contains(const Key &key) const { return m_indexes.contains(key); }
+    qsizetype size(const Key &key) const;
+
+    // Adds an embedding, creating the index of the folder if needed. An embedding that is already present is kept.
+    bool add(const Key &key, int chunk_id, const float *embedding, int n_embd);
+    // Removes chunks from every index that holds them.
+    void remove(const QList<int> &chunkIds);
+    // Forgets the indexes of a folder, and deletes their files.
+    void removeFolder(int folder_id);
+    // Forgets the index of a folder and model, and deletes its file.
+    void drop(const Key &key);
+
+    // The nearest chunks to the query and their distances, searching expansion candidates, or nullopt on error. The
+    // distances are only approximate if the index is quantized.
+    std::optional<QList<QPair<int, float>>> search(const Key &key, const std::vector<float> &query, int k,
+                                                  int expansion);
+
+    // Writes the indexes that changed since they were last saved.
+    void save();
+    bool hasUnsavedChanges() const;
+
+private:
+    using Index = unum::usearch::index_dense_t;
+
+    struct Entry {
+        std::unique_ptr<Index> index;
+        bool                   viewed = false; // memory-mapped, and so read-only
+        bool                   dirty  = false; // changed since it was saved, and its file is deleted
+    };
+
+    QString path(const Key &key) const;
+    unum::usearch::scalar_kind_t scalarKind() const;
+    bool makeMutable(const Key &key, Entry &entry);
+
+    QString              m_directory;
+    Quantization         m_quantization;
+    std::map<Key, Entry> m_indexes;
+};
+
+#endif // EMBEDDINGINDEX_H
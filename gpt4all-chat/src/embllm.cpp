@@ -1,5 +1,6 @@
 #include "embllm.h"
 
+#include "metrics.h"
 #include "modellist.h"
 #include "mysettings.h"
 
@@ -9,7 +10,6 @@
 #include <QDebug>
 #include <QFile>
 #include <QFileInfo>
-#include <QGuiApplication>
 #include <QIODevice>
 #include <QJsonArray>
 #include <QJsonDocument>
@@ -19,12 +19,15 @@
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
 #include <QNetworkRequest>
+#include <QTimer>
 #include <QUrl>
 #include <Qt>
 #include <QtGlobal>
 #include <QtLogging>
 
 #include <exception>
+#include <optional>
+#include <string>
 #include <utility>
 #include <vector>
 
@@ -32,12 +35,39 @@ using namespace Qt::Literals::StringLiterals;
 
 static const QString EMBEDDING_MODEL_NAME = u"nomic-embed-text-v1.5"_s;
 static const QString LOCAL_EMBEDDING_MODEL = u"nomic-embed-text-v1.5.f16.gguf"_s;
+// The context size of the local embedding model, which is also the most tokens it decodes at once.
+static constexpr int EMBEDDING_N_CTX = 2048;
+
+// A rough count of the tokens of a chunk, including the task prefix and the BOS and EOS tokens, to fill batches
+// without tokenizing twice.
+static qsizetype estimateTokens(const QString &text)
+{
+    constexpr qsizetype bytesPerToken = 4;
+    constexpr qsizetype overhead = 8;
+    return text.toUtf8().size() / bytesPerToken + overhead;
+}
+
+// The sizes of the batches the model decoded in the last call to embed on this thread.
+static thread_local std::vector<unsigned> t_decodeBatches;
+
+// Records the batches of an embed call instead of cancelling it.
+static bool recordDecodeBatches(unsigned *batchSizes, unsigned nBatch, const char *backend)
+{
+    (void)backend;
+    t_decodeBatches.assign(batchSizes, batchSizes + nBatch);
+    return false;
+}
 
 EmbeddingLLMWorker::EmbeddingLLMWorker()
     : QObject(nullptr)
     , m_networkManager(new QNetworkAccessManager(this))
     , m_stopGenerating(false)
+    , m_flushTimer(new QTimer(this))
 {
+    // wait this long for more chunks to fill a batch before embedding the ones that came
+    m_flushTimer->setSingleShot(true);
+    m_flushTimer->setInterval(50);
+    connect(m_flushTimer, &QTimer::timeout, this, &EmbeddingLLMWorker::flushPendingChunks);
     moveToThread(&m_workerThread);
     connect(this, &EmbeddingLLMWorker::requestAtlasQueryEmbedding, this, &EmbeddingLLMWorker::atlasQueryEmbeddingRequested);
     connect(this, &EmbeddingLLMWorker::finished, &m_workerThread, &QThread::quit, Qt::DirectConnection);
@@ -51,6 +81,7 @@ EmbeddingLLMWorker::~EmbeddingLLMWorker()
     m_workerThread.quit();
     m_workerThread.wait();
 
+    m_modelLoaded = false;
     if (m_model) {
         delete m_model;
         m_model = nullptr;
@@ -64,8 +95,7 @@ void EmbeddingLLMWorker::wait()
 
 bool EmbeddingLLMWorker::loadModel()
 {
-    constexpr int n_ctx = 2048;
-
+    m_modelLoaded = false;
     m_nomicAPIKey.clear();
     m_model = nullptr;
 
@@ -73,9 +103,19 @@ bool EmbeddingLLMWorker::loadModel()
 
     if (MySettings::globalInstance()->localDocsUseRemoteEmbed()) {
         m_nomicAPIKey = MySettings::globalInstance()->localDocsNomicAPIKey();
+        m_modelLoaded = hasModel();
         return true;
     }
 
+    m_model = EmbeddingLLM::loadLocalModel();
+    m_modelLoaded = hasModel();
+    return m_model;
+}
+
+LLModel *EmbeddingLLM::loadLocalModel()
+{
+    constexpr int n_ctx = EMBEDDING_N_CTX;
+
 #ifdef Q_OS_DARWIN
     static const QString embPathFmt = u"%1/../Resources/%2"_s;
 #else
@@ -85,7 +125,7 @@ bool EmbeddingLLMWorker::loadModel()
     QString filePath = embPathFmt.arg(QCoreApplication::applicationDirPath(), LOCAL_EMBEDDING_MODEL);
     if (!QFileInfo::exists(filePath)) {
         qWarning() << "embllm WARNING: Local embedding model not found";
-        return false;
+        return nullptr;
     }
 
     QString requestedDevice = MySettings::globalInstance()->localDocsEmbedDevice();
@@ -98,22 +138,23 @@ bool EmbeddingLLMWorker::loadModel()
         backend = "cuda";
 #endif
 
+    LLModel *model;
     try {
-        m_model = LLModel::Implementation::construct(filePath.toStdString(), backend, n_ctx);
+        model = LLModel::Implementation::construct(filePath.toStdString(), backend, n_ctx);
     } catch (const std::exception &e) {
         qWarning() << "embllm WARNING: Could not load embedding model:" << e.what();
-        return false;
+        return nullptr;
     }
 
     bool actualDeviceIsCPU = true;
 
 #if defined(Q_OS_MAC) && defined(__aarch64__)
-    if (m_model->implementation().buildVariant() == "metal")
+    if (model->implementation().buildVariant() == "metal")
         actualDeviceIsCPU = false;
 #else
     if (requestedDevice != "CPU") {
         const LLModel::GPUDevice *device = nullptr;
-        std::vector<LLModel::GPUDevice> availableDevices = m_model->availableGPUDevices(0);
+        std::vector<LLModel::GPUDevice> availableDevices = model->availableGPUDevices(0);
         if (requestedDevice != "Auto") {
             // Use the selected device
             for (const LLModel::GPUDevice &d : availableDevices) {
@@ -127,7 +168,7 @@ bool EmbeddingLLMWorker::loadModel()
         std::string unavail_reason;
         if (!device) {
             // GPU not available
-        } else if (!m_model->initializeGPUDevice(device->index, &unavail_reason)) {
+        } else if (!model->initializeGPUDevice(device->index, &unavail_reason)) {
             qWarning().noquote() << "embllm WARNING: Did not use GPU:" << QString::fromStdString(unavail_reason);
         } else {
             actualDeviceIsCPU = false;
@@ -135,7 +176,7 @@ bool EmbeddingLLMWorker::loadModel()
     }
 #endif
 
-    bool success = m_model->loadModel(filePath.toStdString(), n_ctx, 100);
+    bool success = model->loadModel(filePath.toStdString(), n_ctx, 100);
 
     // CPU fallback
     if (!actualDeviceIsCPU && !success) {
@@ -145,35 +186,40 @@ bool EmbeddingLLMWorker::loadModel()
         if (backend == "cuda") {
             // For CUDA, make sure we don't use the GPU at all - ngl=0 still offloads matmuls
             try {
-                m_model = LLModel::Implementation::construct(filePath.toStdString(), "auto", n_ctx);
+                model = LLModel::Implementation::construct(filePath.toStdString(), "auto", n_ctx);
             } catch (const std::exception &e) {
                 qWarning() << "embllm WARNING: Could not load embedding model:" << e.what();
-                return false;
+                return nullptr;
             }
         }
 
-        success = m_model->loadModel(filePath.toStdString(), n_ctx, 0);
+        success = model->loadModel(filePath.toStdString(), n_ctx, 0);
     }
 
     if (!success) {
         qWarning() << "embllm WARNING: Could not load embedding model";
-        delete m_model;
-        m_model = nullptr;
-        return false;
+        delete model;
+        return nullptr;
     }
 
-    if (!m_model->supportsEmbedding()) {
+    if (!model->supportsEmbedding()) {
         qWarning() << "embllm WARNING: Model type does not support embeddings";
-        delete m_model;
-        m_model = nullptr;
-        return false;
+        delete model;
+        return nullptr;
     }
 
     // FIXME(jared): the user may want this to take effect without having to restart
     int n_threads = MySettings::globalInstance()->threadCount();
-    m_model->setThreadCount(n_threads);
+    model->setThreadCount(n_threads);
 
-    return true;
+    return model;
+}
+
+void EmbeddingLLMWorker::loadModelRequested()
+{
+    QMutexLocker locker(&m_mutex);
+    if (!hasModel() && !loadModel())
+        qWarning() << "WARNING: Could not load model for embeddings";
 }
 
 std::vector<float> EmbeddingLLMWorker::generateQueryEmbedding(const QString &text)
@@ -222,7 +268,7 @@ void EmbeddingLLMWorker::sendAtlasRequest(const QStringList &texts, const QStrin
     request.setRawHeader("Authorization", authorization.toUtf8());
     request.setAttribute(QNetworkRequest::User, userData);
     QNetworkReply *reply = m_networkManager->post(request, doc.toJson(QJsonDocument::Compact));
-    connect(qGuiApp, &QCoreApplication::aboutToQuit, reply, &QNetworkReply::abort);
+    connect(qApp, &QCoreApplication::aboutToQuit, reply, &QNetworkReply::abort);
     connect(reply, &QNetworkReply::finished, this, &EmbeddingLLMWorker::handleFinished);
 }
 
@@ -256,6 +302,8 @@ void EmbeddingLLMWorker::docEmbeddingsRequested(const QVector<EmbeddingChunk> &c
         QMutexLocker locker(&m_mutex);
         if (!hasModel() && !loadModel()) {
             qWarning() << "WARNING: Could not load model for embeddings";
+            // every chunk is handed back, so that the database can account for it
+            emit errorGenerated(chunks, u"ERROR: Could not load model for embeddings"_s);
             return;
         }
 
@@ -263,37 +311,8 @@ void EmbeddingLLMWorker::docEmbeddingsRequested(const QVector<EmbeddingChunk> &c
     }
 
     if (!isNomic) {
-        QVector<EmbeddingResult> results;
-        results.reserve(chunks.size());
-        std::vector<std::string> texts;
-        texts.reserve(chunks.size());
-        for (const auto &c: chunks) {
-            EmbeddingResult result;
-            result.model = c.model;
-            result.folder_id = c.folder_id;
-            result.chunk_id = c.chunk_id;
-            result.embedding.resize(m_model->embeddingSize());
-            results << result;
-            texts.push_back(c.chunk.toStdString());
-        }
-
-        constexpr int BATCH_SIZE = 4;
-        std::vector<float> result;
-        result.resize(chunks.size() * m_model->embeddingSize());
-        for (int j = 0; j < chunks.size(); j += BATCH_SIZE) {
-            QMutexLocker locker(&m_mutex);
-            std::vector batchTexts(texts.begin() + j, texts.begin() + std::min(j + BATCH_SIZE, int(texts.size())));
-            try {
-                m_model->embed(batchTexts, result.data() + j * m_model->embeddingSize(), /*isRetrieval*/ false);
-            } catch (const std::exception &e) {
-                qWarning() << "WARNING: LLModel::embed failed:" << e.what();
-                return;
-            }
-        }
-        for (int i = 0; i < chunks.size(); i++)
-            memcpy(results[i].embedding.data(), &result[i * m_model->embeddingSize()], m_model->embeddingSize() * sizeof(float));
-
-        emit embeddingsGenerated(results);
+        m_pendingChunks.append(chunks);
+        embedPendingChunks(/*flush*/ false);
         return;
     };
 
@@ -303,6 +322,83 @@ void EmbeddingLLMWorker::docEmbeddingsRequested(const QVector<EmbeddingChunk> &c
     sendAtlasRequest(texts, "search_document", QVariant::fromValue(chunks));
 }
 
+void EmbeddingLLMWorker::flushPendingChunks()
+{
+    embedPendingChunks(/*flush*/ true);
+}
+
+// Embeds the pending chunks a batch of the context size at a time, so that each call to the model fills its batch
+// and a query waits for at most one. Unless flushing, chunks that do not fill a batch wait a moment for more.
+void EmbeddingLLMWorker::embedPendingChunks(bool flush)
+{
+    while (!m_pendingChunks.isEmpty() && !m_stopGenerating) {
+        qsizetype n = 0;
+        qsizetype tokens = 0;
+        for (; n < m_pendingChunks.size(); n++) {
+            qsizetype chunkTokens = estimateTokens(m_pendingChunks[n].chunk);
+            if (n && tokens + chunkTokens > EMBEDDING_N_CTX)
+                break;
+            tokens += chunkTokens;
+        }
+        if (!flush && n == m_pendingChunks.size() && tokens < EMBEDDING_N_CTX) {
+            m_flushTimer->start();
+            return;
+        }
+
+        QVector<EmbeddingChunk> batch = m_pendingChunks.first(n);
+        m_pendingChunks.remove(0, n);
+        embedChunks(batch);
+    }
+    m_flushTimer->stop();
+}
+
+void EmbeddingLLMWorker::embedChunks(const QVector<EmbeddingChunk> &chunks)
+{
+    std::vector<std::string> texts;
+    texts.reserve(chunks.size());
+    for (const auto &c: chunks)
+        texts.push_back(c.chunk.toStdString());
+
+    std::vector<float> result;
+    size_t n_embd;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_model) {
+            emit errorGenerated(chunks, u"ERROR: Could not load model for embeddings"_s);
+            return;
+        }
+        n_embd = m_model->embeddingSize();
+        result.resize(chunks.size() * n_embd);
+        try {
+            // the model packs the chunks into as few decodes as fit its batch, and reports them to the callback
+            m_model->embed(texts, result.data(), std::nullopt /*the document prefix*/, /*dimensionality*/ -1,
+                           /*tokenCount*/ nullptr, /*doMean*/ true, /*atlas*/ false, recordDecodeBatches);
+        } catch (const std::exception &e) {
+            qWarning() << "WARNING: LLModel::embed failed:" << e.what();
+            emit errorGenerated(chunks, u"ERROR: Failed to generate embeddings: %1"_s.arg(e.what()));
+            return;
+        }
+    }
+
+    for (unsigned batchSize : t_decodeBatches)
+        Metrics::globalInstance()->embeddingBatchOccupancy.observe(double(batchSize) / EMBEDDING_N_CTX);
+    t_decodeBatches.clear();
+
+    QVector<EmbeddingResult> results;
+    results.reserve(chunks.size());
+    for (qsizetype i = 0; i < chunks.size(); i++) {
+        const auto &c = chunks[i];
+        EmbeddingResult embedding;
+        embedding.model = c.model;
+        embedding.folder_id = c.folder_id;
+        embedding.chunk_id = c.chunk_id;
+        embedding.embedding.assign(result.begin() + i * n_embd, result.begin() + (i + 1) * n_embd);
+        results << embedding;
+    }
+
+    emit embeddingsGenerated(results);
+}
+
 std::vector<float> jsonArrayToVector(const QJsonArray &jsonArray)
 {
     std::vector<float> result;
@@ -383,6 +479,8 @@ void EmbeddingLLMWorker::handleFinished()
     QJsonDocument document = QJsonDocument::fromJson(jsonData, &err);
     if (err.error != QJsonParseError::NoError) {
         qWarning() << "ERROR: Couldn't parse Nomic Atlas response:" << jsonData << err.errorString();
+        if (!chunks.isEmpty())
+            emit errorGenerated(chunks, u"ERROR: Couldn't parse Nomic Atlas response"_s);
         return;
     }
 
@@ -390,7 +488,11 @@ void EmbeddingLLMWorker::handleFinished()
     const QJsonArray embeddings = root.value("embeddings").toArray();
 
     if (!chunks.isEmpty()) {
-        emit embeddingsGenerated(jsonArrayToEmbeddingResults(chunks, embeddings));
+        auto results = jsonArrayToEmbeddingResults(chunks, embeddings);
+        if (results.isEmpty())
+            emit errorGenerated(chunks, u"ERROR: Nomic Atlas returned the wrong number of embeddings"_s);
+        else
+            emit embeddingsGenerated(results);
     } else {
         m_lastResponse = jsonArrayToVector(embeddings);
         emit finished();
@@ -405,6 +507,8 @@ EmbeddingLLM::EmbeddingLLM()
 {
     connect(this, &EmbeddingLLM::requestDocEmbeddings, m_embeddingWorker,
         &EmbeddingLLMWorker::docEmbeddingsRequested, Qt::QueuedConnection);
+    connect(this, &EmbeddingLLM::requestLoadModel, m_embeddingWorker,
+        &EmbeddingLLMWorker::loadModelRequested, Qt::QueuedConnection);
     connect(m_embeddingWorker, &EmbeddingLLMWorker::embeddingsGenerated, this,
         &EmbeddingLLM::embeddingsGenerated, Qt::QueuedConnection);
     connect(m_embeddingWorker, &EmbeddingLLMWorker::errorGenerated, this,
@@ -422,6 +526,16 @@ QString EmbeddingLLM::model()
     return EMBEDDING_MODEL_NAME;
 }
 
+bool EmbeddingLLM::hasModel() const
+{
+    return m_embeddingWorker->isModelLoaded();
+}
+
+void EmbeddingLLM::loadModelAsync()
+{
+    emit requestLoadModel();
+}
+
 // TODO(jared): embed using all necessary embedding models given collection
 std::vector<float> EmbeddingLLM::generateQueryEmbedding(const QString &text)
 {
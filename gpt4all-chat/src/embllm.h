@@ -15,6 +15,7 @@
 
 class LLModel;
 class QNetworkAccessManager;
+class QTimer;
 
 struct EmbeddingChunk {
     QString model; // TODO(jared): use to select model
@@ -45,12 +46,16 @@ public:
     bool loadModel();
     bool isNomic() const { return !m_nomicAPIKey.isEmpty(); }
     bool hasModel() const { return isNomic() || m_model; }
+    // Whether a query can be embedded without loading the model first. Can be called from any thread, without waiting
+    // for an embedding in progress.
+    bool isModelLoaded() const { return m_modelLoaded; }
 
     std::vector<float> generateQueryEmbedding(const QString &text);
 
 public Q_SLOTS:
     void atlasQueryEmbeddingRequested(const QString &text);
     void docEmbeddingsRequested(const QVector<EmbeddingChunk> &chunks);
+    void loadModelRequested();
 
 Q_SIGNALS:
     void requestAtlasQueryEmbedding(const QString &text);
@@ -60,17 +65,23 @@ Q_SIGNALS:
 
 private Q_SLOTS:
     void handleFinished();
+    void flushPendingChunks();
 
 private:
     void sendAtlasRequest(const QStringList &texts, const QString &taskType, const QVariant &userData = {});
+    void embedPendingChunks(bool flush);
+    void embedChunks(const QVector<EmbeddingChunk> &chunks);
 
     QString m_nomicAPIKey;
     QNetworkAccessManager *m_networkManager;
     std::vector<float> m_lastResponse;
     LLModel *m_model = nullptr;
     std::atomic<bool> m_stopGenerating;
+    std::atomic<bool> m_modelLoaded = false; // hasModel(), set as the model is loaded and unloaded
     QThread m_workerThread;
     QMutex m_mutex; // guards m_model and m_nomicAPIKey
+    QVector<EmbeddingChunk> m_pendingChunks; // to embed locally once they fill a batch
+    QTimer *m_flushTimer;
 };
 
 class EmbeddingLLM : public QObject
@@ -81,8 +92,12 @@ public:
     ~EmbeddingLLM() override;
 
     static QString model();
+    // Loads the bundled embedding model on the device chosen for LocalDocs, or returns nullptr if it cannot be loaded.
+    static LLModel *loadLocalModel();
     bool loadModel();
     bool hasModel() const;
+    // Loads the model on the embedding thread, so that later queries do not wait for it.
+    void loadModelAsync();
 
 public Q_SLOTS:
     std::vector<float> generateQueryEmbedding(const QString &text); // synchronous
@@ -90,6 +105,7 @@ public Q_SLOTS:
 
 Q_SIGNALS:
     void requestDocEmbeddings(const QVector<EmbeddingChunk> &chunks);
+    void requestLoadModel();
     void embeddingsGenerated(const QVector<EmbeddingResult> &embeddings);
     void errorGenerated(const QVector<EmbeddingChunk> &chunks, const QString &error);
 
@@ -0,0 +1,214 @@
+#include "folderwatcher.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileSystemWatcher>
+#include <QList>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <QtLogging>
+
+#include <algorithm>
+
+#ifdef Q_OS_LINUX
+#   include <cerrno>
+#   include <cstring>
+#   include <sys/inotify.h>
+#   include <unistd.h>
+#endif
+
+using namespace Qt::Literals::StringLiterals;
+
+
+FolderWatcher::FolderWatcher(QObject *parent)
+    : QObject(parent)
+    , m_changeTimer(new QTimer(this))
+{
+    // wait for a burst of changes, like a copy of many files, to settle before reporting them
+    m_changeTimer->setSingleShot(true);
+    m_changeTimer->setInterval(250);
+    connect(m_changeTimer, &QTimer::timeout, this, &FolderWatcher::reportChanges);
+
+#ifdef Q_OS_LINUX
+    m_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd == -1) {
+        qWarning() << "FolderWatcher ERROR: Unable to initialize inotify:" << std::strerror(errno);
+        return;
+    }
+    m_notifier = new QSocketNotifier(m_fd, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &FolderWatcher::readEvents);
+#else
+    m_watcher = new QFileSystemWatcher(this);
+    connect(m_watcher, &QFileSystemWatcher::directoryChanged, this, [this](const QString &path) {
+        m_changed.insert(path);
+        m_changeTimer->start();
+    });
+#endif
+}
+
+FolderWatcher::~FolderWatcher()
+{
+#ifdef Q_OS_LINUX
+    if (m_fd != -1)
+        ::close(m_fd);
+#endif
+}
+
+void FolderWatcher::reportChanges()
+{
+    QStringList changed(m_changed.begin(), m_changed.end());
+    m_changed.clear();
+
+    // a directory is scanned with its subdirectories, so those need no report of their own
+    std::sort(changed.begin(), changed.end());
+    QString last;
+    for (const QString &path : std::as_const(changed)) {
+        if (!last.isNull() && path.startsWith(last + u'/'))
+            continue;
+        last = path;
+        emit directoryChanged(path);
+    }
+}
+
+#ifdef Q_OS_LINUX
+
+bool FolderWatcher::addPath(const QString &path)
+{
+    if (m_fd == -1)
+        return false;
+    if (m_watches.contains(path))
+        return true; // with its subdirectories
+    if (!addWatch(path))
+        return false;
+    addWatches(path);
+    return true;
+}
+
+QStringList FolderWatcher::removePaths(const QStringList &paths)
+{
+    QStringList notWatched;
+    for (const QString &path : paths) {
+        if (!m_watches.contains(path)) {
+            notWatched << path;
+            continue;
+        }
+        removeWatches(path);
+    }
+    return notWatched;
+}
+
+bool FolderWatcher::addWatch(const QString &path)
+{
+    if (m_watches.contains(path))
+        return true;
+
+    constexpr uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB
+                            | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+    int wd = ::inotify_add_watch(m_fd, QFile::encodeName(path).constData(), mask);
+    if (wd == -1) {
+        // most likely ENOSPC, for more directories than fs.inotify.max_user_watches
+        qWarning() << "FolderWatcher ERROR: Unable to watch" << path << std::strerror(errno);
+        return false;
+    }
+    // the directory is already watched under another path, if it was moved without our knowing
+    auto it = m_paths.constFind(wd);
+    if (it != m_paths.constEnd())
+        m_watches.remove(*it);
+    m_paths.insert(wd, path);
+    m_watches.insert(path, wd);
+    return true;
+}
+
+// Watches the subdirectories of path.
+void FolderWatcher::addWatches(const QString &path)
+{
+    QDirIterator it(path, QDir::Dirs | QDir::NoDotAndDotDot | QDir::Readable, QDirIterator::Subdirectories);
+    while (it.hasNext())
+        addWatch(it.next());
+}
+
+// Stops watching path and its subdirectories.
+void FolderWatcher::removeWatches(const QString &path)
+{
+    const QString prefix = path + u'/';
+    for (auto it = m_watches.begin(); it != m_watches.end();) {
+        if (it.key() == path || it.key().startsWith(prefix)) {
+            ::inotify_rm_watch(m_fd, it.value());
+            m_paths.remove(it.value());
+            it = m_watches.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void FolderWatcher::readEvents()
+{
+    alignas(inotify_event) char buffer[16 * 1024];
+    for (;;) {
+        ssize_t n = ::read(m_fd, buffer, sizeof buffer);
+        if (n <= 0)
+            break; // EAGAIN once there are no more events
+
+        for (char *p = buffer; p < buffer + n;) {
+            const auto *event = reinterpret_cast<const inotify_event *>(p);
+            p += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // events were lost, so anything may have changed
+                for (auto it = m_watches.keyBegin(); it != m_watches.keyEnd(); ++it)
+                    m_changed.insert(*it);
+                continue;
+            }
+
+            auto it = m_paths.constFind(event->wd);
+            if (it == m_paths.constEnd())
+                continue;
+            const QString dir = *it;
+
+            if (event->mask & IN_IGNORED) {
+                // the directory is gone; its parent reports that
+                m_paths.remove(event->wd);
+                m_watches.remove(dir);
+                continue;
+            }
+
+            if (event->mask & IN_MOVE_SELF) {
+                // the watches of the directory and its subdirectories would go on with paths that are gone; its
+                // parent reports the move if it is watched, and is watched again where it is moved to
+                removeWatches(dir);
+                m_changed.insert(dir);
+                continue;
+            }
+
+            if ((event->mask & IN_ISDIR) && (event->mask & IN_MOVED_FROM) && event->len)
+                removeWatches(dir + u'/' + QFile::decodeName(event->name));
+
+            if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)) && event->len) {
+                const QString subdir = dir + u'/' + QFile::decodeName(event->name);
+                if (addWatch(subdir))
+                    addWatches(subdir);
+            }
+            m_changed.insert(dir);
+        }
+    }
+
+    if (!m_changed.isEmpty())
+        m_changeTimer->start();
+}
+
+#else
+
+bool FolderWatcher::addPath(const QString &path)
+{
+    return m_watcher->addPath(path);
+}
+
+QStringList FolderWatcher::removePaths(const QStringList &paths)
+{
+    return m_watcher->removePaths(paths);
+}
+
+#endif
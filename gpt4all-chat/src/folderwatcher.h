@@ -0,0 +1,62 @@
+#ifndef FOLDERWATCHER_H
+#define FOLDERWATCHER_H
+
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QtGlobal>
+
+class QFileSystemWatcher;
+class QSocketNotifier;
+class QTimer;
+
+/*
+ * Watches the folders of LocalDocs for changes, with the interface of the parts of QFileSystemWatcher it replaces.
+ *
+ * On Linux it uses inotify directly and watches a folder recursively: the subdirectories of a path are watched when it
+ * is added, and new ones as soon as they are created, so that no change is missed before they are scanned. It also
+ * reports files that were written to, which QFileSystemWatcher does not for a directory. Elsewhere, each directory
+ * has to be added on its own, as with QFileSystemWatcher.
+ *
+ * Changes are reported once they settle for a moment, a directory at a time, leaving out those within another
+ * directory that changed too.
+ */
+class FolderWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FolderWatcher(QObject *parent = nullptr);
+    ~FolderWatcher() override;
+
+    bool addPath(const QString &path);
+    // Returns the paths that were not watched. On Linux, also stops watching their subdirectories.
+    QStringList removePaths(const QStringList &paths);
+    bool removePath(const QString &path) { return removePaths({ path }).isEmpty(); }
+
+Q_SIGNALS:
+    void directoryChanged(const QString &path);
+
+private:
+    void reportChanges();
+
+#ifdef Q_OS_LINUX
+    bool addWatch(const QString &path);
+    void addWatches(const QString &path);
+    void removeWatches(const QString &path);
+    void readEvents();
+
+    int              m_fd = -1;
+    QSocketNotifier *m_notifier = nullptr;
+    QHash<int, QString> m_paths;   // by watch descriptor
+    QHash<QString, int> m_watches; // by path
+#else
+    QFileSystemWatcher *m_watcher;
+#endif
+    QSet<QString> m_changed;
+    QTimer       *m_changeTimer;
+};
+
+#endif // FOLDERWATCHER_H
@@ -13,7 +13,9 @@
 #include <QUrl>
 #include <QtLogging>
 
-#ifdef GPT4ALL_OFFLINE_INSTALLER
+// the headless server does not link Qt6::Gui, and does not check for updates
+#if defined(GPT4ALL_HEADLESS)
+#elif defined(GPT4ALL_OFFLINE_INSTALLER)
 #   include <QDesktopServices>
 #else
 #   include "network.h"
@@ -49,7 +51,9 @@ bool LLM::hasSettingsAccess() const
 
 bool LLM::checkForUpdates() const
 {
-#ifdef GPT4ALL_OFFLINE_INSTALLER
+#if defined(GPT4ALL_HEADLESS)
+    return false; // updated with the app
+#elif defined(GPT4ALL_OFFLINE_INSTALLER)
 #   pragma message(__FILE__ ": WARNING: offline installer build will not check for updates!")
     return QDesktopServices::openUrl(QUrl("https://github.com/nomic-ai/gpt4all/releases"));
 #else
@@ -90,6 +94,23 @@ bool LLM::fileExists(const QString &path)
     return info.exists() && info.isFile();
 }
 
+QString LLM::implementationsSearchPath()
+{
+    QString searchPaths = QCoreApplication::applicationDirPath();
+    const QString libDir = QCoreApplication::applicationDirPath() + "/../lib/";
+    if (directoryExists(libDir))
+        searchPaths += ";" + libDir;
+#if defined(Q_OS_MAC)
+    const QString binDir = QCoreApplication::applicationDirPath() + "/../../../";
+    if (directoryExists(binDir))
+        searchPaths += ";" + binDir;
+    const QString frameworksDir = QCoreApplication::applicationDirPath() + "/../Frameworks/";
+    if (directoryExists(frameworksDir))
+        searchPaths += ";" + frameworksDir;
+#endif
+    return searchPaths;
+}
+
 qint64 LLM::systemTotalRAMInGB() const
 {
     return getSystemTotalRAMInGB();
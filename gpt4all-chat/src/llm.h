@@ -23,6 +23,9 @@ public:
     Q_INVOKABLE QString systemTotalRAMInGBString() const;
     Q_INVOKABLE bool isNetworkOnline() const;
 
+    // the directories to search for the model implementation libraries, relative to the executable
+    static QString implementationsSearchPath();
+
 Q_SIGNALS:
     void isNetworkOnlineChanged();
 
@@ -0,0 +1,586 @@
+// gpt4all-loadtest: load generator for the local API server.
+//
+// Keeps a number of clients busy sending streamed /v1/chat/completions requests, each over its own keep-alive
+// connection, with prompt and response lengths drawn from the given distributions. Reports the time to first token,
+// latency, throughput and errors as a single JSON object, so that results can be compared across commits and
+// settings. Start the server with `gpt4all-server --stand-in-model` to measure the server rather than a model. Both the
+// tool and that option are only built with -DGPT4ALL_LOADTEST=ON, and neither is installed with the app.
+
+#include <QByteArray>
+#include <QCommandLineOption>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QList>
+#include <QObject>
+#include <QString>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QtGlobal>
+#include <QtLogging>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <utility>
+#include <vector>
+
+using namespace Qt::Literals::StringLiterals;
+
+
+namespace {
+
+// A length that is either fixed or drawn from a uniform or normal distribution, and always at least 1.
+class Distribution
+{
+public:
+    // Parses "N", "uniform:MIN,MAX" or "normal:MEAN,STDDEV".
+    static std::optional<Distribution> parse(const QString &spec)
+    {
+        Distribution dist;
+        bool ok = false;
+        auto kindAndArgs = spec.split(u':');
+        if (kindAndArgs.size() == 1) {
+            dist.m_a = spec.toDouble(&ok);
+            return ok && dist.m_a >= 1 ? std::optional(dist) : std::nullopt;
+        }
+        if (kindAndArgs.size() != 2)
+            return std::nullopt;
+        auto args = kindAndArgs[1].split(u',');
+        if (args.size() != 2)
+            return std::nullopt;
+        bool ok2 = false;
+        dist.m_a = args[0].toDouble(&ok);
+        dist.m_b = args[1].toDouble(&ok2);
+        if (!ok || !ok2)
+            return std::nullopt;
+        if (kindAndArgs[0] == "uniform"_L1 && dist.m_a >= 1 && dist.m_b >= dist.m_a)
+            dist.m_kind = Kind::Uniform;
+        else if (kindAndArgs[0] == "normal"_L1 && dist.m_a >= 1 && dist.m_b >= 0)
+            dist.m_kind = Kind::Normal;
+        else
+            return std::nullopt;
+        return dist;
+    }
+
+    int sample(std::mt19937 &rng) const
+    {
+        double value = m_a;
+        switch (m_kind) {
+        case Kind::Fixed:
+            break;
+        case Kind::Uniform:
+            value = std::uniform_int_distribution<int>(int(m_a), int(m_b))(rng);
+            break;
+        case Kind::Normal:
+            value = std::normal_distribution<double>(m_a, m_b)(rng);
+            break;
+        }
+        return std::max(1, int(std::lround(value)));
+    }
+
+private:
+    enum class Kind { Fixed, Uniform, Normal };
+
+    Kind   m_kind = Kind::Fixed;
+    double m_a = 0;
+    double m_b = 0;
+};
+
+struct Options {
+    QString      host;
+    quint16      port;
+    QString      model;
+    int          concurrency;
+    qint64       requests;   // 0 if the test runs for a duration
+    qint64       durationMs;
+    qint64       timeoutMs;
+    double       temperature;
+    Distribution promptWords;
+    Distribution maxTokens;
+    unsigned     seed;
+};
+
+struct Sample {
+    bool   ok = false;
+    double ttftMs = -1; // -1 if no token was received
+    double latencyMs = 0;
+    qint64 promptTokens = 0;
+    qint64 completionTokens = 0;
+};
+
+class LoadTest;
+
+// One connection to the server, which sends a request at a time and parses its streamed response.
+class Client
+{
+public:
+    Client(LoadTest *test, const Options &options)
+        : m_test(test), m_options(options)
+    {
+        m_timeout.setSingleShot(true);
+        QObject::connect(&m_socket, &QTcpSocket::connected,    &m_socket, [this] { writeRequest(); });
+        QObject::connect(&m_socket, &QTcpSocket::readyRead,    &m_socket, [this] { readResponse(); });
+        QObject::connect(&m_socket, &QTcpSocket::disconnected, &m_socket, [this] { onDisconnected(); });
+        QObject::connect(&m_socket, &QTcpSocket::errorOccurred, &m_socket, [this](QAbstractSocket::SocketError err) {
+            // a closed connection is handled when it is disconnected
+            if (m_active && err != QAbstractSocket::RemoteHostClosedError)
+                fail(m_socket.errorString());
+        });
+        QObject::connect(&m_timeout, &QTimer::timeout, &m_socket, [this] {
+            fail(u"timed out"_s);
+            m_socket.abort();
+        });
+    }
+
+    void start(QByteArray body);
+
+private:
+    enum class State { StatusLine, Headers, ChunkSize, ChunkData, ChunkEnd, Body };
+
+    void writeRequest();
+    void readResponse();
+    void onDisconnected();
+    void handleBody(const QByteArray &data);
+    void handleEvent(const QByteArray &event);
+    void finish();
+    void fail(const QString &error);
+
+    LoadTest       *m_test;
+    const Options  &m_options;
+    QTcpSocket      m_socket;
+    QTimer          m_timeout;
+    QByteArray      m_body;
+    QElapsedTimer   m_elapsed;
+    bool            m_active = false;
+    bool            m_keepAlive = true;
+
+    // the response so far
+    State      m_state = State::StatusLine;
+    QByteArray m_buffer;   // received bytes that are not parsed yet
+    QByteArray m_events;   // decoded body that does not end in a complete event yet
+    int        m_status = 0;
+    bool       m_chunked = false;
+    qint64     m_remaining = 0; // of the current chunk, or of a body with a Content-Length
+    bool       m_done = false;  // saw [DONE]
+    Sample     m_sample;
+};
+
+class LoadTest
+{
+public:
+    explicit LoadTest(Options options)
+        : m_options(std::move(options)), m_rng(m_options.seed)
+    {
+        for (int i = 0; i < m_options.concurrency; i++)
+            m_clients.push_back(std::make_unique<Client>(this, m_options));
+    }
+
+    void run()
+    {
+        m_elapsed.start();
+        for (auto &client : m_clients) {
+            if (!next(*client))
+                break;
+        }
+        if (!m_running)
+            report();
+    }
+
+    // Starts another request on the client if the test is not over. Returns false if it is.
+    bool next(Client &client)
+    {
+        bool more = m_options.requests ? m_started < m_options.requests
+                                       : m_elapsed.elapsed() < m_options.durationMs;
+        if (!more)
+            return false;
+        m_started++;
+        m_running++;
+        client.start(makeBody());
+        return true;
+    }
+
+    void record(Client &client, const Sample &sample, const QString &error)
+    {
+        m_samples.push_back(sample);
+        if (!sample.ok)
+            m_errors[error.isEmpty() ? u"unknown"_s : error]++;
+        m_running--;
+        // the client is free for the next request after the current event has been handled
+        QTimer::singleShot(0, qApp, [this, &client] {
+            if (!next(client) && !m_running)
+                report();
+        });
+    }
+
+private:
+    QByteArray makeBody()
+    {
+        static const char *words[] = {
+            "the", "model", "answers", "a", "question", "about", "local", "documents", "with", "short", "and", "long",
+            "sentences", "that", "describe", "how", "servers", "schedule", "requests", "under", "heavy", "load",
+        };
+        int nWords = m_options.promptWords.sample(m_rng);
+        std::uniform_int_distribution<size_t> pick(0, std::size(words) - 1);
+        // a unique opening keeps requests from sharing more of a prefix than real traffic would
+        QString prompt = u"Request %1:"_s.arg(m_started);
+        for (int i = 0; i < nWords; i++)
+            prompt += u" "_s + QLatin1StringView(words[pick(m_rng)]);
+
+        QJsonObject body {
+            { u"model"_s,          m_options.model },
+            { u"messages"_s,       QJsonArray { QJsonObject { { u"role"_s, u"user"_s }, { u"content"_s, prompt } } } },
+            { u"max_tokens"_s,     m_options.maxTokens.sample(m_rng) },
+            { u"temperature"_s,    m_options.temperature },
+            { u"stream"_s,         true },
+            { u"stream_options"_s, QJsonObject { { u"include_usage"_s, true } } },
+        };
+        return QJsonDocument(body).toJson(QJsonDocument::Compact);
+    }
+
+    static QJsonObject summarize(std::vector<double> values)
+    {
+        if (values.empty())
+            return {};
+        std::ranges::sort(values);
+        // nearest-rank percentile
+        auto percentile = [&values](double p) {
+            size_t rank = size_t(std::ceil(p / 100.0 * double(values.size())));
+            return values[std::clamp(rank, size_t(1), values.size()) - 1];
+        };
+        double mean = std::accumulate(values.begin(), values.end(), 0.0) / double(values.size());
+        return {
+            { u"p50"_s,  percentile(50) },
+            { u"p95"_s,  percentile(95) },
+            { u"p99"_s,  percentile(99) },
+            { u"mean"_s, mean },
+            { u"max"_s,  values.back() },
+        };
+    }
+
+    void report()
+    {
+        if (std::exchange(m_reported, true))
+            return;
+        double wallMs = double(m_elapsed.elapsed());
+        std::vector<double> ttfts, latencies;
+        qint64 succeeded = 0, promptTokens = 0, completionTokens = 0;
+        for (const auto &s : m_samples) {
+            if (!s.ok)
+                continue;
+            succeeded++;
+            latencies.push_back(s.latencyMs);
+            if (s.ttftMs >= 0)
+                ttfts.push_back(s.ttftMs);
+            promptTokens += s.promptTokens;
+            completionTokens += s.completionTokens;
+        }
+        auto perSecond = [wallMs](double count) { return wallMs > 0 ? count * 1000.0 / wallMs : 0.0; };
+
+        QJsonObject errors;
+        for (auto it = m_errors.cbegin(); it != m_errors.cend(); ++it)
+            errors.insert(it->first, it->second);
+
+        QJsonObject result {
+            { u"model"_s,                   m_options.model },
+            { u"concurrency"_s,             m_options.concurrency },
+            { u"wall_ms"_s,                 wallMs },
+            { u"requests"_s,                qint64(m_samples.size()) },
+            { u"succeeded"_s,               succeeded },
+            { u"failed"_s,                  qint64(m_samples.size()) - succeeded },
+            { u"errors"_s,                  errors },
+            { u"requests_per_sec"_s,        perSecond(double(succeeded)) },
+            { u"prompt_tokens"_s,           promptTokens },
+            { u"completion_tokens"_s,       completionTokens },
+            { u"completion_tokens_per_sec"_s, perSecond(double(completionTokens)) },
+            { u"ttft_ms"_s,                 summarize(std::move(ttfts)) },
+            { u"latency_ms"_s,              summarize(std::move(latencies)) },
+        };
+        std::fputs(QJsonDocument(result).toJson(QJsonDocument::Indented).constData(), stdout);
+        std::fflush(stdout);
+        QCoreApplication::exit(succeeded ? 0 : 1);
+    }
+
+    Options                              m_options;
+    std::mt19937                         m_rng;
+    std::vector<std::unique_ptr<Client>> m_clients;
+    QElapsedTimer                        m_elapsed;
+    qint64                               m_started = 0;
+    int                                  m_running = 0;
+    bool                                 m_reported = false;
+    std::vector<Sample>                  m_samples;
+    std::map<QString, qint64>            m_errors; // count of each kind of error
+};
+
+void Client::start(QByteArray body)
+{
+    m_body = std::move(body);
+    m_active = true;
+    m_state = State::StatusLine;
+    m_buffer.clear();
+    m_events.clear();
+    m_status = 0;
+    m_chunked = false;
+    m_remaining = -1;
+    m_done = false;
+    m_sample = {};
+    m_elapsed.start();
+    m_timeout.start(int(std::min<qint64>(m_options.timeoutMs, std::numeric_limits<int>::max())));
+
+    if (m_socket.state() == QAbstractSocket::ConnectedState && m_keepAlive) {
+        writeRequest();
+    } else {
+        m_socket.abort();
+        m_keepAlive = true;
+        m_socket.connectToHost(m_options.host, m_options.port);
+    }
+}
+
+void Client::writeRequest()
+{
+    if (!m_active)
+        return;
+    QByteArray request = "POST /v1/chat/completions HTTP/1.1\r\n"
+                         "Host: " + m_options.host.toUtf8() + ':' + QByteArray::number(m_options.port) + "\r\n"
+                         "Content-Type: application/json\r\n"
+                         "Accept: text/event-stream\r\n"
+                         "Connection: keep-alive\r\n"
+                         "Content-Length: " + QByteArray::number(m_body.size()) + "\r\n"
+                         "\r\n" + m_body;
+    m_socket.write(request);
+}
+
+void Client::readResponse()
+{
+    m_buffer += m_socket.readAll();
+    while (m_active) {
+        switch (m_state) {
+        case State::StatusLine:
+        case State::Headers:
+        case State::ChunkSize:
+        case State::ChunkEnd: {
+            qsizetype eol = m_buffer.indexOf("\r\n");
+            if (eol < 0)
+                return;
+            QByteArray line = m_buffer.left(eol);
+            m_buffer.remove(0, eol + 2);
+
+            if (m_state == State::StatusLine) {
+                // HTTP/1.1 200 OK
+                auto parts = line.split(' ');
+                m_status = parts.size() >= 2 ? parts[1].toInt() : 0;
+                m_state = State::Headers;
+            } else if (m_state == State::Headers) {
+                if (!line.isEmpty()) {
+                    qsizetype colon = line.indexOf(':');
+                    QByteArray name  = line.left(colon).trimmed().toLower();
+                    QByteArray value = line.mid(colon + 1).trimmed().toLower();
+                    if (name == "transfer-encoding")
+                        m_chunked = value.contains("chunked");
+                    else if (name == "content-length")
+                        m_remaining = value.toLongLong();
+                    else if (name == "connection")
+                        m_keepAlive = value != "close";
+                    break;
+                }
+                m_state = m_chunked ? State::ChunkSize : State::Body;
+                if (!m_chunked && m_remaining == 0)
+                    return finish();
+            } else if (m_state == State::ChunkSize) {
+                bool ok = false;
+                m_remaining = line.split(';').constFirst().trimmed().toLongLong(&ok, 16);
+                if (!ok)
+                    return fail(u"malformed chunk"_s);
+                if (m_remaining == 0)
+                    return finish(); // ignores trailers, which the server does not send
+                m_state = State::ChunkData;
+            } else {
+                // the CRLF that ends the data of a chunk
+                if (!line.isEmpty())
+                    return fail(u"malformed chunk"_s);
+                m_state = State::ChunkSize;
+            }
+            break;
+        }
+        case State::ChunkData:
+        case State::Body: {
+            if (m_buffer.isEmpty())
+                return;
+            // a body without a length goes on until the connection is closed
+            qsizetype n = m_remaining < 0 ? m_buffer.size() : qsizetype(std::min<qint64>(m_remaining, m_buffer.size()));
+            handleBody(m_buffer.left(n));
+            m_buffer.remove(0, n);
+            if (m_remaining >= 0)
+                m_remaining -= n;
+            if (m_remaining == 0) {
+                if (m_state == State::Body)
+                    return finish();
+                m_state = State::ChunkEnd;
+            }
+            break;
+        }
+        }
+    }
+}
+
+void Client::handleBody(const QByteArray &data)
+{
+    // the body of an error is reported by its status code
+    if (m_status != 200)
+        return;
+    m_events += data;
+    qsizetype end;
+    while ((end = m_events.indexOf("\n\n")) >= 0) {
+        handleEvent(m_events.left(end));
+        m_events.remove(0, end + 2);
+    }
+}
+
+void Client::handleEvent(const QByteArray &event)
+{
+    for (const QByteArray &line : event.split('\n')) {
+        if (!line.startsWith("data:"))
+            continue;
+        QByteArray data = line.mid(5).trimmed();
+        if (data == "[DONE]") {
+            m_done = true;
+            continue;
+        }
+        QJsonObject chunk = QJsonDocument::fromJson(data).object();
+        const QJsonArray choices = chunk.value("choices"_L1).toArray();
+        if (m_sample.ttftMs < 0 && !choices.isEmpty()) {
+            QString content = choices.first().toObject().value("delta"_L1).toObject().value("content"_L1).toString();
+            if (!content.isEmpty())
+                m_sample.ttftMs = double(m_elapsed.nsecsElapsed()) / 1e6;
+        }
+        QJsonObject usage = chunk.value("usage"_L1).toObject();
+        if (!usage.isEmpty()) {
+            m_sample.promptTokens     = usage.value("prompt_tokens"_L1).toInteger();
+            m_sample.completionTokens = usage.value("completion_tokens"_L1).toInteger();
+        }
+    }
+}
+
+void Client::onDisconnected()
+{
+    m_keepAlive = false;
+    if (!m_active)
+        return;
+    // a body without a length ends with the connection
+    if (m_state == State::Body && m_remaining < 0)
+        finish();
+    else
+        fail(u"connection closed"_s);
+}
+
+void Client::finish()
+{
+    if (!m_active)
+        return;
+    if (m_status != 200)
+        return fail(u"HTTP %1"_s.arg(m_status));
+    if (!m_done)
+        return fail(u"stream ended without [DONE]"_s);
+    m_active = false;
+    m_timeout.stop();
+    m_sample.ok = true;
+    m_sample.latencyMs = double(m_elapsed.nsecsElapsed()) / 1e6;
+    m_test->record(*this, m_sample, {});
+}
+
+void Client::fail(const QString &error)
+{
+    if (!m_active)
+        return;
+    m_active = false;
+    m_timeout.stop();
+    // the connection is in an unknown state
+    m_keepAlive = false;
+    m_sample.ok = false;
+    m_sample.latencyMs = double(m_elapsed.nsecsElapsed()) / 1e6;
+    m_test->record(*this, m_sample, error);
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(u"gpt4all-loadtest"_s);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(u"Sends concurrent streamed chat completion requests to the GPT4All local API "
+                                     u"server and reports their latency and throughput as JSON."_s);
+    parser.addHelpOption();
+    QCommandLineOption hostOption(u"host"_s, u"Host of the server. Default: 127.0.0.1."_s, u"host"_s, u"127.0.0.1"_s);
+    QCommandLineOption portOption(u"port"_s, u"Port of the server. Default: 4891."_s, u"port"_s, u"4891"_s);
+    QCommandLineOption modelOption(u"model"_s, u"Model to request. Default: stand-in."_s, u"name"_s, u"stand-in"_s);
+    QCommandLineOption concurrencyOption(u"concurrency"_s, u"Number of connections. Default: 8."_s, u"n"_s, u"8"_s);
+    QCommandLineOption requestsOption(u"requests"_s, u"Total number of requests. Default: 100."_s, u"n"_s, u"100"_s);
+    QCommandLineOption durationOption(u"duration"_s,
+        u"Send requests for this many seconds instead of a number of them."_s, u"secs"_s);
+    QCommandLineOption timeoutOption(u"timeout"_s, u"Seconds before a request fails. Default: 600."_s,
+                                     u"secs"_s, u"600"_s);
+    QCommandLineOption promptWordsOption(u"prompt-words"_s,
+        u"Words in each prompt: N, uniform:MIN,MAX or normal:MEAN,STDDEV. Default: uniform:16,256."_s,
+        u"dist"_s, u"uniform:16,256"_s);
+    QCommandLineOption maxTokensOption(u"max-tokens"_s,
+        u"Tokens to generate for each response, in the same format. Default: uniform:16,256."_s,
+        u"dist"_s, u"uniform:16,256"_s);
+    QCommandLineOption temperatureOption(u"temperature"_s, u"Sampling temperature. Default: 0.7."_s,
+                                         u"temp"_s, u"0.7"_s);
+    QCommandLineOption seedOption(u"seed"_s, u"Seed of the prompt and length generator. Default: 42."_s,
+                                  u"seed"_s, u"42"_s);
+    parser.addOptions({ hostOption, portOption, modelOption, concurrencyOption, requestsOption, durationOption,
+                        timeoutOption, promptWordsOption, maxTokensOption, temperatureOption, seedOption });
+    parser.process(app);
+
+    auto usageError = [](const QString &message) {
+        qCritical().noquote() << "ERROR:" << message;
+        return 1;
+    };
+
+    // a duration replaces the number of requests
+    bool byDuration = parser.isSet(durationOption);
+    bool ok[7];
+    std::ranges::fill(ok, true);
+    Options options {
+        .host        = parser.value(hostOption),
+        .port        = parser.value(portOption).toUShort(&ok[0]),
+        .model       = parser.value(modelOption),
+        .concurrency = parser.value(concurrencyOption).toInt(&ok[1]),
+        .requests    = byDuration ? 0 : parser.value(requestsOption).toLongLong(&ok[2]),
+        .durationMs  = byDuration ? qint64(parser.value(durationOption).toDouble(&ok[3]) * 1000) : 0,
+        .timeoutMs   = qint64(parser.value(timeoutOption).toDouble(&ok[4]) * 1000),
+        .temperature = parser.value(temperatureOption).toDouble(&ok[5]),
+        .promptWords = {},
+        .maxTokens   = {},
+        .seed        = parser.value(seedOption).toUInt(&ok[6]),
+    };
+    if (!std::ranges::all_of(ok, [](bool b) { return b; }) || options.concurrency <= 0 || options.timeoutMs <= 0
+        || options.temperature < 0 || (options.requests <= 0 && options.durationMs <= 0))
+        return usageError(u"The numeric options must be valid, and the counts and times positive."_s);
+
+    auto promptWords = Distribution::parse(parser.value(promptWordsOption));
+    auto maxTokens   = Distribution::parse(parser.value(maxTokensOption));
+    if (!promptWords || !maxTokens)
+        return usageError(u"A length must be N, uniform:MIN,MAX or normal:MEAN,STDDEV, with lengths of at least 1."_s);
+    options.promptWords = *promptWords;
+    options.maxTokens   = *maxTokens;
+
+    LoadTest test(std::move(options));
+    QTimer::singleShot(0, &app, [&test] { test.run(); });
+    return app.exec();
+}
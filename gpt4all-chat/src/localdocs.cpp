@@ -6,7 +6,6 @@
 
 #include <QCoreApplication>
 #include <QGlobalStatic>
-#include <QGuiApplication>
 #include <QUrl>
 #include <Qt>
 
@@ -56,7 +55,7 @@ LocalDocs::LocalDocs()
     connect(m_database, &Database::requestGuiCollectionListUpdated,
         m_localDocsModel, &LocalDocsModel::collectionListUpdated, Qt::QueuedConnection);
 
-    connect(qGuiApp, &QCoreApplication::aboutToQuit, this, &LocalDocs::aboutToQuit);
+    connect(qApp, &QCoreApplication::aboutToQuit, this, &LocalDocs::aboutToQuit);
 }
 
 void LocalDocs::aboutToQuit()
@@ -123,6 +123,10 @@ QVariant LocalDocsModel::data(const QModelIndex &index, int role) const
             return item.embeddingModel;
         case UpdatingRole:
             return item.indexing || item.currentEmbeddingsToIndex != 0;
+        case EmbeddingQueueBytesRole:
+            return item.embeddingQueueBytes;
+        case IndexingStallMsRole:
+            return item.indexingStallMs;
     }
 
     return QVariant();
@@ -151,6 +155,8 @@ QHash<int, QByteArray> LocalDocsModel::roleNames() const
     roles[FileCurrentlyProcessingRole] = "fileCurrentlyProcessing";
     roles[EmbeddingModelRole] = "embeddingModel";
     roles[UpdatingRole] = "updating";
+    roles[EmbeddingQueueBytesRole] = "embeddingQueueBytes";
+    roles[IndexingStallMsRole] = "indexingStallMs";
     return roles;
 }
 
@@ -202,6 +208,10 @@ void LocalDocsModel::updateCollectionItem(const CollectionItem &item)
             changed.append(FileCurrentlyProcessingRole);
         if (stored.embeddingModel != item.embeddingModel)
             changed.append(EmbeddingModelRole);
+        if (stored.embeddingQueueBytes != item.embeddingQueueBytes)
+            changed.append(EmbeddingQueueBytesRole);
+        if (stored.indexingStallMs != item.indexingStallMs)
+            changed.append(IndexingStallMsRole);
 
         // preserve collection name as we ignore it for matching
         QString collection = stored.collection;
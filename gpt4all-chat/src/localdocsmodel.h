@@ -70,7 +70,9 @@ public:
         LastUpdateRole,
         FileCurrentlyProcessingRole,
         EmbeddingModelRole,
-        UpdatingRole
+        UpdatingRole,
+        EmbeddingQueueBytesRole,
+        IndexingStallMsRole
     };
 
     explicit LocalDocsModel(QObject *parent = nullptr);
@@ -0,0 +1,157 @@
+#include "metrics.h"
+
+#include <QGlobalStatic>
+#include <QMutexLocker>
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+using namespace Qt::Literals::StringLiterals;
+
+
+static QByteArray formatValue(double value)
+{
+    if (std::isinf(value))
+        return value > 0 ? "+Inf"_ba : "-Inf"_ba;
+    return QByteArray::number(value, 'g', 12);
+}
+
+static void writeHeader(QByteArray &out, const char *name, const char *help, const char *type)
+{
+    out += "# HELP "_ba + name + ' ' + help + '\n';
+    out += "# TYPE "_ba + name + ' ' + type + '\n';
+}
+
+// escapes a label value of the text format
+static QByteArray escapeLabel(const QString &value)
+{
+    QByteArray escaped = value.toUtf8();
+    escaped.replace('\\', "\\\\"_ba).replace('"', "\\\""_ba).replace('\n', "\\n"_ba);
+    return escaped;
+}
+
+Histogram::Histogram(std::initializer_list<double> bounds)
+    : m_bounds(bounds)
+    , m_buckets(std::make_unique<std::atomic<quint64>[]>(bounds.size() + 1))
+{
+}
+
+void Histogram::observe(double value)
+{
+    size_t i = std::ranges::lower_bound(m_bounds, value) - m_bounds.begin();
+    m_buckets[i].fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+void Histogram::write(QByteArray &out, const char *name, const char *help) const
+{
+    writeHeader(out, name, help, "histogram");
+
+    // the count is taken from the buckets, so that it agrees with them even while values are being observed
+    quint64 count = 0;
+    for (size_t i = 0; i <= m_bounds.size(); i++) {
+        count += m_buckets[i].load(std::memory_order_relaxed);
+        double bound = i < m_bounds.size() ? m_bounds[i] : INFINITY;
+        out += name + "_bucket{le=\""_ba + formatValue(bound) + "\"} "_ba + QByteArray::number(count) + '\n';
+    }
+    out += name + "_sum "_ba + formatValue(m_sum.load(std::memory_order_relaxed)) + '\n';
+    out += name + "_count "_ba + QByteArray::number(count) + '\n';
+}
+
+class MyMetrics: public Metrics { };
+Q_GLOBAL_STATIC(MyMetrics, metricsInstance)
+Metrics *Metrics::globalInstance()
+{
+    return metricsInstance();
+}
+
+Metrics::Metrics()
+    : queueWait       ({ .005, .01, .025, .05, .1, .25, .5, 1, 2.5, 5, 10, 30, 60 })
+    , timeToFirstToken({ .025, .05, .1, .25, .5, 1, 2.5, 5, 10, 30, 60 })
+    , requestDuration ({ .1, .25, .5, 1, 2.5, 5, 10, 30, 60, 120, 300 })
+    , promptTokens    ({ 16, 64, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768 })
+    , completionTokens({ 16, 64, 256, 512, 1024, 2048, 4096, 8192 })
+    , modelLoad       ({ .5, 1, 2.5, 5, 10, 30, 60, 120, 300 })
+    , retrieval       ({ .005, .01, .025, .05, .1, .25, .5, 1, 2.5, 5 })
+    , quantizedRecall ({ .5, .6, .7, .8, .9, .95, .99, 1 })
+    , embeddingBatchOccupancy({ .1, .25, .5, .75, .9, .95, 1 })
+{
+}
+
+void Metrics::writeCounter(QByteArray &out, const char *name, const char *help, double value)
+{
+    writeHeader(out, name, help, "counter");
+    out += QByteArray(name) + ' ' + formatValue(value) + '\n';
+}
+
+void Metrics::writeGauge(QByteArray &out, const char *name, const char *help, double value)
+{
+    writeHeader(out, name, help, "gauge");
+    out += QByteArray(name) + ' ' + formatValue(value) + '\n';
+}
+
+void Metrics::setEmbeddingCacheMemory(QHash<QString, qint64> memory)
+{
+    QMutexLocker locker(&m_embeddingCacheMutex);
+    m_embeddingCacheMemory = std::move(memory);
+}
+
+QByteArray Metrics::exposition() const
+{
+    static const char *routeNames[s_nRoutes] {
+        "/v1/models", "/v1/models/{model}", "/v1/completions", "/v1/chat/completions", "/v1/embeddings", "/v1/batches",
+        "/metrics",
+    };
+
+    QByteArray out;
+    writeHeader(out, "gpt4all_http_requests_total", "HTTP requests received, by route.", "counter");
+    for (size_t i = 0; i < s_nRoutes; i++) {
+        out += "gpt4all_http_requests_total{route=\""_ba + routeNames[i] + "\"} "_ba
+             + QByteArray::number(m_requests[i].load(std::memory_order_relaxed)) + '\n';
+    }
+
+    queueWait.write(out, "gpt4all_queue_wait_seconds",
+                    "Time generation requests waited for a slot.");
+    timeToFirstToken.write(out, "gpt4all_time_to_first_token_seconds",
+                           "Time from the arrival of a generation request to its first token.");
+    requestDuration.write(out, "gpt4all_request_duration_seconds",
+                          "Time from the arrival of a generation request to its response.");
+    promptTokens.write(out, "gpt4all_prompt_tokens",
+                       "Prompt tokens of generation requests, including the template and history.");
+    completionTokens.write(out, "gpt4all_completion_tokens",
+                           "Generated tokens of generation requests, over all choices.");
+    modelLoad.write(out, "gpt4all_model_load_seconds",
+                    "Time to load a model for the server.");
+    retrieval.write(out, "gpt4all_localdocs_retrieval_seconds",
+                    "Time to search the LocalDocs collections for a prompt.");
+    quantizedRecall.write(out, "gpt4all_localdocs_quantized_recall",
+                          "Recall@k of sampled LocalDocs searches of quantized embeddings against exact searches.");
+    embeddingBatchOccupancy.write(out, "gpt4all_localdocs_embedding_batch_occupancy",
+                                  "Fraction of the batch of the embedding model filled by each decode of LocalDocs chunks.");
+
+    writeCounter(out, "gpt4all_context_shifts_total",
+                 "Context shifts that discarded tokens to make room for a response.",
+                 double(m_contextShifts.load(std::memory_order_relaxed)));
+    writeCounter(out, "gpt4all_response_cache_hits_total",
+                 "Deterministic requests answered from the response cache.",
+                 double(m_cacheHits.load(std::memory_order_relaxed)));
+    writeCounter(out, "gpt4all_response_cache_misses_total",
+                 "Deterministic requests that were not in the response cache.",
+                 double(m_cacheMisses.load(std::memory_order_relaxed)));
+    writeCounter(out, "gpt4all_requests_cancelled_total",
+                 "Generation requests dropped because the client disconnected.",
+                 double(m_cancelled.load(std::memory_order_relaxed)));
+    writeCounter(out, "gpt4all_requests_timed_out_total",
+                 "Generation requests that reached their deadline or the maximum generation time.",
+                 double(m_timedOut.load(std::memory_order_relaxed)));
+
+    writeHeader(out, "gpt4all_localdocs_embedding_cache_bytes",
+                "Memory taken by the LocalDocs embeddings cached for exact search, by collection.", "gauge");
+    QMutexLocker locker(&m_embeddingCacheMutex);
+    for (const auto &[collection, bytes] : m_embeddingCacheMemory.asKeyValueRange()) {
+        out += "gpt4all_localdocs_embedding_cache_bytes{collection=\""_ba + escapeLabel(collection) + "\"} "_ba
+             + QByteArray::number(bytes) + '\n';
+    }
+    return out;
+}
@@ -0,0 +1,97 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QtGlobal>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+// A Prometheus histogram. Observations only update atomics, so any thread can record them without a lock.
+class Histogram
+{
+public:
+    // bounds are the upper bounds of the buckets, in increasing order, not counting +Inf
+    Histogram(std::initializer_list<double> bounds);
+
+    void observe(double value);
+
+    // appends the histogram in the Prometheus text format
+    void write(QByteArray &out, const char *name, const char *help) const;
+
+private:
+    const std::vector<double>                     m_bounds;
+    const std::unique_ptr<std::atomic<quint64>[]> m_buckets; // not cumulative, the last one is +Inf
+    std::atomic<double>                           m_sum { 0.0 };
+};
+
+/*
+ * The counters and histograms of the /metrics endpoint of the local API server. Recording a value is a few relaxed
+ * atomic operations, so they stay enabled. The gauges that describe the scheduler are not kept here, but read from
+ * it when the endpoint is scraped.
+ */
+class Metrics
+{
+public:
+    enum class Route {
+        Models,
+        Model,
+        Completions,
+        ChatCompletions,
+        Embeddings,
+        Batches,
+        Metrics,
+    };
+
+    static Metrics *globalInstance();
+
+    void countRequest(Route route) { m_requests[size_t(route)].fetch_add(1, std::memory_order_relaxed); }
+    void countContextShifts(quint64 n) { m_contextShifts.fetch_add(n, std::memory_order_relaxed); }
+    void countResponseCache(bool hit) { (hit ? m_cacheHits : m_cacheMisses).fetch_add(1, std::memory_order_relaxed); }
+    void countCancelled() { m_cancelled.fetch_add(1, std::memory_order_relaxed); }
+    void countTimedOut() { m_timedOut.fetch_add(1, std::memory_order_relaxed); }
+    // bytes of embeddings LocalDocs keeps in memory, by collection; set rarely, so it takes a lock
+    void setEmbeddingCacheMemory(QHash<QString, qint64> memory);
+
+    // the text format of everything recorded so far
+    QByteArray exposition() const;
+
+    static void writeCounter(QByteArray &out, const char *name, const char *help, double value);
+    static void writeGauge(QByteArray &out, const char *name, const char *help, double value);
+
+    Histogram queueWait;        // seconds between the arrival of a generation request and its admission
+    Histogram timeToFirstToken; // seconds between the arrival of a generation request and its first token
+    Histogram requestDuration;  // seconds between the arrival of a generation request and its response
+    Histogram promptTokens;
+    Histogram completionTokens; // over all choices of a request
+    Histogram modelLoad;        // seconds to load a model for the server
+    Histogram retrieval;        // seconds to search the LocalDocs collections for a prompt
+    Histogram quantizedRecall;  // recall@k of a sample of the LocalDocs searches of quantized embeddings
+    Histogram embeddingBatchOccupancy; // fraction of the batch filled by each decode of LocalDocs chunks
+
+private:
+    static constexpr size_t s_nRoutes = size_t(Route::Metrics) + 1;
+
+    std::array<std::atomic<quint64>, s_nRoutes> m_requests {};
+    std::atomic<quint64>                        m_contextShifts { 0 };
+    std::atomic<quint64>                        m_cacheHits { 0 };   // of the response cache
+    std::atomic<quint64>                        m_cacheMisses { 0 };
+    std::atomic<quint64>                        m_cancelled { 0 };   // generation requests of clients that went away
+    std::atomic<quint64>                        m_timedOut { 0 };
+    mutable QMutex                              m_embeddingCacheMutex;
+    QHash<QString, qint64>                      m_embeddingCacheMemory;
+
+private:
+    explicit Metrics();
+    ~Metrics() {}
+    friend class MyMetrics;
+};
+
+#endif // METRICS_H
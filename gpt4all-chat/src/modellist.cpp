@@ -15,7 +15,6 @@
 #include <QFile>
 #include <QFileInfo>
 #include <QGlobalStatic>
-#include <QGuiApplication>
 #include <QIODevice>
 #include <QJsonArray>
 #include <QJsonDocument>
@@ -1358,7 +1357,7 @@ void ModelList::updateModelsFromJson()
     conf.setPeerVerifyMode(QSslSocket::VerifyNone);
     request.setSslConfiguration(conf);
     QNetworkReply *jsonReply = m_networkManager.get(request);
-    connect(qGuiApp, &QCoreApplication::aboutToQuit, jsonReply, &QNetworkReply::abort);
+    connect(qApp, &QCoreApplication::aboutToQuit, jsonReply, &QNetworkReply::abort);
     QEventLoop loop;
     connect(jsonReply, &QNetworkReply::finished, &loop, &QEventLoop::quit);
     QTimer::singleShot(1500, &loop, &QEventLoop::quit);
@@ -1402,7 +1401,7 @@ void ModelList::updateModelsFromJsonAsync()
     conf.setPeerVerifyMode(QSslSocket::VerifyNone);
     request.setSslConfiguration(conf);
     QNetworkReply *jsonReply = m_networkManager.get(request);
-    connect(qGuiApp, &QCoreApplication::aboutToQuit, jsonReply, &QNetworkReply::abort);
+    connect(qApp, &QCoreApplication::aboutToQuit, jsonReply, &QNetworkReply::abort);
     connect(jsonReply, &QNetworkReply::finished, this, &ModelList::handleModelsJsonDownloadFinished);
     connect(jsonReply, &QNetworkReply::errorOccurred, this, &ModelList::handleModelsJsonDownloadErrorOccurred);
 }
@@ -1984,7 +1983,7 @@ void ModelList::discoverSearch(const QString &search)
     QNetworkRequest request(hfUrl);
     request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
     QNetworkReply *reply = m_networkManager.get(request);
-    connect(qGuiApp, &QCoreApplication::aboutToQuit, reply, &QNetworkReply::abort);
+    connect(qApp, &QCoreApplication::aboutToQuit, reply, &QNetworkReply::abort);
     connect(reply, &QNetworkReply::finished, this, &ModelList::handleDiscoveryFinished);
     connect(reply, &QNetworkReply::errorOccurred, this, &ModelList::handleDiscoveryErrorOccurred);
 }
@@ -2092,7 +2091,7 @@ void ModelList::parseDiscoveryJsonFile(const QByteArray &jsonData)
         request.setAttribute(QNetworkRequest::User, jsonData);
         request.setAttribute(QNetworkRequest::UserMax, filename);
         QNetworkReply *reply = m_networkManager.head(request);
-        connect(qGuiApp, &QCoreApplication::aboutToQuit, reply, &QNetworkReply::abort);
+        connect(qApp, &QCoreApplication::aboutToQuit, reply, &QNetworkReply::abort);
         connect(reply, &QNetworkReply::finished, this, &ModelList::handleDiscoveryItemFinished);
         connect(reply, &QNetworkReply::errorOccurred, this, &ModelList::handleDiscoveryItemErrorOccurred);
     }
@@ -0,0 +1,108 @@
+#include "modelworker.h"
+
+#include "metrics.h"
+#include "mysettings.h"
+
+#include <gpt4all-backend/llmodel.h>
+
+#include <QElapsedTimer>
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <Qt>
+#include <QtLogging>
+
+#include <utility>
+
+using namespace Qt::Literals::StringLiterals;
+
+
+ModelWorker::ModelWorker(const ModelInfo &modelInfo, LLModel *standInModel, int32_t maxSlots, qsizetype queueDepth,
+                         qint64 maxGenerationMs)
+    : ChatLLM(u"server:%1"_s.arg(modelInfo.id()), true /*isServer*/)
+    , m_servedModel(modelInfo)
+    , m_standInModel(standInModel)
+    , m_maxSlots(maxSlots)
+    , m_queueDepth(queueDepth)
+    , m_maxGenerationMs(maxGenerationMs)
+{
+    // the scheduler belongs to the worker's thread, which is already running
+    QMetaObject::invokeMethod(this, &ModelWorker::start, Qt::QueuedConnection);
+}
+
+ModelWorker::~ModelWorker()
+{
+    // stop the thread before the members it uses are destroyed
+    destroy();
+}
+
+void ModelWorker::start()
+{
+    m_scheduler = new Scheduler(
+        [this](const ModelInfo &modelInfo) { return loadModelForScheduler(modelInfo); },
+        m_maxSlots, m_queueDepth, m_maxGenerationMs, this
+    );
+    connect(this, &ChatLLM::loadedModelInfoChanged, m_scheduler, &Scheduler::resetModel);
+    connect(m_scheduler, &Scheduler::stepped, this, &ModelWorker::updateStats);
+}
+
+void ModelWorker::submit(std::shared_ptr<GenerationJob> job)
+{
+    QMetaObject::invokeMethod(this, [this, job = std::move(job)]() mutable { enqueue(std::move(job)); },
+                              Qt::QueuedConnection);
+}
+
+void ModelWorker::enqueue(std::shared_ptr<GenerationJob> job)
+{
+    // WorkerPool keeps within the queue depth, so this is only a safeguard
+    if (!m_scheduler->submit(job)) {
+        GenerationResult result;
+        result.error = u"The server is busy with other requests, please try again later."_s;
+        result.internalError = true;
+        job->onFinished(result);
+        return;
+    }
+    updateStats();
+}
+
+LLModel *ModelWorker::loadModelForScheduler(const ModelInfo &modelInfo)
+{
+    if (m_standInModel)
+        return m_standInModel;
+
+    // load the new model if necessary
+    setShouldBeLoaded(true);
+
+    // NB: loadModel resets the context, which would discard the sequences of the scheduler
+    if (!isModelLoaded() || !(this->modelInfo() == modelInfo)) {
+        QElapsedTimer timer;
+        timer.start();
+        if (!loadModel(modelInfo)) {
+            qWarning() << "ERROR: couldn't load model" << modelInfo.name();
+            return nullptr;
+        }
+        Metrics::globalInstance()->modelLoad.observe(timer.elapsed() / 1000.0);
+    }
+
+    LLModel *model = llModel();
+    model->setThreadCount(MySettings::globalInstance()->threadCount());
+    return model;
+}
+
+void ModelWorker::updateStats()
+{
+    Stats stats;
+    stats.loaded       = m_standInModel || isModelLoaded();
+    stats.activeSlots  = m_scheduler->activeSlots();
+    stats.queuedJobs   = m_scheduler->queuedJobs();
+    stats.kvCacheUsage = m_scheduler->kvCacheUsage();
+    stats.prefixCache  = m_scheduler->prefixCacheStats();
+
+    QMutexLocker locker(&m_statsMutex);
+    m_stats = stats;
+}
+
+ModelWorker::Stats ModelWorker::stats() const
+{
+    QMutexLocker locker(&m_statsMutex);
+    return m_stats;
+}
@@ -0,0 +1,66 @@
+#ifndef MODELWORKER_H
+#define MODELWORKER_H
+
+#include "chatllm.h"
+#include "modellist.h"
+#include "scheduler.h"
+
+#include <QMutex>
+#include <QObject>
+#include <QtGlobal>
+
+#include <cstdint>
+#include <memory>
+
+class LLModel;
+
+/*
+ * Serves the generation requests of the local API server for one model, with a context and a Scheduler of its own on
+ * the thread of its ChatLLM. Workers for different models decode at the same time, and a worker loads its model on
+ * its own thread, so the other workers keep serving meanwhile.
+ *
+ * The callbacks of the jobs are run on the worker's thread, see WorkerPool for how they get back to the server.
+ */
+class ModelWorker : public ChatLLM
+{
+    Q_OBJECT
+
+public:
+    struct Stats {
+        bool                        loaded = false;
+        int32_t                     activeSlots = 0;
+        qsizetype                   queuedJobs = 0;
+        double                      kvCacheUsage = 0.0;
+        Scheduler::PrefixCacheStats prefixCache;
+    };
+
+    // The stand-in model, if set, is used instead of loading the model, and must outlive the worker.
+    ModelWorker(const ModelInfo &modelInfo, LLModel *standInModel, int32_t maxSlots, qsizetype queueDepth,
+                qint64 maxGenerationMs);
+    ~ModelWorker() override;
+
+    const ModelInfo &servedModel() const { return m_servedModel; }
+
+    // Queues a job, or ends it with an error if the scheduler's queue is full. Can be called from any thread.
+    void submit(std::shared_ptr<GenerationJob> job);
+
+    // A snapshot of the scheduler as of its last step. Can be called from any thread.
+    Stats stats() const;
+
+private:
+    void start();
+    void enqueue(std::shared_ptr<GenerationJob> job);
+    LLModel *loadModelForScheduler(const ModelInfo &modelInfo);
+    void updateStats();
+
+    const ModelInfo  m_servedModel;
+    LLModel         *m_standInModel;
+    const int32_t    m_maxSlots;
+    const qsizetype  m_queueDepth;
+    const qint64     m_maxGenerationMs;
+    Scheduler       *m_scheduler = nullptr; // created on the worker's thread
+    mutable QMutex   m_statsMutex;
+    Stats            m_stats;
+};
+
+#endif // MODELWORKER_H
@@ -2,12 +2,12 @@
 
 #include <gpt4all-backend/llmodel.h>
 
+#include <QCoreApplication>
 #include <QDebug>
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
 #include <QGlobalStatic>
-#include <QGuiApplication>
 #include <QIODevice>
 #include <QMap>
 #include <QMetaObject>
@@ -28,6 +28,7 @@ using namespace Qt::Literals::StringLiterals;
 static const QStringList suggestionModeNames { "LocalDocsOnly", "On", "Off" };
 static const QStringList chatThemeNames      { "Light", "Dark", "LegacyDark" };
 static const QStringList fontSizeNames       { "Small", "Medium", "Large" };
+static const QStringList quantizationNames   { "None", "Int8", "Binary" };
 
 // FIXME: All of these default strings that are shown in the UI for settings need to be marked as
 // translatable
@@ -49,7 +50,15 @@ static const QVariantMap basicDefaults {
     { "lastVersionStarted",       "" },
     { "networkPort",              4891, },
     { "saveChatsContext",         false },
+    { "regenerateChoices",        1 },
     { "serverChat",               false },
+    { "server/maxSlots",          4 },
+    { "server/queueDepth",        16 },
+    { "server/socketPath",        "" },
+    { "server/responseCacheSize", 0 },
+    { "server/responseCacheTtl",  3600 },
+    { "server/maxGenerationTime", 0 },
+    { "server/modelMemory",       0 },
     { "userDefaultModel",         "Application default" },
     { "suggestionMode",           QVariant::fromValue(SuggestionMode::LocalDocsOnly) },
     { "localdocs/chunkSize",      512 },
@@ -59,6 +68,8 @@ static const QVariantMap basicDefaults {
     { "localdocs/useRemoteEmbed", false },
     { "localdocs/nomicAPIKey",    "" },
     { "localdocs/embedDevice",    "Auto" },
+    { "localdocs/searchExpansion", 64 },
+    { "localdocs/quantization",   QVariant::fromValue(EmbeddingQuantization::Int8) },
     { "network/attribution",      "" },
 };
 
@@ -206,8 +217,16 @@ void MySettings::restoreApplicationDefaults()
     setDevice(defaults::device);
     setThreadCount(defaults::threadCount);
     setSaveChatsContext(basicDefaults.value("saveChatsContext").toBool());
+    setRegenerateChoices(basicDefaults.value("regenerateChoices").toInt());
     setServerChat(basicDefaults.value("serverChat").toBool());
     setNetworkPort(basicDefaults.value("networkPort").toInt());
+    setServerMaxSlots(basicDefaults.value("server/maxSlots").toInt());
+    setServerQueueDepth(basicDefaults.value("server/queueDepth").toInt());
+    setServerSocketPath(basicDefaults.value("server/socketPath").toString());
+    setServerResponseCacheSize(basicDefaults.value("server/responseCacheSize").toInt());
+    setServerResponseCacheTtl(basicDefaults.value("server/responseCacheTtl").toInt());
+    setServerMaxGenerationTime(basicDefaults.value("server/maxGenerationTime").toInt());
+    setServerModelMemory(basicDefaults.value("server/modelMemory").toInt());
     setModelPath(defaultLocalModelsPath());
     setUserDefaultModel(basicDefaults.value("userDefaultModel").toString());
     setForceMetal(defaults::forceMetal);
@@ -224,6 +243,8 @@ void MySettings::restoreLocalDocsDefaults()
     setLocalDocsUseRemoteEmbed(basicDefaults.value("localdocs/useRemoteEmbed").toBool());
     setLocalDocsNomicAPIKey(basicDefaults.value("localdocs/nomicAPIKey").toString());
     setLocalDocsEmbedDevice(basicDefaults.value("localdocs/embedDevice").toString());
+    setLocalDocsSearchExpansion(basicDefaults.value("localdocs/searchExpansion").toInt());
+    setLocalDocsQuantization(basicDefaults.value("localdocs/quantization").value<EmbeddingQuantization>());
 }
 
 void MySettings::eraseModel(const ModelInfo &info)
@@ -444,8 +465,16 @@ void MySettings::setThreadCount(int value)
 }
 
 bool        MySettings::saveChatsContext() const        { return getBasicSetting("saveChatsContext"        ).toBool(); }
+int         MySettings::regenerateChoices() const       { return getBasicSetting("regenerateChoices"       ).toInt(); }
 bool        MySettings::serverChat() const              { return getBasicSetting("serverChat"              ).toBool(); }
 int         MySettings::networkPort() const             { return getBasicSetting("networkPort"             ).toInt(); }
+int         MySettings::serverMaxSlots() const          { return getBasicSetting("server/maxSlots"         ).toInt(); }
+int         MySettings::serverQueueDepth() const        { return getBasicSetting("server/queueDepth"       ).toInt(); }
+QString     MySettings::serverSocketPath() const        { return getBasicSetting("server/socketPath"       ).toString(); }
+int         MySettings::serverResponseCacheSize() const { return getBasicSetting("server/responseCacheSize").toInt(); }
+int         MySettings::serverResponseCacheTtl() const  { return getBasicSetting("server/responseCacheTtl" ).toInt(); }
+int         MySettings::serverMaxGenerationTime() const { return getBasicSetting("server/maxGenerationTime").toInt(); }
+int         MySettings::serverModelMemory() const       { return getBasicSetting("server/modelMemory"      ).toInt(); }
 QString     MySettings::userDefaultModel() const        { return getBasicSetting("userDefaultModel"        ).toString(); }
 QString     MySettings::lastVersionStarted() const      { return getBasicSetting("lastVersionStarted"      ).toString(); }
 int         MySettings::localDocsChunkSize() const      { return getBasicSetting("localdocs/chunkSize"     ).toInt(); }
@@ -455,15 +484,26 @@ QStringList MySettings::localDocsFileExtensions() const { return getBasicSetting
 bool        MySettings::localDocsUseRemoteEmbed() const { return getBasicSetting("localdocs/useRemoteEmbed").toBool(); }
 QString     MySettings::localDocsNomicAPIKey() const    { return getBasicSetting("localdocs/nomicAPIKey"   ).toString(); }
 QString     MySettings::localDocsEmbedDevice() const    { return getBasicSetting("localdocs/embedDevice"   ).toString(); }
+int         MySettings::localDocsSearchExpansion() const { return getBasicSetting("localdocs/searchExpansion").toInt(); }
 QString     MySettings::networkAttribution() const      { return getBasicSetting("network/attribution"     ).toString(); }
 
 ChatTheme      MySettings::chatTheme() const      { return ChatTheme     (getEnumSetting("chatTheme", chatThemeNames)); }
 FontSize       MySettings::fontSize() const       { return FontSize      (getEnumSetting("fontSize",  fontSizeNames)); }
 SuggestionMode MySettings::suggestionMode() const { return SuggestionMode(getEnumSetting("suggestionMode", suggestionModeNames)); }
+EmbeddingQuantization MySettings::localDocsQuantization() const
+    { return EmbeddingQuantization(getEnumSetting("localdocs/quantization", quantizationNames)); }
 
 void MySettings::setSaveChatsContext(bool value)                      { setBasicSetting("saveChatsContext",         value); }
+void MySettings::setRegenerateChoices(int value)                      { setBasicSetting("regenerateChoices",        value); }
 void MySettings::setServerChat(bool value)                            { setBasicSetting("serverChat",               value); }
 void MySettings::setNetworkPort(int value)                            { setBasicSetting("networkPort",              value); }
+void MySettings::setServerMaxSlots(int value)                         { setBasicSetting("server/maxSlots",          value, "serverMaxSlots"); }
+void MySettings::setServerQueueDepth(int value)                       { setBasicSetting("server/queueDepth",        value, "serverQueueDepth"); }
+void MySettings::setServerSocketPath(const QString &value)            { setBasicSetting("server/socketPath",        value, "serverSocketPath"); }
+void MySettings::setServerResponseCacheSize(int value)                { setBasicSetting("server/responseCacheSize", value, "serverResponseCacheSize"); }
+void MySettings::setServerResponseCacheTtl(int value)                 { setBasicSetting("server/responseCacheTtl",  value, "serverResponseCacheTtl"); }
+void MySettings::setServerMaxGenerationTime(int value)                { setBasicSetting("server/maxGenerationTime", value, "serverMaxGenerationTime"); }
+void MySettings::setServerModelMemory(int value)                      { setBasicSetting("server/modelMemory",       value, "serverModelMemory"); }
 void MySettings::setUserDefaultModel(const QString &value)            { setBasicSetting("userDefaultModel",         value); }
 void MySettings::setLastVersionStarted(const QString &value)          { setBasicSetting("lastVersionStarted",       value); }
 void MySettings::setLocalDocsChunkSize(int value)                     { setBasicSetting("localdocs/chunkSize",      value, "localDocsChunkSize"); }
@@ -473,11 +513,14 @@ void MySettings::setLocalDocsFileExtensions(const QStringList &value) { setBasic
 void MySettings::setLocalDocsUseRemoteEmbed(bool value)               { setBasicSetting("localdocs/useRemoteEmbed", value, "localDocsUseRemoteEmbed"); }
 void MySettings::setLocalDocsNomicAPIKey(const QString &value)        { setBasicSetting("localdocs/nomicAPIKey",    value, "localDocsNomicAPIKey"); }
 void MySettings::setLocalDocsEmbedDevice(const QString &value)        { setBasicSetting("localdocs/embedDevice",    value, "localDocsEmbedDevice"); }
+void MySettings::setLocalDocsSearchExpansion(int value)               { setBasicSetting("localdocs/searchExpansion", value, "localDocsSearchExpansion"); }
 void MySettings::setNetworkAttribution(const QString &value)          { setBasicSetting("network/attribution",      value, "networkAttribution"); }
 
 void MySettings::setChatTheme(ChatTheme value)           { setBasicSetting("chatTheme",      chatThemeNames     .value(int(value))); }
 void MySettings::setFontSize(FontSize value)             { setBasicSetting("fontSize",       fontSizeNames      .value(int(value))); }
 void MySettings::setSuggestionMode(SuggestionMode value) { setBasicSetting("suggestionMode", suggestionModeNames.value(int(value))); }
+void MySettings::setLocalDocsQuantization(EmbeddingQuantization value)
+    { setBasicSetting("localdocs/quantization", quantizationNames.value(int(value)), "localDocsQuantization"); }
 
 QString MySettings::modelPath()
 {
@@ -635,7 +678,7 @@ void MySettings::setLanguageAndLocale(const QString &bcp47Name)
 
     // If we previously installed a translator, then remove it
     if (m_translator) {
-        if (!qGuiApp->removeTranslator(m_translator.get())) {
+        if (!qApp->removeTranslator(m_translator.get())) {
             qDebug() << "ERROR: Failed to remove the previous translator";
         } else {
             m_translator.reset();
@@ -657,7 +700,7 @@ void MySettings::setLanguageAndLocale(const QString &bcp47Name)
         }
 
         // If we've successfully loaded it, then try and install it
-        if (!qGuiApp->installTranslator(m_translator.get())) {
+        if (!qApp->installTranslator(m_translator.get())) {
             qDebug() << "ERROR: Failed to install the translator:" << filePath;
             m_translator.reset();
         }
@@ -19,7 +19,8 @@ namespace MySettingsEnums {
     Q_NAMESPACE
 
     /* NOTE: values of these enums are used as indices for the corresponding combo boxes in
-     *       ApplicationSettings.qml, as well as the corresponding name lists in mysettings.cpp */
+     *       ApplicationSettings.qml and LocalDocsSettings.qml, as well as the corresponding name lists in
+     *       mysettings.cpp */
 
     enum class SuggestionMode {
         LocalDocsOnly = 0,
@@ -41,6 +42,13 @@ namespace MySettingsEnums {
         Large  = 2,
     };
     Q_ENUM_NS(FontSize)
+
+    enum class EmbeddingQuantization {
+        None   = 0,
+        Int8   = 1,
+        Binary = 2,
+    };
+    Q_ENUM_NS(EmbeddingQuantization)
 }
 using namespace MySettingsEnums;
 
@@ -49,6 +57,7 @@ class MySettings : public QObject
     Q_OBJECT
     Q_PROPERTY(int threadCount READ threadCount WRITE setThreadCount NOTIFY threadCountChanged)
     Q_PROPERTY(bool saveChatsContext READ saveChatsContext WRITE setSaveChatsContext NOTIFY saveChatsContextChanged)
+    Q_PROPERTY(int regenerateChoices READ regenerateChoices WRITE setRegenerateChoices NOTIFY regenerateChoicesChanged)
     Q_PROPERTY(bool serverChat READ serverChat WRITE setServerChat NOTIFY serverChatChanged)
     Q_PROPERTY(QString modelPath READ modelPath WRITE setModelPath NOTIFY modelPathChanged)
     Q_PROPERTY(QString userDefaultModel READ userDefaultModel WRITE setUserDefaultModel NOTIFY userDefaultModelChanged)
@@ -64,6 +73,8 @@ class MySettings : public QObject
     Q_PROPERTY(bool localDocsUseRemoteEmbed READ localDocsUseRemoteEmbed WRITE setLocalDocsUseRemoteEmbed NOTIFY localDocsUseRemoteEmbedChanged)
     Q_PROPERTY(QString localDocsNomicAPIKey READ localDocsNomicAPIKey WRITE setLocalDocsNomicAPIKey NOTIFY localDocsNomicAPIKeyChanged)
     Q_PROPERTY(QString localDocsEmbedDevice READ localDocsEmbedDevice WRITE setLocalDocsEmbedDevice NOTIFY localDocsEmbedDeviceChanged)
+    Q_PROPERTY(int localDocsSearchExpansion READ localDocsSearchExpansion WRITE setLocalDocsSearchExpansion NOTIFY localDocsSearchExpansionChanged)
+    Q_PROPERTY(EmbeddingQuantization localDocsQuantization READ localDocsQuantization WRITE setLocalDocsQuantization NOTIFY localDocsQuantizationChanged)
     Q_PROPERTY(QString networkAttribution READ networkAttribution WRITE setNetworkAttribution NOTIFY networkAttributionChanged)
     Q_PROPERTY(bool networkIsActive READ networkIsActive WRITE setNetworkIsActive NOTIFY networkIsActiveChanged)
     Q_PROPERTY(bool networkUsageStatsActive READ networkUsageStatsActive WRITE setNetworkUsageStatsActive NOTIFY networkUsageStatsActiveChanged)
@@ -71,6 +82,13 @@ class MySettings : public QObject
     Q_PROPERTY(QStringList deviceList MEMBER m_deviceList CONSTANT)
     Q_PROPERTY(QStringList embeddingsDeviceList MEMBER m_embeddingsDeviceList CONSTANT)
     Q_PROPERTY(int networkPort READ networkPort WRITE setNetworkPort NOTIFY networkPortChanged)
+    Q_PROPERTY(int serverMaxSlots READ serverMaxSlots WRITE setServerMaxSlots NOTIFY serverMaxSlotsChanged)
+    Q_PROPERTY(int serverQueueDepth READ serverQueueDepth WRITE setServerQueueDepth NOTIFY serverQueueDepthChanged)
+    Q_PROPERTY(QString serverSocketPath READ serverSocketPath WRITE setServerSocketPath NOTIFY serverSocketPathChanged)
+    Q_PROPERTY(int serverResponseCacheSize READ serverResponseCacheSize WRITE setServerResponseCacheSize NOTIFY serverResponseCacheSizeChanged)
+    Q_PROPERTY(int serverResponseCacheTtl READ serverResponseCacheTtl WRITE setServerResponseCacheTtl NOTIFY serverResponseCacheTtlChanged)
+    Q_PROPERTY(int serverMaxGenerationTime READ serverMaxGenerationTime WRITE setServerMaxGenerationTime NOTIFY serverMaxGenerationTimeChanged)
+    Q_PROPERTY(int serverModelMemory READ serverModelMemory WRITE setServerModelMemory NOTIFY serverModelMemoryChanged)
     Q_PROPERTY(SuggestionMode suggestionMode READ suggestionMode WRITE setSuggestionMode NOTIFY suggestionModeChanged)
     Q_PROPERTY(QStringList uiLanguages MEMBER m_uiLanguages CONSTANT)
 
@@ -142,6 +160,8 @@ public:
     void setThreadCount(int value);
     bool saveChatsContext() const;
     void setSaveChatsContext(bool value);
+    int regenerateChoices() const;
+    void setRegenerateChoices(int value);
     bool serverChat() const;
     void setServerChat(bool value);
     QString modelPath();
@@ -185,6 +205,10 @@ public:
     void setLocalDocsNomicAPIKey(const QString &value);
     QString localDocsEmbedDevice() const;
     void setLocalDocsEmbedDevice(const QString &value);
+    int localDocsSearchExpansion() const;
+    void setLocalDocsSearchExpansion(int value);
+    EmbeddingQuantization localDocsQuantization() const;
+    void setLocalDocsQuantization(EmbeddingQuantization value);
 
     // Network settings
     QString networkAttribution() const;
@@ -197,6 +221,20 @@ public:
     void setNetworkUsageStatsActive(bool value);
     int networkPort() const;
     void setNetworkPort(int value);
+    int serverMaxSlots() const;
+    void setServerMaxSlots(int value);
+    int serverQueueDepth() const;
+    void setServerQueueDepth(int value);
+    QString serverSocketPath() const;
+    void setServerSocketPath(const QString &value);
+    int serverResponseCacheSize() const;
+    void setServerResponseCacheSize(int value);
+    int serverResponseCacheTtl() const;
+    void setServerResponseCacheTtl(int value);
+    int serverMaxGenerationTime() const;
+    void setServerMaxGenerationTime(int value);
+    int serverModelMemory() const;
+    void setServerModelMemory(int value);
 
 Q_SIGNALS:
     void nameChanged(const ModelInfo &info);
@@ -218,6 +256,7 @@ Q_SIGNALS:
     void suggestedFollowUpPromptChanged(const ModelInfo &info);
     void threadCountChanged();
     void saveChatsContextChanged();
+    void regenerateChoicesChanged();
     void serverChatChanged();
     void modelPathChanged();
     void userDefaultModelChanged();
@@ -232,9 +271,18 @@ Q_SIGNALS:
     void localDocsUseRemoteEmbedChanged();
     void localDocsNomicAPIKeyChanged();
     void localDocsEmbedDeviceChanged();
+    void localDocsSearchExpansionChanged();
+    void localDocsQuantizationChanged();
     void networkAttributionChanged();
     void networkIsActiveChanged();
     void networkPortChanged();
+    void serverMaxSlotsChanged();
+    void serverQueueDepthChanged();
+    void serverSocketPathChanged();
+    void serverResponseCacheSizeChanged();
+    void serverResponseCacheTtlChanged();
+    void serverMaxGenerationTimeChanged();
+    void serverModelMemoryChanged();
     void networkUsageStatsActiveChanged();
     void attemptModelLoadChanged();
     void deviceChanged();
@@ -1,7 +1,5 @@
 #include "network.h"
 
-#include "chat.h"
-#include "chatlistmodel.h"
 #include "download.h"
 #include "llm.h"
 #include "localdocs.h"
@@ -9,19 +7,22 @@
 #include "modellist.h"
 #include "mysettings.h"
 
+#ifndef GPT4ALL_HEADLESS
+#   include "chat.h"
+#   include "chatlistmodel.h"
+#endif
+
 #include <gpt4all-backend/llmodel.h>
 
 #include <QCoreApplication>
 #include <QDateTime>
 #include <QDebug>
 #include <QGlobalStatic>
-#include <QGuiApplication>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QLibraryInfo>
 #include <QNetworkRequest>
-#include <QScreen>
 #include <QSettings>
 #include <QSize>
 #include <QSslConfiguration>
@@ -37,6 +38,11 @@
 #include <cstring>
 #include <utility>
 
+#ifndef GPT4ALL_HEADLESS
+#   include <QGuiApplication>
+#   include <QScreen>
+#endif
+
 #ifdef __GLIBC__
 #   include <gnu/libc-version.h>
 #endif
@@ -193,10 +199,14 @@ bool Network::packageAndSendJson(const QString &ingestId, const QString &json)
     }
 
     Q_ASSERT(doc.isObject());
-    Q_ASSERT(ChatListModel::globalInstance()->currentChat());
     QJsonObject object = doc.object();
     object.insert("source", "gpt4all-chat");
-    object.insert("agent_id", ChatListModel::globalInstance()->currentChat()->modelInfo().filename());
+#ifndef GPT4ALL_HEADLESS
+    Q_ASSERT(ChatListModel::globalInstance()->currentChat());
+    const ModelInfo modelInfo = ChatListModel::globalInstance()->currentChat()->modelInfo();
+    object.insert("agent_id", modelInfo.filename());
+    object.insert("prompt_template", modelInfo.promptTemplate());
+#endif
     object.insert("submitter_id", m_uniqueId);
     object.insert("ingest_id", ingestId);
 
@@ -204,9 +214,6 @@ bool Network::packageAndSendJson(const QString &ingestId, const QString &json)
     if (!attribution.isEmpty())
         object.insert("network/attribution", attribution);
 
-    QString promptTemplate = ChatListModel::globalInstance()->currentChat()->modelInfo().promptTemplate();
-    object.insert("prompt_template", promptTemplate);
-
     QJsonDocument newDoc;
     newDoc.setObject(object);
 
@@ -223,7 +230,7 @@ bool Network::packageAndSendJson(const QString &ingestId, const QString &json)
     QByteArray body(newDoc.toJson(QJsonDocument::Compact));
     request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
     QNetworkReply *jsonReply = m_networkManager.post(request, body);
-    connect(qGuiApp, &QCoreApplication::aboutToQuit, jsonReply, &QNetworkReply::abort);
+    connect(qApp, &QCoreApplication::aboutToQuit, jsonReply, &QNetworkReply::abort);
     connect(jsonReply, &QNetworkReply::finished, this, &Network::handleJsonUploadFinished);
     m_activeUploads.append(jsonReply);
     return true;
@@ -314,7 +321,9 @@ void Network::sendStartup()
     // only chance to enable usage stats is at the start of a new session
     m_sendUsageStats = true;
 
+#ifndef GPT4ALL_HEADLESS
     const auto *display = QGuiApplication::primaryScreen();
+#endif
     trackEvent("startup", {
         // Build info
         { "build_compiler",     COMPILER_NAME                                                         },
@@ -339,8 +348,10 @@ void Network::sendStartup()
 #ifdef Q_OS_MAC
         { "sys_hw_model",       getSysctl("hw.model").value_or(u"(unknown)"_s)                        },
 #endif
+#ifndef GPT4ALL_HEADLESS
         { "$screen_dpi",        std::round(display->physicalDotsPerInch())                            },
         { "display",            u"%1x%2"_s.arg(display->size().width()).arg(display->size().height()) },
+#endif
         { "ram",                LLM::globalInstance()->systemTotalRAMInGB()                           },
         { "cpu",                getCPUModel()                                                         },
         { "cpu_supports_avx2",  LLModel::Implementation::cpuSupportsAVX2()                            },
@@ -358,15 +369,20 @@ void Network::sendStartup()
 
 void Network::trackChatEvent(const QString &ev, QVariantMap props)
 {
+#ifdef GPT4ALL_HEADLESS
+    // there is no current chat, the event comes from the server
+    props.insert("using_server", true);
+#else
     const auto &curChat = ChatListModel::globalInstance()->currentChat();
     if (!props.contains("model"))
         props.insert("model", curChat->modelInfo().filename());
     props.insert("device_backend", curChat->deviceBackend());
     props.insert("actualDevice", curChat->device());
     props.insert("doc_collections_enabled", curChat->collectionList().count());
+    props.insert("using_server", curChat->isServer());
+#endif
     props.insert("doc_collections_total", LocalDocs::globalInstance()->localDocsModel()->rowCount());
     props.insert("datalake_active", MySettings::globalInstance()->networkIsActive());
-    props.insert("using_server", ChatListModel::globalInstance()->currentChat()->isServer());
     trackEvent(ev, props);
 }
 
@@ -421,7 +437,7 @@ void Network::sendIpify()
     conf.setPeerVerifyMode(QSslSocket::VerifyNone);
     request.setSslConfiguration(conf);
     QNetworkReply *reply = m_networkManager.get(request);
-    connect(qGuiApp, &QCoreApplication::aboutToQuit, reply, &QNetworkReply::abort);
+    connect(qApp, &QCoreApplication::aboutToQuit, reply, &QNetworkReply::abort);
     connect(reply, &QNetworkReply::finished, this, &Network::handleIpifyFinished);
 }
 
@@ -434,7 +450,7 @@ void Network::sendMixpanel(const QByteArray &json)
     request.setSslConfiguration(conf);
     request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
     QNetworkReply *trackReply = m_networkManager.post(request, json);
-    connect(qGuiApp, &QCoreApplication::aboutToQuit, trackReply, &QNetworkReply::abort);
+    connect(qApp, &QCoreApplication::aboutToQuit, trackReply, &QNetworkReply::abort);
     connect(trackReply, &QNetworkReply::finished, this, &Network::handleMixpanelFinished);
 }
 
@@ -496,7 +512,7 @@ void Network::sendHealth()
     conf.setPeerVerifyMode(QSslSocket::VerifyNone);
     request.setSslConfiguration(conf);
     QNetworkReply *healthReply = m_networkManager.get(request);
-    connect(qGuiApp, &QCoreApplication::aboutToQuit, healthReply, &QNetworkReply::abort);
+    connect(qApp, &QCoreApplication::aboutToQuit, healthReply, &QNetworkReply::abort);
     connect(healthReply, &QNetworkReply::finished, this, &Network::handleHealthFinished);
 }
 
@@ -500,16 +500,48 @@ MySettingsTab {
                 MySettings.saveChatsContext = !MySettings.saveChatsContext
             }
         }
+        MySettingsLabel {
+            id: regenerateChoicesLabel
+            text: qsTr("Regenerate Alternatives")
+            helpText: qsTr("The number of responses generated at once when regenerating, sharing a single decode of the prompt. Later regenerations show the others. 1 turns this off.")
+            Layout.row: 13
+            Layout.column: 0
+        }
+        MyTextField {
+            text: MySettings.regenerateChoices
+            color: theme.textColor
+            font.pixelSize: theme.fontSizeLarge
+            Layout.alignment: Qt.AlignRight
+            Layout.row: 13
+            Layout.column: 2
+            Layout.minimumWidth: 200
+            Layout.maximumWidth: 200
+            validator: IntValidator {
+                bottom: 1
+            }
+            onEditingFinished: {
+                var val = parseInt(text)
+                if (!isNaN(val)) {
+                    MySettings.regenerateChoices = val
+                    focus = false
+                } else {
+                    text = MySettings.regenerateChoices
+                }
+            }
+            Accessible.role: Accessible.EditableText
+            Accessible.name: regenerateChoicesLabel.text
+            Accessible.description: ToolTip.text
+        }
         MySettingsLabel {
             id: serverChatLabel
             text: qsTr("Enable Local API Server")
             helpText: qsTr("Expose an OpenAI-Compatible server to localhost. WARNING: Results in increased resource usage.")
-            Layout.row: 13
+            Layout.row: 14
             Layout.column: 0
         }
         MyCheckBox {
             id: serverChatBox
-            Layout.row: 13
+            Layout.row: 14
             Layout.column: 2
             Layout.alignment: Qt.AlignRight
             checked: MySettings.serverChat
@@ -521,7 +553,7 @@ MySettingsTab {
             id: serverPortLabel
             text: qsTr("API Server Port")
             helpText: qsTr("The port to use for the local server. Requires restart.")
-            Layout.row: 14
+            Layout.row: 15
             Layout.column: 0
         }
         MyTextField {
@@ -529,7 +561,7 @@ MySettingsTab {
             text: MySettings.networkPort
             color: theme.textColor
             font.pixelSize: theme.fontSizeLarge
-            Layout.row: 14
+            Layout.row: 15
             Layout.column: 2
             Layout.minimumWidth: 200
             Layout.maximumWidth: 200
@@ -550,16 +582,240 @@ MySettingsTab {
             Accessible.name: serverPortLabel.text
             Accessible.description: serverPortLabel.helpText
         }
+        MySettingsLabel {
+            id: serverMaxSlotsLabel
+            text: qsTr("API Server Parallel Requests")
+            helpText: qsTr("The number of requests the local server generates responses for at the same time. Requires restart.")
+            Layout.row: 16
+            Layout.column: 0
+        }
+        MyTextField {
+            id: serverMaxSlotsField
+            text: MySettings.serverMaxSlots
+            color: theme.textColor
+            font.pixelSize: theme.fontSizeLarge
+            Layout.row: 16
+            Layout.column: 2
+            Layout.minimumWidth: 200
+            Layout.maximumWidth: 200
+            Layout.alignment: Qt.AlignRight
+            validator: IntValidator {
+                bottom: 1
+            }
+            onEditingFinished: {
+                var val = parseInt(text)
+                if (!isNaN(val)) {
+                    MySettings.serverMaxSlots = val
+                    focus = false
+                } else {
+                    text = MySettings.serverMaxSlots
+                }
+            }
+            Accessible.role: Accessible.EditableText
+            Accessible.name: serverMaxSlotsLabel.text
+            Accessible.description: serverMaxSlotsLabel.helpText
+        }
+        MySettingsLabel {
+            id: serverQueueDepthLabel
+            text: qsTr("API Server Queue Depth")
+            helpText: qsTr("The number of requests that may wait for a free slot before the local server rejects new ones.")
+            Layout.row: 17
+            Layout.column: 0
+        }
+        MyTextField {
+            id: serverQueueDepthField
+            text: MySettings.serverQueueDepth
+            color: theme.textColor
+            font.pixelSize: theme.fontSizeLarge
+            Layout.row: 17
+            Layout.column: 2
+            Layout.minimumWidth: 200
+            Layout.maximumWidth: 200
+            Layout.alignment: Qt.AlignRight
+            validator: IntValidator {
+                bottom: 0
+            }
+            onEditingFinished: {
+                var val = parseInt(text)
+                if (!isNaN(val)) {
+                    MySettings.serverQueueDepth = val
+                    focus = false
+                } else {
+                    text = MySettings.serverQueueDepth
+                }
+            }
+            Accessible.role: Accessible.EditableText
+            Accessible.name: serverQueueDepthLabel.text
+            Accessible.description: serverQueueDepthLabel.helpText
+        }
+
+        MySettingsLabel {
+            id: serverSocketPathLabel
+            text: qsTr("API Server Socket")
+            helpText: qsTr("A Unix domain socket the local server also listens on, only accessible to the current user. Leave empty to only use the port. Requires restart.")
+            Layout.row: 18
+            Layout.column: 0
+        }
+        MyTextField {
+            id: serverSocketPathField
+            text: MySettings.serverSocketPath
+            color: theme.textColor
+            font.pixelSize: theme.fontSizeLarge
+            Layout.row: 18
+            Layout.column: 2
+            Layout.minimumWidth: 200
+            Layout.maximumWidth: 200
+            Layout.alignment: Qt.AlignRight
+            onEditingFinished: {
+                MySettings.serverSocketPath = text.trim()
+                focus = false
+            }
+            Accessible.role: Accessible.EditableText
+            Accessible.name: serverSocketPathLabel.text
+            Accessible.description: serverSocketPathLabel.helpText
+        }
+        MySettingsLabel {
+            id: serverResponseCacheSizeLabel
+            text: qsTr("API Server Response Cache Size")
+            helpText: qsTr("The number of responses to requests with a temperature of 0 the local server keeps, to answer identical requests without generating them again. 0 disables the cache. Requires restart.")
+            Layout.row: 19
+            Layout.column: 0
+        }
+        MyTextField {
+            id: serverResponseCacheSizeField
+            text: MySettings.serverResponseCacheSize
+            color: theme.textColor
+            font.pixelSize: theme.fontSizeLarge
+            Layout.row: 19
+            Layout.column: 2
+            Layout.minimumWidth: 200
+            Layout.maximumWidth: 200
+            Layout.alignment: Qt.AlignRight
+            validator: IntValidator {
+                bottom: 0
+            }
+            onEditingFinished: {
+                var val = parseInt(text)
+                if (!isNaN(val)) {
+                    MySettings.serverResponseCacheSize = val
+                    focus = false
+                } else {
+                    text = MySettings.serverResponseCacheSize
+                }
+            }
+            Accessible.role: Accessible.EditableText
+            Accessible.name: serverResponseCacheSizeLabel.text
+            Accessible.description: serverResponseCacheSizeLabel.helpText
+        }
+        MySettingsLabel {
+            id: serverResponseCacheTtlLabel
+            text: qsTr("API Server Response Cache TTL")
+            helpText: qsTr("The number of seconds a cached response is used for. 0 keeps responses until the cache is full. Requires restart.")
+            Layout.row: 20
+            Layout.column: 0
+        }
+        MyTextField {
+            id: serverResponseCacheTtlField
+            text: MySettings.serverResponseCacheTtl
+            color: theme.textColor
+            font.pixelSize: theme.fontSizeLarge
+            Layout.row: 20
+            Layout.column: 2
+            Layout.minimumWidth: 200
+            Layout.maximumWidth: 200
+            Layout.alignment: Qt.AlignRight
+            validator: IntValidator {
+                bottom: 0
+            }
+            onEditingFinished: {
+                var val = parseInt(text)
+                if (!isNaN(val)) {
+                    MySettings.serverResponseCacheTtl = val
+                    focus = false
+                } else {
+                    text = MySettings.serverResponseCacheTtl
+                }
+            }
+            Accessible.role: Accessible.EditableText
+            Accessible.name: serverResponseCacheTtlLabel.text
+            Accessible.description: serverResponseCacheTtlLabel.helpText
+        }
+        MySettingsLabel {
+            id: serverMaxGenerationTimeLabel
+            text: qsTr("API Server Max Generation Time")
+            helpText: qsTr("The number of seconds the local server spends on a response before cutting it short, so that one long request does not hold up the others. Clients can ask for a shorter deadline. 0 means no limit. Requires restart.")
+            Layout.row: 21
+            Layout.column: 0
+        }
+        MyTextField {
+            id: serverMaxGenerationTimeField
+            text: MySettings.serverMaxGenerationTime
+            color: theme.textColor
+            font.pixelSize: theme.fontSizeLarge
+            Layout.row: 21
+            Layout.column: 2
+            Layout.minimumWidth: 200
+            Layout.maximumWidth: 200
+            Layout.alignment: Qt.AlignRight
+            validator: IntValidator {
+                bottom: 0
+            }
+            onEditingFinished: {
+                var val = parseInt(text)
+                if (!isNaN(val)) {
+                    MySettings.serverMaxGenerationTime = val
+                    focus = false
+                } else {
+                    text = MySettings.serverMaxGenerationTime
+                }
+            }
+            Accessible.role: Accessible.EditableText
+            Accessible.name: serverMaxGenerationTimeLabel.text
+            Accessible.description: serverMaxGenerationTimeLabel.helpText
+        }
+        MySettingsLabel {
+            id: serverModelMemoryLabel
+            text: qsTr("API Server Model Memory")
+            helpText: qsTr("The GB of memory the models of the local server may take together. Requests for different models are served at the same time while their models fit, and idle models are unloaded to make room. 0 keeps one model loaded at a time. Requires restart.")
+            Layout.row: 22
+            Layout.column: 0
+        }
+        MyTextField {
+            id: serverModelMemoryField
+            text: MySettings.serverModelMemory
+            color: theme.textColor
+            font.pixelSize: theme.fontSizeLarge
+            Layout.row: 22
+            Layout.column: 2
+            Layout.minimumWidth: 200
+            Layout.maximumWidth: 200
+            Layout.alignment: Qt.AlignRight
+            validator: IntValidator {
+                bottom: 0
+            }
+            onEditingFinished: {
+                var val = parseInt(text)
+                if (!isNaN(val)) {
+                    MySettings.serverModelMemory = val
+                    focus = false
+                } else {
+                    text = MySettings.serverModelMemory
+                }
+            }
+            Accessible.role: Accessible.EditableText
+            Accessible.name: serverModelMemoryLabel.text
+            Accessible.description: serverModelMemoryLabel.helpText
+        }
 
         /*MySettingsLabel {
             id: gpuOverrideLabel
             text: qsTr("Force Metal (macOS+arm)")
-            Layout.row: 13
+            Layout.row: 14
             Layout.column: 0
         }
         MyCheckBox {
             id: gpuOverrideBox
-            Layout.row: 13
+            Layout.row: 14
             Layout.column: 2
             Layout.alignment: Qt.AlignRight
             checked: MySettings.forceMetal
@@ -574,12 +830,12 @@ MySettingsTab {
             id: updatesLabel
             text: qsTr("Check For Updates")
             helpText: qsTr("Manually check for an update to GPT4All.");
-            Layout.row: 15
+            Layout.row: 23
             Layout.column: 0
         }
 
         MySettingsButton {
-            Layout.row: 15
+            Layout.row: 23
             Layout.column: 2
             Layout.alignment: Qt.AlignRight
             text: qsTr("Updates");
@@ -590,7 +846,7 @@ MySettingsTab {
         }
 
         Rectangle {
-            Layout.row: 16
+            Layout.row: 24
             Layout.column: 0
             Layout.columnSpan: 3
             Layout.fillWidth: true
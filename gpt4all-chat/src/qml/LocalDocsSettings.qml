@@ -311,6 +311,61 @@ MySettingsTab {
             }
         }
 
+        RowLayout {
+            Layout.topMargin: 15
+            MySettingsLabel {
+                id: searchExpansionLabel
+                text: qsTr("Search Expansion")
+                helpText: qsTr("Number of candidates considered when searching large collections. Larger numbers find better matches, but make retrieval slower.")
+            }
+
+            MyTextField {
+                text: MySettings.localDocsSearchExpansion
+                validator: IntValidator {
+                    bottom: 1
+                }
+                onEditingFinished: {
+                    var val = parseInt(text)
+                    if (!isNaN(val)) {
+                        MySettings.localDocsSearchExpansion = val
+                        focus = false
+                    } else {
+                        text = MySettings.localDocsSearchExpansion
+                    }
+                }
+            }
+        }
+
+        RowLayout {
+            Layout.topMargin: 15
+            MySettingsLabel {
+                id: quantizationLabel
+                text: qsTr("Embedding Quantization")
+                helpText: qsTr("How the embeddings are kept in the search indexes and in memory. Int8 and binary take a quarter and a 32nd of the space, and their best matches are re-ranked with the full embeddings.")
+            }
+            MyComboBox {
+                id: quantizationBox
+                Layout.minimumWidth: 400
+                Layout.maximumWidth: 400
+                Layout.fillWidth: false
+                Layout.alignment: Qt.AlignRight
+                // NOTE: indices match values of EmbeddingQuantization enum, keep them in sync
+                model: ListModel {
+                    ListElement { name: qsTr("None") }
+                    ListElement { name: qsTr("Int8") }
+                    ListElement { name: qsTr("Binary") }
+                }
+                Accessible.name: quantizationLabel.text
+                Accessible.description: quantizationLabel.helpText
+                onActivated: {
+                    MySettings.localDocsQuantization = quantizationBox.currentIndex;
+                }
+                Component.onCompleted: {
+                    quantizationBox.currentIndex = MySettings.localDocsQuantization;
+                }
+            }
+        }
+
         Rectangle {
             Layout.topMargin: 15
             Layout.fillWidth: true
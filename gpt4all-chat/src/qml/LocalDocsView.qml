@@ -361,6 +361,19 @@ Rectangle {
                                 color: theme.mutedTextColor
                                 font.pixelSize: theme.fontSizeSmall
                             }
+                            Text {
+                                // indexing pauses while too much text waits for its embeddings
+                                visible: model.indexing && (model.embeddingQueueBytes > 0 || model.indexingStallMs > 0)
+                                text: {
+                                    var queued = qsTr("%1 KB queued for embedding").arg(Math.ceil(model.embeddingQueueBytes / 1024));
+                                    if (model.indexingStallMs === 0)
+                                        return queued;
+                                    return queued + ", " + qsTr("waited %1 s").arg((model.indexingStallMs / 1000).toFixed(1));
+                                }
+                                elide: Text.ElideRight
+                                color: theme.mutedTextColor
+                                font.pixelSize: theme.fontSizeSmall
+                            }
                         }
 
                         Rectangle {
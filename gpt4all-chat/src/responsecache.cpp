@@ -0,0 +1,83 @@
+#include "responsecache.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QIODevice>
+
+#include <utility>
+
+
+ResponseCache::ResponseCache(qsizetype maxEntries, qint64 ttlSecs)
+    : m_maxEntries(qMax(maxEntries, qsizetype(0)))
+    , m_ttlMs(qMax(ttlSecs, qint64(0)) * 1000)
+{
+}
+
+// Identifies the weights of a model without reading the whole file: by the hash of a downloaded model, or otherwise by
+// the size and modification time of the file, which change when it is replaced.
+QByteArray ResponseCache::modelIdentity(const ModelInfo &info)
+{
+    if (!info.hash.isEmpty())
+        return info.hash;
+    QFileInfo file(info.dirpath + info.filename());
+    return (file.absoluteFilePath() + u'\n' + QString::number(file.size()) + u'\n'
+            + QString::number(file.lastModified().toMSecsSinceEpoch())).toUtf8();
+}
+
+std::optional<QByteArray> ResponseCache::keyFor(const GenerationJob &job) const
+{
+    // zero temperature is greedy sampling, and remote models may not be deterministic
+    if (!isEnabled() || job.params.temp > 0.f || job.modelInfo.isOnline)
+        return std::nullopt;
+
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << modelIdentity(job.modelInfo) << job.modelInfo.contextLength()
+           << job.systemPrompt << job.history << job.docsContext << job.prompt << job.promptTemplate << job.n
+           << job.params.n_predict << job.params.top_k << job.params.top_p << job.params.min_p
+           << job.params.repeat_penalty << job.params.repeat_last_n;
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha256);
+}
+
+std::optional<GenerationResult> ResponseCache::find(const QByteArray &key)
+{
+    auto it = m_entries.find(key);
+    if (it == m_entries.end())
+        return std::nullopt;
+    if (it->expiry.hasExpired()) {
+        remove(it);
+        return std::nullopt;
+    }
+
+    m_lru.splice(m_lru.begin(), m_lru, it->lruPos);
+    GenerationResult result = it->result;
+    result.responseCacheHits = ++it->hits;
+    result.cachedTokens      = result.promptTokens; // nothing was decoded
+    result.elapsedMs         = 0;
+    return result;
+}
+
+void ResponseCache::insert(const QByteArray &key, const GenerationResult &result)
+{
+    if (!isEnabled())
+        return;
+    if (auto it = m_entries.find(key); it != m_entries.end())
+        remove(it);
+    while (m_entries.size() >= m_maxEntries)
+        remove(m_entries.find(m_lru.back()));
+
+    m_lru.push_front(key);
+    Entry entry;
+    entry.result = result;
+    entry.expiry = m_ttlMs ? QDeadlineTimer(m_ttlMs) : QDeadlineTimer(QDeadlineTimer::Forever);
+    entry.lruPos = m_lru.begin();
+    m_entries.insert(key, std::move(entry));
+}
+
+void ResponseCache::remove(QHash<QByteArray, Entry>::iterator it)
+{
+    m_lru.erase(it->lruPos);
+    m_entries.erase(it);
+}
@@ -0,0 +1,57 @@
+#ifndef RESPONSECACHE_H
+#define RESPONSECACHE_H
+
+#include "modellist.h"
+#include "scheduler.h"
+
+#include <QByteArray>
+#include <QDeadlineTimer>
+#include <QHash>
+#include <QtGlobal>
+
+#include <list>
+#include <optional>
+
+/*
+ * Exact-match cache of the results of the local API server, for clients that send the same request more than once,
+ * like retries and repeated classification prompts. Only requests whose output does not depend on sampling, i.e.
+ * those with a temperature of zero to a local model, are cached. The key is a hash of the model file, the conversation
+ * as the model will see it, and the generation parameters, so requests that only differ in how their response is
+ * presented share an entry.
+ *
+ * Entries expire after a fixed time, and the least recently used ones are dropped when the cache is full. Only used on
+ * the server's thread.
+ */
+class ResponseCache
+{
+public:
+    // a maxEntries of 0 disables the cache, and a ttlSecs of 0 keeps entries until they are dropped
+    ResponseCache(qsizetype maxEntries, qint64 ttlSecs);
+
+    bool isEnabled() const { return m_maxEntries > 0; }
+
+    // The key of a job that can be answered from the cache, or nullopt if its output is sampled.
+    std::optional<QByteArray> keyFor(const GenerationJob &job) const;
+
+    // Returns a copy of the cached result with responseCacheHits set, and counts the hit.
+    std::optional<GenerationResult> find(const QByteArray &key);
+    void insert(const QByteArray &key, const GenerationResult &result);
+
+private:
+    struct Entry {
+        GenerationResult                result;
+        QDeadlineTimer                  expiry;
+        quint64                         hits = 0;
+        std::list<QByteArray>::iterator lruPos;
+    };
+
+    static QByteArray modelIdentity(const ModelInfo &info);
+    void remove(QHash<QByteArray, Entry>::iterator it);
+
+    qsizetype                m_maxEntries;
+    qint64                   m_ttlMs;
+    QHash<QByteArray, Entry> m_entries;
+    std::list<QByteArray>    m_lru; // most recently used first
+};
+
+#endif // RESPONSECACHE_H
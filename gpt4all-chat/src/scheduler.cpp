@@ -0,0 +1,609 @@
+#include "scheduler.h"
+
+#include "metrics.h"
+
+#include <QDebug>
+#include <QMetaObject>
+#include <Qt>
+#include <QtLogging>
+
+#include <algorithm>
+#include <tuple>
+#include <utility>
+
+namespace ranges = std::ranges;
+using namespace Qt::Literals::StringLiterals;
+
+//#define DEBUG_SCHEDULER
+
+Scheduler::Scheduler(ModelLoader loader, int32_t maxSlots, qsizetype queueDepth, qint64 maxGenerationMs,
+                     QObject *parent)
+    : QObject(parent)
+    , m_loader(std::move(loader))
+    , m_maxSlots(std::max(maxSlots, 1))
+    , m_queueDepth(std::max(queueDepth, qsizetype(0)))
+    , m_maxGenerationMs(std::max(maxGenerationMs, qint64(0)))
+{
+}
+
+bool Scheduler::submit(std::shared_ptr<GenerationJob> job)
+{
+    // jobs that can be admitted right away do not count against the queue depth
+    qsizetype freeSlots = std::max(m_maxSlots - activeSlots(), 0);
+    if (qsizetype(m_queue.size()) >= m_queueDepth + freeSlots)
+        return false;
+
+    auto request = std::make_shared<Request>();
+    request->job = std::move(job);
+    request->timer.start();
+    request->job->startDeadline();
+    request->deadline = request->job->deadline;
+    m_queue.push_back(std::move(request));
+    scheduleStep();
+    return true;
+}
+
+int32_t Scheduler::activeSlots() const
+{
+    return ranges::count_if(m_slots, [](const Slot &slot) { return bool(slot.request); });
+}
+
+double Scheduler::kvCacheUsage() const
+{
+    return m_nCtx ? double(usedCells()) / double(m_nCtx) : 0.0;
+}
+
+void Scheduler::scheduleStep()
+{
+    if (m_stepQueued)
+        return;
+    m_stepQueued = true;
+    // queued, so that new requests are received between steps
+    QMetaObject::invokeMethod(this, &Scheduler::step, Qt::QueuedConnection);
+}
+
+void Scheduler::step()
+{
+    m_stepQueued = false;
+    dropExpired();
+    admit();
+
+    // the model may have been replaced while idle, so only use it with slots in use
+    if (activeSlots()) {
+        stopCancelled();
+        makeRoom();
+
+        std::vector<LLModel::Sequence *> active;
+        for (auto &slot : m_slots) {
+            if (slot.request && !slot.waiting && !slot.seq.stopped)
+                active.push_back(&slot.seq);
+        }
+
+        if (!active.empty()) {
+            // leave room for the prompts of new requests next to one token per generating slot
+            int32_t nBatch = m_nBatch + int32_t(active.size());
+            if (!m_model->stepSequences(active, nBatch, m_timings))
+                qWarning() << "Scheduler: failed to decode a batch for" << active.size() << "slots";
+#if defined(DEBUG_SCHEDULER)
+            qDebug() << "Scheduler: stepped" << active.size() << "slots," << m_queue.size() << "queued";
+#endif
+        }
+
+        forkChoices();
+        retire();
+    }
+
+    if (activeSlots() || !m_queue.empty())
+        scheduleStep();
+    emit stepped();
+}
+
+// Ends the queued jobs that were cancelled or ran out of time before they could be admitted.
+void Scheduler::dropExpired()
+{
+    const auto now = std::chrono::steady_clock::now();
+    for (auto it = m_queue.begin(); it != m_queue.end();) {
+        auto request = *it;
+        if (request->job->cancelled) {
+            request->result.error = u"The request was cancelled."_s;
+            Metrics::globalInstance()->countCancelled();
+        } else if (now >= request->deadline) {
+            request->result.error = u"The request timed out before it could be started."_s;
+            request->result.timedOut = true;
+            Metrics::globalInstance()->countTimedOut();
+        } else {
+            ++it;
+            continue;
+        }
+        it = m_queue.erase(it);
+        finish(*request);
+    }
+}
+
+// Stops the slots of cancelled jobs, so that their cells are free for the next step.
+void Scheduler::stopCancelled()
+{
+    for (auto &slot : m_slots) {
+        if (!slot.request || !slot.request->job->cancelled)
+            continue;
+        if (!slot.request->result.error) {
+            slot.request->result.error = u"The request was cancelled."_s;
+            Metrics::globalInstance()->countCancelled();
+        }
+        // choices waiting to fork are stopped along with choice 0
+        if (!slot.waiting && !slot.seq.stopped)
+            m_model->finishSequence(slot.seq);
+    }
+}
+
+// The time by which the model has to stop working on an admitted request.
+std::chrono::steady_clock::time_point Scheduler::generationDeadline(const Request &request) const
+{
+    if (!m_maxGenerationMs)
+        return request.deadline;
+    return std::min(request.deadline, std::chrono::steady_clock::now() + std::chrono::milliseconds(m_maxGenerationMs));
+}
+
+void Scheduler::resetModel()
+{
+    std::vector<std::shared_ptr<Request>> interrupted;
+    for (auto &slot : m_slots) {
+        if (slot.request && !ranges::contains(interrupted, slot.request))
+            interrupted.push_back(slot.request);
+    }
+
+    m_model = nullptr;
+    m_modelInfo.reset();
+    m_slots.clear();
+    m_nCtx = 0;
+
+    for (auto &request : interrupted) {
+        request->result.error = u"the model was unloaded"_s;
+        request->result.internalError = true;
+        finish(*request);
+    }
+    emit stepped();
+}
+
+bool Scheduler::ensureModel(const ModelInfo &modelInfo)
+{
+    LLModel *model = m_loader(modelInfo);
+    if (!model) {
+        m_model = nullptr;
+        m_modelInfo.reset();
+        m_slots.clear();
+        m_nCtx = 0;
+        return false;
+    }
+
+    if (model != m_model || !m_modelInfo || !(*m_modelInfo == modelInfo)) {
+        m_model = model;
+        m_modelInfo = modelInfo;
+        m_nBatch = std::min(modelInfo.promptBatchSize(), LLMODEL_MAX_PROMPT_BATCH);
+        m_nCtx = model->contextLength();
+
+        // sequence 0 belongs to ChatLLM
+        int32_t nSlots = std::min(m_maxSlots, model->maxSequences() - 1);
+        m_slots = std::vector<Slot>(std::max(nSlots, 0));
+        for (size_t i = 0; i < m_slots.size(); i++)
+            m_slots[i].seq.id = int32_t(i) + 1;
+    }
+    return true;
+}
+
+// Tokenizes the conversation of a request, without decoding it yet.
+bool Scheduler::prepare(Request &request)
+{
+    const auto &job = *request.job;
+    const std::string promptTemplate = job.promptTemplate.toStdString();
+
+    LLModel::Sequence seq;
+    seq.ctx = job.params;
+
+    bool ok = true;
+    // use "%1%2" and not "%1" to avoid implicit whitespace
+    if (!job.systemPrompt.trimmed().isEmpty())
+        ok = m_model->appendSequencePrompt(seq, job.systemPrompt.toStdString(), "%1%2", {}, /*special*/ true);
+    for (qsizetype i = 0; ok && i < job.history.size(); i++) {
+        std::string reply = job.history[i].second.toStdString();
+        ok = m_model->appendSequencePrompt(seq, job.history[i].first.toStdString(), promptTemplate, reply);
+    }
+    // decode localdocs context without a response
+    if (ok && !job.docsContext.isEmpty())
+        ok = m_model->appendSequencePrompt(seq, job.docsContext.toStdString(), "%1", "");
+    if (ok)
+        ok = m_model->appendSequencePrompt(seq, job.prompt.toStdString(), promptTemplate);
+
+    if (!ok) {
+        request.result.error = u"The prompt size exceeds the context window size and cannot be processed."_s;
+        return false;
+    }
+
+    request.prepared = std::move(seq);
+    return true;
+}
+
+// Moves jobs from the queue into free slots, in order.
+void Scheduler::admit()
+{
+    while (!m_queue.empty()) {
+        auto request = m_queue.front();
+        const auto &job = *request->job;
+
+        if (!activeSlots()) {
+            if (!ensureModel(job.modelInfo)) {
+                request->result.error = u"couldn't load model %1"_s.arg(job.modelInfo.name());
+                request->result.internalError = true;
+                m_queue.pop_front();
+                finish(*request);
+                continue;
+            }
+        } else if (!(*m_modelInfo == job.modelInfo)) {
+            break; // wait for the requests to the current model to finish
+        }
+
+        if (m_slots.empty()) {
+            m_queue.pop_front();
+            runDirect(*request);
+            break; // one at a time
+        }
+
+        if (job.n > int32_t(m_slots.size())) {
+            request->result.error = u"'n' must be at most %1 with this model"_s.arg(m_slots.size());
+            m_queue.pop_front();
+            finish(*request);
+            continue;
+        }
+
+        int32_t freeSlots = int32_t(m_slots.size()) - activeSlots();
+        if (freeSlots < job.n)
+            break;
+
+        if (!request->prepared && !prepare(*request)) {
+            m_queue.pop_front();
+            finish(*request);
+            continue;
+        }
+
+        auto &prepared = *request->prepared;
+        auto [targets, source, n_keep] = pickSlots(prepared, job.n);
+
+        // the cached prefixes of the slots that are about to be reused are replaced, so they do not count
+        auto projected = [&] {
+            return usedCells() - cachedCells(targets) + int32_t(prepared.pending.size()) + job.n;
+        };
+        if (projected() > m_model->contextLength())
+            evictCached(projected() - m_model->contextLength(), targets, source);
+        if (projected() > m_model->contextLength()) {
+            if (activeSlots())
+                break; // wait for running requests to free up the context
+            request->result.error = u"The prompt size exceeds the context window size and cannot be processed."_s;
+            m_queue.pop_front();
+            finish(*request);
+            continue;
+        }
+
+        m_queue.pop_front();
+        Metrics::globalInstance()->queueWait.observe(request->timer.elapsed() / 1000.0);
+        auto &result = request->result;
+        result.promptTokens   = int32_t(prepared.pending.size());
+        result.cachedTokens   = n_keep;
+        result.responses      = QList<std::string>(job.n);
+        result.responseTokens = QList<int32_t>(job.n, 0);
+        result.finishReasons  = QList<GenerationResult::FinishReason>(job.n, GenerationResult::FinishReason::Stop);
+        request->running = job.n;
+        const auto deadline = generationDeadline(*request);
+
+        m_cacheStats.lookups++;
+        if (n_keep) {
+            m_cacheStats.hits++;
+            m_cacheStats.tokensSaved += n_keep;
+        }
+#if defined(DEBUG_SCHEDULER)
+        qDebug() << "Scheduler: resuming from" << n_keep << "of" << prepared.pending.size() << "prompt tokens,"
+                 << "hit ratio" << m_cacheStats.hitRatio();
+#endif
+
+        for (int32_t choice = 0; choice < job.n; choice++) {
+            auto &slot = *targets[choice];
+            if (choice == 0) {
+                // choice 0 decodes the rest of the prompt, and the others are forked from it afterwards
+                if (source)
+                    m_model->resetSequence(slot.seq, n_keep, &source->seq);
+                else
+                    m_model->resetSequence(slot.seq, 0);
+                auto tokens = std::move(slot.seq.ctx.tokens);
+                slot.seq.ctx = prepared.ctx;
+                slot.seq.ctx.tokens = std::move(tokens);
+                slot.seq.ctx.n_past = n_keep;
+                slot.seq.pending.assign(prepared.pending.begin() + n_keep, prepared.pending.end());
+            } else {
+                m_model->releaseSequence(slot.seq);
+                slot.seq.ctx = job.params;
+            }
+            slot.seq.ctx.deadline = deadline;
+            slot.seq.responseCallback = [r = request.get(), choice](int32_t token, const std::string &piece) {
+                (void)token;
+                if (!std::exchange(r->responded, true))
+                    Metrics::globalInstance()->timeToFirstToken.observe(r->timer.elapsed() / 1000.0);
+                r->result.responses[choice] += piece;
+                r->result.responseTokens[choice]++;
+                return !r->job->onResponse || r->job->onResponse(choice, piece);
+            };
+            slot.request   = request;
+            slot.choice    = choice;
+            slot.waiting   = choice != 0;
+            slot.truncated = false;
+        }
+        request->prepared.reset();
+    }
+}
+
+static int32_t commonPrefix(const std::vector<LLModel::Token> &a, const std::vector<LLModel::Token> &b)
+{
+    return int32_t(ranges::mismatch(a, b).in1 - a.begin());
+}
+
+// Picks free slots for the choices of a request, and the slot holding the longest prefix of its prompt. Choice 0
+// goes to that slot if it is free, and the rest to slots without a cached prefix or the least recently used ones.
+auto Scheduler::pickSlots(const LLModel::Sequence &prepared, int32_t n) -> std::tuple<std::vector<Slot *>, Slot *, int32_t>
+{
+    Slot *source = nullptr;
+    int32_t n_keep = 0;
+    for (auto &slot : m_slots) {
+        if (slot.waiting)
+            continue;
+        int32_t prefix = commonPrefix(slot.seq.ctx.tokens, prepared.pending);
+        if (prefix > n_keep) {
+            source = &slot;
+            n_keep = prefix;
+        }
+    }
+    // at least one token must be decoded for the logits
+    n_keep = std::min(n_keep, int32_t(prepared.pending.size()) - 1);
+    if (n_keep <= 0) {
+        source = nullptr;
+        n_keep = 0;
+    }
+
+    std::vector<Slot *> targets;
+    if (source && !source->request)
+        targets.push_back(source);
+    std::vector<Slot *> free;
+    for (auto &slot : m_slots) {
+        if (!slot.request && &slot != source)
+            free.push_back(&slot);
+    }
+    ranges::sort(free, {}, [](const Slot *slot) { return slot->seq.ctx.tokens.empty() ? 0 : slot->lastUsed + 1; });
+    for (Slot *slot : free) {
+        if (int32_t(targets.size()) == n)
+            break;
+        targets.push_back(slot);
+    }
+    Q_ASSERT(int32_t(targets.size()) == n);
+    return { std::move(targets), source, n_keep };
+}
+
+// Releases the least recently used cached prefixes, other than the ones given, until enough cells are freed.
+void Scheduler::evictCached(int32_t cells, const std::vector<Slot *> &keep, const Slot *source)
+{
+    std::vector<Slot *> cached;
+    for (auto &slot : m_slots) {
+        if (!slot.request && !slot.seq.ctx.tokens.empty() && &slot != source && !ranges::contains(keep, &slot))
+            cached.push_back(&slot);
+    }
+    ranges::sort(cached, {}, &Slot::lastUsed);
+    for (Slot *slot : cached) {
+        if (cells <= 0)
+            break;
+        cells -= slot->seq.ctx.n_past;
+        m_model->releaseSequence(slot->seq);
+    }
+}
+
+int32_t Scheduler::cachedCells(const std::vector<Slot *> &slots) const
+{
+    int32_t cells = 0;
+    for (const Slot *slot : slots)
+        cells += slot->seq.ctx.n_past;
+    return cells;
+}
+
+// Shares the decoded prompt of choice 0 with the other choices of the same request.
+void Scheduler::forkChoices()
+{
+    for (auto &slot : m_slots) {
+        if (!slot.request || !slot.waiting)
+            continue;
+
+        auto first = ranges::find_if(m_slots, [&slot](const Slot &s) {
+            return s.request == slot.request && s.choice == 0;
+        });
+        Q_ASSERT(first != m_slots.end());
+        if (first->seq.stopped) {
+            // the prompt could not be decoded
+            slot.waiting = false;
+            slot.seq.stopped = true;
+            continue;
+        }
+        if (!first->seq.pending.empty() || !first->seq.hasLogits)
+            continue;
+
+        m_model->resetSequence(slot.seq, first->seq.ctx.n_past, &first->seq);
+        slot.seq.batchIdx  = first->seq.batchIdx;
+        slot.seq.hasLogits = true;
+        slot.waiting = false;
+    }
+}
+
+// Ends the longest responses if the context cannot hold the next batch.
+void Scheduler::makeRoom()
+{
+    const int32_t n_ctx = m_model->contextLength();
+    for (;;) {
+        int32_t needed = usedCells();
+        int32_t pending = 0;
+        Slot *longest = nullptr;
+        for (auto &slot : m_slots) {
+            if (!slot.request || slot.waiting || slot.seq.stopped)
+                continue;
+            if (!slot.seq.pending.empty()) {
+                pending += slot.seq.pending.size();
+                continue;
+            }
+            needed += 1;
+            if (!longest || slot.seq.ctx.n_past > longest->seq.ctx.n_past)
+                longest = &slot;
+        }
+        needed += std::min(pending, m_nBatch);
+        if (needed <= n_ctx)
+            break;
+
+        // give up cached prefixes before cutting responses short
+        if (ranges::any_of(m_slots, [](const Slot &slot) { return !slot.request && !slot.seq.ctx.tokens.empty(); })) {
+            evictCached(needed - n_ctx, {}, nullptr);
+            continue;
+        }
+        if (!longest)
+            break;
+
+        m_model->finishSequence(longest->seq);
+        longest->truncated = true;
+    }
+}
+
+void Scheduler::retire()
+{
+    for (auto &slot : m_slots) {
+        if (!slot.request || slot.waiting || !slot.seq.stopped)
+            continue;
+
+        auto request = std::exchange(slot.request, nullptr);
+        if (slot.seq.ctx.deadlineExceeded && !std::exchange(request->result.timedOut, true))
+            Metrics::globalInstance()->countTimedOut();
+        bool length = slot.truncated || slot.seq.ctx.deadlineExceeded || slot.seq.n_predicted >= slot.seq.ctx.n_predict;
+        request->result.finishReasons[slot.choice] = length ? GenerationResult::FinishReason::Length
+                                                            : GenerationResult::FinishReason::Stop;
+        // keep the decoded tokens, as a prefix for later requests
+        slot.seq.responseCallback = nullptr;
+        slot.lastUsed = ++m_clock;
+
+        if (--request->running == 0)
+            finish(*request);
+    }
+}
+
+// Runs a job to completion on a model that does not support multiple sequences.
+void Scheduler::runDirect(Request &request)
+{
+    const auto &job = *request.job;
+    auto &result = request.result;
+    Metrics::globalInstance()->queueWait.observe(request.timer.elapsed() / 1000.0);
+
+    if (job.n > 1 && job.modelInfo.isOnline) {
+        result.error = u"'n' must be 1 with this model"_s;
+        finish(request);
+        return;
+    }
+
+    LLModel::PromptContext ctx = job.params;
+    ctx.deadline = generationDeadline(request);
+    // the timings of the context are reset by every call
+    quint64 contextShifts = 0;
+    auto promptFunc = [&result, &job](int32_t token) {
+        (void)token;
+        result.promptTokens++;
+        return !job.cancelled;
+    };
+    auto historyFunc = [&result, &job](int32_t token, const std::string &piece) {
+        (void)token;
+        (void)piece;
+        result.promptTokens++;
+        return !job.cancelled;
+    };
+    const std::string promptTemplate = job.promptTemplate.toStdString();
+
+    if (!job.systemPrompt.trimmed().isEmpty()) {
+        auto old_n_predict = std::exchange(ctx.n_predict, 0); // decode system prompt without a response
+        m_model->prompt(job.systemPrompt.toStdString(), "%1%2", promptFunc, historyFunc, /*allowContextShift*/ true,
+                        ctx, /*special*/ true);
+        contextShifts += ctx.timings.n_context_shift;
+        ctx.n_predict = old_n_predict;
+    }
+    for (const auto &[prompt, reply] : job.history) {
+        if (job.cancelled || ctx.deadlineExceeded)
+            break;
+        m_model->prompt(prompt.toStdString(), promptTemplate, promptFunc, historyFunc, /*allowContextShift*/ true,
+                        ctx, false, reply.toStdString());
+        contextShifts += ctx.timings.n_context_shift;
+    }
+    if (!job.docsContext.isEmpty() && !job.cancelled && !ctx.deadlineExceeded) {
+        auto old_n_predict = std::exchange(ctx.n_predict, 0); // decode localdocs context without a response
+        m_model->prompt(job.docsContext.toStdString(), "%1", promptFunc, historyFunc, /*allowContextShift*/ true,
+                        ctx);
+        contextShifts += ctx.timings.n_context_shift;
+        ctx.n_predict = old_n_predict;
+    }
+
+    result.responses      = QList<std::string>(job.n);
+    result.responseTokens = QList<int32_t>(job.n, 0);
+    result.finishReasons  = QList<GenerationResult::FinishReason>(job.n, GenerationResult::FinishReason::Stop);
+    auto choiceFunc = [&request, &result, &job](int32_t choice, int32_t token, const std::string &piece) {
+        if (token == -1) {
+            result.error = QString::fromStdString(piece);
+            return false;
+        }
+        if (!std::exchange(request.responded, true))
+            Metrics::globalInstance()->timeToFirstToken.observe(request.timer.elapsed() / 1000.0);
+        result.responses[choice] += piece;
+        result.responseTokens[choice]++;
+        return !job.cancelled && (!job.onResponse || job.onResponse(choice, piece));
+    };
+    if (!job.cancelled && !ctx.deadlineExceeded) {
+        m_model->promptChoices(job.prompt.toStdString(), promptTemplate, promptFunc, choiceFunc, job.n,
+                               /*allowContextShift*/ true, ctx);
+        contextShifts += ctx.timings.n_context_shift;
+    }
+    Metrics::globalInstance()->countContextShifts(contextShifts);
+
+    if (job.cancelled) {
+        result.error = u"The request was cancelled."_s;
+        Metrics::globalInstance()->countCancelled();
+    } else if (ctx.deadlineExceeded) {
+        result.timedOut = true;
+        Metrics::globalInstance()->countTimedOut();
+    }
+    for (int32_t i = 0; i < job.n; i++) {
+        if (result.timedOut || result.responseTokens[i] >= ctx.n_predict)
+            result.finishReasons[i] = GenerationResult::FinishReason::Length;
+    }
+    finish(request);
+}
+
+void Scheduler::finish(Request &request)
+{
+    auto &result = request.result;
+    result.elapsedMs = request.timer.elapsed();
+
+    auto *metrics = Metrics::globalInstance();
+    metrics->requestDuration.observe(result.elapsedMs / 1000.0);
+    if (!result.error) {
+        int32_t responseTokens = 0;
+        for (int32_t n : result.responseTokens)
+            responseTokens += n;
+        metrics->promptTokens.observe(result.promptTokens);
+        metrics->completionTokens.observe(responseTokens);
+    }
+
+    if (request.job->onFinished)
+        request.job->onFinished(result);
+}
+
+int32_t Scheduler::usedCells() const
+{
+    // cells shared by forked choices and cached prefixes are counted once per slot, which errs on the safe side
+    int32_t cells = 0;
+    for (const auto &slot : m_slots)
+        cells += slot.seq.ctx.n_past + int32_t(slot.seq.pending.size());
+    return cells;
+}
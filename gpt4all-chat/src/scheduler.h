@@ -0,0 +1,183 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "modellist.h"
+
+#include <gpt4all-backend/llmodel.h>
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QObject>
+#include <QPair>
+#include <QString>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+struct GenerationResult {
+    enum class FinishReason {
+        Stop,   // end of text, a stop sequence, or the client stopped it
+        Length, // max_tokens was reached or the context ran out
+    };
+
+    std::optional<QString> error;                    // set if the job failed
+    bool                   internalError = false;    // the error is not caused by the request
+    int32_t                promptTokens = 0; // tokens of the prompt, including the template
+    int32_t                cachedTokens = 0; // prompt tokens resumed from the prefix cache instead of decoded
+    QList<std::string>     responses;        // one per choice
+    QList<int32_t>         responseTokens;
+    QList<FinishReason>    finishReasons;
+    qint64                 elapsedMs = 0;
+    std::optional<quint64> responseCacheHits; // set if the response cache applies: times it was served from it
+    bool                   timedOut = false;  // the deadline cut the responses short, or with an error, passed
+                                              // before the job could start
+};
+
+// A request for one or more responses to a prompt, as submitted to the Scheduler.
+struct GenerationJob {
+    ModelInfo                      modelInfo;
+    QString                        systemPrompt;   // decoded first, if not empty
+    QList<QPair<QString, QString>> history;        // earlier prompt/response pairs of the conversation
+    QString                        docsContext;    // LocalDocs excerpts for the last prompt, if any
+    QString                        prompt;
+    QString                        promptTemplate;
+    int32_t                        n = 1;          // number of choices
+    LLModel::PromptContext         params;         // n_predict and sampling parameters
+    qint64                         timeoutMs = 0;  // deadline from submission, or 0 for none
+    std::atomic<bool>              cancelled = false; // set when the client goes away, to drop the job
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+
+    // Starts the deadline from timeoutMs when the job is first accepted, by the WorkerPool or the Scheduler.
+    void startDeadline()
+    {
+        if (timeoutMs > 0 && deadline == std::chrono::steady_clock::time_point::max())
+            deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    }
+
+    // Called on the scheduler's thread for each piece of a response. Returning false stops that choice.
+    std::function<bool(int32_t choice, const std::string &piece)> onResponse;
+    // Called on the scheduler's thread once the job is done, successfully or not.
+    std::function<void(const GenerationResult &result)> onFinished;
+};
+
+/*
+ * Continuous batching for the local API server. Each in-flight response occupies a slot, i.e. a sequence of the
+ * KV cache of the loaded model. Every step decodes the next token of all generating slots together with chunks of
+ * the prompts of newly admitted jobs in a single batch. Jobs from the queue are admitted between steps as soon as
+ * enough slots are free, and slots are retired independently when their response is done.
+ *
+ * Retired slots keep their tokens and KV cells as a prefix cache. A new request resumes from the longest prefix of
+ * its prompt held by any slot, so a conversation does not decode its whole history again on every turn. Cached
+ * prefixes are evicted, least recently used first, when the context runs out of room.
+ *
+ * Sequence 0 is left to ChatLLM, so the number of slots is limited to one less than the number of sequences the
+ * model supports. Models without multiple sequences run one job at a time through LLModel::prompt.
+ *
+ * Cancelled jobs and jobs past their deadline are dropped from the queue, and their slots are stopped before the next
+ * step. A job is also limited to maxGenerationMs from when it is admitted, which the model enforces while it decodes.
+ */
+class Scheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Returns the model for the job, loading it if necessary, or nullptr if it cannot be loaded. Only called while
+    // no slots are in use.
+    using ModelLoader = std::function<LLModel *(const ModelInfo &modelInfo)>;
+
+    struct PrefixCacheStats {
+        quint64 lookups     = 0; // admitted requests
+        quint64 hits        = 0; // requests that resumed from a cached prefix
+        quint64 tokensSaved = 0; // prompt tokens that did not have to be decoded
+
+        double hitRatio() const { return lookups ? double(hits) / double(lookups) : 0.0; }
+    };
+
+    // a maxGenerationMs of 0 does not limit how long a job runs
+    Scheduler(ModelLoader loader, int32_t maxSlots, qsizetype queueDepth, qint64 maxGenerationMs,
+              QObject *parent = nullptr);
+
+    // Queues a job. Returns false if the queue is full.
+    bool submit(std::shared_ptr<GenerationJob> job);
+
+    int32_t maxSlots() const { return m_maxSlots; }
+    int32_t activeSlots() const;
+    // the fraction of the context of the model held by the slots, including cached prefixes
+    double kvCacheUsage() const;
+    qsizetype queuedJobs() const { return m_queue.size(); }
+    qsizetype queueDepth() const { return m_queueDepth; }
+    const PrefixCacheStats &prefixCacheStats() const { return m_cacheStats; }
+
+public Q_SLOTS:
+    // Forgets the slots and their cached prefixes after the model was unloaded or replaced.
+    void resetModel();
+
+Q_SIGNALS:
+    // after every step, and whenever the statistics above change otherwise
+    void stepped();
+
+private Q_SLOTS:
+    void step();
+
+private:
+    struct Request {
+        std::shared_ptr<GenerationJob>       job;
+        GenerationResult                     result;
+        std::optional<LLModel::Sequence>     prepared;     // tokenized prompt, waiting for slots
+        int32_t                              running = 0;  // slots still generating a response
+        bool                                 responded = false; // the first token has been generated
+        QElapsedTimer                        timer;
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    };
+
+    struct Slot {
+        LLModel::Sequence        seq;
+        std::shared_ptr<Request> request;
+        int32_t                  choice  = 0;
+        bool                     waiting = false; // for the prompt of choice 0 to be decoded, to fork from it
+        bool                     truncated = false;
+        quint64                  lastUsed  = 0;   // when the cached prefix was last retired
+    };
+
+    void scheduleStep();
+    void dropExpired();
+    void stopCancelled();
+    std::chrono::steady_clock::time_point generationDeadline(const Request &request) const;
+    bool ensureModel(const ModelInfo &modelInfo);
+    bool prepare(Request &request);
+    void admit();
+    auto pickSlots(const LLModel::Sequence &prepared, int32_t n) -> std::tuple<std::vector<Slot *>, Slot *, int32_t>;
+    void evictCached(int32_t cells, const std::vector<Slot *> &keep, const Slot *source);
+    int32_t cachedCells(const std::vector<Slot *> &slots) const;
+    void forkChoices();
+    void makeRoom();
+    void retire();
+    void runDirect(Request &request);
+    void finish(Request &request);
+    int32_t usedCells() const;
+
+    ModelLoader                          m_loader;
+    int32_t                              m_maxSlots;
+    qsizetype                            m_queueDepth;
+    qint64                               m_maxGenerationMs;
+    LLModel                             *m_model = nullptr;
+    std::optional<ModelInfo>             m_modelInfo;
+    int32_t                              m_nBatch = LLMODEL_MAX_PROMPT_BATCH;
+    int32_t                              m_nCtx = 0;
+    std::vector<Slot>                    m_slots;
+    std::deque<std::shared_ptr<Request>> m_queue;
+    bool                                 m_stepQueued = false;
+    quint64                              m_clock = 0;
+    PrefixCacheStats                     m_cacheStats;
+    LLModel::Timings                     m_timings;  // accumulated over all steps
+};
+
+#endif // SCHEDULER_H
@@ -1,8 +1,12 @@
 #include "server.h"
 
-#include "chat.h"
+#include "batchmanager.h"
+#include "embeddingbatcher.h"
+#include "embllm.h"
+#include "metrics.h"
 #include "modellist.h"
 #include "mysettings.h"
+#include "unixsocketserver.h"
 
 #include <fmt/base.h>
 #include <fmt/format.h>
@@ -13,6 +17,8 @@
 #include <QCborValue>
 #include <QDateTime>
 #include <QDebug>
+#include <QDir>
+#include <QFile>
 #include <QHostAddress>
 #include <QHttpServer>
 #include <QHttpServerResponder>
@@ -21,18 +27,29 @@
 #include <QJsonObject>
 #include <QJsonValue>
 #include <QLatin1StringView>
+#include <QMetaObject>
 #include <QPair>
+#include <QPointer>
+#include <QStringList>
+#include <QTcpSocket>
 #include <QVariant>
 #include <Qt>
 #include <QtCborCommon>
+#include <QtGlobal>
 #include <QtLogging>
 
+#if QT_VERSION >= QT_VERSION_CHECK(6, 8, 0)
+#   include <QHttpHeaders>
+#endif
+
 #include <algorithm>
 #include <cstdint>
 #include <iostream>
+#include <memory>
 #include <optional>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <unordered_map>
 #include <utility>
@@ -124,7 +141,75 @@ static inline QJsonObject resultToJson(const ResultInfo &info)
     return result;
 }
 
-class BaseCompletionRequest {
+class BaseRequest {
+public:
+    BaseRequest() = default;
+    virtual ~BaseRequest() = default;
+
+    virtual BaseRequest &parse(QCborMap request)
+    {
+        parseImpl(request);
+        if (!request.isEmpty())
+            throw InvalidRequestError(fmt::format(
+                "Unrecognized request argument supplied: {}", request.keys().constFirst().toString()
+            ));
+        return *this;
+    }
+
+protected:
+    virtual void parseImpl(QCborMap &request) = 0;
+
+    enum class Type : uint8_t {
+        Boolean,
+        Integer,
+        Number,
+        String,
+        Array,
+        Object,
+    };
+
+    static const std::unordered_map<Type, const char *> s_typeNames;
+
+    static bool typeMatches(const QCborValue &value, Type type) noexcept {
+        using enum Type;
+        switch (type) {
+            case Boolean: return value.isBool();
+            case Integer: return value.isInteger();
+            case Number:  return value.isInteger() || value.isDouble();
+            case String:  return value.isString();
+            case Array:   return value.isArray();
+            case Object:  return value.isMap();
+        }
+        Q_UNREACHABLE();
+    }
+
+    static QCborValue takeValue(
+        QCborMap &obj, const char *key, std::optional<Type> type = {}, bool required = false,
+        std::optional<qint64> min = {}, std::optional<qint64> max = {}
+    ) {
+        auto value = obj.take(QLatin1StringView(key));
+        if (value.isUndefined())
+            value = QCborValue(QCborSimpleType::Null);
+        if (required && value.isNull())
+            throw InvalidRequestError(fmt::format("you must provide a {} parameter", key));
+        if (type && !value.isNull() && !typeMatches(value, *type))
+            throw InvalidRequestError(fmt::format("'{}' is not of type '{}' - '{}'",
+                                                  value.toVariant(), s_typeNames.at(*type), key));
+        if (!value.isNull()) {
+            double num = value.toDouble();
+            if (min && num < double(*min))
+                throw InvalidRequestError(fmt::format("{} is less than the minimum of {} - '{}'", num, *min, key));
+            if (max && num > double(*max))
+                throw InvalidRequestError(fmt::format("{} is greater than the maximum of {} - '{}'", num, *max, key));
+        }
+        return value;
+    }
+
+private:
+    Q_DISABLE_COPY_MOVE(BaseRequest)
+};
+
+class BaseCompletionRequest : public BaseRequest {
 public:
     QString model; // required
     // NB: some parameters are not supported yet
@@ -133,22 +218,18 @@ public:
     float temperature = 1.f;
     float top_p = 1.f;
     float min_p = 0.f;
+    bool stream = false;
+    bool include_usage = false; // stream_options.include_usage
+    qint64 timeoutMs = 0; // timeout, in seconds in the request, or the X-Request-Timeout header
 
-    BaseCompletionRequest() = default;
-    virtual ~BaseCompletionRequest() = default;
-
-    virtual BaseCompletionRequest &parse(QCborMap request)
+    BaseCompletionRequest &parse(QCborMap request) override
     {
-        parseImpl(request);
-        if (!request.isEmpty())
-            throw InvalidRequestError(fmt::format(
-                "Unrecognized request argument supplied: {}", request.keys().constFirst().toString()
-            ));
+        BaseRequest::parse(std::move(request));
         return *this;
     }
 
 protected:
-    virtual void parseImpl(QCborMap &request)
+    void parseImpl(QCborMap &request) override
     {
         using enum Type;
 
@@ -182,17 +263,34 @@ protected:
             throw InvalidRequestError("'stop' is not supported");
 
         value = reqValue("stream", Boolean);
-        if (value.isTrue())
-            throw InvalidRequestError("'stream' is not supported");
+        if (value.isBool())
+            this->stream = value.toBool();
 
         value = reqValue("stream_options", Object);
-        if (!value.isNull())
-            throw InvalidRequestError("'stream_options' is not supported");
+        if (!value.isNull()) {
+            if (!this->stream)
+                throw InvalidRequestError("The 'stream_options' parameter is only allowed when 'stream' is enabled.");
+            QCborMap options = value.toMap();
+            QCborValue usage = takeValue(options, "include_usage", Boolean);
+            if (usage.isBool())
+                this->include_usage = usage.toBool();
+            if (!options.isEmpty())
+                throw InvalidRequestError(fmt::format(
+                    "Unrecognized stream_options argument supplied: {}", options.keys().constFirst().toString()
+                ));
+        }
 
         value = reqValue("temperature", Number, false, /*min*/ 0, /*max*/ 2);
         if (!value.isNull())
             this->temperature = float(value.toDouble());
 
+        value = reqValue("timeout", Number, false, /*min*/ 0);
+        if (!value.isNull()) {
+            if (value.toDouble() <= 0)
+                throw InvalidRequestError("'timeout' must be greater than 0");
+            this->timeoutMs = qMax(qint64(value.toDouble() * 1000), qint64(1));
+        }
+
         value = reqValue("top_p", Number, /*min*/ 0, /*max*/ 1);
         if (!value.isNull())
             this->top_p = float(value.toDouble());
@@ -203,55 +301,6 @@ protected:
 
         reqValue("user", String); // validate but don't use
     }
-
-    enum class Type : uint8_t {
-        Boolean,
-        Integer,
-        Number,
-        String,
-        Array,
-        Object,
-    };
-
-    static const std::unordered_map<Type, const char *> s_typeNames;
-
-    static bool typeMatches(const QCborValue &value, Type type) noexcept {
-        using enum Type;
-        switch (type) {
-            case Boolean: return value.isBool();
-            case Integer: return value.isInteger();
-            case Number:  return value.isInteger() || value.isDouble();
-            case String:  return value.isString();
-            case Array:   return value.isArray();
-            case Object:  return value.isMap();
-        }
-        Q_UNREACHABLE();
-    }
-
-    static QCborValue takeValue(
-        QCborMap &obj, const char *key, std::optional<Type> type = {}, bool required = false,
-        std::optional<qint64> min = {}, std::optional<qint64> max = {}
-    ) {
-        auto value = obj.take(QLatin1StringView(key));
-        if (value.isUndefined())
-            value = QCborValue(QCborSimpleType::Null);
-        if (required && value.isNull())
-            throw InvalidRequestError(fmt::format("you must provide a {} parameter", key));
-        if (type && !value.isNull() && !typeMatches(value, *type))
-            throw InvalidRequestError(fmt::format("'{}' is not of type '{}' - '{}'",
-                                                  value.toVariant(), s_typeNames.at(*type), key));
-        if (!value.isNull()) {
-            double num = value.toDouble();
-            if (min && num < double(*min))
-                throw InvalidRequestError(fmt::format("{} is less than the minimum of {} - '{}'", num, *min, key));
-            if (max && num > double(*max))
-                throw InvalidRequestError(fmt::format("{} is greater than the maximum of {} - '{}'", num, *max, key));
-        }
-        return value;
-    }
-
-private:
-    Q_DISABLE_COPY_MOVE(BaseCompletionRequest)
 };
 
 class CompletionRequest : public BaseCompletionRequest {
@@ -311,13 +360,13 @@ protected:
     }
 };
 
-const std::unordered_map<BaseCompletionRequest::Type, const char *> BaseCompletionRequest::s_typeNames = {
-    { BaseCompletionRequest::Type::Boolean, "boolean" },
-    { BaseCompletionRequest::Type::Integer, "integer" },
-    { BaseCompletionRequest::Type::Number,  "number"  },
-    { BaseCompletionRequest::Type::String,  "string"  },
-    { BaseCompletionRequest::Type::Array,   "array"   },
-    { BaseCompletionRequest::Type::Object,  "object"  },
+const std::unordered_map<BaseRequest::Type, const char *> BaseRequest::s_typeNames = {
+    { BaseRequest::Type::Boolean, "boolean" },
+    { BaseRequest::Type::Integer, "integer" },
+    { BaseRequest::Type::Number,  "number"  },
+    { BaseRequest::Type::String,  "string"  },
+    { BaseRequest::Type::Array,   "array"   },
+    { BaseRequest::Type::Object,  "object"  },
 };
 
 class ChatRequest : public BaseCompletionRequest {
@@ -439,6 +488,116 @@ protected:
     }
 };
 
+class EmbeddingRequest : public BaseRequest {
+public:
+    static constexpr qsizetype MAX_INPUTS = 2048;
+
+    QString model; // required
+    QStringList input; // required
+    int dimensions = -1; // the full size of the model
+    bool base64 = false; // encoding_format
+
+    EmbeddingRequest &parse(QCborMap request) override
+    {
+        BaseRequest::parse(std::move(request));
+        return *this;
+    }
+
+protected:
+    void parseImpl(QCborMap &request) override
+    {
+        using enum Type;
+
+        auto reqValue = [&request](auto &&...args) { return takeValue(request, args...); };
+        QCborValue value;
+
+        this->model = reqValue("model", String, /*required*/ true).toString();
+
+        value = reqValue("input", std::nullopt, /*required*/ true);
+        this->input.clear();
+        if (value.isString()) {
+            this->input.append(value.toString());
+        } else if (value.isArray()) {
+            QCborArray arr = value.toArray();
+            for (qsizetype i = 0; i < arr.size(); i++) {
+                if (!arr[i].isString())
+                    throw InvalidRequestError(fmt::format(
+                        "Invalid type for 'input[{}]': expected a string, but got '{}' instead. Token arrays are not "
+                        "supported.", i, arr[i].toVariant()
+                    ));
+                this->input.append(arr[i].toString());
+            }
+        } else {
+            throw InvalidRequestError(fmt::format(
+                "Invalid type for 'input': expected a string or an array of strings, but got '{}' instead.",
+                value.toVariant()
+            ));
+        }
+        if (this->input.isEmpty() || this->input.size() > MAX_INPUTS)
+            throw InvalidRequestError(fmt::format(
+                "'input' must contain between 1 and {} strings, but got {}.", MAX_INPUTS, this->input.size()
+            ));
+        for (qsizetype i = 0; i < this->input.size(); i++) {
+            if (this->input[i].isEmpty())
+                throw InvalidRequestError(fmt::format("'input[{}]' must not be empty.", i));
+        }
+
+        value = reqValue("dimensions", Integer, false, /*min*/ 1);
+        if (!value.isNull())
+            this->dimensions = int(qMin(value.toInteger(), INT32_MAX));
+
+        value = reqValue("encoding_format", String);
+        if (!value.isNull()) {
+            QString format = value.toString();
+            if (format != u"float"_s && format != u"base64"_s)
+                throw InvalidRequestError(fmt::format(
+                    "'{}' is not one of ['float', 'base64'] - 'encoding_format'", format
+                ));
+            this->base64 = format == u"base64"_s;
+        }
+
+        reqValue("user", String); // validate but don't use
+    }
+};
+
+class BatchRequest : public BaseRequest {
+public:
+    QString input_file; // required
+
+    BatchRequest &parse(QCborMap request) override
+    {
+        BaseRequest::parse(std::move(request));
+        return *this;
+    }
+
+protected:
+    void parseImpl(QCborMap &request) override
+    {
+        using enum Type;
+
+        auto reqValue = [&request](auto &&...args) { return takeValue(request, args...); };
+        QCborValue value;
+
+        // the name of a file in the input directory of the batches, so that a request can only read what the user
+        // put there
+        this->input_file = reqValue("input_file", String, /*required*/ true).toString();
+        if (this->input_file.isEmpty() || this->input_file == u"."_s || this->input_file == u".."_s
+            || this->input_file.contains(u'/') || this->input_file.contains(u'\\'))
+            throw InvalidRequestError(fmt::format(
+                "'input_file' must be the name of a file in {}", BatchManager::inputDirectory()
+            ));
+
+        value = reqValue("endpoint", String);
+        if (!value.isNull() && value.toString() != u"/v1/completions"_s)
+            throw InvalidRequestError(fmt::format(
+                "'{}' is not one of ['/v1/completions'] - 'endpoint'", value.toString()
+            ));
+
+        reqValue("completion_window", String); // validate but don't use
+        reqValue("metadata", Object);          // validate but don't use
+    }
+};
+
 template <typename T>
 T &parseRequest(T &request, QJsonObject &&obj)
 {
@@ -446,14 +605,230 @@ T &parseRequest(T &request, QJsonObject &&obj)
     return request.parse(QCborMap::fromJsonObject(obj));
 }
 
-Server::Server(Chat *chat)
-    : ChatLLM(chat, true /*isServer*/)
-    , m_chat(chat)
+Server::Server(const QString &id, bool headless, std::unique_ptr<LLModel> standInModel)
+    : ChatLLM(id, true /*isServer*/)
+    , m_headless(headless)
+    , m_standInModel(std::move(standInModel))
     , m_server(nullptr)
 {
+    if (m_standInModel) {
+        // NB: not installed, so that the settings of the model are not saved
+        m_standInInfo.setId(u"stand-in"_s);
+        m_standInInfo.setName(u"Stand-in"_s);
+        m_standInInfo.setFilename(u"stand-in"_s);
+        m_standInInfo.setPromptTemplate(u"%1"_s);
+        m_standInInfo.setContextLength(m_standInModel->contextLength());
+    }
     connect(this, &Server::threadStarted, this, &Server::start);
-    connect(this, &Server::databaseResultsChanged, this, &Server::handleDatabaseResultsChanged);
-    connect(chat, &Chat::collectionListChanged, this, &Server::handleCollectionListChanged, Qt::QueuedConnection);
+}
+
+bool Server::isEnabled() const
+{
+    // the headless server exists only to serve the API
+    return m_headless || MySettings::globalInstance()->serverChat();
+}
+
+static QHttpServerResponse errorResponse(const QString &message, const QString &type,
+                                         QHttpServerResponder::StatusCode status)
+{
+    QJsonObject error {
+        { "message", message          },
+        { "type",    type             },
+        { "param",   QJsonValue::Null },
+        { "code",    QJsonValue::Null },
+    };
+    return { QJsonObject {{ "error", error }}, status };
+}
+
+static QHttpServerResponse batchNotFound(const QString &id)
+{
+    return errorResponse(u"No batch found with id '%1'."_s.arg(id), u"invalid_request_error"_s,
+                         QHttpServerResponder::StatusCode::NotFound);
+}
+
+// Routes that reply through a QHttpServerResponder bypass the afterRequest hook, so do its work here.
+static void sendResponse(QHttpServerResponder &responder, QHttpServerResponse &&resp)
+{
+    resp.addHeader("Access-Control-Allow-Origin", "*");
+#if QT_VERSION >= QT_VERSION_CHECK(6, 8, 0)
+    responder.sendResponse(resp);
+#else
+    resp.write(std::move(responder));
+#endif
+}
+
+// Returns the length of the longest prefix of str that does not end in an incomplete UTF-8 sequence.
+static size_t completeUtf8Length(std::string_view str)
+{
+    // the lead byte of the last sequence is at most 3 bytes from the end
+    for (size_t i = 1; i <= std::min<size_t>(3, str.size()); i++) {
+        auto c = uint8_t(str[str.size() - i]);
+        if ((c & 0xC0) == 0x80)
+            continue; // continuation byte
+        size_t len = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        return len > i ? str.size() - i : str.size();
+    }
+    return str.size();
+}
+
+namespace {
+
+// The Server-Sent Events of a request with 'stream' enabled. The status line and headers are only written with the
+// first event, so a request that fails before generating anything still gets a regular error response.
+//
+// The events are sent with chunked transfer encoding. Qt 6.8 frames the chunks itself; before it, the responder can
+// only write a body of known length, so the framing is written to its socket directly.
+class EventStream {
+public:
+    struct Choice {
+        std::string pending;         // bytes of a UTF-8 sequence that is not complete yet
+        bool        started = false; // the first chunk of the choice was sent
+    };
+
+    EventStream(std::shared_ptr<QHttpServerResponder> responder, int32_t n)
+        : m_responder(std::move(responder))
+#if QT_VERSION < QT_VERSION_CHECK(6, 8, 0)
+        , m_socket(m_responder->socket())
+#endif
+        , m_choices(n)
+    {}
+
+    // false once the client has disconnected, which stops the generation
+    bool isOpen() const
+    {
+        if (m_closed)
+            return false;
+#if QT_VERSION < QT_VERSION_CHECK(6, 8, 0)
+        return m_socket && m_socket->state() == QAbstractSocket::ConnectedState;
+#else
+        // NB: the responder no longer exposes its socket, so only the deadline of the request stops it
+        return true;
+#endif
+    }
+    bool isStarted() const { return m_started; }
+
+    Choice &choice(int32_t i) { return m_choices[i]; }
+
+    // Appends a piece of the response of a choice and returns the text that is ready to be sent.
+    QString takeText(int32_t i, std::string_view piece, bool flush = false)
+    {
+        auto &pending = m_choices[i].pending;
+        pending += piece;
+        size_t len = flush ? pending.size() : completeUtf8Length(pending);
+        QString text = QString::fromUtf8(pending.data(), qsizetype(len));
+        pending.erase(0, len);
+        return text;
+    }
+
+    void send(const QJsonObject &event)
+    {
+        write("data: " + QJsonDocument(event).toJson(QJsonDocument::Compact) + "\n\n");
+    }
+
+    void close()
+    {
+        if (!isOpen())
+            return;
+        begin();
+        static const QByteArray done = "data: [DONE]\n\n";
+#if QT_VERSION < QT_VERSION_CHECK(6, 8, 0)
+        m_socket->write(frame(done) + "0\r\n\r\n");
+        m_socket->flush();
+#else
+        m_responder->writeEndChunked(done);
+#endif
+        m_closed = true;
+    }
+
+private:
+    // Writes the status line and headers before the first event.
+    void begin()
+    {
+        if (std::exchange(m_started, true))
+            return;
+#if QT_VERSION < QT_VERSION_CHECK(6, 8, 0)
+        m_responder->writeStatusLine(QHttpServerResponder::StatusCode::Ok);
+        m_responder->writeHeader("Content-Type", "text/event-stream");
+        m_responder->writeHeader("Cache-Control", "no-cache");
+        m_responder->writeHeader("Transfer-Encoding", "chunked");
+        m_responder->writeHeader("Access-Control-Allow-Origin", "*");
+        m_socket->write("\r\n"); // the end of the headers
+#else
+        QHttpHeaders headers;
+        headers.append(QHttpHeaders::WellKnownHeader::ContentType, "text/event-stream");
+        headers.append(QHttpHeaders::WellKnownHeader::CacheControl, "no-cache");
+        headers.append(QHttpHeaders::WellKnownHeader::AccessControlAllowOrigin, "*");
+        m_responder->writeBeginChunked(headers);
+#endif
+    }
+
+    void write(const QByteArray &data)
+    {
+        if (!isOpen())
+            return;
+        begin();
+#if QT_VERSION < QT_VERSION_CHECK(6, 8, 0)
+        m_socket->write(frame(data));
+        m_socket->flush();
+#else
+        m_responder->writeChunk(data);
+#endif
+    }
+
+#if QT_VERSION < QT_VERSION_CHECK(6, 8, 0)
+    static QByteArray frame(const QByteArray &data)
+    {
+        return QByteArray::number(data.size(), 16) + "\r\n" + data + "\r\n";
+    }
+#endif
+
+    std::shared_ptr<QHttpServerResponder> m_responder;
+#if QT_VERSION < QT_VERSION_CHECK(6, 8, 0)
+    QPointer<QTcpSocket>                  m_socket;
+#endif
+    std::vector<Choice>                   m_choices;
+    bool                                  m_started = false;
+    bool                                  m_closed  = false; // the last chunk was written
+};
+
+} // namespace
+
+// The X-Request-Timeout header limits a generation request like its 'timeout' field, and the shorter of both applies.
+static void applyTimeoutHeader(const QHttpServerRequest &request, BaseCompletionRequest &parsed)
+{
+    const QByteArray header = request.value("X-Request-Timeout");
+    if (header.isEmpty())
+        return;
+    bool ok;
+    double secs = header.trimmed().toDouble(&ok);
+    if (!ok || secs <= 0)
+        throw InvalidRequestError("The X-Request-Timeout header must be a number of seconds greater than 0.");
+    qint64 ms = qMax(qint64(secs * 1000), qint64(1));
+    parsed.timeoutMs = parsed.timeoutMs ? qMin(parsed.timeoutMs, ms) : ms;
+}
+
+// Cancels a job when the client disconnects, which frees its slots or takes it off the queue.
+static void cancelOnDisconnect(const std::shared_ptr<GenerationJob> &job, QHttpServerResponder &responder)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 8, 0)
+    // NB: the responder no longer exposes its socket, so only the deadline of the request stops it
+    Q_UNUSED(job)
+    Q_UNUSED(responder)
+#else
+    QTcpSocket *socket = responder.socket();
+    if (!socket)
+        return;
+    auto connection = QObject::connect(socket, &QAbstractSocket::disconnected, socket,
+        [weakJob = std::weak_ptr<GenerationJob>(job)] {
+            if (auto job = weakJob.lock())
+                job->cancelled = true;
+        });
+    // the connection may outlive the request with keep-alive
+    job->onFinished = [connection, onFinished = std::move(job->onFinished)](const GenerationResult &result) {
+        QObject::disconnect(connection);
+        onFinished(result);
+    };
+#endif
 }
 
 static QJsonObject requestFromJson(const QByteArray &request)
@@ -476,9 +851,20 @@ void Server::start()
         return;
     }
 
+    // the same routes on a Unix domain socket, for clients on this machine that want to skip TCP
+    const QString socketPath = MySettings::globalInstance()->serverSocketPath();
+    if (!socketPath.isEmpty()) {
+        auto *socketServer = new UnixSocketServer;
+        if (socketServer->listenOnPath(socketPath))
+            m_server->bind(socketServer); // takes ownership
+        else
+            delete socketServer;
+    }
+
     m_server->route("/v1/models", QHttpServerRequest::Method::Get,
-        [](const QHttpServerRequest &) {
-            if (!MySettings::globalInstance()->serverChat())
+        [this](const QHttpServerRequest &) {
+            Metrics::globalInstance()->countRequest(Metrics::Route::Models);
+            if (!isEnabled())
                 return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
 
             const QList<ModelInfo> modelList = ModelList::globalInstance()->selectableModelList();
@@ -497,8 +883,9 @@ void Server::start()
     );
 
     m_server->route("/v1/models/<arg>", QHttpServerRequest::Method::Get,
-        [](const QString &model, const QHttpServerRequest &) {
-            if (!MySettings::globalInstance()->serverChat())
+        [this](const QString &model, const QHttpServerRequest &) {
+            Metrics::globalInstance()->countRequest(Metrics::Route::Model);
+            if (!isEnabled())
                 return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
 
             const QList<ModelInfo> modelList = ModelList::globalInstance()->selectableModelList();
@@ -518,9 +905,13 @@ void Server::start()
     );
 
     m_server->route("/v1/completions", QHttpServerRequest::Method::Post,
-        [this](const QHttpServerRequest &request) {
-            if (!MySettings::globalInstance()->serverChat())
-                return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
+        [this](const QHttpServerRequest &request, QHttpServerResponder &&responder) {
+            Metrics::globalInstance()->countRequest(Metrics::Route::Completions);
+            auto resp = std::make_shared<QHttpServerResponder>(std::move(responder));
+            if (!isEnabled()) {
+                sendResponse(*resp, QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized));
+                return;
+            }
 
             try {
                 auto reqObj = requestFromJson(request.body());
@@ -529,22 +920,22 @@ void Server::start()
 #endif
                 CompletionRequest req;
                 parseRequest(req, std::move(reqObj));
-                auto [resp, respObj] = handleCompletionRequest(req);
-#if defined(DEBUG)
-                if (respObj)
-                    qDebug().noquote() << "/v1/completions reply" << QJsonDocument(*respObj).toJson(QJsonDocument::Indented);
-#endif
-                return std::move(resp);
+                applyTimeoutHeader(request, req);
+                handleCompletionRequest(req, resp);
             } catch (const InvalidRequestError &e) {
-                return e.asResponse();
+                sendResponse(*resp, e.asResponse());
             }
         }
     );
 
     m_server->route("/v1/chat/completions", QHttpServerRequest::Method::Post,
-        [this](const QHttpServerRequest &request) {
-            if (!MySettings::globalInstance()->serverChat())
-                return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
+        [this](const QHttpServerRequest &request, QHttpServerResponder &&responder) {
+            Metrics::globalInstance()->countRequest(Metrics::Route::ChatCompletions);
+            auto resp = std::make_shared<QHttpServerResponder>(std::move(responder));
+            if (!isEnabled()) {
+                sendResponse(*resp, QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized));
+                return;
+            }
 
             try {
                 auto reqObj = requestFromJson(request.body());
@@ -553,23 +944,136 @@ void Server::start()
 #endif
                 ChatRequest req;
                 parseRequest(req, std::move(reqObj));
-                auto [resp, respObj] = handleChatRequest(req);
-                (void)respObj;
-#if defined(DEBUG)
-                if (respObj)
-                    qDebug().noquote() << "/v1/chat/completions reply" << QJsonDocument(*respObj).toJson(QJsonDocument::Indented);
-#endif
-                return std::move(resp);
+                applyTimeoutHeader(request, req);
+                handleChatRequest(req, resp);
+            } catch (const InvalidRequestError &e) {
+                sendResponse(*resp, e.asResponse());
+            }
+        }
+    );
+
+    m_server->route("/v1/embeddings", QHttpServerRequest::Method::Post,
+        [this](const QHttpServerRequest &request, QHttpServerResponder &&responder) {
+            Metrics::globalInstance()->countRequest(Metrics::Route::Embeddings);
+            auto resp = std::make_shared<QHttpServerResponder>(std::move(responder));
+            if (!isEnabled()) {
+                sendResponse(*resp, QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized));
+                return;
+            }
+
+            try {
+                auto reqObj = requestFromJson(request.body());
+                EmbeddingRequest req;
+                parseRequest(req, std::move(reqObj));
+                handleEmbeddingsRequest(req, resp);
+            } catch (const InvalidRequestError &e) {
+                sendResponse(*resp, e.asResponse());
+            }
+        }
+    );
+
+    m_server->route("/v1/batches", QHttpServerRequest::Method::Post,
+        [this](const QHttpServerRequest &request) {
+            Metrics::globalInstance()->countRequest(Metrics::Route::Batches);
+            if (!isEnabled())
+                return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
+
+            try {
+                return createBatch(request);
             } catch (const InvalidRequestError &e) {
                 return e.asResponse();
             }
         }
     );
 
+    m_server->route("/v1/batches", QHttpServerRequest::Method::Get,
+        [this](const QHttpServerRequest &) {
+            Metrics::globalInstance()->countRequest(Metrics::Route::Batches);
+            if (!isEnabled())
+                return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
+
+            QJsonArray data;
+            for (const auto &batch : m_batches->list())
+                data.append(batch);
+            return QHttpServerResponse(QJsonObject {
+                { "object", "list" },
+                { "data",   data   },
+            });
+        }
+    );
+
+    m_server->route("/v1/batches/<arg>", QHttpServerRequest::Method::Get,
+        [this](const QString &id, const QHttpServerRequest &) {
+            Metrics::globalInstance()->countRequest(Metrics::Route::Batches);
+            if (!isEnabled())
+                return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
+
+            if (auto batch = m_batches->status(id))
+                return QHttpServerResponse(*batch);
+            return batchNotFound(id);
+        }
+    );
+
+    m_server->route("/v1/batches/<arg>/cancel", QHttpServerRequest::Method::Post,
+        [this](const QString &id, const QHttpServerRequest &) {
+            Metrics::globalInstance()->countRequest(Metrics::Route::Batches);
+            if (!isEnabled())
+                return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
+
+            if (auto batch = m_batches->cancel(id))
+                return QHttpServerResponse(*batch);
+            return batchNotFound(id);
+        }
+    );
+
+    // the results written so far, as JSONL
+    m_server->route("/v1/batches/<arg>/output", QHttpServerRequest::Method::Get,
+        [this](const QString &id, const QHttpServerRequest &) {
+            Metrics::globalInstance()->countRequest(Metrics::Route::Batches);
+            if (!isEnabled())
+                return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
+
+            if (auto output = m_batches->output(id))
+                return QHttpServerResponse("application/jsonl"_ba, *output);
+            return batchNotFound(id);
+        }
+    );
+
+    // Prometheus text format
+    m_server->route("/metrics", QHttpServerRequest::Method::Get,
+        [this](const QHttpServerRequest &) {
+            Metrics::globalInstance()->countRequest(Metrics::Route::Metrics);
+            if (!isEnabled())
+                return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
+
+            QByteArray body = Metrics::globalInstance()->exposition();
+            const auto stats = m_workers->stats();
+            const auto &cacheStats = stats.prefixCache;
+            Metrics::writeGauge(body, "gpt4all_loaded_models", "Models loaded to serve generation requests.",
+                                stats.loadedModels);
+            Metrics::writeGauge(body, "gpt4all_queue_depth", "Generation requests waiting for a slot.",
+                                double(stats.queuedJobs));
+            Metrics::writeGauge(body, "gpt4all_active_slots", "Slots generating a response.", stats.activeSlots);
+            Metrics::writeGauge(body, "gpt4all_max_slots", "Slots of the loaded models.", stats.maxSlots);
+            Metrics::writeGauge(body, "gpt4all_kv_cache_usage_ratio",
+                                "Fraction of the fullest context of the loaded models held by the slots, including cached prefixes.",
+                                stats.kvCacheUsage);
+            Metrics::writeCounter(body, "gpt4all_prefix_cache_lookups_total",
+                                  "Generation requests admitted to a slot.", double(cacheStats.lookups));
+            Metrics::writeCounter(body, "gpt4all_prefix_cache_hits_total",
+                                  "Generation requests that resumed from a cached prefix.", double(cacheStats.hits));
+            Metrics::writeCounter(body, "gpt4all_prefix_cache_saved_tokens_total",
+                                  "Prompt tokens resumed from the prefix cache instead of decoded.",
+                                  double(cacheStats.tokensSaved));
+            return QHttpServerResponse("text/plain; version=0.0.4; charset=utf-8"_ba, body);
+        }
+    );
+
     // Respond with code 405 to wrong HTTP methods:
     m_server->route("/v1/models",  QHttpServerRequest::Method::Post,
-        [] {
-            if (!MySettings::globalInstance()->serverChat())
+        [this] {
+            Metrics::globalInstance()->countRequest(Metrics::Route::Models);
+            if (!isEnabled())
                 return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
             return QHttpServerResponse(
                 QJsonDocument::fromJson("{\"error\": {\"message\": \"Not allowed to POST on /v1/models."
@@ -580,9 +1084,10 @@ void Server::start()
     );
 
     m_server->route("/v1/models/<arg>", QHttpServerRequest::Method::Post,
-        [](const QString &model) {
+        [this](const QString &model) {
+            Metrics::globalInstance()->countRequest(Metrics::Route::Model);
             (void)model;
-            if (!MySettings::globalInstance()->serverChat())
+            if (!isEnabled())
                 return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
             return QHttpServerResponse(
                 QJsonDocument::fromJson("{\"error\": {\"message\": \"Not allowed to POST on /v1/models/*."
@@ -593,8 +1098,9 @@ void Server::start()
     );
 
     m_server->route("/v1/completions", QHttpServerRequest::Method::Get,
-        [] {
-            if (!MySettings::globalInstance()->serverChat())
+        [this] {
+            Metrics::globalInstance()->countRequest(Metrics::Route::Completions);
+            if (!isEnabled())
                 return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
             return QHttpServerResponse(
                 QJsonDocument::fromJson("{\"error\": {\"message\": \"Only POST requests are accepted.\","
@@ -604,8 +1110,21 @@ void Server::start()
     );
 
     m_server->route("/v1/chat/completions", QHttpServerRequest::Method::Get,
-        [] {
-            if (!MySettings::globalInstance()->serverChat())
+        [this] {
+            Metrics::globalInstance()->countRequest(Metrics::Route::ChatCompletions);
+            if (!isEnabled())
+                return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
+            return QHttpServerResponse(
+                QJsonDocument::fromJson("{\"error\": {\"message\": \"Only POST requests are accepted.\","
+                    " \"type\": \"invalid_request_error\", \"param\": null, \"code\": \"method_not_supported\"}}").object(),
+                QHttpServerResponder::StatusCode::MethodNotAllowed);
+        }
+    );
+
+    m_server->route("/v1/embeddings", QHttpServerRequest::Method::Get,
+        [this] {
+            Metrics::globalInstance()->countRequest(Metrics::Route::Embeddings);
+            if (!isEnabled())
                 return QHttpServerResponse(QHttpServerResponder::StatusCode::Unauthorized);
             return QHttpServerResponse(
                 QJsonDocument::fromJson("{\"error\": {\"message\": \"Only POST requests are accepted.\","
@@ -619,17 +1138,74 @@ void Server::start()
         return std::move(resp);
     });
 
-    connect(this, &Server::requestServerNewPromptResponsePair, m_chat,
-        &Chat::serverNewPromptResponsePair, Qt::BlockingQueuedConnection);
+    m_workers = new WorkerPool(
+        m_standInModel.get(),
+        MySettings::globalInstance()->serverMaxSlots(),
+        MySettings::globalInstance()->serverQueueDepth(),
+        qint64(MySettings::globalInstance()->serverMaxGenerationTime()) * 1000,
+        qint64(MySettings::globalInstance()->serverModelMemory()) << 30,
+        this
+    );
+
+    m_batches = new BatchManager(m_workers, [this](const QJsonObject &body) { return prepareBatchRequest(body); },
+                                 this);
+    m_responseCache = std::make_unique<ResponseCache>(MySettings::globalInstance()->serverResponseCacheSize(),
+                                                      MySettings::globalInstance()->serverResponseCacheTtl());
+
+    m_embeddings = std::make_unique<EmbeddingBatcher>();
 }
 
-static auto makeError(auto &&...args) -> std::pair<QHttpServerResponse, std::optional<QJsonObject>>
+// adds a finished prompt/response pair to the GUI
+void Server::showInChat(const QString &prompt, const QString &response, qint64 elapsedMs)
 {
-    return {QHttpServerResponse(args...), std::nullopt};
+    if (m_headless)
+        return;
+    emit requestServerNewPromptResponsePair(prompt); // blocks
+    emit responseChanged(response);
+    emit responseStopped(elapsedMs);
 }
 
-auto Server::handleCompletionRequest(const CompletionRequest &request)
-    -> std::pair<QHttpServerResponse, std::optional<QJsonObject>>
+// Answers a job from the response cache if it can, or submits it to the scheduler and caches its result.
+bool Server::submitJob(std::shared_ptr<GenerationJob> job)
+{
+    auto key = m_responseCache->keyFor(*job);
+    if (!key)
+        return m_workers->submit(std::move(job));
+
+    if (auto cached = m_responseCache->find(*key)) {
+        Metrics::globalInstance()->countResponseCache(/*hit*/ true);
+        // replayed through the callbacks, so that streamed requests are answered the same way
+        for (int32_t i = 0; i < int32_t(cached->responses.size()); i++) {
+            if (job->onResponse && !cached->responses[i].empty())
+                job->onResponse(i, cached->responses[i]);
+        }
+        job->onFinished(*cached);
+        return true;
+    }
+    Metrics::globalInstance()->countResponseCache(/*hit*/ false);
+
+    // a response the client stopped early, or that ran out of time, is not complete
+    auto stopped = std::make_shared<bool>(false);
+    if (job->onResponse) {
+        job->onResponse = [onResponse = std::move(job->onResponse), stopped](int32_t choice, const std::string &piece) {
+            if (onResponse(choice, piece))
+                return true;
+            *stopped = true;
+            return false;
+        };
+    }
+    job->onFinished = [this, onFinished = std::move(job->onFinished), key = *key, stopped]
+                      (const GenerationResult &result) {
+        GenerationResult uncached = result;
+        uncached.responseCacheHits = 0;
+        if (!result.error && !result.timedOut && !*stopped)
+            m_responseCache->insert(key, uncached);
+        onFinished(uncached);
+    };
+    return m_workers->submit(std::move(job));
+}
+
+static ModelInfo findModel(const QString &name)
 {
     ModelInfo modelInfo = ModelList::globalInstance()->defaultModelInfo();
     const QList<ModelInfo> modelList = ModelList::globalInstance()->selectableModelList();
@@ -637,67 +1213,86 @@ auto Server::handleCompletionRequest(const CompletionRequest &request)
         Q_ASSERT(info.installed);
         if (!info.installed)
             continue;
-        if (request.model == info.name() || request.model == info.filename()) {
+        if (name == info.name() || name == info.filename()) {
             modelInfo = info;
             break;
         }
     }
+    return modelInfo;
+}
 
-    // adds prompt/response items to GUI
-    emit requestServerNewPromptResponsePair(request.prompt); // blocks
-    resetResponse();
+static LLModel::PromptContext samplingParams(const ModelInfo &modelInfo, const BaseCompletionRequest &request)
+{
+    // FIXME(jared): taking parameters from the UI inhibits reproducibility of results
+    LLModel::PromptContext params;
+    params.n_predict      = request.max_tokens;
+    params.top_k          = modelInfo.topK();
+    params.top_p          = request.top_p;
+    params.min_p          = request.min_p;
+    params.temp           = request.temperature;
+    params.n_batch        = modelInfo.promptBatchSize();
+    params.repeat_penalty = float(modelInfo.repeatPenalty());
+    params.repeat_last_n  = modelInfo.repeatPenaltyTokens();
+    return params;
+}
 
-    // load the new model if necessary
-    setShouldBeLoaded(true);
+// The model a request asks for, or the stand-in model that answers every request.
+ModelInfo Server::requestedModel(const QString &name) const
+{
+    return m_standInModel ? m_standInInfo : findModel(name);
+}
 
-    if (modelInfo.filename().isEmpty()) {
-        std::cerr << "ERROR: couldn't load default model " << request.model.toStdString() << std::endl;
-        return makeError(QHttpServerResponder::StatusCode::InternalServerError);
-    }
+static QHttpServerResponse failedResponse(const GenerationResult &result)
+{
+    if (result.timedOut)
+        return errorResponse(*result.error, u"timeout_error"_s, QHttpServerResponder::StatusCode::RequestTimeout);
+    if (result.internalError)
+        return errorResponse(*result.error, u"server_error"_s, QHttpServerResponder::StatusCode::InternalServerError);
+    return errorResponse(*result.error, u"invalid_request_error"_s, QHttpServerResponder::StatusCode::BadRequest);
+}
 
-    // NB: this resets the context, regardless of whether this model is already loaded
-    if (!loadModel(modelInfo)) {
-        std::cerr << "ERROR: couldn't load model " << modelInfo.name().toStdString() << std::endl;
-        return makeError(QHttpServerResponder::StatusCode::InternalServerError);
-    }
+static QHttpServerResponse busyResponse()
+{
+    return errorResponse(u"The server is busy with other requests, please try again later."_s, u"server_error"_s,
+                         QHttpServerResponder::StatusCode::ServiceUnavailable);
+}
 
-    // FIXME(jared): taking parameters from the UI inhibits reproducibility of results
-    const int  top_k          = modelInfo.topK();
-    const int  n_batch        = modelInfo.promptBatchSize();
-    const auto repeat_penalty = float(modelInfo.repeatPenalty());
-    const int  repeat_last_n  = modelInfo.repeatPenaltyTokens();
-
-    int promptTokens = 0;
-    int responseTokens = 0;
-    QList<QPair<QString, QList<ResultInfo>>> responses;
-    for (int i = 0; i < request.n; ++i) {
-        if (!promptInternal(
-            m_collections,
-            request.prompt,
-            /*promptTemplate*/ u"%1"_s,
-            request.max_tokens,
-            top_k,
-            request.top_p,
-            request.min_p,
-            request.temperature,
-            n_batch,
-            repeat_penalty,
-            repeat_last_n)) {
-
-            std::cerr << "ERROR: couldn't prompt model " << modelInfo.name().toStdString() << std::endl;
-            return makeError(QHttpServerResponder::StatusCode::InternalServerError);
-        }
-        QString resp = response(/*trim*/ false);
-        if (request.echo)
-            resp = request.prompt + resp;
-        responses.append({resp, m_databaseResults});
-        if (!promptTokens)
-            promptTokens = m_promptTokens;
-        responseTokens += m_promptResponseTokens - m_promptTokens;
-        if (i < request.n - 1)
-            resetResponse();
+static QJsonValue referencesToJson(const QList<ResultInfo> &infos)
+{
+    QJsonArray references;
+    for (const auto &ref : infos)
+        references.append(resultToJson(ref));
+    return references.isEmpty() ? QJsonValue::Null : QJsonValue(references);
+}
+
+static const char *finishReasonName(GenerationResult::FinishReason reason)
+{
+    return reason == GenerationResult::FinishReason::Length ? "length" : "stop";
+}
+
+static QJsonObject usageToJson(const GenerationResult &result)
+{
+    int32_t responseTokens = 0;
+    for (int32_t n : result.responseTokens)
+        responseTokens += n;
+    QJsonObject usage {
+        { "prompt_tokens",     result.promptTokens                  },
+        { "completion_tokens", responseTokens                       },
+        { "total_tokens",      result.promptTokens + responseTokens },
+        { "prompt_tokens_details", QJsonObject {{ "cached_tokens", result.cachedTokens }} },
+    };
+    if (result.responseCacheHits) {
+        usage.insert("response_cache", QJsonObject {
+            { "hit",  *result.responseCacheHits > 0     },
+            { "hits", qint64(*result.responseCacheHits) },
+        });
     }
+    return usage;
+}
 
+static QJsonObject completionToJson(const GenerationResult &result, const ModelInfo &modelInfo,
+                                    const QString &prompt, bool echo, const QList<ResultInfo> &databaseResults)
+{
     QJsonObject responseObject {
         { "id",      "placeholder"                      },
         { "object",  "text_completion"                  },
@@ -706,75 +1301,216 @@ auto Server::handleCompletionRequest(const CompletionRequest &request)
     };
 
     QJsonArray choices;
-    {
-        int index = 0;
-        for (const auto &r : responses) {
-            QString result = r.first;
-            QList<ResultInfo> infos = r.second;
+    for (qsizetype i = 0; i < result.responses.size(); i++) {
+        QString text = QString::fromStdString(result.responses[i]);
+        if (echo)
+            text = prompt + text;
+        QJsonObject choice {
+            { "text",          text                                       },
+            { "index",         i                                          },
+            { "logprobs",      QJsonValue::Null                           },
+            { "finish_reason", finishReasonName(result.finishReasons[i]) },
+        };
+        if (MySettings::globalInstance()->localDocsShowReferences())
+            choice.insert("references", referencesToJson(databaseResults));
+        choices.append(choice);
+    }
+
+    responseObject.insert("choices", choices);
+    responseObject.insert("usage", usageToJson(result));
+    return responseObject;
+}
+
+static QJsonObject chunkToJson(const char *object, const ModelInfo &modelInfo, const QJsonArray &choices,
+                               bool includeUsage)
+{
+    QJsonObject chunk {
+        { "id",      "placeholder"                      },
+        { "object",  object                             },
+        { "created", QDateTime::currentSecsSinceEpoch() },
+        { "model",   modelInfo.name()                   },
+        { "choices", choices                            },
+    };
+    if (includeUsage)
+        chunk.insert("usage", QJsonValue::Null); // only the last chunk has usage
+    return chunk;
+}
+
+// ends a stream whose request failed after the first event was sent
+static void failStream(EventStream &stream, const GenerationResult &result)
+{
+    const QString type = result.timedOut      ? u"timeout_error"_s
+                       : result.internalError ? u"server_error"_s
+                                              : u"invalid_request_error"_s;
+    stream.send(QJsonObject {{ "error", QJsonObject {
+        { "message", *result.error    },
+        { "type",    type             },
+        { "param",   QJsonValue::Null },
+        { "code",    QJsonValue::Null },
+    }}});
+    stream.close();
+}
+
+void Server::handleCompletionRequest(const CompletionRequest &request, std::shared_ptr<QHttpServerResponder> responder)
+{
+    ModelInfo modelInfo = requestedModel(request.model);
+    if (modelInfo.filename().isEmpty()) {
+        std::cerr << "ERROR: couldn't load default model " << request.model.toStdString() << std::endl;
+        sendResponse(*responder, QHttpServerResponse(QHttpServerResponder::StatusCode::InternalServerError));
+        return;
+    }
+
+    QList<ResultInfo> databaseResults;
+    auto job = std::make_shared<GenerationJob>();
+    job->modelInfo      = modelInfo;
+    job->docsContext    = retrieveDocsContext(m_collections, request.prompt, databaseResults);
+    job->prompt         = request.prompt;
+    job->promptTemplate = u"%1"_s;
+    job->n              = int32_t(qMin(request.n, INT32_MAX));
+    job->params         = samplingParams(modelInfo, request);
+    job->timeoutMs      = request.timeoutMs;
+
+    if (request.stream) {
+        auto stream = std::make_shared<EventStream>(responder, job->n);
+        // sends the next text of a choice, which starts with the prompt if it is echoed
+        auto sendText = [stream, modelInfo, prompt = request.prompt, echo = request.echo,
+                         includeUsage = request.include_usage]
+                        (int32_t i, QString text, const QJsonValue &finishReason, const QJsonValue &references) {
+            if (!std::exchange(stream->choice(i).started, true) && echo)
+                text.prepend(prompt);
             QJsonObject choice {
-                { "text",          result                                                   },
-                { "index",         index++                                                  },
-                { "logprobs",      QJsonValue::Null                                         },
-                { "finish_reason", responseTokens == request.max_tokens ? "length" : "stop" },
+                { "text",          text             },
+                { "index",         i                },
+                { "logprobs",      QJsonValue::Null },
+                { "finish_reason", finishReason     },
             };
-            if (MySettings::globalInstance()->localDocsShowReferences()) {
-                QJsonArray references;
-                for (const auto &ref : infos)
-                    references.append(resultToJson(ref));
-                choice.insert("references", references.isEmpty() ? QJsonValue::Null : QJsonValue(references));
+            if (!references.isUndefined())
+                choice.insert("references", references);
+            stream->send(chunkToJson("text_completion", modelInfo, { choice }, includeUsage));
+        };
+
+        job->onResponse = [stream, sendText](int32_t choice, const std::string &piece) {
+            if (!stream->isOpen())
+                return false; // the client went away
+            if (QString text = stream->takeText(choice, piece); !text.isEmpty())
+                sendText(choice, text, QJsonValue::Null, QJsonValue::Undefined);
+            return true;
+        };
+
+        job->onFinished = [this, responder, stream, sendText, modelInfo, databaseResults, prompt = request.prompt,
+                           includeUsage = request.include_usage]
+                          (const GenerationResult &result) {
+            if (result.error) {
+                if (stream->isStarted())
+                    failStream(*stream, result);
+                else if (stream->isOpen())
+                    sendResponse(*responder, failedResponse(result));
+                return;
             }
-            choices.append(choice);
-        }
+
+            bool showReferences = MySettings::globalInstance()->localDocsShowReferences();
+            for (int32_t i = 0; i < result.responses.size(); i++)
+                sendText(i, stream->takeText(i, {}, /*flush*/ true), finishReasonName(result.finishReasons[i]),
+                         showReferences ? referencesToJson(databaseResults) : QJsonValue(QJsonValue::Undefined));
+            if (includeUsage) {
+                QJsonObject chunk = chunkToJson("text_completion", modelInfo, {}, false);
+                chunk.insert("usage", usageToJson(result));
+                stream->send(chunk);
+            }
+            stream->close();
+            showInChat(prompt, QString::fromStdString(result.responses.value(0)), result.elapsedMs);
+        };
+    } else {
+        job->onFinished = [this, responder, modelInfo, databaseResults, prompt = request.prompt, echo = request.echo]
+                          (const GenerationResult &result) {
+            if (result.error) {
+                sendResponse(*responder, failedResponse(result));
+                return;
+            }
+
+            QJsonObject responseObject = completionToJson(result, modelInfo, prompt, echo, databaseResults);
+#if defined(DEBUG)
+            qDebug().noquote() << "/v1/completions reply" << QJsonDocument(responseObject).toJson(QJsonDocument::Indented);
+#endif
+            showInChat(prompt, QString::fromStdString(result.responses.value(0)), result.elapsedMs);
+            sendResponse(*responder, QHttpServerResponse(responseObject));
+        };
     }
 
-    responseObject.insert("choices", choices);
-    responseObject.insert("usage", QJsonObject {
-        { "prompt_tokens",     promptTokens                  },
-        { "completion_tokens", responseTokens                },
-        { "total_tokens",      promptTokens + responseTokens },
-    });
+    cancelOnDisconnect(job, *responder);
+    if (!submitJob(job))
+        sendResponse(*responder, busyResponse());
+}
 
-    return {QHttpServerResponse(responseObject), responseObject};
+BatchManager::Prepared Server::prepareBatchRequest(const QJsonObject &body) const
+{
+    CompletionRequest request;
+    parseRequest(request, QJsonObject(body));
+    if (request.stream)
+        throw InvalidRequestError("'stream' is not supported in batches");
+
+    ModelInfo modelInfo = requestedModel(request.model);
+    if (modelInfo.filename().isEmpty())
+        throw InvalidRequestError(fmt::format("couldn't load default model {}", request.model));
+
+    // NB: batches do not search LocalDocs, which would block the server on the database for every request
+    auto job = std::make_shared<GenerationJob>();
+    job->modelInfo      = modelInfo;
+    job->prompt         = request.prompt;
+    job->promptTemplate = u"%1"_s;
+    job->n              = int32_t(qMin(request.n, INT32_MAX));
+    job->params         = samplingParams(modelInfo, request);
+    job->timeoutMs      = request.timeoutMs;
+
+    return { job, [modelInfo, prompt = request.prompt, echo = request.echo](const GenerationResult &result) {
+        return completionToJson(result, modelInfo, prompt, echo, {});
+    }};
 }
 
-auto Server::handleChatRequest(const ChatRequest &request)
-    -> std::pair<QHttpServerResponse, std::optional<QJsonObject>>
+QHttpServerResponse Server::createBatch(const QHttpServerRequest &request)
 {
-    ModelInfo modelInfo = ModelList::globalInstance()->defaultModelInfo();
-    const QList<ModelInfo> modelList = ModelList::globalInstance()->selectableModelList();
-    for (const ModelInfo &info : modelList) {
-        Q_ASSERT(info.installed);
-        if (!info.installed)
-            continue;
-        if (request.model == info.name() || request.model == info.filename()) {
-            modelInfo = info;
-            break;
-        }
+    QByteArray input;
+    QString inputName;
+
+    // the input is either uploaded as the body, or a file named in a JSON object
+    const QByteArray contentType = request.value("Content-Type").toLower();
+    if (contentType.startsWith("application/jsonl") || contentType.startsWith("application/x-ndjson")) {
+        input = request.body();
+    } else {
+        BatchRequest req;
+        parseRequest(req, requestFromJson(request.body()));
+        QFile file(QDir(BatchManager::inputDirectory()).filePath(req.input_file));
+        if (!file.open(QIODevice::ReadOnly))
+            throw InvalidRequestError(fmt::format("could not read the input file {}: {}", req.input_file,
+                                                  file.errorString()));
+        input     = file.readAll();
+        inputName = req.input_file;
     }
 
-    // load the new model if necessary
-    setShouldBeLoaded(true);
+    QString error;
+    QJsonObject batch = m_batches->create(input, inputName, &error);
+    if (!error.isEmpty())
+        return errorResponse(error, u"server_error"_s, QHttpServerResponder::StatusCode::InternalServerError);
+    return QHttpServerResponse(batch);
+}
 
+void Server::handleChatRequest(const ChatRequest &request, std::shared_ptr<QHttpServerResponder> responder)
+{
+    ModelInfo modelInfo = requestedModel(request.model);
     if (modelInfo.filename().isEmpty()) {
         std::cerr << "ERROR: couldn't load default model " << request.model.toStdString() << std::endl;
-        return makeError(QHttpServerResponder::StatusCode::InternalServerError);
-    }
-
-    // NB: this resets the context, regardless of whether this model is already loaded
-    if (!loadModel(modelInfo)) {
-        std::cerr << "ERROR: couldn't load model " << modelInfo.name().toStdString() << std::endl;
-        return makeError(QHttpServerResponder::StatusCode::InternalServerError);
+        sendResponse(*responder, QHttpServerResponse(QHttpServerResponder::StatusCode::InternalServerError));
+        return;
     }
 
-    const QString promptTemplate = modelInfo.promptTemplate();
-    const int     top_k          = modelInfo.topK();
-    const int     n_batch        = modelInfo.promptBatchSize();
-    const auto    repeat_penalty = float(modelInfo.repeatPenalty());
-    const int     repeat_last_n  = modelInfo.repeatPenaltyTokens();
+    auto job = std::make_shared<GenerationJob>();
+    job->modelInfo      = modelInfo;
+    job->systemPrompt   = MySettings::globalInstance()->modelSystemPrompt(modelInfo);
+    job->promptTemplate = modelInfo.promptTemplate();
+    job->n              = int32_t(qMin(request.n, INT32_MAX));
+    job->params         = samplingParams(modelInfo, request);
+    job->timeoutMs      = request.timeoutMs;
 
-    int promptTokens = 0;
-    int responseTokens = 0;
-    QList<QPair<QString, QList<ResultInfo>>> responses;
     Q_ASSERT(!request.messages.isEmpty());
     Q_ASSERT(request.messages.size() % 2 == 1);
     for (int i = 0; i < request.messages.size() - 2; i += 2) {
@@ -783,101 +1519,190 @@ auto Server::handleChatRequest(const ChatRequest &request)
         auto &assistant = request.messages[i + 1];
         Q_ASSERT(user.role      == User);
         Q_ASSERT(assistant.role == Assistant);
-
-        // adds prompt/response items to GUI
-        emit requestServerNewPromptResponsePair(user.content); // blocks
-        resetResponse();
-
-        if (!promptInternal(
-            {},
-            user.content,
-            promptTemplate,
-            request.max_tokens,
-            top_k,
-            request.top_p,
-            request.min_p,
-            request.temperature,
-            n_batch,
-            repeat_penalty,
-            repeat_last_n,
-            assistant.content)
-        ) {
-            std::cerr << "ERROR: couldn't prompt model " << modelInfo.name().toStdString() << std::endl;
-            return makeError(QHttpServerResponder::StatusCode::InternalServerError);
-        }
-        promptTokens += m_promptResponseTokens; // previous responses are part of current prompt
-    }
-
-    QString lastMessage = request.messages.last().content;
-    // adds prompt/response items to GUI
-    emit requestServerNewPromptResponsePair(lastMessage); // blocks
-    resetResponse();
-
-    for (int i = 0; i < request.n; ++i) {
-        if (!promptInternal(
-            m_collections,
-            lastMessage,
-            promptTemplate,
-            request.max_tokens,
-            top_k,
-            request.top_p,
-            request.min_p,
-            request.temperature,
-            n_batch,
-            repeat_penalty,
-            repeat_last_n)
-        ) {
-            std::cerr << "ERROR: couldn't prompt model " << modelInfo.name().toStdString() << std::endl;
-            return makeError(QHttpServerResponder::StatusCode::InternalServerError);
-        }
-        responses.append({response(), m_databaseResults});
-        // FIXME(jared): these are UI counts and do not include framing tokens, which they should
-        if (i == 0)
-            promptTokens += m_promptTokens;
-        responseTokens += m_promptResponseTokens - m_promptTokens;
-        if (i != request.n - 1)
-            resetResponse();
+        job->history.append({ user.content, assistant.content });
     }
 
-    QJsonObject responseObject {
-        { "id",      "placeholder"                      },
-        { "object",  "chat.completion"                  },
-        { "created", QDateTime::currentSecsSinceEpoch() },
-        { "model",   modelInfo.name()                   },
-    };
-
-    QJsonArray choices;
-    {
-        int index = 0;
-        for (const auto &r : responses) {
-            QString result = r.first;
-            QList<ResultInfo> infos = r.second;
-            QJsonObject message {
-                { "role",    "assistant" },
-                { "content", result      },
-            };
+    QList<ResultInfo> databaseResults;
+    job->prompt      = request.messages.last().content;
+    job->docsContext = retrieveDocsContext(m_collections, job->prompt, databaseResults);
+
+    if (request.stream) {
+        auto stream = std::make_shared<EventStream>(responder, job->n);
+        // sends the next delta of a choice, which starts with the role
+        auto sendDelta = [stream, modelInfo, includeUsage = request.include_usage]
+                         (int32_t i, const QString &content, const QJsonValue &finishReason,
+                          const QJsonValue &references) {
+            QJsonObject delta;
+            if (!std::exchange(stream->choice(i).started, true))
+                delta.insert("role", "assistant");
+            if (!content.isEmpty())
+                delta.insert("content", content);
             QJsonObject choice {
-                { "index",         index++                                                  },
-                { "message",       message                                                  },
-                { "finish_reason", responseTokens == request.max_tokens ? "length" : "stop" },
-                { "logprobs",      QJsonValue::Null                                         },
+                { "index",         i                },
+                { "delta",         delta            },
+                { "finish_reason", finishReason     },
+                { "logprobs",      QJsonValue::Null },
+            };
+            if (!references.isUndefined())
+                choice.insert("references", references);
+            stream->send(chunkToJson("chat.completion.chunk", modelInfo, { choice }, includeUsage));
+        };
+
+        job->onResponse = [stream, sendDelta](int32_t choice, const std::string &piece) {
+            if (!stream->isOpen())
+                return false; // the client went away
+            QString content = stream->takeText(choice, piece);
+            if (!stream->choice(choice).started) {
+                // like the non-streamed response, skip the leading whitespace
+                qsizetype start = 0;
+                while (start < content.size() && content[start].isSpace())
+                    start++;
+                content.remove(0, start);
+            }
+            if (!content.isEmpty())
+                sendDelta(choice, content, QJsonValue::Null, QJsonValue::Undefined);
+            return true;
+        };
+
+        job->onFinished = [this, responder, stream, sendDelta, modelInfo, databaseResults, history = job->history,
+                           prompt = job->prompt, includeUsage = request.include_usage]
+                          (const GenerationResult &result) {
+            if (result.error) {
+                if (stream->isStarted())
+                    failStream(*stream, result);
+                else if (stream->isOpen())
+                    sendResponse(*responder, failedResponse(result));
+                return;
+            }
+
+            bool showReferences = MySettings::globalInstance()->localDocsShowReferences();
+            for (int32_t i = 0; i < result.responses.size(); i++) {
+                QString content = stream->takeText(i, {}, /*flush*/ true);
+                if (!stream->choice(i).started)
+                    content = content.trimmed();
+                sendDelta(i, content, finishReasonName(result.finishReasons[i]),
+                          showReferences ? referencesToJson(databaseResults) : QJsonValue(QJsonValue::Undefined));
+            }
+            if (includeUsage) {
+                QJsonObject chunk = chunkToJson("chat.completion.chunk", modelInfo, {}, false);
+                chunk.insert("usage", usageToJson(result));
+                stream->send(chunk);
+            }
+            stream->close();
+            for (const auto &[user, assistant] : history)
+                showInChat(user, assistant, 0);
+            showInChat(prompt, QString::fromStdString(result.responses.value(0)).trimmed(), result.elapsedMs);
+        };
+    } else {
+        job->onFinished = [this, responder, modelInfo, databaseResults, history = job->history, prompt = job->prompt]
+                          (const GenerationResult &result) {
+            if (result.error) {
+                sendResponse(*responder, failedResponse(result));
+                return;
+            }
+
+            QJsonObject responseObject {
+                { "id",      "placeholder"                      },
+                { "object",  "chat.completion"                  },
+                { "created", QDateTime::currentSecsSinceEpoch() },
+                { "model",   modelInfo.name()                   },
             };
-            if (MySettings::globalInstance()->localDocsShowReferences()) {
-                QJsonArray references;
-                for (const auto &ref : infos)
-                    references.append(resultToJson(ref));
-                choice.insert("references", references.isEmpty() ? QJsonValue::Null : QJsonValue(references));
+
+            QJsonArray choices;
+            for (qsizetype i = 0; i < result.responses.size(); i++) {
+                QJsonObject message {
+                    { "role",    "assistant"                                           },
+                    { "content", QString::fromStdString(result.responses[i]).trimmed() },
+                };
+                QJsonObject choice {
+                    { "index",         i                                          },
+                    { "message",       message                                    },
+                    { "finish_reason", finishReasonName(result.finishReasons[i]) },
+                    { "logprobs",      QJsonValue::Null                           },
+                };
+                if (MySettings::globalInstance()->localDocsShowReferences())
+                    choice.insert("references", referencesToJson(databaseResults));
+                choices.append(choice);
             }
-            choices.append(choice);
+
+            responseObject.insert("choices", choices);
+            responseObject.insert("usage", usageToJson(result));
+
+#if defined(DEBUG)
+            qDebug().noquote() << "/v1/chat/completions reply" << QJsonDocument(responseObject).toJson(QJsonDocument::Indented);
+#endif
+            for (const auto &[user, assistant] : history)
+                showInChat(user, assistant, 0);
+            showInChat(prompt, QString::fromStdString(result.responses.value(0)).trimmed(), result.elapsedMs);
+            sendResponse(*responder, QHttpServerResponse(responseObject));
+        };
+    }
+
+    cancelOnDisconnect(job, *responder);
+    if (!submitJob(job))
+        sendResponse(*responder, busyResponse());
+}
+
+static QHttpServerResponse embeddingsResponse(const EmbeddingJobResult &result, const QString &model, bool base64)
+{
+    if (result.error) {
+        if (result.internalError)
+            return errorResponse(*result.error, u"server_error"_s, QHttpServerResponder::StatusCode::InternalServerError);
+        return errorResponse(*result.error, u"invalid_request_error"_s, QHttpServerResponder::StatusCode::BadRequest);
+    }
+
+    QJsonArray data;
+    const qsizetype rows = qsizetype(result.embeddings.size()) / result.dimensions;
+    for (qsizetype i = 0; i < rows; i++) {
+        const float *row = result.embeddings.data() + i * result.dimensions;
+        QJsonValue embedding;
+        if (base64) {
+            // little-endian float32, like the OpenAI API
+            auto bytes = QByteArray::fromRawData(reinterpret_cast<const char *>(row),
+                                                 result.dimensions * qsizetype(sizeof(float)));
+            embedding = QString::fromLatin1(bytes.toBase64());
+        } else {
+            QJsonArray values;
+            for (int j = 0; j < result.dimensions; j++)
+                values.append(row[j]);
+            embedding = values;
         }
+        data.append(QJsonObject {
+            { "object",    "embedding" },
+            { "index",     i           },
+            { "embedding", embedding   },
+        });
     }
 
-    responseObject.insert("choices", choices);
-    responseObject.insert("usage", QJsonObject {
-        { "prompt_tokens",     promptTokens                  },
-        { "completion_tokens", responseTokens                },
-        { "total_tokens",      promptTokens + responseTokens },
+    return QHttpServerResponse(QJsonObject {
+        { "object", "list" },
+        { "data",   data   },
+        { "model",  model  },
+        { "usage",  QJsonObject {
+            { "prompt_tokens", result.promptTokens },
+            { "total_tokens",  result.promptTokens },
+        }},
     });
+}
+
+void Server::handleEmbeddingsRequest(const EmbeddingRequest &request, std::shared_ptr<QHttpServerResponder> responder)
+{
+    if (request.model != EmbeddingLLM::model()) {
+        sendResponse(*responder, errorResponse(u"The model `%1` does not exist"_s.arg(request.model),
+                                               u"invalid_request_error"_s, QHttpServerResponder::StatusCode::NotFound));
+        return;
+    }
+
+    auto job = std::make_shared<EmbeddingJob>();
+    job->texts      = request.input;
+    job->dimensions = request.dimensions;
+    job->onFinished = [this, responder, model = request.model, base64 = request.base64]
+                      (const EmbeddingJobResult &result) {
+        // the responder belongs to the server's thread
+        QMetaObject::invokeMethod(this, [responder, result, model, base64] {
+            sendResponse(*responder, embeddingsResponse(result, model, base64));
+        }, Qt::QueuedConnection);
+    };
 
-    return {QHttpServerResponse(responseObject), responseObject};
+    m_embeddings->submit(job);
 }
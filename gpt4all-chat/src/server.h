@@ -1,23 +1,31 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+#include "batchmanager.h"
 #include "chatllm.h"
 #include "database.h"
+#include "embeddingbatcher.h"
+#include "modellist.h"
+#include "responsecache.h"
+#include "scheduler.h"
+#include "workerpool.h"
+
+#include <gpt4all-backend/llmodel.h>
 
 #include <QHttpServer>
+#include <QHttpServerRequest>
 #include <QHttpServerResponse>
+#include <QHttpServerResponder>
 #include <QJsonObject>
 #include <QList>
 #include <QObject>
 #include <QString>
 
 #include <memory>
-#include <optional>
-#include <utility>
 
-class Chat;
 class ChatRequest;
 class CompletionRequest;
+class EmbeddingRequest;
 
 
 class Server : public ChatLLM
@@ -25,27 +33,39 @@ class Server : public ChatLLM
     Q_OBJECT
 
 public:
-    explicit Server(Chat *chat);
+    // A headless server is always enabled and does not mirror the requests into a chat. A stand-in model, like
+    // StandInModel, answers every generation request instead of the installed models, for benchmarking.
+    explicit Server(const QString &id, bool headless = false, std::unique_ptr<LLModel> standInModel = {});
     ~Server() override = default;
 
 public Q_SLOTS:
     void start();
+    void handleCollectionListChanged(const QList<QString> &collectionList) { m_collections = collectionList; }
 
 Q_SIGNALS:
     void requestServerNewPromptResponsePair(const QString &prompt);
 
 private:
-    auto handleCompletionRequest(const CompletionRequest &request) -> std::pair<QHttpServerResponse, std::optional<QJsonObject>>;
-    auto handleChatRequest(const ChatRequest &request) -> std::pair<QHttpServerResponse, std::optional<QJsonObject>>;
-
-private Q_SLOTS:
-    void handleDatabaseResultsChanged(const QList<ResultInfo> &results) { m_databaseResults = results; }
-    void handleCollectionListChanged(const QList<QString> &collectionList) { m_collections = collectionList; }
+    bool isEnabled() const;
+    // the response is sent through the responder once the scheduler has finished the request
+    void handleCompletionRequest(const CompletionRequest &request, std::shared_ptr<QHttpServerResponder> responder);
+    void handleChatRequest(const ChatRequest &request, std::shared_ptr<QHttpServerResponder> responder);
+    void handleEmbeddingsRequest(const EmbeddingRequest &request, std::shared_ptr<QHttpServerResponder> responder);
+    QHttpServerResponse createBatch(const QHttpServerRequest &request);
+    BatchManager::Prepared prepareBatchRequest(const QJsonObject &body) const;
+    ModelInfo requestedModel(const QString &name) const;
+    bool submitJob(std::shared_ptr<GenerationJob> job);
+    void showInChat(const QString &prompt, const QString &response, qint64 elapsedMs);
 
 private:
-    Chat *m_chat;
+    bool m_headless;
+    std::unique_ptr<LLModel> m_standInModel;
+    ModelInfo m_standInInfo;
     std::unique_ptr<QHttpServer> m_server;
-    QList<ResultInfo> m_databaseResults;
+    WorkerPool *m_workers = nullptr;
+    BatchManager *m_batches = nullptr;
+    std::unique_ptr<EmbeddingBatcher> m_embeddings;
+    std::unique_ptr<ResponseCache> m_responseCache;
     QList<QString> m_collections;
 };
 
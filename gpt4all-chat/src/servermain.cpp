@@ -0,0 +1,94 @@
+#include "config.h"
+#include "llm.h"
+#include "logger.h"
+#include "mysettings.h"
+#include "server.h"
+
+#include <gpt4all-backend/llmodel.h>
+#ifdef GPT4ALL_LOADTEST
+#   include <gpt4all-backend/standinmodel.h>
+#endif
+
+#include <QCommandLineOption>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QList>
+#include <QMetaObject>
+#include <QSettings>
+#include <QString>
+#include <QStringList>
+#include <Qt>
+#include <QtLogging>
+
+#include <memory>
+#include <utility>
+
+using namespace Qt::Literals::StringLiterals;
+
+
+// The local API server without the chat UI. It shares the settings, models and LocalDocs collections of the
+// desktop app, but does not load the chats and is enabled regardless of the "Enable Local Server" setting.
+int main(int argc, char *argv[])
+{
+    QCoreApplication::setOrganizationName("nomic.ai");
+    QCoreApplication::setOrganizationDomain("gpt4all.io");
+    QCoreApplication::setApplicationName("GPT4All");
+    QCoreApplication::setApplicationVersion(APP_VERSION);
+    QSettings::setDefaultFormat(QSettings::IniFormat);
+
+    Logger::globalInstance();
+
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(u"Serves the GPT4All local API without the chat UI."_s);
+    parser.addHelpOption();
+    parser.addVersionOption();
+    QCommandLineOption collectionOption(u"collection"_s,
+        u"Search the LocalDocs collection <name> for every request. Can be given more than once."_s, u"name"_s);
+    parser.addOption(collectionOption);
+#ifdef GPT4ALL_LOADTEST
+    QCommandLineOption standInOption(u"stand-in-model"_s,
+        u"Answer every generation request with a model without weights that generates placeholder text at a fixed "
+        u"speed, to benchmark the server on any machine."_s);
+    QCommandLineOption standInSpeedOption(u"stand-in-speed"_s,
+        u"Tokens per second the stand-in model generates for each response. Default: 20."_s, u"tokens"_s, u"20"_s);
+    QCommandLineOption standInPromptSpeedOption(u"stand-in-prompt-speed"_s,
+        u"Prompt tokens per second the stand-in model decodes. Default: 1000."_s, u"tokens"_s, u"1000"_s);
+    QCommandLineOption standInContextOption(u"stand-in-context"_s,
+        u"Context length of the stand-in model. Default: 4096."_s, u"tokens"_s, u"4096"_s);
+    parser.addOptions({ standInOption, standInSpeedOption, standInPromptSpeedOption, standInContextOption });
+#endif
+    parser.process(app);
+
+    std::unique_ptr<LLModel> standInModel;
+#ifdef GPT4ALL_LOADTEST
+    if (parser.isSet(standInOption)) {
+        StandInModel::Config config;
+        bool ok[3];
+        config.genTokensPerSec    = parser.value(standInSpeedOption).toDouble(&ok[0]);
+        config.promptTokensPerSec = parser.value(standInPromptSpeedOption).toDouble(&ok[1]);
+        config.contextLength      = parser.value(standInContextOption).toInt(&ok[2]);
+        if (!ok[0] || !ok[1] || !ok[2] || config.genTokensPerSec <= 0 || config.promptTokensPerSec <= 0
+            || config.contextLength <= 0) {
+            qCritical() << "ERROR: The speeds and context length of the stand-in model must be positive.";
+            return 1;
+        }
+        standInModel = std::make_unique<StandInModel>(config);
+    }
+#endif
+
+    // set search path before constructing the MySettings instance, which relies on this
+    LLModel::Implementation::setImplementationsSearchPath(LLM::implementationsSearchPath().toStdString());
+
+    // translates the error messages of the server
+    MySettings::globalInstance()->setLanguageAndLocale();
+
+    Server server(u"server"_s, /*headless*/ true, std::move(standInModel));
+    const QStringList collections = parser.values(collectionOption);
+    if (!collections.isEmpty())
+        QMetaObject::invokeMethod(&server, "handleCollectionListChanged", Qt::QueuedConnection,
+                                  Q_ARG(QList<QString>, collections));
+
+    return app.exec();
+}
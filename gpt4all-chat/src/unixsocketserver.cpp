@@ -0,0 +1,114 @@
+#include "unixsocketserver.h"
+
+#include <QByteArray>
+#include <QDebug>
+#include <QFile>
+#include <QtLogging>
+#include <QtGlobal>
+
+#ifdef Q_OS_UNIX
+#   include <cerrno>
+#   include <cstring>
+#   include <fcntl.h>
+#   include <sys/socket.h>
+#   include <sys/stat.h>
+#   include <sys/un.h>
+#   include <unistd.h>
+#endif
+
+
+UnixSocketServer::UnixSocketServer(QObject *parent)
+    : QTcpServer(parent)
+{
+}
+
+UnixSocketServer::~UnixSocketServer()
+{
+#ifdef Q_OS_UNIX
+    if (isListening()) {
+        close();
+        ::unlink(QFile::encodeName(m_path).constData());
+    }
+#endif
+}
+
+#ifdef Q_OS_UNIX
+
+static bool fillAddress(sockaddr_un &addr, const QByteArray &path)
+{
+    std::memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= qsizetype(sizeof addr.sun_path))
+        return false;
+    std::memcpy(addr.sun_path, path.constData(), path.size());
+    return true;
+}
+
+// A socket file that nothing accepts connections on anymore, like the one of a server that crashed.
+static bool isStaleSocket(const sockaddr_un &addr)
+{
+    struct stat info;
+    if (::lstat(addr.sun_path, &info) != 0 || !S_ISSOCK(info.st_mode))
+        return false;
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+        return false;
+    bool stale = ::connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof addr) != 0 && errno == ECONNREFUSED;
+    ::close(fd);
+    return stale;
+}
+
+bool UnixSocketServer::listenOnPath(const QString &path)
+{
+    Q_ASSERT(!isListening());
+    const QByteArray encodedPath = QFile::encodeName(path);
+
+    sockaddr_un addr;
+    if (!fillAddress(addr, encodedPath)) {
+        qWarning() << "ERROR: Socket path is too long:" << path;
+        return false;
+    }
+    if (isStaleSocket(addr))
+        ::unlink(addr.sun_path);
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        qWarning() << "ERROR: Unable to create a socket:" << std::strerror(errno);
+        return false;
+    }
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    if (::bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof addr) != 0) {
+        qWarning() << "ERROR: Unable to bind to" << path << ":" << std::strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    // the local API has no authentication, so access is limited by the permissions of the socket file
+    if (::chmod(addr.sun_path, S_IRUSR | S_IWUSR) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+        qWarning() << "ERROR: Unable to listen on" << path << ":" << std::strerror(errno);
+        ::close(fd);
+        ::unlink(addr.sun_path);
+        return false;
+    }
+
+    // QTcpServer accepts on any listening stream socket, and wraps the connections in QTcpSockets
+    if (!setSocketDescriptor(fd)) {
+        qWarning() << "ERROR: Unable to accept connections on" << path << ":" << errorString();
+        ::close(fd);
+        ::unlink(addr.sun_path);
+        return false;
+    }
+    m_path = path;
+    return true;
+}
+
+#else // !Q_OS_UNIX
+
+bool UnixSocketServer::listenOnPath(const QString &path)
+{
+    qWarning() << "ERROR: Unix domain sockets are not supported on this platform, not listening on" << path;
+    return false;
+}
+
+#endif // Q_OS_UNIX
@@ -0,0 +1,32 @@
+#ifndef UNIXSOCKETSERVER_H
+#define UNIXSOCKETSERVER_H
+
+#include <QObject>
+#include <QString>
+#include <QTcpServer>
+
+/*
+ * Accepts connections on a Unix domain socket for a QHttpServer, which only binds to a QTcpServer before Qt 6.8.
+ * The listening socket is given to QTcpServer as its descriptor, so that it is listening and delivers each connection
+ * like a TCP one: accepted into a QTcpSocket, which works on any connected stream socket, and announced with
+ * pendingConnectionAvailable(). The routes and responders do not know the difference.
+ *
+ * The socket file is only accessible to the current user. It is removed again when the server is destroyed.
+ */
+class UnixSocketServer : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    explicit UnixSocketServer(QObject *parent = nullptr);
+    ~UnixSocketServer() override;
+
+    // Starts listening on path, replacing a stale socket left behind by a previous run.
+    bool listenOnPath(const QString &path);
+    QString path() const { return m_path; }
+
+private:
+    QString m_path;
+};
+
+#endif // UNIXSOCKETSERVER_H
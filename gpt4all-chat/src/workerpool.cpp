@@ -0,0 +1,253 @@
+#include "workerpool.h"
+
+#include "metrics.h"
+#include "modelworker.h"
+
+#include <QFileInfo>
+#include <QMetaObject>
+#include <QTimer>
+#include <Qt>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace Qt::Literals::StringLiterals;
+
+
+WorkerPool::WorkerPool(LLModel *standInModel, int32_t maxSlots, qsizetype queueDepth, qint64 maxGenerationMs,
+                       qint64 memoryBudget, QObject *parent)
+    : QObject(parent)
+    , m_standInModel(standInModel)
+    , m_maxSlots(std::max(maxSlots, 1))
+    , m_queueDepth(std::max(queueDepth, qsizetype(0)))
+    , m_maxGenerationMs(maxGenerationMs)
+    , m_memoryBudget(std::max(memoryBudget, qint64(0)))
+    , m_expiryTimer(new QTimer(this))
+{
+    m_expiryTimer->setInterval(100);
+    connect(m_expiryTimer, &QTimer::timeout, this, &WorkerPool::dropExpired);
+}
+
+// NB: the workers wait for their threads to stop when they are destroyed
+WorkerPool::~WorkerPool() = default;
+
+bool WorkerPool::submit(std::shared_ptr<GenerationJob> job)
+{
+    const QString id = job->modelInfo.id();
+    auto [it, inserted] = m_entries.try_emplace(id);
+    Entry &entry = it->second;
+    if (inserted) {
+        entry.modelInfo = job->modelInfo;
+        entry.memory    = estimateMemory(job->modelInfo);
+    }
+
+    // like the scheduler, which takes as many jobs as it has slots plus the queue depth
+    if (entry.inFlight >= m_maxSlots + m_queueDepth) {
+        if (inserted)
+            m_entries.erase(it);
+        return false;
+    }
+    entry.inFlight++;
+    entry.lastUsed = ++m_clock;
+    job->startDeadline();
+
+    // while any model waits for its turn, requests wait behind it, so that the loaded models drain
+    if (m_waitingModels.empty() && startWorker(entry)) {
+        dispatch(entry, std::move(job));
+    } else {
+        if (entry.waiting.empty())
+            m_waitingModels.push_back(id);
+        entry.waiting.push_back(std::move(job));
+        m_expiryTimer->start();
+    }
+    return true;
+}
+
+WorkerPool::Stats WorkerPool::stats() const
+{
+    Stats stats;
+    stats.prefixCache = m_unloadedStats;
+    for (const auto &[id, entry] : m_entries) {
+        stats.queuedJobs += qsizetype(entry.waiting.size());
+        if (!entry.worker)
+            continue;
+        const auto worker = entry.worker->stats();
+        if (worker.loaded) {
+            stats.loadedModels++;
+            stats.maxSlots += m_maxSlots;
+        }
+        stats.activeSlots               += worker.activeSlots;
+        stats.queuedJobs                += worker.queuedJobs;
+        stats.kvCacheUsage               = std::max(stats.kvCacheUsage, worker.kvCacheUsage);
+        stats.prefixCache.lookups       += worker.prefixCache.lookups;
+        stats.prefixCache.hits          += worker.prefixCache.hits;
+        stats.prefixCache.tokensSaved   += worker.prefixCache.tokensSaved;
+    }
+    return stats;
+}
+
+// The memory a model takes once loaded, for the budget: the RAM required by its entry in the model list, or the size
+// of its weights.
+qint64 WorkerPool::estimateMemory(const ModelInfo &modelInfo) const
+{
+    if (m_standInModel || modelInfo.isOnline)
+        return 0;
+    if (modelInfo.ramrequired > 0)
+        return qint64(modelInfo.ramrequired) << 30;
+    return QFileInfo(modelInfo.dirpath + modelInfo.filename()).size();
+}
+
+bool WorkerPool::fits(const Entry &entry) const
+{
+    qint64 used = 0;
+    int32_t loaded = 0;
+    for (const auto &[id, other] : m_entries) {
+        if (other.worker) {
+            used += other.memory;
+            loaded++;
+        }
+    }
+    if (!loaded)
+        return true;
+    return m_memoryBudget > 0 && used + entry.memory <= m_memoryBudget;
+}
+
+// Starts the worker of a model if the memory budget allows it, unloading idle models if necessary. The worker loads
+// its model on its own thread.
+bool WorkerPool::startWorker(Entry &entry)
+{
+    if (entry.worker)
+        return true;
+    if (!fits(entry))
+        unloadIdle(entry);
+    if (!fits(entry))
+        return false;
+
+    entry.worker = std::make_unique<ModelWorker>(entry.modelInfo, m_standInModel, m_maxSlots, m_queueDepth,
+                                                 m_maxGenerationMs);
+    return true;
+}
+
+// Unloads the least recently used models without running requests until the given one fits. A model whose requests
+// wait for their turn is loaded again then.
+void WorkerPool::unloadIdle(const Entry &entry)
+{
+    std::vector<QString> idle;
+    for (const auto &[id, other] : m_entries) {
+        if (other.worker && !other.running && &other != &entry)
+            idle.push_back(id);
+    }
+    std::ranges::sort(idle, {}, [this](const QString &id) { return m_entries.at(id).lastUsed; });
+
+    for (const QString &id : idle) {
+        if (fits(entry))
+            break;
+        auto it = m_entries.find(id);
+        const auto stats = it->second.worker->stats();
+        m_unloadedStats.lookups     += stats.prefixCache.lookups;
+        m_unloadedStats.hits        += stats.prefixCache.hits;
+        m_unloadedStats.tokensSaved += stats.prefixCache.tokensSaved;
+        if (it->second.waiting.empty())
+            m_entries.erase(it);
+        else
+            it->second.worker.reset();
+    }
+}
+
+// Hands a job to the worker of its model, with its callbacks moved to the pool's thread. The worker only learns that
+// a choice was stopped when it generates the next piece of it, so it may generate a piece more than needed.
+void WorkerPool::dispatch(Entry &entry, std::shared_ptr<GenerationJob> job)
+{
+    using ResponseFunc = std::function<bool(int32_t choice, const std::string &piece)>;
+
+    if (job->onResponse) {
+        auto onResponse = std::make_shared<ResponseFunc>(std::move(job->onResponse));
+        auto stopped = std::make_shared<std::atomic<bool>[]>(size_t(std::max(job->n, 1)));
+        job->onResponse = [this, onResponse, stopped](int32_t choice, const std::string &piece) {
+            if (stopped[choice])
+                return false;
+            QMetaObject::invokeMethod(this, [onResponse, stopped, choice, piece] {
+                if (!stopped[choice] && !(*onResponse)(choice, piece))
+                    stopped[choice] = true;
+            }, Qt::QueuedConnection);
+            return true;
+        };
+    }
+    job->onFinished = [this, onFinished = std::move(job->onFinished), id = entry.modelInfo.id()]
+                      (const GenerationResult &result) {
+        // after the pieces of the response, which were queued first
+        QMetaObject::invokeMethod(this, [this, onFinished, result, id] {
+            if (onFinished)
+                onFinished(result);
+            onJobFinished(id);
+        }, Qt::QueuedConnection);
+    };
+    entry.running++;
+    entry.worker->submit(std::move(job));
+}
+
+void WorkerPool::onJobFinished(const QString &id)
+{
+    auto it = m_entries.find(id);
+    if (it == m_entries.end())
+        return;
+    it->second.inFlight--;
+    if (--it->second.running == 0)
+        startWaiting(); // the model may be unloaded now
+}
+
+// Gives the models that wait their turn, in the order they started to wait, starting their workers if necessary.
+void WorkerPool::startWaiting()
+{
+    while (!m_waitingModels.empty()) {
+        Entry &entry = m_entries.at(m_waitingModels.front());
+        if (!startWorker(entry))
+            break;
+        m_waitingModels.pop_front();
+        for (auto &job : std::exchange(entry.waiting, {}))
+            dispatch(entry, std::move(job));
+    }
+    if (m_waitingModels.empty())
+        m_expiryTimer->stop();
+}
+
+// Ends the waiting jobs that were cancelled or ran out of time before their model's turn, like the scheduler does for
+// its queue.
+void WorkerPool::dropExpired()
+{
+    const auto now = std::chrono::steady_clock::now();
+    std::vector<std::pair<std::shared_ptr<GenerationJob>, GenerationResult>> dropped;
+    for (auto &[id, entry] : m_entries) {
+        for (auto it = entry.waiting.begin(); it != entry.waiting.end();) {
+            GenerationResult result;
+            if ((*it)->cancelled) {
+                result.error = u"The request was cancelled."_s;
+                Metrics::globalInstance()->countCancelled();
+            } else if (now >= (*it)->deadline) {
+                result.error = u"The request timed out before it could be started."_s;
+                result.timedOut = true;
+                Metrics::globalInstance()->countTimedOut();
+            } else {
+                ++it;
+                continue;
+            }
+            dropped.emplace_back(std::move(*it), std::move(result));
+            it = entry.waiting.erase(it);
+            entry.inFlight--;
+        }
+    }
+    if (dropped.empty())
+        return;
+
+    std::erase_if(m_waitingModels, [this](const QString &id) { return m_entries.at(id).waiting.empty(); });
+    for (auto &[job, result] : dropped) {
+        if (job->onFinished)
+            job->onFinished(result);
+    }
+    startWaiting(); // the models behind the dropped ones may have their turn now
+}
@@ -0,0 +1,95 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include "modellist.h"
+#include "scheduler.h"
+
+#include <QObject>
+#include <QString>
+#include <QtGlobal>
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+
+class LLModel;
+class ModelWorker;
+class QTimer;
+
+/*
+ * Routes the generation requests of the local API server to a ModelWorker per model, so that requests for different
+ * models run at the same time instead of unloading each other's model.
+ *
+ * The models that are loaded at the same time are limited by a memory budget, for which a model is assumed to take
+ * the RAM its entry in the model list requires, or otherwise the size of its file. When a model does not fit, the
+ * least recently used idle workers are unloaded, and if that is not enough its requests wait until a worker becomes
+ * idle. A model is always loaded if no other one is, however large it is.
+ *
+ * Models take turns in the order they started to wait: once a model waits, new requests for the loaded ones wait
+ * behind it, so that they drain and can be unloaded rather than starve it. Waiting requests are dropped when they are
+ * cancelled or their deadline passes, which starts when the pool accepts them.
+ *
+ * Jobs are handed to the workers with their callbacks wrapped, so that onResponse and onFinished run on the pool's
+ * thread, which is the one the responders of the server belong to. Only used on that thread.
+ */
+class WorkerPool : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Stats {
+        int32_t                     loadedModels = 0;
+        int32_t                     activeSlots = 0;
+        int32_t                     maxSlots = 0;     // of the loaded models
+        qsizetype                   queuedJobs = 0;   // including those that wait for memory
+        double                      kvCacheUsage = 0; // of the fullest context
+        Scheduler::PrefixCacheStats prefixCache;      // since the server started
+    };
+
+    // The stand-in model, if set, serves every model and must outlive the pool. A memoryBudget of 0 keeps one model
+    // loaded at a time.
+    WorkerPool(LLModel *standInModel, int32_t maxSlots, qsizetype queueDepth, qint64 maxGenerationMs,
+               qint64 memoryBudget, QObject *parent = nullptr);
+    ~WorkerPool() override;
+
+    // Queues a job for the worker of its model. Returns false if the queue of that model is full.
+    bool submit(std::shared_ptr<GenerationJob> job);
+
+    // the slots of each model
+    int32_t maxSlots() const { return m_maxSlots; }
+    Stats stats() const;
+
+private:
+    struct Entry {
+        ModelInfo                                  modelInfo;
+        std::unique_ptr<ModelWorker>               worker;       // null while waiting for memory
+        qint64                                     memory = 0;   // estimated
+        qsizetype                                  inFlight = 0; // jobs submitted and not finished
+        qsizetype                                  running = 0;  // of those, the ones given to the worker
+        quint64                                    lastUsed = 0;
+        std::deque<std::shared_ptr<GenerationJob>> waiting;      // for the turn of the model
+    };
+
+    qint64 estimateMemory(const ModelInfo &modelInfo) const;
+    bool fits(const Entry &entry) const;
+    bool startWorker(Entry &entry);
+    void unloadIdle(const Entry &entry);
+    void dispatch(Entry &entry, std::shared_ptr<GenerationJob> job);
+    void onJobFinished(const QString &id);
+    void startWaiting();
+    void dropExpired();
+
+    LLModel                               *m_standInModel;
+    int32_t                                m_maxSlots;
+    qsizetype                              m_queueDepth;
+    qint64                                 m_maxGenerationMs;
+    qint64                                 m_memoryBudget;  // bytes
+    std::unordered_map<QString, Entry>     m_entries;       // by model id
+    std::deque<QString>                    m_waitingModels; // in the order they started to wait
+    QTimer                                *m_expiryTimer;   // while requests wait, for dropExpired
+    quint64                                m_clock = 0;
+    Scheduler::PrefixCacheStats            m_unloadedStats; // of the workers that were unloaded
+};
+
+#endif // WORKERPOOL_H
@@ -0,0 +1,82 @@
+#include "folderwatcher.h"
+
+#include <QDir>
+#include <QFile>
+#include <QObject>
+#include <QSignalSpy>
+#include <QString>
+#include <QTemporaryDir>
+#include <QTest>
+
+#include <utility>
+
+using namespace Qt::Literals::StringLiterals;
+
+
+// Watches the directories of a temporary folder as they are renamed and removed.
+class TestFolderWatcher : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void renameSubdirectory();
+
+private:
+    static bool touch(const QString &path);
+};
+
+bool TestFolderWatcher::touch(const QString &path)
+{
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly) && file.write("x") == 1;
+}
+
+// A renamed subdirectory is watched under its new path only, and not at all once the folder is removed.
+void TestFolderWatcher::renameSubdirectory()
+{
+#ifndef Q_OS_LINUX
+    QSKIP("subdirectories are only watched with the folder on Linux");
+#else
+    QTemporaryDir tmp;
+    QVERIFY(tmp.isValid());
+    const QString folder = tmp.filePath(u"folder"_s);
+    QVERIFY(QDir().mkpath(folder + u"/old/nested"_s));
+
+    FolderWatcher watcher;
+    QSignalSpy changed(&watcher, &FolderWatcher::directoryChanged);
+    QVERIFY(watcher.addPath(folder));
+
+    QVERIFY(QDir().rename(folder + u"/old"_s, folder + u"/new"_s));
+    QTRY_VERIFY_WITH_TIMEOUT(changed.contains({ folder }), 5000);
+    changed.clear();
+
+    // a change under the new path is reported with it
+    QVERIFY(touch(folder + u"/new/nested/file.txt"_s));
+    QTRY_VERIFY_WITH_TIMEOUT(changed.contains({ folder + u"/new/nested"_s }), 5000);
+    for (const auto &args : std::as_const(changed))
+        QVERIFY2(!args.first().toString().startsWith(folder + u"/old"_s), qPrintable(args.first().toString()));
+    changed.clear();
+
+    // a subdirectory moved out of the folder is no longer watched
+    const QString outside = tmp.filePath(u"outside"_s);
+    QVERIFY(QDir().rename(folder + u"/new"_s, outside));
+    QTRY_VERIFY_WITH_TIMEOUT(changed.contains({ folder }), 5000);
+    changed.clear();
+    QVERIFY(touch(outside + u"/nested/other.txt"_s));
+    QTest::qWait(500);
+    QVERIFY(changed.isEmpty());
+
+    // nor is anything once the folder is removed
+    QVERIFY(QDir().mkpath(folder + u"/again"_s));
+    QTRY_VERIFY_WITH_TIMEOUT(changed.contains({ folder }), 5000);
+    QVERIFY(watcher.removePath(folder));
+    changed.clear();
+    QVERIFY(touch(folder + u"/again/file.txt"_s));
+    QVERIFY(touch(folder + u"/file.txt"_s));
+    QTest::qWait(500);
+    QVERIFY(changed.isEmpty());
+#endif
+}
+
+QTEST_GUILESS_MAIN(TestFolderWatcher)
+#include "tst_folderwatcher.moc"
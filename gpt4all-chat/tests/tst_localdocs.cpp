@@ -0,0 +1,189 @@
+#include "database.h"
+#include "embeddingcache.h"
+#include "embeddingindex.h"
+
+#include <QList>
+#include <QObject>
+#include <QPair>
+#include <QString>
+#include <QTemporaryDir>
+#include <QTest>
+
+#include <cmath>
+#include <random>
+#include <utility>
+#include <vector>
+
+using namespace Qt::Literals::StringLiterals;
+
+
+// Runs the parts of the LocalDocs search that do not need a database: the embedding cache, the embedding indexes and
+// the fusion of the keyword and vector rankings.
+class TestLocalDocs : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void cacheQuantization_data();
+    void cacheQuantization();
+    void fuseRankings();
+    void indexAddRemoveSave();
+
+private:
+    static constexpr int s_embd = 64;
+    // normalized embeddings that are the same on every run
+    static std::vector<std::vector<float>> makeEmbeddings(int n);
+    static float distance(const std::vector<float> &a, const std::vector<float> &b);
+};
+
+std::vector<std::vector<float>> TestLocalDocs::makeEmbeddings(int n)
+{
+    std::mt19937 gen(42);
+    std::normal_distribution<float> dist;
+    std::vector<std::vector<float>> embeddings(n, std::vector<float>(s_embd));
+    for (auto &embedding : embeddings) {
+        float norm = 0.0f;
+        for (float &x : embedding) {
+            x = dist(gen);
+            norm += x * x;
+        }
+        norm = std::sqrt(norm);
+        for (float &x : embedding)
+            x /= norm;
+    }
+    return embeddings;
+}
+
+float TestLocalDocs::distance(const std::vector<float> &a, const std::vector<float> &b)
+{
+    float dot = 0.0f;
+    for (int i = 0; i < s_embd; i++)
+        dot += a[i] * b[i];
+    return 1.0f - dot;
+}
+
+void TestLocalDocs::cacheQuantization_data()
+{
+    QTest::addColumn<int>("quantizationValue");
+    QTest::newRow("none")   << int(EmbeddingCache::Quantization::None);
+    QTest::newRow("int8")   << int(EmbeddingCache::Quantization::Int8);
+    QTest::newRow("binary") << int(EmbeddingCache::Quantization::Binary);
+}
+
+// Whatever the quantization, the nearest chunks come back with the exact distances of their full embeddings, and
+// removed chunks are not found.
+void TestLocalDocs::cacheQuantization()
+{
+    QFETCH(int, quantizationValue);
+    const auto quantization = EmbeddingCache::Quantization(quantizationValue);
+
+    const auto embeddings = makeEmbeddings(200);
+    const EmbeddingCache::Key key { u"model"_s, 1 };
+    EmbeddingCache cache(1 << 20);
+    cache.setQuantization(quantization);
+    cache.insert(key);
+    for (int i = 0; i < int(embeddings.size()); i++)
+        QVERIFY(cache.add(key, i, embeddings[i].data(), s_embd));
+    QCOMPARE(cache.size(key), qsizetype(embeddings.size()));
+    const qint64 fullBytes = qint64(embeddings.size() * s_embd * sizeof(float));
+    if (quantization == EmbeddingCache::Quantization::None)
+        QVERIFY(cache.memoryUsage(key) >= fullBytes);
+    else
+        QVERIFY(cache.memoryUsage(key) > fullBytes); // the full embeddings are kept to re-rank
+
+    // all of them are candidates, so the re-ranked results are the exact nearest ones
+    const auto &query = embeddings[7];
+    auto found = cache.search(key, query, 5, int(embeddings.size()));
+    QVERIFY(found);
+    QCOMPARE(found->size(), 5);
+    QCOMPARE(found->first().first, 7);
+    for (const auto &[chunk_id, dist] : std::as_const(*found))
+        QVERIFY(qAbs(dist - distance(query, embeddings[chunk_id])) < 1e-5f);
+    for (qsizetype i = 1; i < found->size(); i++)
+        QVERIFY(found->at(i - 1).second <= found->at(i).second);
+
+    cache.remove({ 7 });
+    QCOMPARE(cache.size(key), qsizetype(embeddings.size() - 1));
+    found = cache.search(key, query, 5, int(embeddings.size()));
+    QVERIFY(found);
+    for (const auto &result : std::as_const(*found))
+        QVERIFY(result.first != 7);
+
+    // another quantization forgets the folder, to load it again
+    cache.setQuantization(quantization == EmbeddingCache::Quantization::Binary ? EmbeddingCache::Quantization::Int8
+                                                                               : EmbeddingCache::Quantization::Binary);
+    QVERIFY(!cache.contains(key));
+}
+
+// The chunks ranked well by both rankings come first, then those ranked best by either.
+void TestLocalDocs::fuseRankings()
+{
+    QCOMPARE(::fuseRankings({ { 1, 2, 3 }, { 3, 1, 4 } }, 10), QList<int>({ 1, 3, 2, 4 }));
+    QCOMPARE(::fuseRankings({ { 1, 2, 3 }, { 3, 1, 4 } }, 2), QList<int>({ 1, 3 }));
+    QCOMPARE(::fuseRankings({ { 5, 6 }, {} }, 10), QList<int>({ 5, 6 }));
+    QVERIFY(::fuseRankings({ {}, {} }, 10).isEmpty());
+}
+
+// An index finds what was added and not what was removed, and is opened again from its file only if it matches.
+void TestLocalDocs::indexAddRemoveSave()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const auto embeddings = makeEmbeddings(200);
+    const EmbeddingIndex::Key key { u"model"_s, 1 };
+    const auto &query = embeddings[7];
+
+    {
+        EmbeddingIndex index(dir.path(), EmbeddingIndex::Quantization::None);
+        for (int i = 0; i < int(embeddings.size()); i++)
+            QVERIFY(index.add(key, i, embeddings[i].data(), s_embd));
+        QCOMPARE(index.size(key), qsizetype(embeddings.size()));
+
+        auto found = index.search(key, query, 5, 64);
+        QVERIFY(found);
+        QCOMPARE(found->first().first, 7);
+        QVERIFY(qAbs(found->first().second) < 1e-5f);
+
+        index.remove({ 7 });
+        QCOMPARE(index.size(key), qsizetype(embeddings.size() - 1));
+        found = index.search(key, query, 5, 64);
+        QVERIFY(found);
+        for (const auto &result : std::as_const(*found))
+            QVERIFY(result.first != 7);
+
+        QVERIFY(index.hasUnsavedChanges());
+        index.save();
+        QVERIFY(!index.hasUnsavedChanges());
+    }
+
+    {
+        EmbeddingIndex index(dir.path(), EmbeddingIndex::Quantization::None);
+        QVERIFY(index.open(key, qsizetype(embeddings.size() - 1)));
+        QCOMPARE(index.size(key), qsizetype(embeddings.size() - 1));
+        auto found = index.search(key, embeddings[8], 5, 64);
+        QVERIFY(found);
+        QCOMPARE(found->first().first, 8);
+    }
+
+    {
+        // the file no longer matches if the database has more embeddings, and is deleted
+        EmbeddingIndex index(dir.path(), EmbeddingIndex::Quantization::None);
+        QVERIFY(!index.open(key, qsizetype(embeddings.size())));
+        QVERIFY(!index.open(key, qsizetype(embeddings.size() - 1)));
+    }
+
+    {
+        // nor if it is quantized differently
+        EmbeddingIndex index(dir.path(), EmbeddingIndex::Quantization::Int8);
+        for (int i = 0; i < int(embeddings.size()); i++)
+            QVERIFY(index.add(key, i, embeddings[i].data(), s_embd));
+        index.save();
+    }
+    {
+        EmbeddingIndex index(dir.path(), EmbeddingIndex::Quantization::Binary);
+        QVERIFY(!index.open(key, qsizetype(embeddings.size())));
+    }
+}
+
+QTEST_GUILESS_MAIN(TestLocalDocs)
+#include "tst_localdocs.moc"
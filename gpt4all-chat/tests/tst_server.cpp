@@ -0,0 +1,314 @@
+#include "modellist.h"
+#include "mysettings.h"
+#include "scheduler.h"
+#include "server.h"
+#include "workerpool.h"
+
+#include <gpt4all-backend/llmodel.h>
+#include <gpt4all-backend/standinmodel.h>
+
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QHash>
+#include <QHostAddress>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QList>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QObject>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QString>
+#include <QStringList>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+#include <QTest>
+#include <QUrl>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+using namespace Qt::Literals::StringLiterals;
+
+
+// Runs the scheduler, the worker pool and the local API server against the stand-in model, which generates the same
+// text at a fixed speed on any machine.
+class TestServer : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void init();
+
+    void admission();
+    void prefixReuse();
+    void queueDeadline();
+    void generationDeadline();
+    void modelFairness();
+    void streamRoundTrip();
+
+private:
+    static ModelInfo standInInfo(const QString &id);
+    static StandInModel::Config fastConfig();
+    // A job for the model that records its result under the given name once it finishes.
+    std::shared_ptr<GenerationJob> makeJob(const QString &name, const ModelInfo &modelInfo, const QString &prompt,
+                                           int32_t nPredict);
+    // Returns the finished reply, or nullptr if it did not finish in time.
+    std::unique_ptr<QNetworkReply> post(const QString &path, const QJsonObject &body);
+
+    QTemporaryDir                    m_settingsDir;
+    QNetworkAccessManager            m_manager;     // destroyed with the test, before the application
+    QStringList                      m_finished; // names of the jobs in the order they finished
+    QHash<QString, GenerationResult> m_results;
+    quint16                          m_port = 0;
+};
+
+void TestServer::initTestCase()
+{
+    QVERIFY(m_settingsDir.isValid());
+    // keep the settings and models of the user out of the tests
+    QSettings::setDefaultFormat(QSettings::IniFormat);
+    QSettings::setPath(QSettings::IniFormat, QSettings::UserScope, m_settingsDir.path());
+    QStandardPaths::setTestModeEnabled(true);
+
+    // find a free port for the server
+    QTcpServer probe;
+    QVERIFY(probe.listen(QHostAddress::LocalHost));
+    m_port = probe.serverPort();
+    probe.close();
+    MySettings::globalInstance()->setNetworkPort(m_port);
+}
+
+void TestServer::init()
+{
+    m_finished.clear();
+    m_results.clear();
+}
+
+ModelInfo TestServer::standInInfo(const QString &id)
+{
+    // NB: not installed, so that the settings of the model are not saved
+    ModelInfo info;
+    info.setId(id);
+    info.setName(id);
+    info.setFilename(id);
+    info.setPromptTemplate(u"%1"_s);
+    info.setContextLength(StandInModel::Config().contextLength);
+    return info;
+}
+
+StandInModel::Config TestServer::fastConfig()
+{
+    StandInModel::Config config;
+    config.promptTokensPerSec = 100000.0;
+    config.genTokensPerSec    = 200.0;
+    return config;
+}
+
+std::shared_ptr<GenerationJob> TestServer::makeJob(const QString &name, const ModelInfo &modelInfo,
+                                                   const QString &prompt, int32_t nPredict)
+{
+    auto job = std::make_shared<GenerationJob>();
+    job->modelInfo          = modelInfo;
+    job->prompt             = prompt;
+    job->promptTemplate     = modelInfo.promptTemplate();
+    job->params.n_predict   = nPredict;
+    job->onFinished = [this, name](const GenerationResult &result) {
+        m_finished << name;
+        m_results.insert(name, result);
+    };
+    return job;
+}
+
+// Jobs beyond the free slots and the queue depth are rejected, and the accepted ones all finish.
+void TestServer::admission()
+{
+    StandInModel model(fastConfig());
+    Scheduler scheduler([&model](const ModelInfo &) -> LLModel * { return &model; },
+                        /*maxSlots*/ 2, /*queueDepth*/ 1, /*maxGenerationMs*/ 0);
+    int32_t maxActive = 0;
+    connect(&scheduler, &Scheduler::stepped, this, [&] { maxActive = std::max(maxActive, scheduler.activeSlots()); });
+
+    const ModelInfo info = standInInfo(u"stand-in"_s);
+    QVERIFY(scheduler.submit(makeJob(u"a"_s, info, u"Hello"_s, 8)));
+    QVERIFY(scheduler.submit(makeJob(u"b"_s, info, u"Hello"_s, 8)));
+    QVERIFY(scheduler.submit(makeJob(u"c"_s, info, u"Hello"_s, 8)));
+    QVERIFY(!scheduler.submit(makeJob(u"d"_s, info, u"Hello"_s, 8)));
+
+    QTRY_VERIFY_WITH_TIMEOUT(m_finished.size() == 3, 10000);
+    QCOMPARE(maxActive, 2);
+    QVERIFY(!m_results.contains(u"d"_s));
+    for (const auto &result : std::as_const(m_results)) {
+        QVERIFY(!result.error);
+        QCOMPARE(result.responseTokens.value(0), 8);
+    }
+    // the third job had to wait for a slot
+    QCOMPARE(m_finished.last(), u"c"_s);
+}
+
+// A request that repeats the prompt of an earlier one resumes from its cached prefix.
+void TestServer::prefixReuse()
+{
+    StandInModel model(fastConfig());
+    Scheduler scheduler([&model](const ModelInfo &) -> LLModel * { return &model; },
+                        /*maxSlots*/ 2, /*queueDepth*/ 4, /*maxGenerationMs*/ 0);
+
+    const ModelInfo info = standInInfo(u"stand-in"_s);
+    const QString prompt = u"The quick brown fox jumps over the lazy dog."_s;
+    QVERIFY(scheduler.submit(makeJob(u"first"_s, info, prompt, 4)));
+    QTRY_VERIFY_WITH_TIMEOUT(m_finished.size() == 1, 10000);
+    QVERIFY(scheduler.submit(makeJob(u"second"_s, info, prompt, 4)));
+    QTRY_VERIFY_WITH_TIMEOUT(m_finished.size() == 2, 10000);
+
+    const auto &first  = m_results[u"first"_s];
+    const auto &second = m_results[u"second"_s];
+    QVERIFY(!first.error);
+    QVERIFY(!second.error);
+    QCOMPARE(first.cachedTokens, 0);
+    // at least one token is decoded again for the logits
+    QCOMPARE(second.cachedTokens, second.promptTokens - 1);
+    QCOMPARE(second.responses, first.responses);
+
+    const auto &stats = scheduler.prefixCacheStats();
+    QCOMPARE(stats.lookups, quint64(2));
+    QCOMPARE(stats.hits, quint64(1));
+    QCOMPARE(stats.tokensSaved, quint64(second.cachedTokens));
+}
+
+// A job whose deadline passes while it waits for a slot fails as timed out, without taking a slot.
+void TestServer::queueDeadline()
+{
+    StandInModel model(fastConfig());
+    Scheduler scheduler([&model](const ModelInfo &) -> LLModel * { return &model; },
+                        /*maxSlots*/ 1, /*queueDepth*/ 1, /*maxGenerationMs*/ 0);
+
+    const ModelInfo info = standInInfo(u"stand-in"_s);
+    QVERIFY(scheduler.submit(makeJob(u"running"_s, info, u"Hello"_s, 100)));
+    auto waiting = makeJob(u"waiting"_s, info, u"Hello"_s, 8);
+    waiting->timeoutMs = 50;
+    QVERIFY(scheduler.submit(waiting));
+
+    QTRY_VERIFY_WITH_TIMEOUT(m_finished.size() == 2, 10000);
+    QCOMPARE(m_finished, QStringList({ u"waiting"_s, u"running"_s }));
+    const auto &result = m_results[u"waiting"_s];
+    QVERIFY(result.error);
+    QVERIFY(result.timedOut);
+    QVERIFY(!result.internalError);
+    QVERIFY(!m_results[u"running"_s].error);
+}
+
+// maxGenerationMs cuts a response short, which is not an error.
+void TestServer::generationDeadline()
+{
+    StandInModel model(fastConfig());
+    Scheduler scheduler([&model](const ModelInfo &) -> LLModel * { return &model; },
+                        /*maxSlots*/ 1, /*queueDepth*/ 1, /*maxGenerationMs*/ 100);
+
+    const ModelInfo info = standInInfo(u"stand-in"_s);
+    QVERIFY(scheduler.submit(makeJob(u"long"_s, info, u"Hello"_s, 2000))); // 10 s without the deadline
+
+    QTRY_VERIFY_WITH_TIMEOUT(m_finished.size() == 1, 5000);
+    const auto &result = m_results[u"long"_s];
+    QVERIFY(!result.error);
+    QVERIFY(result.timedOut);
+    QCOMPARE(result.finishReasons.value(0), GenerationResult::FinishReason::Length);
+    QVERIFY(result.responseTokens.value(0) < 2000);
+}
+
+// With room for one model, a model that waits gets its turn before later requests for the loaded one.
+void TestServer::modelFairness()
+{
+    StandInModel model(fastConfig());
+    WorkerPool pool(&model, /*maxSlots*/ 2, /*queueDepth*/ 8, /*maxGenerationMs*/ 0, /*memoryBudget*/ 0);
+
+    const ModelInfo a = standInInfo(u"model-a"_s);
+    const ModelInfo b = standInInfo(u"model-b"_s);
+    QVERIFY(pool.submit(makeJob(u"a1"_s, a, u"Hello"_s, 20)));
+    QVERIFY(pool.submit(makeJob(u"b1"_s, b, u"Hello"_s, 20)));
+    QVERIFY(pool.submit(makeJob(u"a2"_s, a, u"Hello"_s, 20)));
+    QVERIFY(pool.submit(makeJob(u"b2"_s, b, u"Hello"_s, 20)));
+
+    QTRY_VERIFY_WITH_TIMEOUT(m_finished.size() == 4, 20000);
+    for (const auto &result : std::as_const(m_results))
+        QVERIFY(!result.error);
+    QCOMPARE(m_finished.first(), u"a1"_s);
+    QVERIFY(m_finished.indexOf(u"b1"_s) < m_finished.indexOf(u"a2"_s));
+    QVERIFY(m_finished.indexOf(u"b2"_s) < m_finished.indexOf(u"a2"_s));
+    QCOMPARE(pool.stats().loadedModels, 1);
+}
+
+std::unique_ptr<QNetworkReply> TestServer::post(const QString &path, const QJsonObject &body)
+{
+    QNetworkRequest request(QUrl(u"http://127.0.0.1:%1%2"_s.arg(m_port).arg(path)));
+    request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+    std::unique_ptr<QNetworkReply> reply(m_manager.post(request, QJsonDocument(body).toJson(QJsonDocument::Compact)));
+    if (!QTest::qWaitFor([&reply] { return reply->isFinished(); }, 10000))
+        return nullptr;
+    return reply;
+}
+
+// The deltas of a streamed chat completion add up to the response that is not streamed.
+void TestServer::streamRoundTrip()
+{
+    StandInModel::Config config = fastConfig();
+    Server server(u"server"_s, /*headless*/ true, std::make_unique<StandInModel>(config));
+
+    // the server starts listening on its own thread
+    auto listening = [this] {
+        QTcpSocket socket;
+        socket.connectToHost(QHostAddress::LocalHost, m_port);
+        return socket.waitForConnected(100);
+    };
+    QTRY_VERIFY_WITH_TIMEOUT(listening(), 5000);
+
+    QJsonObject body {
+        { "model",      "stand-in" },
+        { "messages",   QJsonArray { QJsonObject {{ "role", "user" }, { "content", "Hello" }} } },
+        { "max_tokens", 8 },
+    };
+
+    auto reply = post(u"/v1/chat/completions"_s, body);
+    QVERIFY(reply);
+    QCOMPARE(reply->error(), QNetworkReply::NoError);
+    const QJsonObject completion = QJsonDocument::fromJson(reply->readAll()).object();
+    const QJsonObject choice = completion["choices"].toArray().first().toObject();
+    const QString expected = choice["message"].toObject()["content"].toString();
+    QVERIFY(!expected.isEmpty());
+    QCOMPARE(choice["finish_reason"].toString(), u"length"_s);
+
+    body.insert("stream", true);
+    reply = post(u"/v1/chat/completions"_s, body);
+    QVERIFY(reply);
+    QCOMPARE(reply->error(), QNetworkReply::NoError);
+    QVERIFY(reply->header(QNetworkRequest::ContentTypeHeader).toString().startsWith(u"text/event-stream"_s));
+    const QByteArray stream = reply->readAll();
+
+    QString content;
+    QString finishReason;
+    QStringList events = QString::fromUtf8(stream).split(u"\n\n"_s, Qt::SkipEmptyParts);
+    QVERIFY(!events.isEmpty());
+    QCOMPARE(events.takeLast(), u"data: [DONE]"_s);
+    for (const QString &event : std::as_const(events)) {
+        QVERIFY2(event.startsWith(u"data: "_s), qPrintable(event));
+        QJsonParseError err;
+        const QJsonDocument chunk = QJsonDocument::fromJson(event.sliced(6).toUtf8(), &err);
+        QVERIFY2(!err.error, qPrintable(err.errorString()));
+        QCOMPARE(chunk["object"].toString(), u"chat.completion.chunk"_s);
+        const QJsonObject delta = chunk["choices"][0]["delta"].toObject();
+        content += delta["content"].toString();
+        if (!chunk["choices"][0]["finish_reason"].isNull())
+            finishReason = chunk["choices"][0]["finish_reason"].toString();
+    }
+    QCOMPARE(content, expected);
+    QCOMPARE(finishReason, u"length"_s);
+}
+
+QTEST_GUILESS_MAIN(TestServer)
+#include "tst_server.moc"